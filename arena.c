@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+void arena_init(Arena *arena) {
+  arena->head = NULL;
+  arena->cur = arena->end = NULL;
+  arena->used = 0;
+}
+
+void arena_free(Arena *arena) {
+  ArenaBlock *b = arena->head;
+  while (b) {
+    ArenaBlock *next = b->next;
+    free(b);
+    b = next;
+  }
+  arena_init(arena);
+}
+
+static ArenaBlock *block_new(size_t size) {
+  ArenaBlock *b = malloc(sizeof(ArenaBlock) + size);
+  if (!b) {
+    perror("arena");
+    exit(1);
+  }
+  b->size = size;
+  return b;
+}
+
+void *arena_grow(Arena *arena, size_t size) {
+  arena->used += size;
+  // A large object gets a block of its own behind the current one, so the
+  // space left in the current block is not wasted.
+  if (size > ARENA_BLOCK / 4 && arena->head) {
+    ArenaBlock *b = block_new(size);
+    b->next = arena->head->next;
+    arena->head->next = b;
+    return b->data;
+  }
+  size_t block = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+  ArenaBlock *b = block_new(block);
+  b->next = arena->head;
+  arena->head = b;
+  arena->cur = b->data + size;
+  arena->end = b->data + block;
+  return b->data;
+}
+
+char *arena_strndup(Arena *arena, const char *text, size_t len) {
+  char *s = arena_alloc(arena, len + 1);
+  memcpy(s, text, len);
+  s[len] = '\0';
+  return s;
+}
@@ -0,0 +1,222 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "asm.h"
+
+static const char *const mnemonic[] = {
+  [A_MOV] = "mov",   [A_MOVZX] = "movzx", [A_LEA] = "lea",   [A_ADD] = "add",
+  [A_SUB] = "sub",   [A_IMUL] = "imul",   [A_IMUL1] = "imul", [A_XOR] = "xor",
+  [A_AND] = "and",   [A_SHL] = "shl",     [A_SHR] = "shr",   [A_SAR] = "sar",
+  [A_NEG] = "neg",   [A_CMP] = "cmp",     [A_TEST] = "test", [A_SETCC] = "set",
+  [A_JCC] = "j",     [A_JMP] = "jmp",     [A_CALL] = "call", [A_RET] = "ret",
+  [A_PUSH] = "push", [A_POP] = "pop",     [A_CQO] = "cqo",   [A_IDIV] = "idiv",
+};
+
+static const char *const cond[] = {
+  [CC_E] = "e", [CC_NE] = "ne", [CC_L] = "l", [CC_GE] = "ge", [CC_LE] = "le", [CC_G] = "g",
+};
+
+static const char *const reg64[16] = {
+  "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+  "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+static const char *const reg32[16] = {
+  "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+  "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+};
+
+static const char *const reg8[16] = {
+  "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+  "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+};
+
+void asm_init(AsmFn *fn, const char *name) {
+  fn->name = name;
+  fn->insts = (AsmInsts){0};
+}
+
+void asm_free(AsmFn *fn) {
+  stack_free(&fn->insts);
+}
+
+void asm_emit(AsmFn *fn, AsmOp op, AsmCond cc, AsmArg a, AsmArg b, AsmArg c) {
+  AsmInst in = {.op = op, .cc = cc};
+  const AsmArg *args[3] = {&a, &b, &c};
+  int ndisp = 0, nimm = 0;
+  for (int i = 0; i < 3; i++) {
+    const AsmArg *x = args[i];
+    in.kind[i] = x->kind;
+    in.reg[i] = x->reg;
+    switch (x->kind) {
+    case AO_IMM:
+      in.imm = x->val;
+      nimm++;
+      break;
+    case AO_SYM:
+      in.sym = x->sym;
+      nimm++;
+      break;
+    case AO_MEM:
+    case AO_INDEX:
+    case AO_LABEL:
+    case AO_STR:
+      in.disp = (int32_t)x->val;
+      ndisp++;
+      break;
+    default:
+      break;
+    }
+  }
+  assert(ndisp <= 1 && nimm <= 1 && "operands do not fit one AsmInst");
+  (void)ndisp;
+  (void)nimm;
+  stack_push(&fn->insts, in);
+}
+
+size_t asm_count(const AsmFn *fn) {
+  size_t n = 0;
+  for (size_t i = 0; i < fn->insts.len; i++) {
+    uint8_t op = fn->insts.items[i].op;
+    n += op != A_NOP && op != A_LABEL;
+  }
+  return n;
+}
+
+void asm_compact(AsmFn *fn) {
+  size_t n = 0;
+  for (size_t i = 0; i < fn->insts.len; i++) {
+    if (fn->insts.items[i].op != A_NOP)
+      fn->insts.items[n++] = fn->insts.items[i];
+  }
+  fn->insts.len = n;
+}
+
+// --- printing ---------------------------------------------------------------
+// Text is built in a buffer and written a buffer at a time; a large
+// function prints millions of lines.
+
+typedef struct {
+  FILE *out;
+  char text[4096];
+  size_t len;
+} Text;
+
+static void flush(Text *l) {
+  fwrite(l->text, 1, l->len, l->out);
+  l->len = 0;
+}
+
+static void put(Text *l, const char *s) {
+  for (; *s; s++) {
+    if (l->len == sizeof(l->text))
+      flush(l);
+    l->text[l->len++] = *s;
+  }
+}
+
+static void put_int(Text *l, int64_t v) {
+  if (l->len + 24 > sizeof(l->text))
+    flush(l);
+  char digits[24];
+  size_t n = 0;
+  uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+  do {
+    digits[n++] = (char)('0' + u % 10);
+    u /= 10;
+  } while (u);
+  if (v < 0)
+    l->text[l->len++] = '-';
+  while (n)
+    l->text[l->len++] = digits[--n];
+}
+
+// `.L<fn>_<n>`, or `.L<fn>_str<n>` for a string.
+static void put_label(Text *l, const AsmFn *fn, const char *kind, int32_t n) {
+  put(l, ".L");
+  put(l, fn->name);
+  put(l, kind);
+  put_int(l, n);
+}
+
+static void put_operand(Text *l, const AsmFn *fn, const AsmInst *in, int i) {
+  uint8_t r = in->reg[i];
+  switch (in->kind[i]) {
+  case AO_REG:
+    put(l, reg64[r]);
+    break;
+  case AO_REG32:
+    put(l, reg32[r]);
+    break;
+  case AO_REG8:
+    put(l, reg8[r]);
+    break;
+  case AO_IMM:
+    put_int(l, in->imm);
+    break;
+  case AO_MEM: {
+    // Sized only when no register operand gives the size.
+    bool sized = false;
+    for (int j = 0; j < 3; j++)
+      sized |= in->kind[j] == AO_REG || in->kind[j] == AO_REG32 || in->kind[j] == AO_REG8;
+    put(l, sized ? "[rbp - " : "qword ptr [rbp - ");
+    put_int(l, in->disp);
+    put(l, "]");
+    break;
+  }
+  case AO_INDEX:
+    put(l, "[");
+    put(l, reg64[r]);
+    put(l, " + ");
+    put(l, reg64[r]);
+    put(l, "*");
+    put_int(l, in->disp);
+    put(l, "]");
+    break;
+  case AO_LABEL:
+    put_label(l, fn, "_", in->disp);
+    break;
+  case AO_STR:
+    put(l, "[rip + ");
+    put_label(l, fn, "_str", in->disp);
+    put(l, "]");
+    break;
+  case AO_SYM:
+    put(l, in->sym);
+    break;
+  }
+}
+
+void asm_print(const AsmFn *fn, FILE *out) {
+  Text l = {.out = out, .len = 0};
+  for (size_t i = 0; i < fn->insts.len; i++) {
+    const AsmInst *in = &fn->insts.items[i];
+    if (in->op == A_NOP)
+      continue;
+    if (in->op == A_LABEL) {
+      if (in->kind[1] == AO_IMM) {
+        put(&l, "    .p2align ");
+        put_int(&l, in->imm);
+        put(&l, "\n");
+      }
+      if (in->kind[0] == AO_SYM)
+        put(&l, in->sym);
+      else
+        put_label(&l, fn, "_", in->disp);
+      put(&l, ":\n");
+      continue;
+    }
+    put(&l, "    ");
+    put(&l, mnemonic[in->op]);
+    if (in->op == A_SETCC || in->op == A_JCC)
+      put(&l, cond[in->cc]);
+    for (int j = 0; j < 3 && in->kind[j] != AO_NONE; j++) {
+      put(&l, j ? ", " : " ");
+      put_operand(&l, fn, in, j);
+    }
+    put(&l, "\n");
+  }
+  flush(&l);
+}
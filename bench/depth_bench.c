@@ -0,0 +1,210 @@
+// Nesting-depth benchmark for the parser, analysis and code generator.
+//
+// Generates programs whose trees are `depth` levels deep in different ways
+// and compares their per-node cost with a flat program of similar size.
+//
+//   depth_bench [-d depth] [-r runs] [shape...]
+//   depth_bench [-d depth] -w shape out.hsc     (only write the generated input)
+//
+// Shapes:
+//   flat    `depth` short statements
+//   chain   one `1 + 1 + ... + 1` expression (left-deep)
+//   assign  one `x = y = x = ... = 1` expression (right-deep)
+//   nested  one `-(-(-(... 1)))` expression (prefix operators and parens)
+//   elif    one if/elif chain with `depth` arms
+//   ifs     `depth` ifs, each inside the then block of the one before
+//   blocks  `depth` bare blocks, each inside the one before
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "lexer.h"
+#include "parser.h"
+#include "sem.h"
+
+static const char *shapes[] = {"flat", "chain", "assign", "nested", "elif",
+                               "ifs", "blocks"};
+#define NSHAPES (sizeof(shapes) / sizeof(shapes[0]))
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int generate(FILE *f, const char *shape, long depth) {
+  fprintf(f, "fn main() {\n  let x = 0;\n  let y = 0;\n");
+  if (strcmp(shape, "flat") == 0) {
+    for (long i = 0; i < depth; i++)
+      fprintf(f, "  x = x + 1;\n");
+  } else if (strcmp(shape, "chain") == 0) {
+    fprintf(f, "  x = 1");
+    for (long i = 1; i < depth; i++)
+      fprintf(f, " + 1");
+    fprintf(f, ";\n");
+  } else if (strcmp(shape, "assign") == 0) {
+    fprintf(f, "  x = ");
+    for (long i = 1; i < depth; i++)
+      fprintf(f, "%c = ", i % 2 ? 'y' : 'x');
+    fprintf(f, "1;\n");
+  } else if (strcmp(shape, "nested") == 0) {
+    fprintf(f, "  x = ");
+    for (long i = 0; i < depth; i++)
+      fprintf(f, "-(");
+    fprintf(f, "1");
+    for (long i = 0; i < depth; i++)
+      fputc(')', f);
+    fprintf(f, ";\n");
+  } else if (strcmp(shape, "elif") == 0) {
+    fprintf(f, "  if (x == 0) { y = 0; }\n");
+    for (long i = 1; i < depth; i++)
+      fprintf(f, "  elif (x == %ld) { y = %ld; }\n", i, i);
+    fprintf(f, "  else { y = 1; }\n");
+  } else if (strcmp(shape, "ifs") == 0 || strcmp(shape, "blocks") == 0) {
+    const char *open = shape[0] == 'i' ? "if (x == 0) {\n" : "{\n";
+    for (long i = 0; i < depth; i++)
+      fputs(open, f);
+    fprintf(f, "  y = 1;\n");
+    for (long i = 0; i < depth; i++)
+      fputs("}\n", f);
+  } else {
+    return -1;
+  }
+  fprintf(f, "  write(x + y);\n  exit(0);\n}\n");
+  return 0;
+}
+
+typedef struct {
+  double parse, sem, gen;
+  size_t nodes;
+} Timing;
+
+static void run_once(const char *path, FILE *sink, Timing *t) {
+  Source src;
+  if (source_open(&src, path) != 0) {
+    fprintf(stderr, "ERROR: could not open %s\n", path);
+    exit(1);
+  }
+  TokenStream ts;
+  ts_init(&ts, &src);
+  Ast ast;
+  ast_init(&ast);
+
+  double t0 = now_sec();
+  NodeId root = parser(&ts, &ast);
+  double t1 = now_sec();
+  sem_program(&ast, root);
+  double t2 = now_sec();
+  Codegen *cg = codegen_create(sink);
+  codegen_program(cg, &ast, root);
+  fflush(sink);
+  double t3 = now_sec();
+
+  t->parse = t1 - t0;
+  t->sem = t2 - t1;
+  t->gen = t3 - t2;
+  t->nodes = ast.len - 1;
+  codegen_free(cg);
+  ast_free(&ast);
+  ts_free(&ts);
+  source_close(&src);
+}
+
+static void bench_shape(const char *shape, long depth, int runs, FILE *sink) {
+  char path[] = "/tmp/hsc_depth_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    exit(1);
+  }
+  FILE *f = fdopen(fd, "w");
+  generate(f, shape, depth);
+  fclose(f);
+
+  Timing best = {0};
+  for (int r = 0; r < runs; r++) {
+    Timing t;
+    run_once(path, sink, &t);
+    if (r == 0 || t.parse < best.parse)
+      best.parse = t.parse;
+    if (r == 0 || t.sem < best.sem)
+      best.sem = t.sem;
+    if (r == 0 || t.gen < best.gen)
+      best.gen = t.gen;
+    best.nodes = t.nodes;
+  }
+  unlink(path);
+
+  double total = best.parse + best.sem + best.gen;
+  printf("%-7s %9zu nodes  parse %6.3f s  sem %6.3f s  gen %6.3f s  %6.1f ns/node\n",
+         shape, best.nodes, best.parse, best.sem, best.gen, total / best.nodes * 1e9);
+}
+
+int main(int argc, char **argv) {
+  long depth = 1000000;
+  int runs = 3;
+  const char *write_shape = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "d:r:w:")) != -1) {
+    switch (opt) {
+    case 'd':
+      depth = atol(optarg);
+      break;
+    case 'r':
+      runs = atoi(optarg);
+      break;
+    case 'w':
+      write_shape = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-d depth] [-r runs] [-w shape out.hsc] [shape...]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (write_shape) {
+    if (optind >= argc) {
+      fprintf(stderr, "-w requires an output path\n");
+      return 1;
+    }
+    FILE *f = fopen(argv[optind], "w");
+    if (!f) {
+      perror(argv[optind]);
+      return 1;
+    }
+    int rc = generate(f, write_shape, depth);
+    fclose(f);
+    if (rc != 0)
+      fprintf(stderr, "unknown shape %s\n", write_shape);
+    return rc != 0;
+  }
+
+  FILE *sink = fopen("/dev/null", "w");
+  if (!sink) {
+    perror("/dev/null");
+    return 1;
+  }
+  printf("depth %ld, best of %d\n", depth, runs);
+  if (optind < argc) {
+    for (int i = optind; i < argc; i++) {
+      size_t s = 0;
+      while (s < NSHAPES && strcmp(shapes[s], argv[i]) != 0)
+        s++;
+      if (s == NSHAPES) {
+        fprintf(stderr, "unknown shape %s\n", argv[i]);
+        return 1;
+      }
+      bench_shape(shapes[s], depth, runs, sink);
+    }
+  } else {
+    for (size_t s = 0; s < NSHAPES; s++)
+      bench_shape(shapes[s], depth, runs, sink);
+  }
+  fclose(sink);
+  return 0;
+}
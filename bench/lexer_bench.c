@@ -0,0 +1,156 @@
+// Lexer throughput microbenchmark.
+//
+// Generates a large synthetic hsuScript program (or lexes the file given on
+// the command line) and reports the best tokens/sec over several runs.
+//
+//   lexer_bench [-c] [-f functions] [-r runs] [file.hsc]
+//   lexer_bench [-c] [-f functions] -w out.hsc     (only write the generated input)
+//
+// -c generates config-style functions dominated by long string literals and
+// deep indentation instead of the default control-flow heavy code.
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lexer.h"
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Identifiers are letters only, so function numbers are spelled in base 26.
+static const char *fn_suffix(long i, char *buf) {
+  char *p = buf;
+  do {
+    *p++ = (char)('a' + i % 26);
+    i /= 26;
+  } while (i > 0);
+  *p = '\0';
+  return buf;
+}
+
+// Write `functions` functions mixing every token class the lexer handles.
+static void generate(FILE *f, long functions, int config) {
+  char name[16];
+  for (long i = 0; i < functions; i++) {
+    if (config) {
+      fprintf(f, "fn config%s() {\n", fn_suffix(i, name));
+      for (int j = 0; j < 8; j++)
+        fprintf(f, "                let setting%c = \"value %d of generated configuration block %ld, "
+                   "padded out the way exported settings usually are\";\n", 'a' + j, j, i);
+      fprintf(f, "}\n\n");
+      continue;
+    }
+    fprintf(f, "fn helper%s() {\n", fn_suffix(i, name));
+    fprintf(f, "  let total = 0;\n");
+    fprintf(f, "  let message = \"generated function body number %ld\";\n", i);
+    fprintf(f, "  for (let index = 0; index <= 1000; index++) {\n");
+    fprintf(f, "    if (index %% 3 == 0 && total != 42) {\n");
+    fprintf(f, "      total += index * 2 - 7 / 1;\n");
+    fprintf(f, "    } elif (index less 500 or index eq 999) {\n");
+    fprintf(f, "      total -= 1;\n");
+    fprintf(f, "    } else {\n");
+    fprintf(f, "      message = message + \"x\";\n");
+    fprintf(f, "    }\n");
+    fprintf(f, "  }\n");
+    fprintf(f, "  while (total >= 10 || false) { total = total - 10; }\n");
+    fprintf(f, "  write(message);\n");
+    fprintf(f, "  write(total);\n");
+    fprintf(f, "}\n\n");
+  }
+  fprintf(f, "fn main() {\n  exit(0);\n}\n");
+}
+
+int main(int argc, char **argv) {
+  long functions = 100000;
+  int runs = 5;
+  const char *write_path = NULL;
+  int config = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "cf:r:w:")) != -1) {
+    switch (opt) {
+    case 'c':
+      config = 1;
+      break;
+    case 'f':
+      functions = atol(optarg);
+      break;
+    case 'r':
+      runs = atoi(optarg);
+      break;
+    case 'w':
+      write_path = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-c] [-f functions] [-r runs] [-w out.hsc] [file.hsc]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (write_path) {
+    FILE *f = fopen(write_path, "w");
+    if (!f) {
+      perror(write_path);
+      return 1;
+    }
+    generate(f, functions, config);
+    fclose(f);
+    return 0;
+  }
+
+  char tmp_path[] = "/tmp/hsc_lexer_bench_XXXXXX";
+  const char *path;
+  if (optind < argc) {
+    path = argv[optind];
+  } else {
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+      perror("mkstemp");
+      return 1;
+    }
+    FILE *f = fdopen(fd, "w");
+    generate(f, functions, config);
+    fclose(f);
+    path = tmp_path;
+  }
+
+  Source src;
+  if (source_open(&src, path) != 0) {
+    fprintf(stderr, "ERROR: could not open %s\n", path);
+    return 1;
+  }
+
+  double best = 0;
+  size_t count = 0;
+  size_t bytes = 0;
+  for (int r = 0; r < runs; r++) {
+    TokenBuf buf;
+    double t0 = now_sec();
+    lexer(&src, &buf);
+    double t1 = now_sec();
+    count = buf.len - 1;
+    bytes = buf.len * (sizeof(*buf.kind) + sizeof(*buf.off)) +
+            buf.nlines * sizeof(*buf.lines);
+    tokbuf_free(&buf);
+    if (r == 0 || t1 - t0 < best)
+      best = t1 - t0;
+  }
+
+  printf("input: %.1f MB, %zu tokens, %s kernels, %zu threads\n", src.len / 1e6,
+         count, lexer_scan_kernel(), lexer_threads());
+  printf("token store: %.1f MB, %.2f bytes/token (unpacked Token: %zu)\n",
+         bytes / 1e6, (double)bytes / (count + 1), sizeof(Token));
+  printf("best of %d: %.3f s, %.1f Mtokens/s, %.1f MB/s\n", runs, best,
+         count / best / 1e6, src.len / best / 1e6);
+
+  source_close(&src);
+  if (path == tmp_path)
+    unlink(tmp_path);
+  return 0;
+}
@@ -1,40 +1,59 @@
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
+#include "asm.h"
 #include "codegen.h"
-#include "sem.h"
-
+#include "ir.h"
+#include "iropt.h"
+#include "peephole.h"
+#include "regalloc.h"
+#include "stack.h"
+#include "tools.h"
+
+/* Code is emitted from the IR (see ir.h), one function at a time, after
+   its variables are promoted to SSA values and the values are given
+   registers (see regalloc.h).  A value that got no register lives in a
+   spill slot below the frame.  rax, rdx and r11 are scratch: results are
+   computed in rax when the value has no register of its own, and division
+   needs rax and rdx.  Instructions go into an AsmFn (see asm.h), which the
+   peephole pass rewrites before it is printed. */
+
+/* Where a value is, or where a copy goes: a register, or the 8 bytes at
+   [rbp - off].  Neither for constants, strings and unused values. */
 typedef struct {
-    const char *name;
-    int offset;
-    bool is_string;
-} Symbol;
-
-/* Simple scope stack ------------------------------------------------------ */
-typedef struct CGScope {
-    Symbol *items;
-    size_t len;
-    size_t cap;
-    struct CGScope *parent;
-} CGScope;
+    uint8_t reg;
+    int off;
+} Loc;
 
+/* One copy of a parallel move: `value`, found at `from`, goes to `to`. */
 typedef struct {
-    char **items;
-    size_t len;
-    size_t cap;
-} StrVec;
+    Loc to, from;
+    IrRef value;
+} Move;
 
 struct Codegen {
     FILE *out;
-    int next_label;
-    StrVec strs;
-    CGScope *scope;         /* current innermost scope */
-    int frame_size;         /* bytes of locals allocated so far */
-    int stack_depth;        /* bytes pushed on stack since prologue */
+    const Ast *ast;
+    const IrFn *fn;         /* function being emitted */
+    const char *fn_name;    /* labels are named after their function */
+    AsmFn code;             /* its instructions */
+    RegAlloc ra;
+    uint32_t *edge;         /* index among its successor's predecessors of
+                               each block that ends in a jump */
+    int save_off[REG_COUNT];  /* where a register is saved below rbp */
+    int spill_base;         /* spill slot s is at [rbp - spill_base - 8s] */
+    int frame_size;         /* bytes reserved below rbp */
+    STACK(Move) moves;
+    unsigned peephole;      /* PeepRule mask */
+    unsigned unroll;        /* ir_unroll factor, 0 to choose per loop */
+    bool stats;             /* report instruction counts on stderr */
+    size_t insts_before;    /* instructions emitted, before the peephole */
+    size_t insts_after;     /* and after it */
 };
 
 static void emit(Codegen *cg, const char *fmt, ...) {
@@ -44,577 +63,735 @@ static void emit(Codegen *cg, const char *fmt, ...) {
     va_end(ap);
 }
 
-/* System V AMD64 ABI requires %rsp+8 to be 16-byte aligned at call sites.
-   frame_size tracks our stack frame for locals and stack_depth counts
-   any pushes since the function prologue. */
+static void inst(Codegen *cg, AsmOp op, AsmArg a, AsmArg b) {
+    asm_emit(&cg->code, op, 0, a, b, asm_none());
+}
+
+static void inst0(Codegen *cg, AsmOp op) {
+    asm_emit(&cg->code, op, 0, asm_none(), asm_none(), asm_none());
+}
+
+static void inst1(Codegen *cg, AsmOp op, AsmArg a) {
+    asm_emit(&cg->code, op, 0, a, asm_none(), asm_none());
+}
+
+static void jump(Codegen *cg, uint32_t to) {
+    inst1(cg, A_JMP, asm_label(to));
+}
+
+/* System V AMD64 ABI requires %rsp to be 16-byte aligned at call sites.
+   It is right after the prologue pushes rbp, and the frame below that is a
+   multiple of 16 bytes with nothing pushed on top of it. */
 static void emit_call(Codegen *cg, const char *target) {
-    int total = cg->frame_size + cg->stack_depth + 8;
-    int fix = 0;
-    if (total % 16 != 0) {
-        assert(total % 16 == 8 && "stack misaligned by non-8 bytes");
-        emit(cg, "    sub rsp, 8\n");
-        fix = 8;
-        total += 8;
-    }
-    assert(total % 16 == 0 && "stack misaligned before call");
-    emit(cg, "    call %s\n", target);
-    if (fix)
-        emit(cg, "    add rsp, 8\n");
+    assert(cg->frame_size % 16 == 0 && "stack misaligned before call");
+    inst1(cg, A_CALL, asm_sym(target));
 }
 
-static int new_label(Codegen *cg) __attribute__((unused));
-static int new_label(Codegen *cg) {
-    return cg->next_label++;
+Codegen *codegen_create(FILE *out) {
+    Codegen *cg = calloc(1, sizeof(Codegen));
+    if (!cg) return NULL;
+    cg->out = out;
+    cg->peephole = PEEP_ALL;
+    return cg;
 }
 
-static size_t intern_str(Codegen *cg, const char *s) __attribute__((unused));
-static size_t intern_str(Codegen *cg, const char *s) {
-    for (size_t i = 0; i < cg->strs.len; i++) {
-        if (strcmp(cg->strs.items[i], s) == 0) {
-            return i;
-        }
-    }
-    if (cg->strs.len == cg->strs.cap) {
-        cg->strs.cap = cg->strs.cap ? cg->strs.cap * 2 : 8;
-        cg->strs.items = realloc(cg->strs.items, cg->strs.cap * sizeof(*cg->strs.items));
-    }
-    cg->strs.items[cg->strs.len] = strdup(s);
-    return cg->strs.len++;
+void codegen_free(Codegen *cg) {
+    free(cg);
 }
 
-static int count_locals(Node *node) {
-    if (!node) return 0;
-    if (node->kind == NK_FnDecl) return 0;
-    int n = (node->kind == NK_LetStmt) ? 1 : 0;
-    n += count_locals(node->left);
-    n += count_locals(node->right);
-    for (size_t i = 0; i < node->children.len; i++)
-        n += count_locals(node->children.items[i]);
-    return n;
+void codegen_set_peephole(Codegen *cg, unsigned rules, bool stats) {
+    cg->peephole = rules;
+    cg->stats = stats;
+}
+
+void codegen_set_unroll(Codegen *cg, unsigned factor) {
+    cg->unroll = factor;
+}
+
+void codegen_ir(IrFn *fn, const Ast *ast, NodeId fn_decl, unsigned unroll) {
+    ir_build(fn, ast, fn_decl);
+    ir_promote(fn);
+    ir_hoist(fn);
+    ir_close_loops(fn);
+    ir_unroll(fn, unroll);
+    ir_split_edges(fn);
 }
 
 /* ------------------------------------------------------------------------- */
-/* Scope and symbol helpers                                                 */
-
-static void scope_push(Codegen *cg) {
-    CGScope *s = calloc(1, sizeof(CGScope));
-    if (!s) return;
-    s->items = NULL;
-    s->len = s->cap = 0;
-    s->parent = cg->scope;
-    cg->scope = s;
-}
-
-static void scope_pop(Codegen *cg) {
-    if (!cg->scope) return;
-    CGScope *s = cg->scope;
-    cg->scope = s->parent;
-    for (size_t i = 0; i < s->len; i++)
-        free((char *)s->items[i].name);
-    free(s->items);
-    free(s);
-}
-
-static int sym_add(Codegen *cg, const char *name, bool is_string) {
-    if (!cg->scope) return -1;
-    CGScope *s = cg->scope;
-    if (s->len == s->cap) {
-        s->cap = s->cap ? s->cap * 2 : 8;
-        s->items = realloc(s->items, s->cap * sizeof(*s->items));
+/* Operands                                                                  */
+
+static bool fits_imm32(int64_t v) {
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+static Loc loc_of(const Codegen *cg, IrRef v) {
+    if (cg->ra.reg[v] != REG_NONE)
+        return (Loc){cg->ra.reg[v], 0};
+    if (cg->ra.spill[v])
+        return (Loc){REG_NONE, cg->spill_base + 8 * (int)cg->ra.spill[v]};
+    return (Loc){REG_NONE, 0};
+}
+
+static bool loc_eq(Loc a, Loc b) {
+    return a.reg == b.reg && (a.reg != REG_NONE || a.off == b.off);
+}
+
+static AsmArg loc_arg(Loc l) {
+    return l.reg != REG_NONE ? asm_reg(l.reg) : asm_mem(l.off);
+}
+
+static bool in_memory(const Codegen *cg, IrRef v) {
+    return cg->ra.reg[v] == REG_NONE && cg->ra.spill[v];
+}
+
+/* `v` as a source operand: its register, its spill slot, or an immediate
+   for a constant that fits in 32 bits.  AO_NONE for wider constants and
+   string addresses, which load_value() must put in a register. */
+static AsmArg operand(const Codegen *cg, IrRef v) {
+    const IrInst *in = ir_inst(cg->fn, v);
+    if (in->op == IR_CONST)
+        return fits_imm32(in->imm) ? asm_imm(in->imm) : asm_none();
+    if (in->op == IR_STR)
+        return asm_none();
+    return loc_arg(loc_of(cg, v));
+}
+
+/* Puts value `v` into register `reg`. */
+static void load_value(Codegen *cg, uint8_t reg, IrRef v) {
+    const IrInst *in = ir_inst(cg->fn, v);
+    if (in->op == IR_CONST && in->imm == 0) {
+        inst(cg, A_XOR, asm_reg32(reg), asm_reg32(reg));
+    } else if (in->op == IR_CONST) {
+        inst(cg, A_MOV, asm_reg(reg), asm_imm(in->imm));
+    } else if (in->op == IR_STR) {
+        inst(cg, A_LEA, asm_reg(reg), asm_str((uint32_t)in->imm));
+    } else {
+        Loc l = loc_of(cg, v);
+        if (l.reg != reg)
+            inst(cg, A_MOV, asm_reg(reg), loc_arg(l));
     }
-    cg->frame_size += 8;
-    s->items[s->len].name = strdup(name);
-    s->items[s->len].offset = cg->frame_size;
-    s->items[s->len].is_string = is_string;
-    s->len++;
-    return cg->frame_size;
-}
-
-static int sym_lookup(Codegen *cg, const char *name, bool *is_string) {
-    for (CGScope *s = cg->scope; s; s = s->parent) {
-        for (size_t i = 0; i < s->len; i++) {
-            if (strcmp(s->items[i].name, name) == 0) {
-                if (is_string) *is_string = s->items[i].is_string;
-                return s->items[i].offset;
-            }
+}
+
+/* The register holding `v`, after loading it into `scratch` if it is in
+   none. */
+static uint8_t in_reg(Codegen *cg, IrRef v, uint8_t scratch) {
+    if (cg->ra.reg[v] != REG_NONE)
+        return cg->ra.reg[v];
+    load_value(cg, scratch, v);
+    return scratch;
+}
+
+/* The register to compute `ref` in: its own, or rax if it has none. */
+static uint8_t target(const Codegen *cg, IrRef ref) {
+    return cg->ra.reg[ref] != REG_NONE ? cg->ra.reg[ref] : REG_RAX;
+}
+
+/* Moves the value of `ref`, just computed in `reg`, to where it lives. */
+static void define(Codegen *cg, IrRef ref, uint8_t reg) {
+    Loc l = loc_of(cg, ref);
+    if ((l.reg != REG_NONE && l.reg != reg) || (l.reg == REG_NONE && l.off))
+        inst(cg, A_MOV, loc_arg(l), asm_reg(reg));
+}
+
+/* ------------------------------------------------------------------------- */
+/* Parallel moves                                                            */
+
+static void emit_move(Codegen *cg, const Move *m) {
+    const IrInst *in = ir_inst(cg->fn, m->value);
+    if (m->from.reg == REG_NONE && !m->from.off) {
+        /* A constant or string, made where it goes. */
+        if (m->to.reg != REG_NONE) {
+            load_value(cg, m->to.reg, m->value);
+        } else if (in->op == IR_CONST && fits_imm32(in->imm)) {
+            inst(cg, A_MOV, asm_mem(m->to.off), asm_imm(in->imm));
+        } else {
+            load_value(cg, REG_RAX, m->value);
+            inst(cg, A_MOV, asm_mem(m->to.off), asm_reg(REG_RAX));
         }
+        return;
+    }
+    uint8_t reg = m->from.reg;
+    if (reg == REG_NONE) {
+        reg = m->to.reg != REG_NONE ? m->to.reg : REG_RAX;
+        inst(cg, A_MOV, asm_reg(reg), asm_mem(m->from.off));
     }
-    return -1;
+    if (m->to.reg != reg)
+        inst(cg, A_MOV, loc_arg(m->to), asm_reg(reg));
 }
 
-static void sym_set_is_string(Codegen *cg, const char *name, bool is_string) {
-    for (CGScope *s = cg->scope; s; s = s->parent) {
-        for (size_t i = 0; i < s->len; i++) {
-            if (strcmp(s->items[i].name, name) == 0) {
-                s->items[i].is_string = is_string;
-                return;
+/* Performs cg->moves as if all of them read their sources at once.  A copy
+   goes out once no other pending copy still reads its destination; when
+   only cycles are left, one destination is set aside in r11 first. */
+static void parallel_move(Codegen *cg) {
+    Move *m = cg->moves.items;
+    size_t n = 0;
+    for (size_t i = 0; i < cg->moves.len; i++) {
+        if (!loc_eq(m[i].to, m[i].from))
+            m[n++] = m[i];
+    }
+    while (n) {
+        size_t ready = n;
+        for (size_t i = 0; i < n && ready == n; i++) {
+            ready = i;
+            for (size_t j = 0; j < n; j++) {
+                if (j != i && loc_eq(m[j].from, m[i].to)) {
+                    ready = n;
+                    break;
+                }
             }
         }
+        if (ready < n) {
+            emit_move(cg, &m[ready]);
+            m[ready] = m[--n];
+            continue;
+        }
+        Loc held = m[0].to;
+        inst(cg, A_MOV, asm_reg(REG_R11), loc_arg(held));
+        for (size_t j = 0; j < n; j++) {
+            if (loc_eq(m[j].from, held))
+                m[j].from = (Loc){REG_R11, 0};
+        }
     }
+    cg->moves.len = 0;
 }
 
-static void sym_set_string(Codegen *cg, int offset, bool is_string) {
-    for (CGScope *s = cg->scope; s; s = s->parent) {
-        for (size_t i = 0; i < s->len; i++) {
-            if (s->items[i].offset == offset) {
-                s->items[i].is_string = is_string;
-                return;
-            }
-        }
+static void add_move(Codegen *cg, Loc to, IrRef value) {
+    stack_push(&cg->moves, ((Move){to, loc_of(cg, value), value}));
+}
+
+/* Copies the arguments for block `to`'s phis on the edge from `from`. */
+static void phi_copies(Codegen *cg, uint32_t from, uint32_t to) {
+    const IrFn *fn = cg->fn;
+    const IrBlock *blk = ir_block(fn, to);
+    uint32_t j = cg->edge[from];
+    for (size_t i = 0; i < blk->insts.len; i++) {
+        IrRef phi = blk->insts.items[i];
+        if (ir_inst(fn, phi)->op != IR_PHI)
+            break;
+        add_move(cg, loc_of(cg, phi), fn->args.items[ir_inst(fn, phi)->imm + j]);
     }
+    parallel_move(cg);
 }
 
 /* ------------------------------------------------------------------------- */
-/* Expression and statement emission                                        */
+/* Instructions                                                              */
 
-static void gen_expr(Codegen *cg, Node *node);
+static const AsmCond setcc[] = {
+    [IR_EQ] = CC_E, [IR_NE] = CC_NE, [IR_LT] = CC_L,
+    [IR_LE] = CC_LE, [IR_GT] = CC_G, [IR_GE] = CC_GE,
+};
 
-Codegen *codegen_create(FILE *out) {
-    Codegen *cg = calloc(1, sizeof(Codegen));
-    if (!cg) return NULL;
-    cg->out = out;
-    cg->next_label = 0;
-    cg->strs.items = NULL;
-    cg->strs.len = cg->strs.cap = 0;
-    cg->scope = NULL;
-    cg->frame_size = 0;
-    cg->stack_depth = 0;
-    return cg;
+/* Whether `v` is a constant, and its value in *c if so. */
+static bool const_of(const Codegen *cg, IrRef v, int64_t *c) {
+    const IrInst *in = ir_inst(cg->fn, v);
+    if (in->op != IR_CONST)
+        return false;
+    *c = in->imm;
+    return true;
 }
 
-void codegen_free(Codegen *cg) {
-    if (!cg) return;
-    for (size_t i = 0; i < cg->strs.len; i++) {
-        free(cg->strs.items[i]);
+/* x * c for `c` a power of two, or 3, 5 or 9 times one: a lea for the odd
+   factor and a shift for the rest.  False for any other c, which is left
+   to imul. */
+static bool gen_mul_const(Codegen *cg, IrRef ref, IrRef x, int64_t c) {
+    if (c <= 0)
+        return false;
+    int k = __builtin_ctzll((uint64_t)c);
+    int64_t odd = c >> k;
+    if (odd != 1 && odd != 3 && odd != 5 && odd != 9)
+        return false;
+    uint8_t d = target(cg, ref);
+    if (odd == 1)
+        load_value(cg, d, x);
+    else
+        inst(cg, A_LEA, asm_reg(d), asm_index(in_reg(cg, x, REG_R11), (int)odd - 1));
+    if (k == 1)
+        inst(cg, A_ADD, asm_reg(d), asm_reg(d));
+    else if (k)
+        inst(cg, A_SHL, asm_reg(d), asm_imm(k));
+    define(cg, ref, d);
+    return true;
+}
+
+static void gen_arith(Codegen *cg, IrRef ref, const IrInst *in) {
+    static const AsmOp op[] = {
+        [IR_ADD] = A_ADD, [IR_SUB] = A_SUB, [IR_MUL] = A_IMUL,
+    };
+    IrRef a = in->a, b = in->b;
+    int64_t c;
+    if (in->op == IR_MUL && ((const_of(cg, b, &c) && gen_mul_const(cg, ref, a, c)) ||
+                             (const_of(cg, a, &c) && gen_mul_const(cg, ref, b, c))))
+        return;
+    uint8_t d = target(cg, ref);
+    /* d = a op b, where b may already be in d: commute, or work in rax. */
+    if (cg->ra.reg[b] == d && cg->ra.reg[a] != d) {
+        if (in->op == IR_SUB) {
+            d = REG_RAX;
+        } else {
+            a = in->b;
+            b = in->a;
+        }
     }
-    free(cg->strs.items);
-    /* free scope chain */
-    for (CGScope *s = cg->scope; s;) {
-        CGScope *parent = s->parent;
-        for (size_t i = 0; i < s->len; i++)
-            free((char*)s->items[i].name);
-        free(s->items);
-        free(s);
-        s = parent;
+    AsmArg rhs = operand(cg, b);
+    if (rhs.kind == AO_NONE) {
+        load_value(cg, REG_R11, b);
+        rhs = asm_reg(REG_R11);
     }
-    free(cg);
+    load_value(cg, d, a);
+    if (in->op == IR_MUL && rhs.kind == AO_IMM)
+        asm_emit(&cg->code, A_IMUL, 0, asm_reg(d), asm_reg(d), rhs);
+    else
+        inst(cg, op[in->op], asm_reg(d), rhs);
+    define(cg, ref, d);
 }
 
-static void emit_exit(Codegen *cg, Node *node, bool *has_exit) {
-    if (node && node->left) {
-        gen_expr(cg, node->left);
-        emit(cg, "    mov edi, eax\n");
+/* The multiplier m and shift s for signed division by `d`, 2 <= |d| <
+   2^63, after Hacker's Delight 10-1: the quotient is the high half of
+   m * x, corrected by x when m and d differ in sign, shifted right by s
+   and rounded toward zero. */
+static void div_magic(int64_t d, int64_t *m, int *s) {
+    const uint64_t two63 = (uint64_t)1 << 63;
+    uint64_t ad = d < 0 ? 0 - (uint64_t)d : (uint64_t)d;
+    uint64_t t = two63 + ((uint64_t)d >> 63);
+    uint64_t anc = t - 1 - t % ad;  /* |nc|, the largest dividend to fix */
+    uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+    uint64_t delta;
+    int p = 63;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    *m = (int64_t)(d < 0 ? 0 - (q2 + 1) : q2 + 1);
+    *s = p - 64;
+}
+
+/* x / 2^k or x % 2^k, negated for `neg` (x / -2^k).  rdx holds 2^k - 1
+   for a negative x and 0 otherwise, so the shift rounds toward zero. */
+static void gen_divide_pow2(Codegen *cg, IrRef ref, const IrInst *in, int k, bool neg) {
+    uint8_t x = in_reg(cg, in->a, REG_R11);
+    uint8_t d = target(cg, ref);
+    inst(cg, A_MOV, asm_reg(REG_RDX), asm_reg(x));
+    if (k > 1)
+        inst(cg, A_SAR, asm_reg(REG_RDX), asm_imm(63));
+    inst(cg, A_SHR, asm_reg(REG_RDX), asm_imm(64 - k));
+    if (d != x)
+        inst(cg, A_MOV, asm_reg(d), asm_reg(x));
+    inst(cg, A_ADD, asm_reg(d), asm_reg(REG_RDX));
+    if (in->op == IR_DIV) {
+        inst(cg, A_SAR, asm_reg(d), asm_imm(k));
+        if (neg)
+            inst1(cg, A_NEG, asm_reg(d));
     } else {
-        emit(cg, "    xor edi, edi\n");
+        inst(cg, A_AND, asm_reg(d), asm_imm(((int64_t)1 << k) - 1));
+        inst(cg, A_SUB, asm_reg(d), asm_reg(REG_RDX));
     }
-    emit_call(cg, "exit@PLT");
-    *has_exit = true;
+    define(cg, ref, d);
 }
 
-static void gen_expr(Codegen *cg, Node *node) {
-    if (!node) return;
-
-    switch (node->kind) {
-    case NK_Int:
-        emit(cg, "    mov rax, %s\n", node->value ? node->value : "0");
-        break;
-    case NK_Bool:
-        emit(cg, "    mov rax, %s\n", (node->value && strcmp(node->value, "true") == 0) ? "1" : "0");
-        break;
-    case NK_String: {
-        size_t idx = intern_str(cg, node->value ? node->value : "");
-        emit(cg, "    lea rax, [rip + .Lstr%zu]\n", idx);
-        break;
+/* x / c or x % c by multiplying with div_magic(c).  The remainder is
+   x - x / c * c. */
+static void gen_divide_magic(Codegen *cg, IrRef ref, const IrInst *in, int64_t c) {
+    int64_t m;
+    int s;
+    div_magic(c, &m, &s);
+    uint8_t x = in_reg(cg, in->a, REG_R11);
+    inst(cg, A_MOV, asm_reg(REG_RAX), asm_imm(m));
+    inst1(cg, A_IMUL1, asm_reg(x));
+    if (c > 0 && m < 0)
+        inst(cg, A_ADD, asm_reg(REG_RDX), asm_reg(x));
+    else if (c < 0 && m > 0)
+        inst(cg, A_SUB, asm_reg(REG_RDX), asm_reg(x));
+    if (s)
+        inst(cg, A_SAR, asm_reg(REG_RDX), asm_imm(s));
+    inst(cg, A_MOV, asm_reg(REG_RAX), asm_reg(REG_RDX));
+    inst(cg, A_SHR, asm_reg(REG_RAX), asm_imm(63));
+    inst(cg, A_ADD, asm_reg(REG_RDX), asm_reg(REG_RAX));
+    if (in->op == IR_DIV) {
+        define(cg, ref, REG_RDX);
+        return;
+    }
+    if (fits_imm32(c)) {
+        asm_emit(&cg->code, A_IMUL, 0, asm_reg(REG_RDX), asm_reg(REG_RDX), asm_imm(c));
+    } else {
+        inst(cg, A_MOV, asm_reg(REG_RAX), asm_imm(c));
+        inst(cg, A_IMUL, asm_reg(REG_RDX), asm_reg(REG_RAX));
     }
-    case NK_Identifier: {
-        int off = sym_lookup(cg, node->value, NULL);
-        if (off >= 0) {
-            emit(cg, "    mov rax, [rbp - %d]\n", off);
+    uint8_t d = target(cg, ref);
+    if (d != x)
+        inst(cg, A_MOV, asm_reg(d), asm_reg(x));
+    inst(cg, A_SUB, asm_reg(d), asm_reg(REG_RDX));
+    define(cg, ref, d);
+}
+
+/* Division by a constant avoids idiv, except by 0 and -1, which may trap
+   (INT64_MIN / -1) and are left to it, as is the rare INT64_MIN. */
+static void gen_divide(Codegen *cg, IrRef ref, const IrInst *in) {
+    int64_t c;
+    if (const_of(cg, in->b, &c) && c != 0 && c != -1 && c != INT64_MIN) {
+        uint64_t ac = c < 0 ? 0 - (uint64_t)c : (uint64_t)c;
+        int k = __builtin_ctzll(ac);
+        if (ac == 1) {
+            /* x / 1 is x and x % 1 is 0. */
+            uint8_t d = target(cg, ref);
+            if (in->op == IR_DIV)
+                load_value(cg, d, in->a);
+            else
+                inst(cg, A_XOR, asm_reg32(d), asm_reg32(d));
+            define(cg, ref, d);
+        } else if (ac >> k == 1 && (in->op == IR_DIV || k < 32)) {
+            gen_divide_pow2(cg, ref, in, k, c < 0);
         } else {
-            fprintf(stderr, "codegen: unknown symbol %s\n",
-                    node_name(node));
-            exit(1);
+            gen_divide_magic(cg, ref, in, c);
         }
-        break;
+        return;
     }
-    case NK_Unary:
-        gen_expr(cg, node->left);
-        switch (node->op) {
-        case DASH:
-            emit(cg, "    neg rax\n");
-            break;
-        case NOT:
-            emit(cg, "    test rax, rax\n    sete al\n    movzx rax, al\n");
-            break;
-        case PLUS_PLUS:
-        case MINUS_MINUS: {
-            if (node->left && node->left->kind == NK_Identifier) {
-                int off = sym_lookup(cg, node->left->value, NULL);
-                if (off >= 0) {
-                    if (node->postfix)
-                        emit(cg, "    mov rcx, rax\n");
-                    if (node->op == PLUS_PLUS)
-                        emit(cg, "    add rax, 1\n");
-                    else
-                        emit(cg, "    sub rax, 1\n");
-                    emit(cg, "    mov [rbp - %d], rax\n", off);
-                    if (node->postfix)
-                        emit(cg, "    mov rax, rcx\n");
-                }
-            }
-            break;
-        }
-        default:
-            break;
-        }
-        break;
-    case NK_Assign:
-        gen_expr(cg, node->right);
-        if (node->left && node->left->kind == NK_Identifier) {
-            const char *name = node->left->value;
-            int off = sym_lookup(cg, name, NULL);
-            if (off >= 0) {
-                emit(cg, "    mov [rbp - %d], rax\n", off);
-                bool is_str = node->right &&
-                              (node->right->kind == NK_String ||
-                               (node->right->kind == NK_Binary &&
-                                node->right->op == PLUS &&
-                                node->right->ty && node->right->ty->kind == TY_STRING));
-                sym_set_string(cg, off, is_str);
-            } else {
-                fprintf(stderr, "codegen: unknown symbol %s\n",
-                        node_name(node->left));
-                exit(1);
-            }
-        }
-        break;
-    case NK_Binary:
-        if (node->op == AND || node->op == OR) {
-            int l_short = new_label(cg);
-            int l_end = new_label(cg);
-            if (node->op == AND) {
-                gen_expr(cg, node->left);
-                emit(cg, "    cmp rax, 0\n    je .L%d\n", l_short);
-                gen_expr(cg, node->right);
-                emit(cg, "    cmp rax, 0\n    setne al\n    movzx rax, al\n    jmp .L%d\n", l_end);
-                emit(cg, ".L%d:\n    xor eax, eax\n", l_short);
-                emit(cg, ".L%d:\n", l_end);
-            } else { /* OR */
-                gen_expr(cg, node->left);
-                emit(cg, "    cmp rax, 0\n    jne .L%d\n", l_short);
-                gen_expr(cg, node->right);
-                emit(cg, "    cmp rax, 0\n    setne al\n    movzx rax, al\n    jmp .L%d\n", l_end);
-                emit(cg, ".L%d:\n    mov eax, 1\n", l_short);
-                emit(cg, ".L%d:\n", l_end);
-            }
-            break;
-        }
+    AsmArg divisor;
+    load_value(cg, REG_RAX, in->a);
+    if (ir_inst(cg->fn, in->b)->op == IR_CONST) {
+        load_value(cg, REG_R11, in->b);
+        divisor = asm_reg(REG_R11);
+    } else {
+        divisor = operand(cg, in->b);
+    }
+    inst0(cg, A_CQO);
+    inst1(cg, A_IDIV, divisor);
+    define(cg, ref, in->op == IR_DIV ? REG_RAX : REG_RDX);
+}
 
-        bool left_is_str = node->left &&
-                           ((node->left->ty && node->left->ty->kind == TY_STRING) ||
-                            node->left->kind == NK_String);
-        if (!left_is_str && node->left && node->left->kind == NK_Identifier)
-            sym_lookup(cg, node->left->value, &left_is_str);
-        bool right_is_str = node->right &&
-                             ((node->right->ty && node->right->ty->kind == TY_STRING) ||
-                              node->right->kind == NK_String);
-        if (!right_is_str && node->right && node->right->kind == NK_Identifier)
-            sym_lookup(cg, node->right->value, &right_is_str);
-        if (node->op == PLUS && (left_is_str || right_is_str)) {
-            gen_expr(cg, node->left);
-            emit(cg, "    push rax\n");
-            cg->stack_depth += 8;
-            gen_expr(cg, node->right);
-            emit(cg, "    mov rsi, rax\n    pop rdi\n");
-            cg->stack_depth -= 8;
-            emit_call(cg, "hsu_concat@PLT");
-            node->ty = type_string();
-            break;
-        }
+/* Sets the flags for compare `in`. */
+static void compare(Codegen *cg, const IrInst *in) {
+    AsmArg rhs = operand(cg, in->b);
+    AsmArg lhs;
+    if (in_memory(cg, in->a) && rhs.kind != AO_NONE && !in_memory(cg, in->b))
+        lhs = operand(cg, in->a);
+    else
+        lhs = asm_reg(in_reg(cg, in->a, REG_RAX));
+    if (rhs.kind == AO_NONE) {
+        load_value(cg, REG_R11, in->b);
+        rhs = asm_reg(REG_R11);
+    }
+    inst(cg, A_CMP, lhs, rhs);
+}
 
-        gen_expr(cg, node->left);
-        emit(cg, "    push rax\n");
-        cg->stack_depth += 8;
-        gen_expr(cg, node->right);
-        emit(cg, "    mov r10, rax\n    pop rax\n");
-        cg->stack_depth -= 8;
+/* A compare left in the flags is emitted by the branch that reads it. */
+static void gen_compare(Codegen *cg, IrRef ref, const IrInst *in) {
+    if (cg->ra.reg[ref] == REG_FLAGS)
+        return;
+    compare(cg, in);
+    uint8_t d = target(cg, ref);
+    asm_emit(&cg->code, A_SETCC, setcc[in->op], asm_reg8(REG_RAX), asm_none(), asm_none());
+    inst(cg, A_MOVZX, asm_reg32(d), asm_reg8(REG_RAX));
+    define(cg, ref, d);
+}
 
-        switch (node->op) {
-        case PLUS:
-            emit(cg, "    add rax, r10\n");
-            break;
-        case DASH:
-            emit(cg, "    sub rax, r10\n");
-            break;
-        case STAR:
-            emit(cg, "    imul rax, r10\n");
-            break;
-        case SLASH:
-            emit(cg, "    cqo\n    idiv r10\n");
-            break;
-        case PERCENT:
-            emit(cg, "    cqo\n    idiv r10\n    mov rax, rdx\n");
-            break;
-        case EQUALS:
-            emit(cg, "    cmp rax, r10\n    sete al\n    movzx rax, al\n");
-            break;
-        case NOT_EQUALS:
-            emit(cg, "    cmp rax, r10\n    setne al\n    movzx rax, al\n");
-            break;
-        case LESS:
-            emit(cg, "    cmp rax, r10\n    setl al\n    movzx rax, al\n");
-            break;
-        case LESS_EQUALS:
-            emit(cg, "    cmp rax, r10\n    setle al\n    movzx rax, al\n");
-            break;
-        case GREATER:
-            emit(cg, "    cmp rax, r10\n    setg al\n    movzx rax, al\n");
-            break;
-        case GREATER_EQUALS:
-            emit(cg, "    cmp rax, r10\n    setge al\n    movzx rax, al\n");
-            break;
-        default:
-            break;
-        }
-        break;
-    default:
-        fprintf(stderr, "codegen: unsupported node kind %d\n", node->kind);
-        exit(1);
+/* Saves the caller-saved registers in `mask` before a call, or restores
+   them after it. */
+static void save_regs(Codegen *cg, uint16_t mask, bool restore) {
+    for (uint8_t r = 0; r < REG_COUNT; r++) {
+        if (!(mask >> r & 1))
+            continue;
+        if (restore)
+            inst(cg, A_MOV, asm_reg(r), asm_mem(cg->save_off[r]));
+        else
+            inst(cg, A_MOV, asm_mem(cg->save_off[r]), asm_reg(r));
     }
 }
 
-static void emit_node(Codegen *cg, Node *node, bool *has_exit) {
-    if (!node) return;
-    switch (node->kind) {
-    case NK_Program:
-        scope_push(cg);
-        for (size_t i = 0; i < node->children.len; i++)
-            emit_node(cg, node->children.items[i], has_exit);
-        scope_pop(cg);
-        break;
-    case NK_FnDecl: {
-        const char *name = node_name(node);
-        Node *body = node->children.len > 0 ? node->children.items[0] : NULL;
-        int locals = count_locals(body);
-        int frame = locals * 8;
-        if ((frame + 8) % 16 != 0)
-            frame += 8;
-        emit(cg, "%s:\n", name);
-        emit(cg, "    push rbp\n");
-        emit(cg, "    mov rbp, rsp\n");
-        emit(cg, "    sub rsp, %d\n", frame);
-        int saved_fs = cg->frame_size;
-        int saved_sd = cg->stack_depth;
-        cg->frame_size = 0;
-        cg->stack_depth = 0;
-        if (body)
-            emit_node(cg, body, has_exit);
-        cg->frame_size = saved_fs;
-        cg->stack_depth = saved_sd;
-        emit(cg, "    mov rsp, rbp\n");
-        emit(cg, "    pop rbp\n");
-        emit(cg, "    xor eax, eax\n");
-        emit(cg, "    ret\n");
-        break;
-    }
-    case NK_Block:
-        scope_push(cg);
-        for (size_t i = 0; i < node->children.len; i++)
-            emit_node(cg, node->children.items[i], has_exit);
-        scope_pop(cg);
-        break;
-    case NK_LetStmt: {
-        sym_add(cg, node->value, false);
-        if (node->right) {
-            gen_expr(cg, node->right);
-            int off = sym_lookup(cg, node->value, NULL);
-            if (off >= 0)
-                emit(cg, "    mov [rbp - %d], rax\n", off);
-            bool is_str = node->right &&
-                          (node->right->kind == NK_String ||
-                           (node->right->ty && node->right->ty->kind == TY_STRING));
-            sym_set_is_string(cg, node->value, is_str);
-        }
+/* Calls `target` with arguments `a` and `b` (IR_NONE if unused) in rdi
+   and rsi, keeping the caller-saved registers that live across it. */
+static void gen_call(Codegen *cg, IrRef ref, const char *target, IrRef a, IrRef b) {
+    uint16_t saves = cg->ra.saves[ref];
+    save_regs(cg, saves, false);
+    add_move(cg, (Loc){REG_RDI, 0}, a);
+    if (b)
+        add_move(cg, (Loc){REG_RSI, 0}, b);
+    parallel_move(cg);
+    emit_call(cg, target);
+    save_regs(cg, saves, true);
+}
+
+static void gen_inst(Codegen *cg, uint32_t b, IrRef ref) {
+    const IrFn *fn = cg->fn;
+    const IrInst *in = ir_inst(fn, ref);
+    const IrBlock *blk = ir_block(fn, b);
+    switch (in->op) {
+    case IR_CONST:
+    case IR_STR:
+    case IR_PHI:
+        break;  /* materialized where used / copied in by the predecessors */
+    case IR_LOAD: {
+        uint8_t d = target(cg, ref);
+        inst(cg, A_MOV, asm_reg(d), asm_mem((int)in->imm * 8));
+        define(cg, ref, d);
         break;
     }
-    case NK_AssignStmt: {
-        gen_expr(cg, node->right);
-        const char *name = (node->left && node->left->value) ? node->left->value : NULL;
-        int off = sym_lookup(cg, name, NULL);
-        if (off >= 0) {
-            emit(cg, "    mov [rbp - %d], rax\n", off);
-            bool is_str = node->right &&
-                          (node->right->kind == NK_String ||
-                           (node->right->kind == NK_Binary &&
-                            node->right->op == PLUS &&
-                            node->right->ty && node->right->ty->kind == TY_STRING));
-            sym_set_string(cg, off, is_str);
-        } else {
-            fprintf(stderr, "codegen: unknown symbol %s\n",
-                    node_name(node->left));
-            exit(1);
+    case IR_STORE: {
+        AsmArg src = operand(cg, in->a);
+        if (src.kind == AO_NONE || src.kind == AO_MEM) {
+            load_value(cg, REG_RAX, in->a);
+            src = asm_reg(REG_RAX);
         }
+        inst(cg, A_MOV, asm_mem((int)in->imm * 8), src);
         break;
     }
-    case NK_WriteStmt: {
-        bool is_str = false;
-        if (node->left) {
-            if (node->left->kind == NK_String)
-                is_str = true;
-            else if (node->left->kind == NK_Identifier)
-                sym_lookup(cg, node->left->value, &is_str);
-            else if (node->left->ty && node->left->ty->kind == TY_STRING)
-                is_str = true;
-        }
-        gen_expr(cg, node->left);
-        emit(cg, "    mov rdi, rax\n");
-        if (is_str)
-            emit_call(cg, "hsu_print_cstr@PLT");
+    case IR_NEG:
+    case IR_NOT: {
+        uint8_t d = target(cg, ref);
+        load_value(cg, d, in->a);
+        if (in->op == IR_NEG)
+            inst1(cg, A_NEG, asm_reg(d));
         else
-            emit_call(cg, "hsu_print_int@PLT");
+            inst(cg, A_XOR, asm_reg32(d), asm_imm(1));
+        define(cg, ref, d);
         break;
     }
-    case NK_ExprStmt:
-        gen_expr(cg, node->left);
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+        gen_arith(cg, ref, in);
         break;
-    case NK_ExitStmt:
-        emit_exit(cg, node, has_exit);
+    case IR_DIV:
+    case IR_REM:
+        gen_divide(cg, ref, in);
         break;
-    case NK_IfStmt: {
-        Node *cond = node->children.len > 0 ? node->children.items[0] : NULL;
-        Node *then_block = node->children.len > 1 ? node->children.items[1] : NULL;
-        Node *else_node = node->children.len > 2 ? node->children.items[2] : NULL;
-        int l_else = new_label(cg);
-        int l_end = new_label(cg);
-        if (cond)
-            gen_expr(cg, cond);
-        emit(cg, "    cmp rax, 0\n    je .L%d\n", l_else);
-        if (then_block)
-            emit_node(cg, then_block, has_exit);
-        emit(cg, "    jmp .L%d\n", l_end);
-        emit(cg, ".L%d:\n", l_else);
-        if (else_node)
-            emit_node(cg, else_node, has_exit);
-        emit(cg, ".L%d:\n", l_end);
+    case IR_CONCAT:
+        gen_call(cg, ref, "hsu_concat@PLT", in->a, in->b);
+        define(cg, ref, REG_RAX);
         break;
-    }
-    case NK_WhileStmt: {
-        Node *cond = node->children.len > 0 ? node->children.items[0] : NULL;
-        Node *body = node->children.len > 1 ? node->children.items[1] : NULL;
-        int l_start = new_label(cg);
-        int l_end = new_label(cg);
-        emit(cg, ".L%d:\n", l_start);
-        if (cond) {
-            gen_expr(cg, cond);
-            emit(cg, "    cmp rax, 0\n    je .L%d\n", l_end);
-        }
-        if (body)
-            emit_node(cg, body, has_exit);
-        emit(cg, "    jmp .L%d\n", l_start);
-        emit(cg, ".L%d:\n", l_end);
+    case IR_PRINT:
+        gen_call(cg, ref, ir_inst(fn, in->a)->type == IRT_STR ? "hsu_print_cstr@PLT"
+                                                              : "hsu_print_int@PLT",
+                 in->a, IR_NONE);
         break;
-    }
-    case NK_ForStmt: {
-        Node *init = node->children.len > 0 ? node->children.items[0] : NULL;
-        Node *cond = node->children.len > 1 ? node->children.items[1] : NULL;
-        Node *step = node->children.len > 2 ? node->children.items[2] : NULL;
-        Node *body = node->children.len > 3 ? node->children.items[3] : NULL;
-        scope_push(cg);
-        if (init) {
-            if (init->kind == NK_LetStmt || init->kind == NK_AssignStmt)
-                emit_node(cg, init, has_exit);
-            else
-                gen_expr(cg, init);
+    case IR_EXIT:
+        load_value(cg, REG_RDI, in->a);
+        emit_call(cg, "exit@PLT");
+        break;
+    case IR_RET:
+        for (uint8_t r = 0; r < REG_COUNT; r++) {
+            if (reg_is_callee_saved(r) && (cg->ra.used >> r & 1))
+                inst(cg, A_MOV, asm_reg(r), asm_mem(cg->save_off[r]));
         }
-        int l_start = new_label(cg);
-        int l_end = new_label(cg);
-        emit(cg, ".L%d:\n", l_start);
-        if (cond) {
-            gen_expr(cg, cond);
-            emit(cg, "    cmp rax, 0\n    je .L%d\n", l_end);
+        inst(cg, A_MOV, asm_reg(REG_RSP), asm_reg(REG_RBP));
+        inst1(cg, A_POP, asm_reg(REG_RBP));
+        inst(cg, A_XOR, asm_reg32(REG_RAX), asm_reg32(REG_RAX));
+        inst0(cg, A_RET);
+        break;
+    case IR_JMP:
+        phi_copies(cg, b, blk->succ[0]);
+        jump(cg, blk->succ[0]);
+        break;
+    case IR_BR: {
+        const IrInst *cond = ir_inst(fn, in->a);
+        if (cond->op == IR_CONST) {
+            jump(cg, blk->succ[cond->imm ? 0 : 1]);
+            break;
         }
-        if (body)
-            emit_node(cg, body, has_exit);
-        if (step) {
-            if (step->kind == NK_AssignStmt)
-                emit_node(cg, step, has_exit);
-            else
-                gen_expr(cg, step);
+        AsmCond cc = CC_NE;
+        if (cg->ra.reg[in->a] == REG_FLAGS) {
+            compare(cg, cond);
+            cc = setcc[cond->op];
+        } else if (in_memory(cg, in->a)) {
+            inst(cg, A_CMP, operand(cg, in->a), asm_imm(0));
+        } else {
+            uint8_t r = cg->ra.reg[in->a];
+            inst(cg, A_TEST, asm_reg(r), asm_reg(r));
         }
-        emit(cg, "    jmp .L%d\n", l_start);
-        emit(cg, ".L%d:\n", l_end);
-        scope_pop(cg);
+        asm_emit(&cg->code, A_JCC, cc, asm_label(blk->succ[0]), asm_none(), asm_none());
+        jump(cg, blk->succ[1]);
         break;
     }
     default:
-        fprintf(stderr, "codegen: unsupported node kind %d\n", node->kind);
+        gen_compare(cg, ref, in);
+        break;
+    }
+}
+
+/* Lays out the frame below rbp: frame slots, then a save slot for each
+   callee-saved register the function uses and each caller-saved one kept
+   across a call, then the spill slots. */
+static void layout_frame(Codegen *cg) {
+    const IrFn *fn = cg->fn;
+    uint16_t kept = 0;
+    for (IrRef r = 1; r < fn->insts.len; r++)
+        kept |= cg->ra.saves[r];
+    int off = (int)fn->nslots * 8;
+    for (uint8_t r = 0; r < REG_COUNT; r++) {
+        bool callee = reg_is_callee_saved(r) && (cg->ra.used >> r & 1);
+        cg->save_off[r] = callee || (kept >> r & 1) ? (off += 8) : 0;
+    }
+    cg->spill_base = off;
+    off += 8 * (int)cg->ra.nspills;
+    cg->frame_size = (off + 15) & ~15;
+}
+
+/* Loop tops are aligned to 2^LOOP_ALIGN bytes, so that a short loop body
+   spans as few fetch blocks as possible. */
+#define LOOP_ALIGN 4
+
+/* Whether a jump from later in the layout reaches block `b`: the top of a
+   loop. */
+static bool is_loop_top(const IrFn *fn, uint32_t b) {
+    const IrBlock *blk = ir_block(fn, b);
+    for (size_t i = 0; i < blk->preds.len; i++) {
+        if (blk->preds.items[i] >= b)
+            return true;
+    }
+    return false;
+}
+
+static void gen_fn(Codegen *cg, const IrFn *fn) {
+    cg->fn = fn;
+    size_t nblocks = fn->blocks.len;
+    cg->edge = calloc(nblocks ? nblocks : 1, sizeof(*cg->edge));
+    if (!cg->edge) {
+        perror("codegen");
         exit(1);
     }
+    for (uint32_t b = 0; b < nblocks; b++) {
+        const IrBlock *blk = ir_block(fn, b);
+        for (uint32_t i = 0; i < blk->preds.len; i++)
+            cg->edge[blk->preds.items[i]] = i;
+    }
+    regalloc_run(&cg->ra, fn);
+    layout_frame(cg);
+
+    asm_init(&cg->code, cg->fn_name);
+    inst1(cg, A_LABEL, asm_sym(cg->fn_name));
+    inst1(cg, A_PUSH, asm_reg(REG_RBP));
+    inst(cg, A_MOV, asm_reg(REG_RBP), asm_reg(REG_RSP));
+    if (cg->frame_size)
+        inst(cg, A_SUB, asm_reg(REG_RSP), asm_imm(cg->frame_size));
+    for (uint8_t r = 0; r < REG_COUNT; r++) {
+        if (reg_is_callee_saved(r) && (cg->ra.used >> r & 1))
+            inst(cg, A_MOV, asm_mem(cg->save_off[r]), asm_reg(r));
+    }
+    for (uint32_t b = 0; b < nblocks; b++) {
+        const IrBlock *blk = ir_block(fn, b);
+        if (b)
+            inst(cg, A_LABEL, asm_label(b), is_loop_top(fn, b) ? asm_imm(LOOP_ALIGN) : asm_none());
+        for (size_t i = 0; i < blk->insts.len; i++)
+            gen_inst(cg, b, blk->insts.items[i]);
+    }
+    cg->insts_before += asm_count(&cg->code);
+    peephole_run(&cg->code, cg->peephole);
+    cg->insts_after += asm_count(&cg->code);
+    asm_print(&cg->code, cg->out);
+    asm_free(&cg->code);
+
+    regalloc_free(&cg->ra);
+    stack_free(&cg->moves);
+    free(cg->edge);
+    cg->edge = NULL;
 }
 
-void codegen_program(Codegen *cg, Node *program) {
-    if (!cg || !cg->out) return;
+/* Writes out the string literals of the function just emitted. */
+static void emit_strings(Codegen *cg, const IrFn *fn) {
+    for (size_t i = 0; i < fn->strs.len; i++) {
+        const char *s = fn->strs.items[i];
+        fprintf(cg->out, ".L%s_str%zu: .asciz \"", cg->fn_name, i);
+        for (const char *p = s; *p; p++) {
+            if (*p == '"' || *p == '\\')
+                fprintf(cg->out, "\\%c", *p);
+            else if (*p == '\n')
+                fprintf(cg->out, "\\n");
+            else if (*p == '\t')
+                fprintf(cg->out, "\\t");
+            else if (*p == '\r')
+                fprintf(cg->out, "\\r");
+            else
+                fputc(*p, cg->out);
+        }
+        fprintf(cg->out, "\"\n");
+    }
+}
 
-    /* locate the main function */
-    Node *main_fn = NULL;
-    if (program && program->kind == NK_Program) {
-        for (size_t i = 0; i < program->children.len && !main_fn; i++) {
-            Node *child = program->children.items[i];
-            if (!child) continue;
-            if (child->kind == NK_Block) {
-                for (size_t j = 0; j < child->children.len; j++) {
-                    Node *fn = child->children.items[j];
-                    if (fn && fn->kind == NK_FnDecl && fn->value && strcmp(fn->value, "main") == 0) {
-                        main_fn = fn;
-                        break;
-                    }
-                }
-            } else if (child->kind == NK_FnDecl && child->value && strcmp(child->value, "main") == 0) {
-                main_fn = child;
+typedef STACK(NodeId) FnList;
+
+/* The top-level `fn` declarations, in source order. */
+static void top_level_fns(const Ast *ast, NodeId root, FnList *fns) {
+    const Node *program = root ? ast_node(ast, root) : NULL;
+    if (!program || program->kind != NK_Program) return;
+    for (size_t i = 0; i < program->count; i++) {
+        NodeId child_id = ast_child(ast, program, i);
+        if (!child_id) continue;
+        const Node *child = ast_node(ast, child_id);
+        if (child->kind == NK_Block) {
+            for (size_t j = 0; j < child->count; j++) {
+                NodeId fn = ast_child(ast, child, j);
+                if (fn && ast_node(ast, fn)->kind == NK_FnDecl)
+                    stack_push(fns, fn);
             }
+        } else if (child->kind == NK_FnDecl) {
+            stack_push(fns, child_id);
         }
     }
+}
+
+NodeId codegen_find_main(const Ast *ast, NodeId root) {
+    Atom main_name = intern("main", 4);
+    FnList fns = {0};
+    top_level_fns(ast, root, &fns);
+    NodeId main_fn = NODE_NONE;
+    for (size_t i = 0; i < fns.len && !main_fn; i++) {
+        if (ast_node(ast, fns.items[i])->name == main_name)
+            main_fn = fns.items[i];
+    }
+    stack_free(&fns);
+    return main_fn;
+}
+
+void codegen_program(Codegen *cg, const Ast *ast, NodeId root) {
+    if (!cg || !cg->out) return;
+    cg->ast = ast;
+
+    NodeId main_fn = codegen_find_main(ast, root);
 
     if (!main_fn) {
         fprintf(stderr, "codegen: no main\n");
-        exit(1);
+        error_exit();
     }
 
+    /* Only what main can reach is emitted.  There is no call expression
+       yet, so that is main alone; the other functions are still checked by
+       sem_program.  Lowering can still fail, so nothing is written until
+       the IR is built. */
+    IrFn ir;
+    codegen_ir(&ir, ast, main_fn, cg->unroll);
+#ifndef NDEBUG
+    if (!ir_verify(&ir))
+        error_exit();
+#endif
+    cg->fn_name = ir.name;
+
     emit(cg, ".intel_syntax noprefix\n");
-    static bool externs_emitted = false;
-    if (!externs_emitted) {
-        emit(cg, ".extern hsu_print_int\n");
-        emit(cg, ".extern hsu_print_cstr\n");
-        emit(cg, ".extern hsu_concat\n");
-        emit(cg, ".extern exit\n");
-        externs_emitted = true;
-    }
+    emit(cg, ".extern hsu_print_int\n");
+    emit(cg, ".extern hsu_print_cstr\n");
+    emit(cg, ".extern hsu_concat\n");
+    emit(cg, ".extern exit\n");
     emit(cg, ".text\n");
     emit(cg, ".globl main\n");
-
-    bool has_exit = false;
-    emit_node(cg, main_fn, &has_exit);
-
-    if (cg->strs.len > 0) {
+    gen_fn(cg, &ir);
+    if (ir.strs.len) {
         emit(cg, ".section .rodata\n");
         emit(cg, ".p2align 4\n");
-        for (size_t i = 0; i < cg->strs.len; i++) {
-            const char *s = cg->strs.items[i];
-            emit(cg, ".Lstr%zu: .asciz \"", i);
-            for (const char *p = s; *p; p++) {
-                if (*p == '"' || *p == '\\')
-                    emit(cg, "\\%c", *p);
-                else if (*p == '\n')
-                    emit(cg, "\\n");
-                else if (*p == '\t')
-                    emit(cg, "\\t");
-                else if (*p == '\r')
-                    emit(cg, "\\r");
-                else
-                    emit(cg, "%c", *p);
-            }
-            emit(cg, "\"\n");
-        }
+        emit_strings(cg, &ir);
     }
+    ir_free(&ir);
+    if (cg->stats)
+        fprintf(stderr, "peephole: %zu -> %zu instructions\n",
+                cg->insts_before, cg->insts_after);
 }
-
@@ -0,0 +1,45 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bump allocator for data that lives as long as one compilation.  Objects
+// are never freed one by one; arena_free() drops every block at once.
+
+// Default block size; larger requests get a block of their own.
+#define ARENA_BLOCK (64 << 10)
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t size;
+  // Payload follows, aligned for any object.
+  _Alignas(16) char data[];
+} ArenaBlock;
+
+typedef struct {
+  ArenaBlock *head;  // block being filled
+  char *cur;
+  char *end;
+  size_t used;       // bytes handed out, for statistics
+} Arena;
+
+void arena_init(Arena *arena);
+void arena_free(Arena *arena);
+// Slow path of arena_alloc(): start a new block.
+void *arena_grow(Arena *arena, size_t size);
+// Copy `len` bytes and a terminating NUL into the arena.
+char *arena_strndup(Arena *arena, const char *text, size_t len);
+
+// Allocation is a pointer bump; every object is 16-byte aligned.
+static inline void *arena_alloc(Arena *arena, size_t size) {
+  size = (size + 15) & ~(size_t)15;
+  if ((size_t)(arena->end - arena->cur) < size)
+    return arena_grow(arena, size);
+  void *p = arena->cur;
+  arena->cur += size;
+  arena->used += size;
+  return p;
+}
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef ASM_H
+#define ASM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "stack.h"
+
+// --- x86-64 instructions ---------------------------------------------------
+// Codegen emits each function as a list of AsmInst instead of text.  The
+// peephole pass (peephole.h) rewrites the list, and asm_print() writes it
+// out in Intel syntax.  Registers are numbered as in regalloc.h's Reg.
+
+typedef enum {
+  A_NOP,      // removed instruction
+  A_LABEL,    // a: AO_LABEL for a block, AO_SYM for the function; b: AO_IMM
+              // n to align it to 2^n bytes
+  A_MOV,
+  A_MOVZX,
+  A_LEA,
+  A_ADD,
+  A_SUB,
+  A_IMUL,     // two operands, or three with an immediate c
+  A_IMUL1,    // imul a: rdx:rax = rax * a
+  A_XOR,
+  A_AND,
+  A_SHL,
+  A_SHR,
+  A_SAR,
+  A_NEG,
+  A_CMP,
+  A_TEST,
+  A_SETCC,    // set<cc> a
+  A_JCC,      // j<cc> a
+  A_JMP,
+  A_CALL,
+  A_RET,
+  A_PUSH,
+  A_POP,
+  A_CQO,
+  A_IDIV,
+} AsmOp;
+
+// Condition codes, paired so that cc ^ 1 is the negation of cc.
+typedef enum {
+  CC_E, CC_NE,
+  CC_L, CC_GE,
+  CC_LE, CC_G,
+} AsmCond;
+
+typedef enum {
+  AO_NONE,
+  AO_REG,     // 64-bit register
+  AO_REG32,   // its low 32 bits
+  AO_REG8,    // its low byte
+  AO_IMM,     // AsmInst.imm
+  AO_MEM,     // qword at [rbp - disp]
+  AO_INDEX,   // address [reg + reg*disp], for lea
+  AO_LABEL,   // block disp of the function
+  AO_STR,     // [rip + string literal disp of the function]
+  AO_SYM,     // AsmInst.sym
+} AsmOperandKind;
+
+// One instruction.  It has at most one operand that uses `disp` and at most
+// one that uses `imm` or `sym`.
+typedef struct {
+  uint8_t op;         // AsmOp
+  uint8_t cc;         // AsmCond of A_SETCC and A_JCC
+  uint8_t kind[3];    // AsmOperandKind of operands a, b, c
+  uint8_t reg[3];     // register of an AO_REG* operand
+  int32_t disp;
+  union {
+    int64_t imm;
+    const char *sym;
+  };
+} AsmInst;
+
+// An operand as codegen passes it to asm_emit(), before it is packed into
+// an AsmInst.
+typedef struct {
+  uint8_t kind;       // AsmOperandKind
+  uint8_t reg;
+  int64_t val;        // immediate, offset, block or string
+  const char *sym;
+} AsmArg;
+
+static inline AsmArg asm_none(void) { return (AsmArg){AO_NONE, 0, 0, NULL}; }
+static inline AsmArg asm_reg(uint8_t r) { return (AsmArg){AO_REG, r, 0, NULL}; }
+static inline AsmArg asm_reg32(uint8_t r) { return (AsmArg){AO_REG32, r, 0, NULL}; }
+static inline AsmArg asm_reg8(uint8_t r) { return (AsmArg){AO_REG8, r, 0, NULL}; }
+static inline AsmArg asm_imm(int64_t v) { return (AsmArg){AO_IMM, 0, v, NULL}; }
+static inline AsmArg asm_mem(int off) { return (AsmArg){AO_MEM, 0, off, NULL}; }
+static inline AsmArg asm_index(uint8_t r, int scale) { return (AsmArg){AO_INDEX, r, scale, NULL}; }
+static inline AsmArg asm_label(uint32_t b) { return (AsmArg){AO_LABEL, 0, b, NULL}; }
+static inline AsmArg asm_str(uint32_t s) { return (AsmArg){AO_STR, 0, s, NULL}; }
+static inline AsmArg asm_sym(const char *s) { return (AsmArg){AO_SYM, 0, 0, s}; }
+
+typedef STACK(AsmInst) AsmInsts;
+
+typedef struct {
+  const char *name;   // labels and strings are named after the function
+  AsmInsts insts;
+} AsmFn;
+
+void asm_init(AsmFn *fn, const char *name);
+void asm_free(AsmFn *fn);
+// Append `op` with condition `cc` (0 unless A_SETCC or A_JCC) and up to
+// three operands; unused ones are asm_none().
+void asm_emit(AsmFn *fn, AsmOp op, AsmCond cc, AsmArg a, AsmArg b, AsmArg c);
+// Instructions in `fn`, not counting labels and removed ones.
+size_t asm_count(const AsmFn *fn);
+// Drop the A_NOPs from fn->insts.
+void asm_compact(AsmFn *fn);
+void asm_print(const AsmFn *fn, FILE *out);
+
+#endif // ASM_H
@@ -1,13 +1,27 @@
 #ifndef CODEGEN_H
 #define CODEGEN_H
 
+#include <stdbool.h>
 #include <stdio.h>
+#include "ir.h"
 #include "parser.h"
 
 typedef struct Codegen Codegen;
 
 Codegen *codegen_create(FILE *out);
 void codegen_free(Codegen *cg);
-void codegen_program(Codegen *cg, Node *program);
+// Peephole rules to apply (a PeepRule mask, all by default), and whether
+// codegen_program reports the instruction counts before and after them on
+// stderr.
+void codegen_set_peephole(Codegen *cg, unsigned rules, bool stats);
+// How many times to unroll counted loops (see ir_unroll), or 0 to choose
+// per loop, the default.
+void codegen_set_unroll(Codegen *cg, unsigned factor);
+void codegen_program(Codegen *cg, const Ast *ast, NodeId program);
+// Lower `fn_decl` into `fn` the way codegen_program does before emitting
+// it, unrolling loops by `unroll`; --emit-ir prints the result.
+void codegen_ir(IrFn *fn, const Ast *ast, NodeId fn_decl, unsigned unroll);
+// The `fn main` that codegen_program emits, or NODE_NONE.
+NodeId codegen_find_main(const Ast *ast, NodeId program);
 
 #endif
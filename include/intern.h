@@ -0,0 +1,23 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Identifier interning.  Every distinct identifier maps to one stable atom
+// id for the whole run, so later stages compare integers and keep no
+// copies of names.  Atom 0 is never handed out and means "no name".
+
+typedef uint32_t Atom;
+
+#define ATOM_NONE 0
+
+// Return the atom for the `len` bytes at `text`, adding it if new.
+Atom intern(const char *text, size_t len);
+// NUL-terminated name of an atom; valid until intern_free().
+const char *atom_name(Atom atom);
+// Number of atoms handed out so far (ids are 1..atom_count()).
+size_t atom_count(void);
+void intern_free(void);
+
+#endif
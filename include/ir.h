@@ -0,0 +1,154 @@
+#ifndef IR_H
+#define IR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "parser.h"
+#include "stack.h"
+
+// --- Intermediate representation -------------------------------------------
+// A function lowered from the analysed AST into basic blocks of typed
+// instructions in SSA form.  Every instruction defines at most one value,
+// named by the instruction's index.  ir_build() leaves variables in frame
+// slots, read and written with explicit IR_LOAD and IR_STORE, and
+// ir_promote() (iropt.h) turns them into values.  Codegen lowers the IR to
+// x86-64.
+
+typedef uint32_t IrRef;   // index into IrFn.insts; 0 is "no value"
+
+#define IR_NONE 0
+#define IR_NO_BLOCK UINT32_MAX
+
+typedef enum {
+  IRT_VOID,
+  IRT_INT,
+  IRT_BOOL,
+  IRT_STR,
+} IrType;
+
+typedef enum {
+  IR_NOP,       // removed instruction
+  // values
+  IR_CONST,     // imm; a str constant is 0, for a variable never written
+  IR_STR,       // address of string literal IrFn.strs[imm]
+  IR_LOAD,      // frame slot imm
+  IR_PHI,       // one argument per predecessor, in IrFn.args from imm on
+  IR_NEG,       // -a
+  IR_NOT,       // !a
+  IR_ADD,       // a + b, and likewise down to IR_REM
+  IR_SUB,
+  IR_MUL,
+  IR_DIV,
+  IR_REM,
+  IR_EQ,        // a == b, and likewise down to IR_GE; the result is a bool
+  IR_NE,
+  IR_LT,
+  IR_LE,
+  IR_GT,
+  IR_GE,
+  IR_CONCAT,    // new string a + b (hsu_concat)
+  // effects
+  IR_STORE,     // frame slot imm = a
+  IR_PRINT,     // write(a): hsu_print_cstr for strings, else hsu_print_int
+  // terminators, last in their block
+  IR_JMP,       // to succ[0]
+  IR_BR,        // to succ[0] if a, else to succ[1]
+  IR_EXIT,      // exit(a)
+  IR_RET,       // return 0 from the function
+} IrOp;
+
+typedef struct {
+  uint8_t op;       // IrOp
+  uint8_t type;     // IrType of the value defined, IRT_VOID if none
+  uint32_t block;   // block holding the instruction, IR_NO_BLOCK if removed
+  IrRef a, b;       // operands
+  int64_t imm;      // see IrOp
+} IrInst;
+
+typedef STACK(IrRef) IrRefs;
+typedef STACK(uint32_t) IrBlockList;
+
+// Instructions run in `insts` order: phis first, one terminator last.  A
+// phi's arguments line up with `preds`.
+typedef struct {
+  IrRefs insts;
+  IrBlockList preds;
+  uint32_t succ[2];   // targets of the terminator, IR_NO_BLOCK if unused
+} IrBlock;
+
+typedef struct {
+  const char *name;
+  STACK(IrInst) insts;      // insts.items[0] is a placeholder for IR_NONE
+  STACK(IrBlock) blocks;    // blocks.items[0] is the entry
+  IrRefs args;              // phi arguments
+  STACK(const char *) strs; // string literals, deduplicated
+  uint32_t nslots;          // frame slots are numbered 1..nslots
+} IrFn;
+
+// Lower the body of `fn_decl` into `fn`.  Nested functions are skipped;
+// they are not emitted.  Ends in error_exit() on a node it cannot lower.
+void ir_build(IrFn *fn, const Ast *ast, NodeId fn_decl);
+void ir_free(IrFn *fn);
+
+static inline IrInst *ir_inst(const IrFn *fn, IrRef ref) {
+  return &fn->insts.items[ref];
+}
+
+static inline IrBlock *ir_block(const IrFn *fn, uint32_t b) {
+  return &fn->blocks.items[b];
+}
+
+static inline bool ir_is_terminator(uint8_t op) {
+  return op >= IR_JMP;
+}
+
+// The terminator of block `b`, or IR_NONE while the block is open.
+IrRef ir_terminator(const IrFn *fn, uint32_t b);
+
+// Append an empty block and return its index.
+uint32_t ir_new_block(IrFn *fn);
+// Append `inst` to block `b` and return its value.
+IrRef ir_append(IrFn *fn, uint32_t b, IrInst inst);
+// Insert `inst` at index `at` of block `b` and return its value.
+IrRef ir_insert(IrFn *fn, uint32_t b, size_t at, IrInst inst);
+// Add a phi of `type` after the phis of block `b`, with every argument
+// IR_NONE for the caller to fill in.
+IrRef ir_add_phi(IrFn *fn, uint32_t b, uint8_t type);
+// Take the instructions turned into IR_NOP out of their blocks.
+void ir_compact(IrFn *fn);
+// Renumber the blocks so that order[i] becomes block i.  Blocks missing
+// from `order` must have no edges left from the blocks kept, and are
+// dropped with their instructions.
+void ir_reorder(IrFn *fn, const uint32_t *order, size_t count);
+// Give every edge from a block with two successors into a block with phis
+// a block of its own, so phi copies have a place to go.
+void ir_split_edges(IrFn *fn);
+
+// Dominator tree of the blocks reachable from the entry.
+typedef struct {
+  uint32_t *idom;       // immediate dominator; the entry's is itself,
+                        // IR_NO_BLOCK for unreachable blocks
+  uint32_t *pre, *post; // dominator tree numbering, for ir_dominates()
+} IrDom;
+
+void ir_dom_build(IrDom *dom, const IrFn *fn);
+void ir_dom_free(IrDom *dom);
+// Whether block `a` dominates block `b`; both must be reachable.
+static inline bool ir_dominates(const IrDom *dom, uint32_t a, uint32_t b) {
+  return dom->pre[a] <= dom->pre[b] && dom->post[b] <= dom->post[a];
+}
+
+// Check the structural and SSA invariants of `fn`: every block ends in one
+// terminator and is reachable, edges and predecessor lists agree, phis come
+// first and have one argument per predecessor, operands are typed as their
+// operator requires, each frame slot keeps one type, and every value is
+// defined before each use on all paths.  Prints each problem to stderr and
+// returns false if there was one.
+bool ir_verify(const IrFn *fn);
+
+// Write `fn` as text, one instruction per line.
+void ir_dump(const IrFn *fn, FILE *out);
+
+#endif // IR_H
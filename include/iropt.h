@@ -0,0 +1,31 @@
+#ifndef IROPT_H
+#define IROPT_H
+
+#include "ir.h"
+
+// --- IR optimization -------------------------------------------------------
+// Passes over a verified IrFn.  Each leaves the function verified.
+
+// Promote every frame slot to SSA values: loads become the value last
+// stored on each path, with phis where paths with different values meet,
+// and stores disappear.  Then drop phis that merge a single value and
+// values nothing uses.  Leaves fn->nslots at 0.
+void ir_promote(IrFn *fn);
+
+// Move the values a loop computes the same on every iteration to the block
+// that enters it.  Only values without effects that cannot trap move: a
+// loop that runs no iterations now computes them once.
+void ir_hoist(IrFn *fn);
+
+// Replace the body of each counted loop that only sums up values with the
+// values it leaves after its last iteration, computed from its trip count.
+// Runs after ir_hoist().
+void ir_close_loops(IrFn *fn);
+
+// Copy the body of each innermost counted loop `factor` times, for the
+// iterations that come `factor` at a time, and leave the loop for the rest.
+// A loop that runs at most `factor` times is replaced by the copies.  A
+// factor of 0 is chosen from each body's size, and 1 unrolls nothing.
+void ir_unroll(IrFn *fn, unsigned factor);
+
+#endif // IROPT_H
@@ -1,8 +1,14 @@
 #ifndef LEXER_H_
 #define LEXER_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include "arena.h"
+#include "intern.h"
+
 typedef enum {
   BEGINNING,
 
@@ -60,17 +66,134 @@ typedef enum {
   END_OF_TOKENS,
 } TokenType;
 
+// Bytes read per refill of a chunked source.
+#ifndef SOURCE_CHUNK
+#define SOURCE_CHUNK (1 << 20)
+#endif
+
+// Tokens lexed per refill of a token stream.
+#define TS_BATCH 1024
+
+// lexer() gives each thread at least this many bytes of input.
+#ifndef LEX_MIN_CHUNK
+#define LEX_MIN_CHUNK (4 << 20)
+#endif
+#define LEX_MAX_THREADS 64
+
+// Source text of one input file.  Regular files are mmap'd read-only and
+// complete from the start.  Other inputs are read SOURCE_CHUNK bytes at a
+// time into a window holding bytes [base, base + len) of the input.
+typedef struct {
+  const char *data;
+  size_t base;
+  size_t len;
+  size_t released;   // mapped: bytes before this offset were given back
+  size_t cap;        // chunked: allocated size of the window
+  int fd;            // chunked: descriptor still being read, else -1
+  bool mapped;
+  bool eof;          // the window reaches the end of the input
+} Source;
+
+// Unpacked view of one token: a span into its Source.  `start` is an
+// absolute offset in the input.  STRING spans exclude the quotes.
 typedef struct {
   TokenType type;
-  char *value;
+  uint32_t len;
+  size_t start;
   size_t line_num;
 } Token;
 
-void print_token(Token token);
-Token *generate_number(char *current, int *current_index);
-Token *generate_keyword(char *current, int *current_index);
-Token *generate_separator_or_operator(char *current, int *current_index, TokenType type);
-Token *generate_separator_or_operator(char *current, int *current_index, TokenType type);
-Token *lexer(FILE *file);
+// Consecutive tokens from `first` on share one source line.
+typedef struct {
+  uint32_t first;
+  uint32_t line;     // relative to line_base
+} LineRun;
+
+// Packed token storage.  A token is one kind byte and a 32-bit offset from
+// `base`; lines are run-length encoded since most lines hold several tokens.
+// Lengths are not stored: token_length() rescans the lexeme when a later
+// stage asks for its text.
+typedef struct {
+  uint8_t *kind;
+  uint32_t *off;
+  LineRun *lines;
+  size_t len;
+  size_t cap;
+  size_t nlines;
+  size_t lines_cap;
+  size_t base;       // absolute offset that off[] is relative to
+  size_t line_base;
+} TokenBuf;
+
+// Lexer state for one input.  Several lexers may run at once.
+typedef struct {
+  const Source *src;
+  size_t pos;        // absolute offset of the next byte to lex
+  size_t line;
+} Lexer;
+
+// Pull-based token stream consumed by the parser.  Tokens are lexed
+// TS_BATCH at a time as the parser asks for them and stay alive until
+// ts_retire(), so memory is bounded by the longest stretch of input between
+// two retire points rather than by the whole file.  After ts_lex_ahead()
+// the whole input is in buf and ts_retire() only releases source text.
+typedef struct {
+  Source *src;
+  Lexer lx;
+  TokenBuf buf;
+  size_t pos;        // index of the current token in buf
+  bool ahead;        // buf holds every token, see ts_lex_ahead
+} TokenStream;
+
+// "-" opens standard input.
+int source_open(Source *src, const char *path);
+// Read the next chunk, discarding text before absolute offset keep_from.
+int source_refill(Source *src, size_t keep_from);
+// Hint that text before absolute offset `upto` will not be read again.
+void source_release(Source *src, size_t upto);
+void source_close(Source *src);
+
+const char *token_text(const Source *src, const Token *tok);
+size_t token_length(const Source *src, TokenType type, size_t start);
+void print_token(const Source *src, Token token);
+
+void tokbuf_init(TokenBuf *buf);
+void tokbuf_free(TokenBuf *buf);
+size_t tokbuf_line(const TokenBuf *buf, size_t i);
+Token tokbuf_get(const TokenBuf *buf, const Source *src, size_t i);
+
+static inline size_t tokbuf_start(const TokenBuf *buf, size_t i) {
+  return buf->base + buf->off[i];
+}
+
+void lexer_init(Lexer *lx, const Source *src);
+// Append up to `max` tokens to `buf`, ending with END_OF_TOKENS once the
+// input is exhausted.  Returns 0 when the source window needs a refill.
+size_t lexer_next(Lexer *lx, TokenBuf *buf, size_t max);
+// Lex the whole input into `buf`, ending in END_OF_TOKENS.  Large inputs
+// are split into chunks lexed on lexer_threads() threads.
+void lexer(Source *src, TokenBuf *buf);
+// Thread count for lexer(): HSC_LEX_THREADS if set, else the online CPUs.
+size_t lexer_threads(void);
+
+// Name of the scanning kernel set in use ("scalar", "sse2" or "avx2").
+const char *lexer_scan_kernel(void);
+
+void ts_init(TokenStream *ts, Source *src);
+void ts_free(TokenStream *ts);
+// Lex a large mapped input in full with lexer() before parsing starts, so
+// it is lexed on lexer_threads() threads instead of on demand.  Does
+// nothing for inputs under two LEX_MIN_CHUNKs, streamed inputs, or a single
+// lexer thread.  Call right after ts_init().
+void ts_lex_ahead(TokenStream *ts);
+// Make token ts->pos available, lexing more input if needed.
+void ts_fill(TokenStream *ts);
+// Drop tokens before the current one and release their source text.
+void ts_retire(TokenStream *ts);
+size_t ts_line(const TokenStream *ts, size_t i);
+// Copy the lexeme of token i into `arena`.
+char *ts_strdup(const TokenStream *ts, size_t i, Arena *arena);
+// Intern the lexeme of token i.
+Atom ts_atom(const TokenStream *ts, size_t i);
 
 #endif
@@ -0,0 +1,20 @@
+#ifndef OPT_H
+#define OPT_H
+
+#include "parser.h"
+
+// --- Optimization ----------------------------------------------------------
+// Rewrites the analysed AST in place between sem_program() and
+// codegen_program().  Nodes keep their ids and types; a folded expression
+// becomes a literal node, so codegen needs no knowledge of the passes.
+
+// Fold constant integer, boolean and string expressions, and replace uses
+// of a `let` that is never written again by its constant initializer.
+// Then drop dead code: branches whose condition is constant, statements
+// after one that never completes (flagged NF_EXITS) and empty blocks.
+// Last, drop stores to variables that are never read afterwards, drop
+// unused lets and renumber the remaining frame slots densely.
+// Only the functions codegen emits are rewritten.
+void opt_program(Ast *ast, NodeId root);
+
+#endif // OPT_H
@@ -3,6 +3,7 @@
 
 
 #include <stdbool.h>
+#include "arena.h"
 #include "lexer.h"
 
 // Kinds of AST nodes that may appear in the syntax tree.
@@ -27,41 +28,120 @@ typedef enum {
   NK_Identifier,
 } NodeKind;
 
-// Forward declarations
-struct Node;
-typedef struct Type Type;
+// Nodes are addressed by 32-bit index into an Ast pool; index 0 is never
+// a real node and stands for "no node".
+typedef uint32_t NodeId;
 
-// Simple growable array used for storing block children.  It mirrors a
-// small subset of functionality of more feature rich vector types.
+#define NODE_NONE 0
+
+// Node flags.
+#define NF_POSTFIX 0x01    // ++/-- appears in postfix form
+#define NF_EXITS   0x02    // statement never completes (set by opt_program)
+
+// A 16-byte AST node.  Which fields are live depends on the kind:
+//   Unary, ExprStmt, WriteStmt, ExitStmt   left
+//   Binary, Assign, AssignStmt             op, left, right
+//   LetStmt                                name, right (initializer), slot
+//   Identifier                             name, slot
+//   Int, String, Bool                      lit (index into Ast.lits)
+//   Program, Block, If, While, For, FnDecl children first..first+count in
+//                                          Ast.kids; FnDecl also has name
+// For statements keep all four children (init, cond, step, body), any of
+// which may be NODE_NONE.  `slot` is the variable's frame slot, filled in
+// by analysis (0 before).
 typedef struct {
-  struct Node **items;
+  uint8_t kind;      // NodeKind
+  uint8_t op;        // operator TokenType
+  uint8_t flags;
+  uint8_t ty;        // inferred TypeKind + 1, or 0 before analysis
+  union {
+    NodeId left;
+    uint32_t first;
+    uint32_t lit;
+    uint32_t slot;
+  };
+  union {
+    NodeId right;
+    uint32_t count;
+  };
+  Atom name;
+} Node;
+
+// Pool owning one program's nodes.  Children lists are stored contiguously
+// in `kids`; literal lexemes are copied into `strings`.
+typedef struct {
+  Node *nodes;
   size_t len;
   size_t cap;
-} Vec;
-
-// Representation for a single AST node.  Besides the previous value
-// and left/right pointers the node now stores its kind, an optional
-// operator token and a dynamic array of children for block like nodes.
-typedef struct Node {
-  NodeKind kind;     // What sort of AST node this is
-  TokenType type;    // Original token type (for literals)
-  TokenType op;      // Operator token for binary expressions
-  char *value;       // Literal lexeme if applicable
-  struct Node *right;
-  struct Node *left;
-  Vec children;      // Used when this node represents a block
-  bool postfix;      // true if ++/-- appears in postfix form
-  Type *ty;          // Inferred semantic type
-} Node;
+  NodeId *kids;
+  size_t nkids;
+  size_t kids_cap;
+  const char **lits;
+  size_t nlits;
+  size_t lits_cap;
+  Arena strings;
+} Ast;
+
+void ast_init(Ast *ast);
+// Release every node, child list and lexeme at once.
+void ast_free(Ast *ast);
+// Append a list node of `kind` whose children are a copy of `kids`.
+NodeId ast_list(Ast *ast, NodeKind kind, const NodeId *kids, size_t count);
+// Copy `len` bytes of `text` into the pool as a new literal lexeme and
+// return its index, for nodes rewritten into literals after parsing.
+uint32_t ast_add_lit(Ast *ast, const char *text, size_t len);
+
+static inline Node *ast_node(const Ast *ast, NodeId id) {
+  return &ast->nodes[id];
+}
+
+// The i-th child of a list node, or NODE_NONE past the end.
+static inline NodeId ast_child(const Ast *ast, const Node *node, size_t i) {
+  return i < node->count ? ast->kids[node->first + i] : NODE_NONE;
+}
+
+static inline const char *ast_lit(const Ast *ast, const Node *node) {
+  return ast->lits[node->lit];
+}
+
+static inline bool node_is_list(uint8_t kind) {
+  switch (kind) {
+  case NK_Program: case NK_Block: case NK_FnDecl:
+  case NK_IfStmt: case NK_WhileStmt: case NK_ForStmt:
+    return true;
+  default:
+    return false;
+  }
+}
+
+static inline bool node_is_literal(uint8_t kind) {
+  return kind == NK_Int || kind == NK_String || kind == NK_Bool;
+}
+
+static inline bool node_has_left(uint8_t kind) {
+  switch (kind) {
+  case NK_Unary: case NK_ExprStmt: case NK_WriteStmt: case NK_ExitStmt:
+  case NK_Binary: case NK_Assign: case NK_AssignStmt:
+    return true;
+  default:
+    return false;
+  }
+}
 
-// Basic initializer for AST nodes.
-Node *init_node(Node *node, const char *value, TokenType type);
-void free_tree(Node *node);
+static inline bool node_has_right(uint8_t kind) {
+  return kind == NK_Binary || kind == NK_Assign || kind == NK_AssignStmt ||
+         kind == NK_LetStmt;
+}
 
-// Returns the identifier name for a node or "<null>" if absent.
-const char *node_name(const Node *node);
+// Returns the identifier name or literal lexeme of a node, or "<null>".
+const char *node_name(const Ast *ast, const Node *node);
 
-Node *parser(Token *tokens);
-void print_tree(Node *node, int indent);
+// Build the AST for `ts` in `ast` and return the NK_Program node.
+NodeId parser(TokenStream *ts, Ast *ast);
+// Parse the top-level statements in tokens [ts->pos, end) into an NK_Block,
+// leaving consumed tokens in place.  Watch mode re-parses one function at a
+// time this way.
+NodeId parse_span(TokenStream *ts, size_t end, Ast *ast);
+void print_tree(const Ast *ast, NodeId node, int indent);
 
 #endif
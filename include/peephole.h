@@ -0,0 +1,28 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdbool.h>
+
+#include "asm.h"
+
+// --- Peephole optimization ---------------------------------------------------
+// Local rewrites of a function's instruction list, each in its own rule so
+// that it can be turned off on its own (hsc --peephole=LIST).
+
+typedef enum {
+  PEEP_MOVES = 1 << 0,  // loads and stores of values already in place
+  PEEP_STACK = 1 << 1,  // push/pop pairs
+  PEEP_JUMPS = 1 << 2,  // jumps to the next label or to a jump; dead code
+  PEEP_FLAGS = 1 << 3,  // test of a setcc result whose flags are still set
+  PEEP_ALL = (1 << 4) - 1,
+} PeepRule;
+
+// Apply the rules in the mask `rules` until none of them changes `fn`, for
+// at most a few rounds.
+void peephole_run(AsmFn *fn, unsigned rules);
+
+// Parse a comma-separated list of rule names ("moves", "stack", "jumps",
+// "flags"), or "all" or "none", into a mask.  False for an unknown name.
+bool peephole_parse(const char *list, unsigned *rules);
+
+#endif // PEEPHOLE_H
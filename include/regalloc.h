@@ -0,0 +1,53 @@
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ir.h"
+
+// --- Register allocation ---------------------------------------------------
+// Linear scan over the live intervals of an IrFn's values.  Each value gets
+// one register or one spill slot for its whole life.  Codegen keeps rax,
+// rdx and r11 for itself; the other registers are handed out.
+
+// x86-64 registers, in encoding order.
+typedef enum {
+  REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+  REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+  REG_COUNT,
+  REG_FLAGS = 0xfe,   // a compare only the branch after it reads
+  REG_NONE = 0xff,
+} Reg;
+
+// Registers a call may clobber, as a mask of 1 << Reg.
+#define REG_CALLER_SAVED                                                  \
+  (1u << REG_RAX | 1u << REG_RCX | 1u << REG_RDX | 1u << REG_RSI |        \
+   1u << REG_RDI | 1u << REG_R8 | 1u << REG_R9 | 1u << REG_R10 |          \
+   1u << REG_R11)
+
+typedef struct {
+  uint8_t *reg;       // per value: its register, REG_FLAGS, or REG_NONE
+  uint32_t *spill;    // per value without a register: its spill slot, from
+                      // 1; 0 for constants, strings and unused values
+  uint32_t nspills;
+  uint16_t used;      // mask of the registers given to any value
+  uint16_t *saves;    // per call instruction: the caller-saved registers
+                      // holding values that live across it
+} RegAlloc;
+
+// Allocate registers for every value of `fn`.  Constants and string
+// addresses get none; codegen rematerializes them where they are used.  A
+// compare read only by the branch right after it gets REG_FLAGS: codegen
+// emits it at the branch, which jumps on its flags.
+// Values live across an hsu_* call prefer callee-saved registers; one
+// left in a caller-saved register is listed in that call's `saves`.
+void regalloc_run(RegAlloc *ra, const IrFn *fn);
+void regalloc_free(RegAlloc *ra);
+
+static inline bool reg_is_callee_saved(uint8_t r) {
+  return r < REG_COUNT && !(REG_CALLER_SAVED >> r & 1) && r != REG_RSP &&
+         r != REG_RBP;
+}
+
+#endif // REGALLOC_H
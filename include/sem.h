@@ -2,6 +2,7 @@
 #define SEM_H
 
 #include "parser.h"
+#include "symtab.h"
 
 // Basic type system used by the semantic analyser
 
@@ -17,28 +18,13 @@ typedef struct Type {
   TypeKind kind;
 } Type;
 
-// Symbol table entry
-typedef struct Binding {
-  char *name;
-  Type *type;
-  struct Binding *next;
-} Binding;
-
-// Lexical scope containing variable bindings
-typedef struct Scope {
-  struct Scope *parent;
-  Binding *bindings;
-} Scope;
-
-// --- Scope utilities -------------------------------------------------------
-Scope *scope_new(Scope *parent);
-Type *scope_lookup(Scope *scope, const char *name);
-int   scope_insert(Scope *scope, const char *name, Type *type);
-
 // --- Semantic analysis -----------------------------------------------------
-Type *sem_expr(Node *node, Scope *scope);
-int   sem_block(Node *block, Scope *scope);
-void  sem_program(Node *root);
+// Analysis types every expression and resolves every variable: identifiers
+// and `let`s carry their frame slot (Node.slot) and type, so codegen does
+// no name lookups.
+Type *sem_expr(Ast *ast, NodeId node, SymTab *scope);
+int   sem_block(Ast *ast, NodeId block, SymTab *scope);
+void  sem_program(Ast *ast, NodeId root);
 
 // Helpers to obtain primitive types
 Type *type_int(void);
@@ -47,4 +33,8 @@ Type *type_bool(void);
 Type *type_void(void);
 Type *type_unknown(void);
 
+// Type recorded on a node by analysis, or NULL if it has none.
+Type *node_type(const Node *node);
+void  node_set_type(Node *node, Type *type);
+
 #endif // SEM_H
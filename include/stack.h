@@ -0,0 +1,33 @@
+#ifndef STACK_H
+#define STACK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Growable stacks of frames for the non-recursive tree walks.  Declare one
+// with STACK(FrameType) s = {0}; and release it with stack_free(&s).
+
+#define STACK(T) struct { T *items; size_t len; size_t cap; }
+
+static inline void *stack_grow(void *items, size_t *cap, size_t size) {
+  *cap = *cap ? *cap * 2 : 64;
+  items = realloc(items, *cap * size);
+  if (!items) {
+    perror("stack");
+    exit(1);
+  }
+  return items;
+}
+
+#define stack_push(s, v)                                                  \
+  do {                                                                    \
+    if ((s)->len == (s)->cap)                                             \
+      (s)->items = stack_grow((s)->items, &(s)->cap, sizeof(*(s)->items)); \
+    (s)->items[(s)->len++] = (v);                                         \
+  } while (0)
+
+#define stack_pop(s) ((s)->items[--(s)->len])
+#define stack_top(s) (&(s)->items[(s)->len - 1])
+#define stack_free(s) (free((s)->items), (s)->items = NULL, (s)->len = (s)->cap = 0)
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "intern.h"
+
+// Scoped symbol table for the analyser.
+// Bindings sit on one stack in declaration order; an open-addressing table
+// keyed by atom points at the innermost binding of each name, and every
+// binding remembers the one it shadows.  Leaving a scope pops its bindings
+// and restores what they shadowed, so lookups never walk enclosing scopes
+// and the storage is reused by the next scope.
+
+typedef struct {
+  Atom name;
+  uint32_t shadowed;  // index + 1 of the binding this one hides, or 0
+  uint32_t value;     // owner's data (sem: the frame slot)
+  uint32_t flags;     // owner's bits (sem: the TypeKind)
+} Sym;
+
+typedef struct {
+  Atom name;
+  uint32_t top;       // index + 1 of the innermost binding, or 0
+} SymSlot;
+
+typedef struct {
+  Sym *syms;
+  size_t len;
+  size_t cap;
+  SymSlot *slots;     // power-of-two sized; a name keeps its slot once used
+  size_t nslots;
+  size_t used;
+  size_t scope;       // index of the first binding of the innermost scope
+} SymTab;
+
+void symtab_init(SymTab *t);
+void symtab_free(SymTab *t);
+// Drop every binding, e.g. after error_exit() abandoned a walk.
+void symtab_reset(SymTab *t);
+
+// Open a scope; pass the result to symtab_leave() to close it again.
+size_t symtab_enter(SymTab *t);
+void symtab_leave(SymTab *t, size_t mark);
+
+// Declare `name` in the innermost scope.  Returns NULL if that scope
+// already has it.  The pointer is valid until the next declaration.
+Sym *symtab_insert(SymTab *t, Atom name);
+// Innermost visible binding of `name`, or NULL.
+Sym *symtab_lookup(SymTab *t, Atom name);
+
+#endif
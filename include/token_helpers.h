@@ -2,39 +2,41 @@
 #define TOKEN_HELPERS_H
 
 #include "lexer.h"
+#include "tools.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-static inline Token *peek(Token **pp) {
-  return *pp;
+// Cursor helpers over a TokenStream.  Tokens are addressed by index into
+// the stream's packed buffer; peek/match/expect pull more input as needed.
+
+static inline TokenType peek(TokenStream *ts) {
+  if (ts->pos >= ts->buf.len)
+    ts_fill(ts);
+  return (TokenType)ts->buf.kind[ts->pos];
 }
 
-static inline Token *next(Token **pp) {
-  (*pp)++;
-  return *pp;
+static inline size_t next(TokenStream *ts) {
+  return ts->pos++;
 }
 
-static inline Token *prev(Token **pp) {
-  (*pp)--;
-  return *pp;
+static inline size_t prev(TokenStream *ts) {
+  return --ts->pos;
 }
 
-static inline bool match(Token **pp, TokenType type) {
-  if ((*pp)->type != type)
+static inline bool match(TokenStream *ts, TokenType type) {
+  if (peek(ts) != type)
     return false;
-  (*pp)++;
+  ts->pos++;
   return true;
 }
 
-static inline Token *expect(Token **pp, TokenType type, const char *msg) {
-  if ((*pp)->type != type) {
-    printf("ERROR: %s on line number: %zu\n", msg, (*pp)->line_num);
-    exit(1);
+static inline size_t expect(TokenStream *ts, TokenType type, const char *msg) {
+  if (peek(ts) != type) {
+    printf("ERROR: %s on line number: %zu\n", msg, ts_line(ts, ts->pos));
+    error_exit();
   }
-  Token *t = *pp;
-  (*pp)++;
-  return t;
+  return ts->pos++;
 }
 
 #endif
@@ -1,7 +1,9 @@
 #ifndef TOOLS_H
 #define TOOLS_H
 
+#include <setjmp.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "lexer.h"
 
 bool is_operator(TokenType token);
@@ -10,4 +12,26 @@ bool is_separator(TokenType token);
 bool is_keyword(TokenType token);
 bool is_literal(TokenType token);
 
+// Diagnostics in the parser, analyser and code generator end in
+// error_exit().  It exits with status 1 unless error_trap is set, in which
+// case it jumps there instead (watch mode survives a bad edit this way).
+// The trap is per thread.
+extern _Thread_local jmp_buf *error_trap;
+_Noreturn void error_exit(void);
+
+// --- parallel tasks ---------------------------------------------------------
+// One unit of work: `worker` (below task_threads()) names the thread running
+// it, so tasks can keep per-thread state; `index` is the task number.
+typedef void (*TaskFn)(void *arg, size_t worker, size_t index);
+
+// Threads run_tasks() uses: HSC_THREADS if set, else the online CPUs.
+size_t task_threads(void);
+// Run every task in [0, count), handing them out in order to up to
+// task_threads() threads; the caller's thread is worker 0.  A task that ends
+// in error_exit() stops later tasks from starting and makes this return
+// false.  Every task numbered below a failed one has still run to the end,
+// so a caller that records diagnostics by index can report the first one
+// the same way for any thread count.
+bool run_tasks(size_t count, TaskFn task, void *arg);
+
 #endif
@@ -0,0 +1,15 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+// Assembles `asm_path` and links the result into `bin_path`; returns 0 on
+// success.  Supplied by the driver, which owns the embedded runtime.
+typedef int (*LinkFn)(const char *asm_path, const char *bin_path);
+
+// Build `path` into `bin_path`, then rebuild it every time the file is
+// written.  Only top-level functions whose tokens changed are re-parsed, and
+// the assembly is regenerated only when `fn main` changed.  Runs until
+// interrupted; returns 1 if watching could not start.
+int watch_file(const char *path, const char *asm_path, const char *bin_path,
+               LinkFn link);
+
+#endif
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+// Names live in fixed-size blocks so atom_name() pointers stay valid as
+// the table grows.  `slots` is an open-addressing table of atom ids.
+#define NAME_BLOCK 65536
+
+typedef struct NameBlock {
+  struct NameBlock *next;
+  size_t used;
+  char data[];
+} NameBlock;
+
+typedef struct {
+  const char *name;
+  uint32_t len;
+  uint32_t hash;
+} AtomInfo;
+
+static AtomInfo *atoms;        // indexed by atom id
+static size_t natoms = 1;      // slot 0 is ATOM_NONE
+static size_t atoms_cap;
+static Atom *slots;
+static size_t slots_cap;       // power of two
+static NameBlock *blocks;
+
+static uint32_t hash_name(const char *text, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)text[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void *xrealloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (!p) {
+    perror("intern");
+    exit(1);
+  }
+  return p;
+}
+
+static const char *store_name(const char *text, size_t len) {
+  if (!blocks || NAME_BLOCK - blocks->used < len + 1) {
+    size_t size = len + 1 > NAME_BLOCK ? len + 1 : NAME_BLOCK;
+    NameBlock *b = xrealloc(NULL, sizeof(NameBlock) + size);
+    b->next = blocks;
+    b->used = 0;
+    blocks = b;
+  }
+  char *s = blocks->data + blocks->used;
+  memcpy(s, text, len);
+  s[len] = '\0';
+  blocks->used += len + 1;
+  return s;
+}
+
+static void grow_slots(void) {
+  size_t cap = slots_cap ? slots_cap * 2 : 1024;
+  Atom *next = calloc(cap, sizeof(*next));
+  if (!next) {
+    perror("intern");
+    exit(1);
+  }
+  for (Atom a = 1; a < natoms; a++) {
+    size_t i = atoms[a].hash & (cap - 1);
+    while (next[i])
+      i = (i + 1) & (cap - 1);
+    next[i] = a;
+  }
+  free(slots);
+  slots = next;
+  slots_cap = cap;
+}
+
+Atom intern(const char *text, size_t len) {
+  if (natoms * 2 >= slots_cap)
+    grow_slots();
+  uint32_t h = hash_name(text, len);
+  size_t i = h & (slots_cap - 1);
+  for (Atom a; (a = slots[i]) != ATOM_NONE; i = (i + 1) & (slots_cap - 1)) {
+    if (atoms[a].hash == h && atoms[a].len == len &&
+        memcmp(atoms[a].name, text, len) == 0)
+      return a;
+  }
+  if (natoms >= atoms_cap) {
+    atoms_cap = atoms_cap ? atoms_cap * 2 : 1024;
+    atoms = xrealloc(atoms, atoms_cap * sizeof(*atoms));
+  }
+  Atom a = (Atom)natoms++;
+  atoms[a].name = store_name(text, len);
+  atoms[a].len = (uint32_t)len;
+  atoms[a].hash = h;
+  slots[i] = a;
+  return a;
+}
+
+const char *atom_name(Atom atom) {
+  return atom != ATOM_NONE && atom < natoms ? atoms[atom].name : NULL;
+}
+
+size_t atom_count(void) {
+  return natoms - 1;
+}
+
+void intern_free(void) {
+  while (blocks) {
+    NameBlock *next = blocks->next;
+    free(blocks);
+    blocks = next;
+  }
+  free(atoms);
+  free(slots);
+  atoms = NULL;
+  slots = NULL;
+  natoms = 1;
+  atoms_cap = slots_cap = 0;
+}
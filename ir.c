@@ -0,0 +1,1277 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ir.h"
+#include "sem.h"
+#include "tools.h"
+
+// --- blocks and instructions -----------------------------------------------
+
+// Most blocks hold a few instructions and have one or two predecessors, so
+// their lists start at 4 entries rather than stack_push's 64.
+#define list_push(s, v)                                                   \
+  do {                                                                    \
+    if ((s)->len == (s)->cap) {                                           \
+      (s)->cap = (s)->cap ? (s)->cap * 2 : 4;                             \
+      (s)->items = realloc((s)->items, (s)->cap * sizeof(*(s)->items));   \
+      if (!(s)->items) {                                                  \
+        perror("ir");                                                     \
+        exit(1);                                                          \
+      }                                                                   \
+    }                                                                     \
+    (s)->items[(s)->len++] = (v);                                         \
+  } while (0)
+
+uint32_t ir_new_block(IrFn *fn) {
+  IrBlock blk = {.succ = {IR_NO_BLOCK, IR_NO_BLOCK}};
+  stack_push(&fn->blocks, blk);
+  return (uint32_t)fn->blocks.len - 1;
+}
+
+IrRef ir_append(IrFn *fn, uint32_t b, IrInst inst) {
+  if (!fn->insts.len)
+    stack_push(&fn->insts, ((IrInst){.block = IR_NO_BLOCK}));
+  inst.block = b;
+  stack_push(&fn->insts, inst);
+  IrRef ref = (IrRef)fn->insts.len - 1;
+  list_push(&ir_block(fn, b)->insts, ref);
+  return ref;
+}
+
+IrRef ir_insert(IrFn *fn, uint32_t b, size_t at, IrInst inst) {
+  IrBlock *blk = ir_block(fn, b);
+  IrRef ref = ir_append(fn, b, inst);
+  memmove(&blk->insts.items[at + 1], &blk->insts.items[at],
+          (blk->insts.len - 1 - at) * sizeof(*blk->insts.items));
+  blk->insts.items[at] = ref;
+  return ref;
+}
+
+IrRef ir_add_phi(IrFn *fn, uint32_t b, uint8_t type) {
+  IrBlock *blk = ir_block(fn, b);
+  size_t at = 0;
+  while (at < blk->insts.len && ir_inst(fn, blk->insts.items[at])->op == IR_PHI)
+    at++;
+  int64_t first = (int64_t)fn->args.len;
+  for (size_t i = 0; i < blk->preds.len; i++)
+    stack_push(&fn->args, IR_NONE);
+  return ir_insert(fn, b, at, (IrInst){.op = IR_PHI, .type = type,
+                                       .imm = first});
+}
+
+void ir_compact(IrFn *fn) {
+  for (size_t b = 0; b < fn->blocks.len; b++) {
+    IrRefs *insts = &ir_block(fn, (uint32_t)b)->insts;
+    size_t keep = 0;
+    for (size_t i = 0; i < insts->len; i++) {
+      if (ir_inst(fn, insts->items[i])->op != IR_NOP)
+        insts->items[keep++] = insts->items[i];
+    }
+    insts->len = keep;
+  }
+}
+
+IrRef ir_terminator(const IrFn *fn, uint32_t b) {
+  const IrBlock *blk = ir_block(fn, b);
+  if (!blk->insts.len)
+    return IR_NONE;
+  IrRef last = blk->insts.items[blk->insts.len - 1];
+  return ir_is_terminator(ir_inst(fn, last)->op) ? last : IR_NONE;
+}
+
+static void add_edge(IrFn *fn, uint32_t from, int i, uint32_t to) {
+  ir_block(fn, from)->succ[i] = to;
+  list_push(&ir_block(fn, to)->preds, from);
+}
+
+static bool has_phis(const IrFn *fn, uint32_t b) {
+  const IrBlock *blk = ir_block(fn, b);
+  return blk->insts.len && ir_inst(fn, blk->insts.items[0])->op == IR_PHI;
+}
+
+void ir_reorder(IrFn *fn, const uint32_t *order, size_t count) {
+  size_t n = fn->blocks.len;
+  uint32_t *map = malloc(n * sizeof(*map));
+  IrBlock *blocks = malloc((count ? count : 1) * sizeof(*blocks));
+  if (!map || !blocks) {
+    perror("ir");
+    exit(1);
+  }
+  for (size_t i = 0; i < n; i++)
+    map[i] = IR_NO_BLOCK;
+  for (size_t i = 0; i < count; i++)
+    map[order[i]] = (uint32_t)i;
+  for (size_t i = 0; i < n; i++) {
+    IrBlock *blk = ir_block(fn, (uint32_t)i);
+    if (map[i] != IR_NO_BLOCK)
+      continue;
+    for (size_t j = 0; j < blk->insts.len; j++) {
+      IrInst *inst = ir_inst(fn, blk->insts.items[j]);
+      inst->op = IR_NOP;
+      inst->block = IR_NO_BLOCK;
+    }
+    stack_free(&blk->insts);
+    stack_free(&blk->preds);
+  }
+  for (size_t i = 0; i < count; i++) {
+    IrBlock blk = fn->blocks.items[order[i]];
+    for (int k = 0; k < 2; k++) {
+      if (blk.succ[k] != IR_NO_BLOCK)
+        blk.succ[k] = map[blk.succ[k]];
+    }
+    for (size_t j = 0; j < blk.preds.len; j++)
+      blk.preds.items[j] = map[blk.preds.items[j]];
+    for (size_t j = 0; j < blk.insts.len; j++)
+      ir_inst(fn, blk.insts.items[j])->block = (uint32_t)i;
+    blocks[i] = blk;
+  }
+  free(fn->blocks.items);
+  fn->blocks.items = blocks;
+  fn->blocks.len = fn->blocks.cap = count;
+  free(map);
+}
+
+void ir_split_edges(IrFn *fn) {
+  size_t n = fn->blocks.len;
+  IrBlockList order = {0};
+  for (uint32_t from = 0; from < n; from++) {
+    stack_push(&order, from);
+    if (ir_block(fn, from)->succ[1] == IR_NO_BLOCK)
+      continue;
+    for (int i = 0; i < 2; i++) {
+      uint32_t to = ir_block(fn, from)->succ[i];
+      if (!has_phis(fn, to))
+        continue;
+      uint32_t mid = ir_new_block(fn);
+      ir_append(fn, mid, (IrInst){.op = IR_JMP});
+      ir_block(fn, mid)->succ[0] = to;
+      list_push(&ir_block(fn, mid)->preds, from);
+      ir_block(fn, from)->succ[i] = mid;
+      // With both edges into `to`, the first one still listed is this one.
+      IrBlock *target = ir_block(fn, to);
+      for (size_t j = 0; j < target->preds.len; j++) {
+        if (target->preds.items[j] == from) {
+          target->preds.items[j] = mid;
+          break;
+        }
+      }
+      stack_push(&order, mid);  // laid out right after the branch
+    }
+  }
+  if (order.len != n)
+    ir_reorder(fn, order.items, order.len);
+  stack_free(&order);
+}
+
+void ir_free(IrFn *fn) {
+  for (size_t i = 0; i < fn->blocks.len; i++) {
+    stack_free(&fn->blocks.items[i].insts);
+    stack_free(&fn->blocks.items[i].preds);
+  }
+  stack_free(&fn->blocks);
+  stack_free(&fn->insts);
+  stack_free(&fn->args);
+  stack_free(&fn->strs);
+  *fn = (IrFn){0};
+}
+
+// --- lowering ---------------------------------------------------------------
+// Statements, expressions and conditions are all lowered on explicit stacks,
+// so blocks nest and elif chains run as deep as the source has them.
+// Blocks are laid out in the order they start receiving code, so a join
+// created before the arms that jump to it still follows them.
+
+// An expression node part-way through lowering; `step` counts the operands
+// already lowered.
+typedef struct {
+  NodeId id;
+  uint8_t step;
+  uint32_t join;    // block after a short-circuit `&&`/`||`
+  IrRef old;        // target of a compound assignment, before it
+} BuildFrame;
+
+// A condition part-way through lowering: branch to `t` if `cond` holds,
+// else to `f`, in block `at` (or the current one if IR_NO_BLOCK).
+typedef struct {
+  NodeId cond;
+  uint32_t t, f, at;
+} CondFrame;
+
+typedef enum { SL_LIST, SL_ARM, SL_ELSE, SL_LOOP } StmtKind;
+
+// A block, if arm or loop part-way through lowering.  `join` is the block
+// after the if or loop; an arm's `other` is its else block and a loop's is
+// its head.
+typedef struct {
+  NodeId id;
+  uint8_t kind;     // StmtKind
+  uint32_t next;    // SL_LIST: statements lowered so far
+  uint32_t join;
+  uint32_t other;
+  uint32_t body;    // SL_LOOP: first block of the body
+} StmtFrame;
+
+typedef struct {
+  IrFn *fn;
+  const Ast *ast;
+  uint32_t cur;             // block being filled, IR_NO_BLOCK after a jump
+  IrBlockList order;        // blocks in layout order
+  STACK(BuildFrame) work;
+  IrRefs vals;              // values of the operands lowered so far
+  STACK(CondFrame) conds;
+  STACK(StmtFrame) stmts;
+} Builder;
+
+static void start(Builder *b, uint32_t blk) {
+  b->cur = blk;
+  stack_push(&b->order, blk);
+}
+
+// Append to the current block.  Code after an `exit` has no block; it gets
+// one of its own, which finish() drops as unreachable.
+static IrRef emit(Builder *b, IrOp op, IrType type, IrRef x, IrRef y,
+                  int64_t imm) {
+  if (b->cur == IR_NO_BLOCK)
+    start(b, ir_new_block(b->fn));
+  return ir_append(b->fn, b->cur, (IrInst){.op = op, .type = type, .a = x,
+                                           .b = y, .imm = imm});
+}
+
+static void jump(Builder *b, uint32_t to) {
+  if (b->cur == IR_NO_BLOCK)
+    return;
+  emit(b, IR_JMP, IRT_VOID, IR_NONE, IR_NONE, 0);
+  add_edge(b->fn, b->cur, 0, to);
+  b->cur = IR_NO_BLOCK;
+}
+
+static void branch(Builder *b, IrRef cond, uint32_t t, uint32_t f) {
+  emit(b, IR_BR, IRT_VOID, cond, IR_NONE, 0);
+  add_edge(b->fn, b->cur, 0, t);
+  add_edge(b->fn, b->cur, 1, f);
+  b->cur = IR_NO_BLOCK;
+}
+
+static IrType ir_type(const Node *node) {
+  Type *t = node_type(node);
+  if (t == type_string())
+    return IRT_STR;
+  if (t == type_bool())
+    return IRT_BOOL;
+  return IRT_INT;
+}
+
+static uint32_t var_slot(Builder *b, const Node *var) {
+  if (!var->slot) {
+    fprintf(stderr, "ir: unknown symbol %s\n", node_name(b->ast, var));
+    error_exit();
+  }
+  if (var->slot > b->fn->nslots)
+    b->fn->nslots = var->slot;
+  return var->slot;
+}
+
+static IrRef load(Builder *b, const Node *var) {
+  return emit(b, IR_LOAD, ir_type(var), IR_NONE, IR_NONE, var_slot(b, var));
+}
+
+static void store(Builder *b, const Node *var, IrRef value) {
+  emit(b, IR_STORE, IRT_VOID, value, IR_NONE, var_slot(b, var));
+}
+
+static IrRef int_const(Builder *b, int64_t v) {
+  return emit(b, IR_CONST, IRT_INT, IR_NONE, IR_NONE, v);
+}
+
+// Integer lexemes up to 2^64 - 1 wrap, as the assembler used to take them.
+static IrRef int_literal(Builder *b, const Node *node) {
+  const char *text = ast_lit(b->ast, node);
+  char *end;
+  errno = 0;
+  long long v = strtoll(text, &end, 10);
+  if (errno == ERANGE && text[0] != '-') {
+    errno = 0;
+    v = (long long)strtoull(text, &end, 10);
+  }
+  if (errno || *end) {
+    fprintf(stderr, "ir: integer literal %s out of range\n", text);
+    error_exit();
+  }
+  return int_const(b, v);
+}
+
+static IrRef string_literal(Builder *b, const Node *node) {
+  IrFn *fn = b->fn;
+  const char *s = ast_lit(b->ast, node);
+  size_t i = 0;
+  while (i < fn->strs.len && strcmp(fn->strs.items[i], s) != 0)
+    i++;
+  if (i == fn->strs.len)
+    stack_push(&fn->strs, s);
+  return emit(b, IR_STR, IRT_STR, IR_NONE, IR_NONE, (int64_t)i);
+}
+
+static IrRef lower_leaf(Builder *b, const Node *node) {
+  switch (node->kind) {
+  case NK_Int:
+    return int_literal(b, node);
+  case NK_Bool:
+    return emit(b, IR_CONST, IRT_BOOL, IR_NONE, IR_NONE,
+                strcmp(ast_lit(b->ast, node), "true") == 0);
+  case NK_String:
+    return string_literal(b, node);
+  case NK_Identifier:
+    return load(b, node);
+  default:
+    fprintf(stderr, "ir: unsupported node kind %d\n", node->kind);
+    error_exit();
+  }
+}
+
+// Unary operator applied to `v`, the value of its operand.
+static IrRef lower_unary(Builder *b, const Node *node, IrRef v) {
+  switch (node->op) {
+  case DASH:
+    return emit(b, IR_NEG, IRT_INT, v, IR_NONE, 0);
+  case NOT:
+    return emit(b, IR_NOT, IRT_BOOL, v, IR_NONE, 0);
+  case PLUS_PLUS:
+  case MINUS_MINUS: {
+    const Node *target = ast_node(b->ast, node->left);
+    if (!node->left || target->kind != NK_Identifier)
+      return v;
+    IrRef one = int_const(b, 1);
+    IrRef next = emit(b, node->op == PLUS_PLUS ? IR_ADD : IR_SUB, IRT_INT, v,
+                      one, 0);
+    store(b, target, next);
+    return node->flags & NF_POSTFIX ? v : next;
+  }
+  default:
+    return v;
+  }
+}
+
+// Store of `v`, the right operand, into an assignment's target.  `old` is
+// the target's value for `+=` and `-=`.
+static IrRef lower_assign(Builder *b, const Node *node, IrRef old, IrRef v) {
+  const Node *target = ast_node(b->ast, node->left);
+  if (!node->left || target->kind != NK_Identifier)
+    return v;
+  if (node->op == PLUS_EQUALS)
+    v = emit(b, IR_ADD, IRT_INT, old, v, 0);
+  else if (node->op == MINUS_EQUALS)
+    v = emit(b, IR_SUB, IRT_INT, old, v, 0);
+  store(b, target, v);
+  return v;
+}
+
+static IrRef lower_binary(Builder *b, const Node *node, IrRef l, IrRef r) {
+  IrOp op;
+  IrType type = IRT_BOOL;
+  switch (node->op) {
+  case PLUS:
+    if (ir_type(node) == IRT_STR)
+      return emit(b, IR_CONCAT, IRT_STR, l, r, 0);
+    op = IR_ADD, type = IRT_INT;
+    break;
+  case DASH: op = IR_SUB, type = IRT_INT; break;
+  case STAR: op = IR_MUL, type = IRT_INT; break;
+  case SLASH: op = IR_DIV, type = IRT_INT; break;
+  case PERCENT: op = IR_REM, type = IRT_INT; break;
+  case EQUALS: op = IR_EQ; break;
+  case NOT_EQUALS: op = IR_NE; break;
+  case LESS: op = IR_LT; break;
+  case LESS_EQUALS: op = IR_LE; break;
+  case GREATER: op = IR_GT; break;
+  case GREATER_EQUALS: op = IR_GE; break;
+  default:
+    fprintf(stderr, "ir: unsupported operator %d\n", node->op);
+    error_exit();
+  }
+  return emit(b, op, type, l, r, 0);
+}
+
+// Lower the expression `root` and return its value.  Operands are lowered
+// through b->work rather than the C stack, like sem_expr.  `&&` and `||`
+// branch around their right operand; a phi picks the left operand's value
+// when it decided the result.
+static IrRef lower_expr(Builder *b, NodeId root) {
+  if (!root)
+    return int_const(b, 0);
+  const Ast *ast = b->ast;
+  size_t base = b->work.len;
+  stack_push(&b->work, ((BuildFrame){.id = root}));
+
+  while (b->work.len > base) {
+    BuildFrame *f = stack_top(&b->work);
+    const Node *node = ast_node(ast, f->id);
+    NodeId operand = NODE_NONE;
+    IrRef v;
+
+    switch (node->kind) {
+    case NK_Unary:
+      if (f->step++ == 0) {
+        operand = node->left;
+        break;
+      }
+      v = stack_pop(&b->vals);
+      b->work.len--;
+      stack_push(&b->vals, lower_unary(b, node, v));
+      break;
+    case NK_Assign:
+      if (f->step++ == 0) {
+        const Node *target = ast_node(ast, node->left);
+        if (node->op != ASSIGNMENT && node->left &&
+            target->kind == NK_Identifier)
+          f->old = load(b, target);
+        operand = node->right;
+        break;
+      }
+      v = stack_pop(&b->vals);
+      b->work.len--;
+      stack_push(&b->vals, lower_assign(b, node, f->old, v));
+      break;
+    case NK_Binary:
+      if (node->op == AND || node->op == OR) {
+        if (f->step == 0) {
+          f->step++;
+          operand = node->left;
+          break;
+        }
+        if (f->step == 1) {
+          f->step++;
+          IrRef l = *stack_top(&b->vals);
+          uint32_t rhs = ir_new_block(b->fn);
+          f->join = ir_new_block(b->fn);
+          if (node->op == AND)
+            branch(b, l, rhs, f->join);
+          else
+            branch(b, l, f->join, rhs);
+          start(b, rhs);
+          operand = node->right;
+          break;
+        }
+        IrRef r = stack_pop(&b->vals);
+        IrRef l = stack_pop(&b->vals);
+        uint32_t join = f->join;
+        b->work.len--;
+        jump(b, join);
+        start(b, join);
+        // The branch added the left operand's edge first.
+        IrFn *fn = b->fn;
+        int64_t at = (int64_t)fn->args.len;
+        stack_push(&fn->args, l);
+        stack_push(&fn->args, r);
+        stack_push(&b->vals, emit(b, IR_PHI, IRT_BOOL, IR_NONE, IR_NONE, at));
+        break;
+      }
+      if (f->step < 2) {
+        operand = f->step++ == 0 ? node->left : node->right;
+        break;
+      }
+      {
+        IrRef r = stack_pop(&b->vals);
+        IrRef l = stack_pop(&b->vals);
+        b->work.len--;
+        stack_push(&b->vals, lower_binary(b, node, l, r));
+      }
+      break;
+    default:
+      b->work.len--;
+      stack_push(&b->vals, lower_leaf(b, node));
+      break;
+    }
+
+    if (operand)
+      stack_push(&b->work, ((BuildFrame){.id = operand}));
+  }
+  return stack_pop(&b->vals);
+}
+
+// Branch to `t` if `cond` holds, else to `f`.  A missing condition holds.
+// `&&`, `||` and `!` become branches rather than values: `a && b` tests b
+// in a block of its own that a branches to, and `!a` swaps the targets.
+// Chains of them are lowered through b->conds, like expressions.
+static void lower_cond(Builder *b, NodeId cond, uint32_t t, uint32_t f) {
+  if (!cond) {
+    jump(b, t);
+    return;
+  }
+  size_t base = b->conds.len;
+  stack_push(&b->conds, ((CondFrame){cond, t, f, IR_NO_BLOCK}));
+  while (b->conds.len > base) {
+    CondFrame c = stack_pop(&b->conds);
+    if (c.at != IR_NO_BLOCK)
+      start(b, c.at);
+    const Node *node = c.cond ? ast_node(b->ast, c.cond) : NULL;
+    if (node && node->kind == NK_Binary && (node->op == AND || node->op == OR)) {
+      uint32_t rhs = ir_new_block(b->fn);
+      stack_push(&b->conds, ((CondFrame){node->right, c.t, c.f, rhs}));
+      if (node->op == AND)
+        stack_push(&b->conds, ((CondFrame){node->left, rhs, c.f, IR_NO_BLOCK}));
+      else
+        stack_push(&b->conds, ((CondFrame){node->left, c.t, rhs, IR_NO_BLOCK}));
+    } else if (node && node->kind == NK_Unary && node->op == NOT) {
+      stack_push(&b->conds, ((CondFrame){node->left, c.f, c.t, IR_NO_BLOCK}));
+    } else {
+      branch(b, lower_expr(b, c.cond), c.t, c.f);
+    }
+  }
+}
+
+static void lower_stmt(Builder *b, NodeId id);
+
+// Start an arm of an if chain that ends in `join`: test its condition and
+// lower its then block, which the arm's frame follows up on.
+static void lower_arm(Builder *b, NodeId arm, uint32_t join) {
+  const Node *node = ast_node(b->ast, arm);
+  NodeId else_node = ast_child(b->ast, node, 2);
+  uint32_t then_b = ir_new_block(b->fn);
+  uint32_t else_b = else_node ? ir_new_block(b->fn) : join;
+  lower_cond(b, ast_child(b->ast, node, 0), then_b, else_b);
+  start(b, then_b);
+  stack_push(&b->stmts, ((StmtFrame){arm, SL_ARM, 0, join, else_b, 0}));
+  lower_stmt(b, ast_child(b->ast, node, 1));
+}
+
+// A `while`, or a `for` with its `init` already lowered: the condition is
+// tested at the head, and `step` runs after the body.  The head is laid out
+// after the body and entered with a jump, so that each iteration ends in
+// the head's one conditional branch back to the body.  This starts the
+// loop; its frame finishes it once the body is lowered.
+static void lower_loop(Builder *b, NodeId loop, NodeId cond, NodeId body) {
+  IrFn *fn = b->fn;
+  uint32_t head = ir_new_block(fn);
+  uint32_t exit_b = ir_new_block(fn);
+  uint32_t body_b = cond ? ir_new_block(fn) : head;
+  jump(b, head);
+  start(b, body_b);
+  stack_push(&b->stmts, ((StmtFrame){loop, SL_LOOP, 0, exit_b, head, body_b}));
+  lower_stmt(b, body);
+}
+
+static void end_loop(Builder *b, const StmtFrame *f) {
+  const Node *node = ast_node(b->ast, f->id);
+  bool is_for = node->kind == NK_ForStmt;
+  NodeId cond = ast_child(b->ast, node, is_for ? 1 : 0);
+  NodeId step = is_for ? ast_child(b->ast, node, 2) : NODE_NONE;
+  if (step) {
+    if (ast_node(b->ast, step)->kind == NK_AssignStmt)
+      lower_stmt(b, step);
+    else
+      lower_expr(b, step);
+  }
+  jump(b, f->other);
+  if (cond) {
+    start(b, f->other);
+    lower_cond(b, cond, f->body, f->join);
+  }
+  start(b, f->join);
+}
+
+// Lower one statement.  A block, if or loop pushes a frame, and lower_body
+// lowers what it contains; everything else is lowered here.
+static void lower_stmt(Builder *b, NodeId id) {
+  if (!id)
+    return;
+  const Ast *ast = b->ast;
+  const Node *node = ast_node(ast, id);
+  switch (node->kind) {
+  case NK_Program:
+  case NK_Block:
+    stack_push(&b->stmts, ((StmtFrame){id, SL_LIST, 0, 0, 0, 0}));
+    break;
+  case NK_FnDecl:
+    break;  // nested functions are not emitted
+  case NK_LetStmt:
+    if (node->right)
+      store(b, node, lower_expr(b, node->right));
+    break;
+  case NK_AssignStmt: {
+    const Node *target = ast_node(ast, node->left);
+    IrRef old = IR_NONE;
+    if (node->op != ASSIGNMENT)
+      old = load(b, target);
+    lower_assign(b, node, old, lower_expr(b, node->right));
+    break;
+  }
+  case NK_ExprStmt:
+    lower_expr(b, node->left);
+    break;
+  case NK_WriteStmt:
+    emit(b, IR_PRINT, IRT_VOID, lower_expr(b, node->left), IR_NONE, 0);
+    break;
+  case NK_ExitStmt:
+    emit(b, IR_EXIT, IRT_VOID, lower_expr(b, node->left), IR_NONE, 0);
+    b->cur = IR_NO_BLOCK;
+    break;
+  case NK_IfStmt:
+    lower_arm(b, id, ir_new_block(b->fn));
+    break;
+  case NK_WhileStmt:
+    lower_loop(b, id, ast_child(ast, node, 0), ast_child(ast, node, 1));
+    break;
+  case NK_ForStmt: {
+    NodeId init = ast_child(ast, node, 0);
+    if (init) {
+      NodeKind kind = ast_node(ast, init)->kind;
+      if (kind == NK_LetStmt || kind == NK_AssignStmt || kind == NK_ExprStmt)
+        lower_stmt(b, init);
+      else
+        lower_expr(b, init);
+    }
+    lower_loop(b, id, ast_child(ast, node, 1), ast_child(ast, node, 3));
+    break;
+  }
+  default:
+    fprintf(stderr, "ir: unsupported node kind %d\n", node->kind);
+    error_exit();
+  }
+}
+
+// Lower `id` and everything nested in it, innermost frame first.  When an
+// arm's then block is done, the chain jumps to its join and goes on with
+// the next arm or the final else.
+static void lower_body(Builder *b, NodeId id) {
+  size_t base = b->stmts.len;
+  lower_stmt(b, id);
+  while (b->stmts.len > base) {
+    StmtFrame *top = stack_top(&b->stmts);
+    if (top->kind == SL_LIST) {
+      const Node *node = ast_node(b->ast, top->id);
+      if (top->next == node->count)
+        b->stmts.len--;
+      else
+        lower_stmt(b, ast_child(b->ast, node, top->next++));
+      continue;
+    }
+    StmtFrame f = stack_pop(&b->stmts);
+    switch (f.kind) {
+    case SL_ARM: {
+      jump(b, f.join);
+      NodeId else_node = ast_child(b->ast, ast_node(b->ast, f.id), 2);
+      if (!else_node) {
+        start(b, f.join);
+        break;
+      }
+      start(b, f.other);
+      if (ast_node(b->ast, else_node)->kind == NK_IfStmt) {
+        lower_arm(b, else_node, f.join);
+      } else {
+        stack_push(&b->stmts, ((StmtFrame){else_node, SL_ELSE, 0, f.join, 0, 0}));
+        lower_stmt(b, else_node);
+      }
+      break;
+    }
+    case SL_ELSE:
+      jump(b, f.join);
+      start(b, f.join);
+      break;
+    case SL_LOOP:
+      end_loop(b, &f);
+      break;
+    }
+  }
+}
+
+// Drop the blocks the entry cannot reach, with their edges and the phi
+// arguments for them, and lay the rest out in b->order.
+static void finish(Builder *b) {
+  IrFn *fn = b->fn;
+  size_t n = fn->blocks.len;
+  uint8_t *seen = calloc(n, 1);
+  IrBlockList todo = {0};
+  if (!seen) {
+    perror("ir");
+    exit(1);
+  }
+  seen[0] = 1;
+  stack_push(&todo, 0);
+  while (todo.len) {
+    const IrBlock *blk = ir_block(fn, stack_pop(&todo));
+    for (int i = 0; i < 2; i++) {
+      uint32_t s = blk->succ[i];
+      if (s != IR_NO_BLOCK && !seen[s]) {
+        seen[s] = 1;
+        stack_push(&todo, s);
+      }
+    }
+  }
+
+  IrBlockList order = {0};
+  for (size_t i = 0; i < b->order.len; i++) {
+    uint32_t x = b->order.items[i];
+    if (seen[x] == 1) {
+      seen[x] = 2;
+      stack_push(&order, x);
+    }
+  }
+  for (size_t i = 0; i < order.len; i++) {
+    IrBlock *blk = ir_block(fn, order.items[i]);
+    size_t keep = 0;
+    for (size_t j = 0; j < blk->preds.len; j++) {
+      if (!seen[blk->preds.items[j]])
+        continue;
+      for (size_t k = 0; k < blk->insts.len; k++) {
+        const IrInst *phi = ir_inst(fn, blk->insts.items[k]);
+        if (phi->op != IR_PHI)
+          break;
+        fn->args.items[phi->imm + keep] = fn->args.items[phi->imm + j];
+      }
+      blk->preds.items[keep++] = blk->preds.items[j];
+    }
+    blk->preds.len = keep;
+  }
+  ir_reorder(fn, order.items, order.len);
+  stack_free(&order);
+  stack_free(&todo);
+  free(seen);
+}
+
+void ir_build(IrFn *fn, const Ast *ast, NodeId fn_decl) {
+  *fn = (IrFn){0};
+  const Node *decl = ast_node(ast, fn_decl);
+  fn->name = node_name(ast, decl);
+  Builder b = {.fn = fn, .ast = ast};
+  start(&b, ir_new_block(fn));
+  lower_body(&b, ast_child(ast, decl, 0));
+  if (b.cur != IR_NO_BLOCK)
+    emit(&b, IR_RET, IRT_VOID, IR_NONE, IR_NONE, 0);
+  finish(&b);
+  stack_free(&b.order);
+  stack_free(&b.work);
+  stack_free(&b.vals);
+  stack_free(&b.conds);
+  stack_free(&b.stmts);
+}
+
+// --- dominators -------------------------------------------------------------
+// Lengauer-Tarjan with path compression, in depth-first numbers (1-based, 0
+// is "none").  The depth-first search and the compression both keep their
+// paths on explicit stacks: an elif chain nests a million blocks deep.
+
+typedef struct {
+  uint32_t *semi, *ancestor, *label;
+  IrBlockList path;
+} DomLinks;
+
+static uint32_t dom_eval(DomLinks *d, uint32_t v) {
+  if (!d->ancestor[v])
+    return v;
+  uint32_t u = v;
+  d->path.len = 0;
+  while (d->ancestor[d->ancestor[u]]) {
+    stack_push(&d->path, u);
+    u = d->ancestor[u];
+  }
+  while (d->path.len) {
+    u = stack_pop(&d->path);
+    uint32_t a = d->ancestor[u];
+    if (d->semi[d->label[a]] < d->semi[d->label[u]])
+      d->label[u] = d->label[a];
+    d->ancestor[u] = d->ancestor[a];
+  }
+  return d->label[v];
+}
+
+static void *dom_alloc(size_t n) {
+  uint32_t *p = calloc(n ? n : 1, sizeof(uint32_t));
+  if (!p) {
+    perror("ir");
+    exit(1);
+  }
+  return p;
+}
+
+void ir_dom_build(IrDom *dom, const IrFn *fn) {
+  size_t n = fn->blocks.len;
+  uint32_t *num = dom_alloc(n);          // block -> number
+  uint32_t *vertex = dom_alloc(n + 1);   // number -> block
+  uint32_t *parent = dom_alloc(n + 1);
+  uint32_t *idom = dom_alloc(n + 1);
+  uint32_t *bucket = dom_alloc(n + 1);   // first vertex with this semi
+  uint32_t *next = dom_alloc(n + 1);     // next vertex in the same bucket
+  DomLinks d = {dom_alloc(n + 1), dom_alloc(n + 1), dom_alloc(n + 1), {0}};
+
+  typedef struct { uint32_t blk; int next; } Visit;
+  STACK(Visit) visits = {0};
+  uint32_t count = 0;
+  if (n) {
+    num[0] = ++count;
+    vertex[count] = 0;
+    stack_push(&visits, ((Visit){0, 0}));
+  }
+  while (visits.len) {
+    Visit *top = stack_top(&visits);
+    if (top->next == 2) {
+      visits.len--;
+      continue;
+    }
+    uint32_t s = ir_block(fn, top->blk)->succ[top->next++];
+    if (s == IR_NO_BLOCK || num[s])
+      continue;
+    num[s] = ++count;
+    vertex[count] = s;
+    parent[count] = num[top->blk];
+    stack_push(&visits, ((Visit){s, 0}));
+  }
+  stack_free(&visits);
+
+  for (uint32_t v = 1; v <= count; v++)
+    d.semi[v] = d.label[v] = v;
+  for (uint32_t w = count; w >= 2; w--) {
+    const IrBlock *blk = ir_block(fn, vertex[w]);
+    for (size_t i = 0; i < blk->preds.len; i++) {
+      uint32_t v = num[blk->preds.items[i]];
+      if (!v)
+        continue;
+      uint32_t u = dom_eval(&d, v);
+      if (d.semi[u] < d.semi[w])
+        d.semi[w] = d.semi[u];
+    }
+    next[w] = bucket[d.semi[w]];
+    bucket[d.semi[w]] = w;
+    uint32_t p = parent[w];
+    d.ancestor[w] = p;
+    for (uint32_t v = bucket[p]; v; v = next[v]) {
+      uint32_t u = dom_eval(&d, v);
+      idom[v] = d.semi[u] < d.semi[v] ? u : p;
+    }
+    bucket[p] = 0;
+  }
+  for (uint32_t w = 2; w <= count; w++) {
+    if (idom[w] != d.semi[w])
+      idom[w] = idom[idom[w]];
+  }
+
+  dom->idom = dom_alloc(n);
+  dom->pre = dom_alloc(n);
+  dom->post = dom_alloc(n);
+  for (size_t i = 0; i < n; i++) {
+    dom->idom[i] = num[i] ? vertex[num[i] == 1 ? 1 : idom[num[i]]]
+                          : IR_NO_BLOCK;
+    dom->pre[i] = dom->post[i] = UINT32_MAX;
+  }
+
+  // Number the tree: children lists as offsets into one array, then a
+  // depth-first walk that stamps each block on the way down and up.
+  uint32_t *first = dom_alloc(count + 2);
+  uint32_t *kids = dom_alloc(count + 1);
+  for (uint32_t w = 2; w <= count; w++)
+    first[idom[w] + 1]++;
+  for (uint32_t v = 1; v <= count; v++)
+    first[v + 1] += first[v];
+  uint32_t *fill = dom_alloc(count + 2);
+  memcpy(fill, first, (count + 2) * sizeof(*fill));
+  for (uint32_t w = 2; w <= count; w++)
+    kids[fill[idom[w]]++] = w;
+  uint32_t clock = 0;
+  STACK(Visit) walk = {0};
+  if (count) {
+    dom->pre[vertex[1]] = clock++;
+    stack_push(&walk, ((Visit){1, 0}));
+  }
+  while (walk.len) {
+    Visit *top = stack_top(&walk);
+    uint32_t v = top->blk;
+    if (first[v] + (uint32_t)top->next == first[v + 1]) {
+      dom->post[vertex[v]] = clock++;
+      walk.len--;
+      continue;
+    }
+    uint32_t w = kids[first[v] + (uint32_t)top->next++];
+    dom->pre[vertex[w]] = clock++;
+    stack_push(&walk, ((Visit){w, 0}));
+  }
+  stack_free(&walk);
+
+  free(first);
+  free(kids);
+  free(fill);
+  free(num);
+  free(vertex);
+  free(parent);
+  free(idom);
+  free(bucket);
+  free(next);
+  free(d.semi);
+  free(d.ancestor);
+  free(d.label);
+  stack_free(&d.path);
+}
+
+void ir_dom_free(IrDom *dom) {
+  free(dom->idom);
+  free(dom->pre);
+  free(dom->post);
+  *dom = (IrDom){0};
+}
+
+// --- verifier ---------------------------------------------------------------
+
+typedef struct {
+  const IrFn *fn;
+  bool ok;
+} Verifier;
+
+static void bad(Verifier *v, uint32_t blk, IrRef ref, const char *fmt, ...) {
+  va_list ap;
+  fprintf(stderr, "ir: %s: b%u", v->fn->name ? v->fn->name : "?", blk);
+  if (ref)
+    fprintf(stderr, ": v%u", ref);
+  fprintf(stderr, ": ");
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+  v->ok = false;
+}
+
+// Whether `x` names a placed instruction that defines a value.
+static bool is_value(const IrFn *fn, IrRef x) {
+  return x && x < fn->insts.len && ir_inst(fn, x)->block != IR_NO_BLOCK &&
+         ir_inst(fn, x)->type != IRT_VOID;
+}
+
+static uint8_t operand_type(const IrFn *fn, IrRef x) {
+  return is_value(fn, x) ? ir_inst(fn, x)->type : IRT_VOID;
+}
+
+// Types the operands of instruction `ref` must have, and its own.
+static void check_types(Verifier *v, uint32_t blk, IrRef ref,
+                        uint8_t *slot_type) {
+  const IrFn *fn = v->fn;
+  const IrInst *in = ir_inst(fn, ref);
+  uint8_t a = operand_type(fn, in->a), b = operand_type(fn, in->b);
+  bool ok = true;
+  switch (in->op) {
+  case IR_CONST:
+    ok = in->type == IRT_INT ||
+         (in->type == IRT_BOOL && (in->imm == 0 || in->imm == 1)) ||
+         (in->type == IRT_STR && in->imm == 0);
+    break;
+  case IR_STR:
+    ok = in->type == IRT_STR && in->imm >= 0 &&
+         (size_t)in->imm < fn->strs.len;
+    break;
+  case IR_LOAD:
+  case IR_STORE: {
+    uint8_t t = in->op == IR_LOAD ? in->type : a;
+    if (in->imm < 1 || in->imm > fn->nslots || t == IRT_VOID) {
+      ok = false;
+      break;
+    }
+    if (!slot_type[in->imm])
+      slot_type[in->imm] = t;
+    if (slot_type[in->imm] != t)
+      bad(v, blk, ref, "slot s%lld holds two types", (long long)in->imm);
+    ok = in->op == IR_LOAD || in->type == IRT_VOID;
+    break;
+  }
+  case IR_PHI:
+    ok = in->type != IRT_VOID;
+    break;
+  case IR_NEG:
+    ok = a == IRT_INT && in->type == IRT_INT;
+    break;
+  case IR_NOT:
+    ok = a == IRT_BOOL && in->type == IRT_BOOL;
+    break;
+  case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_REM:
+    ok = a == IRT_INT && b == IRT_INT && in->type == IRT_INT;
+    break;
+  case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+    ok = a != IRT_VOID && a == b && in->type == IRT_BOOL;
+    break;
+  case IR_CONCAT:
+    ok = a == IRT_STR && b == IRT_STR && in->type == IRT_STR;
+    break;
+  case IR_PRINT:
+    ok = a != IRT_VOID && in->type == IRT_VOID;
+    break;
+  case IR_EXIT:
+    ok = a == IRT_INT;
+    break;
+  case IR_BR:
+    ok = a == IRT_BOOL;
+    break;
+  case IR_JMP:
+  case IR_RET:
+    break;
+  default:
+    bad(v, blk, ref, "unknown op %u", in->op);
+    return;
+  }
+  if (!ok)
+    bad(v, blk, ref, "operand or result of the wrong type");
+}
+
+// Number of operands instruction `in` reads through a and b.
+static int operand_count(const IrInst *in) {
+  switch (in->op) {
+  case IR_NEG: case IR_NOT: case IR_STORE: case IR_PRINT: case IR_EXIT:
+  case IR_BR:
+    return 1;
+  case IR_ADD: case IR_SUB: case IR_MUL: case IR_DIV: case IR_REM:
+  case IR_EQ: case IR_NE: case IR_LT: case IR_LE: case IR_GT: case IR_GE:
+  case IR_CONCAT:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+// Block structure: one terminator, last, with the successors it needs;
+// phis before anything else; each instruction in the block it names.
+static void check_block(Verifier *v, uint32_t b, uint8_t *placed) {
+  const IrFn *fn = v->fn;
+  const IrBlock *blk = ir_block(fn, b);
+  size_t n = fn->blocks.len;
+  if (!blk->insts.len) {
+    bad(v, b, IR_NONE, "empty block");
+    return;
+  }
+  bool body = false;
+  for (size_t i = 0; i < blk->insts.len; i++) {
+    IrRef ref = blk->insts.items[i];
+    if (!ref || ref >= fn->insts.len) {
+      bad(v, b, IR_NONE, "instruction %u out of range", ref);
+      continue;
+    }
+    const IrInst *in = ir_inst(fn, ref);
+    if (placed[ref])
+      bad(v, b, ref, "instruction listed twice");
+    placed[ref] = 1;
+    if (in->block != b)
+      bad(v, b, ref, "instruction claims block b%u", in->block);
+    if (in->op == IR_PHI && body)
+      bad(v, b, ref, "phi after a non-phi");
+    body |= in->op != IR_PHI;
+    bool last = i + 1 == blk->insts.len;
+    if (ir_is_terminator(in->op) != last)
+      bad(v, b, ref, last ? "block does not end in a terminator"
+                          : "terminator before the end of the block");
+  }
+  const IrInst *term = ir_inst(fn, blk->insts.items[blk->insts.len - 1]);
+  int want = term->op == IR_BR ? 2 : term->op == IR_JMP ? 1 : 0;
+  for (int i = 0; i < 2; i++) {
+    uint32_t s = blk->succ[i];
+    if ((s != IR_NO_BLOCK) != (i < want))
+      bad(v, b, IR_NONE, "successor %d does not match the terminator", i);
+    else if (s != IR_NO_BLOCK && s >= n)
+      bad(v, b, IR_NONE, "successor b%u out of range", s);
+  }
+  for (size_t i = 0; i < blk->preds.len; i++) {
+    if (blk->preds.items[i] >= n)
+      bad(v, b, IR_NONE, "predecessor b%u out of range", blk->preds.items[i]);
+  }
+}
+
+// Every edge p -> s appears in s's predecessors as often as p branches to
+// s, and no other predecessors are listed.
+static void check_edges(Verifier *v) {
+  const IrFn *fn = v->fn;
+  size_t n = fn->blocks.len;
+  uint32_t *seen = calloc(n ? n : 1, sizeof(*seen));
+  if (!seen) {
+    perror("ir");
+    exit(1);
+  }
+  size_t edges = 0, listed = 0;
+  for (uint32_t s = 0; s < n; s++) {
+    const IrBlock *blk = ir_block(fn, s);
+    for (int i = 0; i < 2; i++)
+      edges += ir_block(fn, s)->succ[i] != IR_NO_BLOCK;
+    listed += blk->preds.len;
+    for (size_t i = 0; i < blk->preds.len; i++) {
+      if (blk->preds.items[i] < n)
+        seen[blk->preds.items[i]]++;
+    }
+    for (size_t i = 0; i < blk->preds.len; i++) {
+      uint32_t p = blk->preds.items[i];
+      if (p >= n || !seen[p])
+        continue;
+      const IrBlock *pb = ir_block(fn, p);
+      uint32_t out = (pb->succ[0] == s) + (pb->succ[1] == s);
+      if (out != seen[p])
+        bad(v, s, IR_NONE, "b%u is listed %u times but branches here %u",
+            p, seen[p], out);
+      seen[p] = 0;
+    }
+  }
+  if (edges != listed)
+    bad(v, 0, IR_NONE, "%zu edges but %zu predecessors listed", edges, listed);
+  if (n && ir_block(fn, 0)->preds.len)
+    bad(v, 0, IR_NONE, "the entry block has predecessors");
+  free(seen);
+}
+
+bool ir_verify(const IrFn *fn) {
+  Verifier v = {fn, true};
+  size_t n = fn->blocks.len;
+  if (!n) {
+    bad(&v, 0, IR_NONE, "no blocks");
+    return false;
+  }
+  uint8_t *placed = calloc(fn->insts.len + 1, 1);
+  uint32_t *pos = calloc(fn->insts.len + 1, sizeof(*pos));
+  uint8_t *slot_type = calloc((size_t)fn->nslots + 1, 1);
+  if (!placed || !pos || !slot_type) {
+    perror("ir");
+    exit(1);
+  }
+  for (uint32_t b = 0; b < n; b++)
+    check_block(&v, b, placed);
+  for (IrRef r = 1; r < fn->insts.len; r++) {
+    if (!placed[r] && ir_inst(fn, r)->block != IR_NO_BLOCK)
+      bad(&v, ir_inst(fn, r)->block, r, "instruction is in no block");
+  }
+  check_edges(&v);
+  if (!v.ok)
+    goto done;
+
+  IrDom dom;
+  ir_dom_build(&dom, fn);
+  for (uint32_t b = 0; b < n; b++) {
+    if (dom.idom[b] == IR_NO_BLOCK)
+      bad(&v, b, IR_NONE, "unreachable block");
+    const IrBlock *blk = ir_block(fn, b);
+    for (size_t i = 0; i < blk->insts.len; i++)
+      pos[blk->insts.items[i]] = (uint32_t)i;
+  }
+  for (uint32_t b = 0; b < n && v.ok; b++) {
+    const IrBlock *blk = ir_block(fn, b);
+    for (size_t i = 0; i < blk->insts.len; i++) {
+      IrRef ref = blk->insts.items[i];
+      const IrInst *in = ir_inst(fn, ref);
+      check_types(&v, b, ref, slot_type);
+      if (in->op == IR_PHI) {
+        if (in->imm < 0 || (size_t)in->imm + blk->preds.len > fn->args.len) {
+          bad(&v, b, ref, "phi arguments out of range");
+          continue;
+        }
+        for (size_t j = 0; j < blk->preds.len; j++) {
+          IrRef x = fn->args.items[in->imm + j];
+          if (!is_value(fn, x) || ir_inst(fn, x)->type != in->type)
+            bad(&v, b, ref, "phi argument %zu is not a %u value", j, in->type);
+          else if (!ir_dominates(&dom, ir_inst(fn, x)->block,
+                                 blk->preds.items[j]))
+            bad(&v, b, ref, "v%u does not reach the end of b%u", x,
+                blk->preds.items[j]);
+        }
+        continue;
+      }
+      int count = operand_count(in);
+      for (int k = 0; k < count; k++) {
+        IrRef x = k ? in->b : in->a;
+        if (!is_value(fn, x)) {
+          bad(&v, b, ref, "operand %d is not a value", k);
+          continue;
+        }
+        uint32_t d = ir_inst(fn, x)->block;
+        if (d == b ? pos[x] >= i : !ir_dominates(&dom, d, b))
+          bad(&v, b, ref, "v%u is used before it is defined", x);
+      }
+    }
+  }
+  ir_dom_free(&dom);
+
+done:
+  free(placed);
+  free(pos);
+  free(slot_type);
+  return v.ok;
+}
+
+// --- dump -------------------------------------------------------------------
+
+static const char *const op_names[] = {
+  [IR_NOP] = "nop",     [IR_CONST] = "const", [IR_STR] = "str",
+  [IR_LOAD] = "load",   [IR_PHI] = "phi",     [IR_NEG] = "neg",
+  [IR_NOT] = "not",     [IR_ADD] = "add",     [IR_SUB] = "sub",
+  [IR_MUL] = "mul",     [IR_DIV] = "div",     [IR_REM] = "rem",
+  [IR_EQ] = "eq",       [IR_NE] = "ne",       [IR_LT] = "lt",
+  [IR_LE] = "le",       [IR_GT] = "gt",       [IR_GE] = "ge",
+  [IR_CONCAT] = "concat", [IR_STORE] = "store", [IR_PRINT] = "print",
+  [IR_JMP] = "jmp",     [IR_BR] = "br",       [IR_EXIT] = "exit",
+  [IR_RET] = "ret",
+};
+
+static const char *const type_names[] = {
+  [IRT_VOID] = "void", [IRT_INT] = "int", [IRT_BOOL] = "bool",
+  [IRT_STR] = "str",
+};
+
+static void dump_string(const char *s, FILE *out) {
+  fputc('"', out);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(out, "\\%c", *s);
+    else if (*s == '\n')
+      fputs("\\n", out);
+    else if (*s == '\t')
+      fputs("\\t", out);
+    else
+      fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+void ir_dump(const IrFn *fn, FILE *out) {
+  fprintf(out, "fn %s (slots %u)\n", fn->name, fn->nslots);
+  for (uint32_t b = 0; b < fn->blocks.len; b++) {
+    const IrBlock *blk = ir_block(fn, b);
+    fprintf(out, "b%u:", b);
+    if (blk->preds.len) {
+      fprintf(out, "  ; preds");
+      for (size_t i = 0; i < blk->preds.len; i++)
+        fprintf(out, " b%u", blk->preds.items[i]);
+    }
+    fputc('\n', out);
+    for (size_t i = 0; i < blk->insts.len; i++) {
+      IrRef ref = blk->insts.items[i];
+      const IrInst *in = ir_inst(fn, ref);
+      fputs("  ", out);
+      if (in->type != IRT_VOID)
+        fprintf(out, "v%u = %s %s", ref, op_names[in->op],
+                type_names[in->type]);
+      else
+        fputs(op_names[in->op], out);
+      switch (in->op) {
+      case IR_CONST:
+        fprintf(out, " %lld", (long long)in->imm);
+        break;
+      case IR_STR:
+        fputc(' ', out);
+        dump_string(fn->strs.items[in->imm], out);
+        break;
+      case IR_LOAD:
+        fprintf(out, " s%lld", (long long)in->imm);
+        break;
+      case IR_STORE:
+        fprintf(out, " s%lld, v%u", (long long)in->imm, in->a);
+        break;
+      case IR_PHI:
+        for (size_t j = 0; j < blk->preds.len; j++)
+          fprintf(out, "%s[v%u, b%u]", j ? ", " : " ",
+                  fn->args.items[in->imm + j], blk->preds.items[j]);
+        break;
+      case IR_JMP:
+        fprintf(out, " b%u", blk->succ[0]);
+        break;
+      case IR_BR:
+        fprintf(out, " v%u, b%u, b%u", in->a, blk->succ[0], blk->succ[1]);
+        break;
+      default:
+        if (operand_count(in) >= 1)
+          fprintf(out, " v%u", in->a);
+        if (operand_count(in) == 2)
+          fprintf(out, ", v%u", in->b);
+        break;
+      }
+      fputc('\n', out);
+    }
+  }
+}
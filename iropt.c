@@ -0,0 +1,1295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iropt.h"
+
+static void *xcalloc(size_t n, size_t size) {
+  void *p = calloc(n ? n : 1, size);
+  if (!p) {
+    perror("iropt");
+    exit(1);
+  }
+  return p;
+}
+
+// Take instruction `ref` out of the function; ir_compact() drops it from
+// its block's list.
+static void kill(IrFn *fn, IrRef ref) {
+  IrInst *in = ir_inst(fn, ref);
+  in->op = IR_NOP;
+  in->type = IRT_VOID;
+  in->block = IR_NO_BLOCK;
+  in->a = in->b = IR_NONE;
+}
+
+// --- promotion --------------------------------------------------------------
+// The construction of Cytron et al.: a phi for a slot goes at the iterated
+// dominance frontier of the blocks that store to it, then a walk down the
+// dominator tree tracks each slot's current value, rewriting loads to it
+// and filling in the phi arguments of each successor.
+
+typedef STACK(uint32_t) Words;
+
+// Pairs (key, value) bucketed by key: values of key k are
+// vals[first[k]] .. vals[first[k + 1]].
+typedef struct {
+  uint32_t *first, *vals;
+} Buckets;
+
+static Buckets bucket(const Words *keys, const Words *vals, size_t nkeys) {
+  Buckets out = {xcalloc(nkeys + 2, sizeof(uint32_t)),
+                 xcalloc(vals->len, sizeof(uint32_t))};
+  for (size_t i = 0; i < keys->len; i++)
+    out.first[keys->items[i] + 2]++;
+  for (size_t k = 2; k < nkeys + 2; k++)
+    out.first[k] += out.first[k - 1];
+  for (size_t i = 0; i < keys->len; i++)
+    out.vals[out.first[keys->items[i] + 1]++] = vals->items[i];
+  return out;
+}
+
+static void buckets_free(Buckets *b) {
+  free(b->first);
+  free(b->vals);
+}
+
+// Dominance frontiers, after Cooper, Harvey and Kennedy: walk up from each
+// predecessor of a join to the join's immediate dominator.  A block that
+// already has the join in its frontier has had its dominators walked too,
+// so the walk stops there; an elif chain's shared join would otherwise
+// cost a walk up the whole chain per arm.
+static Buckets frontiers(const IrFn *fn, const IrDom *dom) {
+  size_t n = fn->blocks.len;
+  uint32_t *last = xcalloc(n, sizeof(*last));
+  for (size_t b = 0; b < n; b++)
+    last[b] = IR_NO_BLOCK;
+  Words from = {0}, to = {0};
+  for (uint32_t b = 0; b < n; b++) {
+    const IrBlock *blk = ir_block(fn, b);
+    if (blk->preds.len < 2)
+      continue;
+    for (size_t i = 0; i < blk->preds.len; i++) {
+      uint32_t r = blk->preds.items[i];
+      while (r != dom->idom[b] && last[r] != b) {
+        last[r] = b;
+        stack_push(&from, r);
+        stack_push(&to, b);
+        r = dom->idom[r];
+      }
+    }
+  }
+  Buckets df = bucket(&from, &to, n);
+  stack_free(&from);
+  stack_free(&to);
+  free(last);
+  return df;
+}
+
+typedef struct {
+  IrFn *fn;
+  uint32_t nslots;
+  uint8_t *slot_type;   // per slot; 0 if the slot is never loaded
+  uint32_t *slot_of;    // per instruction: the slot a placed phi is for
+  IrRef *repl;          // per instruction: the value that replaces it
+} Promote;
+
+static IrRef resolve(IrRef *repl, IrRef x) {
+  IrRef root = x;
+  while (repl[root])
+    root = repl[root];
+  while (repl[x] && repl[x] != root) {
+    IrRef next = repl[x];
+    repl[x] = root;
+    x = next;
+  }
+  return root;
+}
+
+static void place_phis(Promote *p, const IrDom *dom) {
+  IrFn *fn = p->fn;
+  size_t n = fn->blocks.len;
+  Words slots = {0}, blocks = {0}, phis = {0}, phi_slots = {0};
+  for (uint32_t b = 0; b < n; b++) {
+    const IrBlock *blk = ir_block(fn, b);
+    for (size_t i = 0; i < blk->insts.len; i++) {
+      const IrInst *in = ir_inst(fn, blk->insts.items[i]);
+      if (in->op == IR_LOAD) {
+        p->slot_type[in->imm] = in->type;
+      } else if (in->op == IR_STORE) {
+        stack_push(&slots, (uint32_t)in->imm);
+        stack_push(&blocks, b);
+      }
+    }
+  }
+  Buckets defs = bucket(&slots, &blocks, p->nslots + 1);
+  Buckets df = frontiers(fn, dom);
+  uint32_t *has_phi = xcalloc(n, sizeof(*has_phi));
+  uint32_t *queued = xcalloc(n, sizeof(*queued));
+  Words work = {0};
+  for (uint32_t s = 1; s <= p->nslots; s++) {
+    if (!p->slot_type[s])
+      continue;
+    for (uint32_t i = defs.first[s]; i < defs.first[s + 1]; i++) {
+      uint32_t b = defs.vals[i];
+      if (queued[b] != s) {
+        queued[b] = s;
+        stack_push(&work, b);
+      }
+    }
+    while (work.len) {
+      uint32_t b = stack_pop(&work);
+      for (uint32_t i = df.first[b]; i < df.first[b + 1]; i++) {
+        uint32_t y = df.vals[i];
+        if (has_phi[y] == s)
+          continue;
+        has_phi[y] = s;
+        stack_push(&phis, ir_add_phi(fn, y, p->slot_type[s]));
+        stack_push(&phi_slots, s);
+        if (queued[y] != s) {
+          queued[y] = s;
+          stack_push(&work, y);
+        }
+      }
+    }
+  }
+  p->slot_of = xcalloc(fn->insts.len, sizeof(*p->slot_of));
+  for (size_t i = 0; i < phis.len; i++)
+    p->slot_of[phis.items[i]] = phi_slots.items[i];
+  stack_free(&slots);
+  stack_free(&blocks);
+  stack_free(&phis);
+  stack_free(&phi_slots);
+  stack_free(&work);
+  free(has_phi);
+  free(queued);
+  buckets_free(&defs);
+  buckets_free(&df);
+}
+
+typedef struct {
+  uint32_t slot;
+  IrRef old;
+} Undo;
+
+typedef struct {
+  uint32_t blk;
+  size_t mark;   // undo log length on entry
+} Open;
+
+static void rename_slots(Promote *p, const IrDom *dom) {
+  IrFn *fn = p->fn;
+  size_t n = fn->blocks.len;
+
+  // A slot read before any store reads a zero of its type.
+  IrRef *val = xcalloc(p->nslots + 1, sizeof(*val));
+  for (uint32_t s = 1; s <= p->nslots; s++) {
+    if (p->slot_type[s])
+      val[s] = ir_insert(fn, 0, 0, (IrInst){.op = IR_CONST,
+                                            .type = p->slot_type[s]});
+  }
+  p->repl = xcalloc(fn->insts.len, sizeof(*p->repl));
+
+  // Where each edge lands in its target's predecessor list.
+  uint32_t (*pred_index)[2] = xcalloc(n, sizeof(*pred_index));
+  for (uint32_t b = 0; b < n; b++) {
+    const IrBlock *blk = ir_block(fn, b);
+    for (uint32_t i = 0; i < blk->preds.len; i++) {
+      uint32_t q = blk->preds.items[i];
+      const IrBlock *qb = ir_block(fn, q);
+      bool first = qb->succ[0] == b &&
+                   (qb->succ[1] != b || !pred_index[q][0]);
+      if (first)
+        pred_index[q][0] = i + 1;
+      else
+        pred_index[q][1] = i + 1;
+    }
+  }
+
+  // Visit blocks in dominator tree preorder; the open blocks are the path
+  // from the entry, and leaving one undoes the values it set.
+  uint32_t *by_pre = xcalloc(2 * n, sizeof(*by_pre));
+  for (uint32_t i = 0; i < 2 * n; i++)
+    by_pre[i] = IR_NO_BLOCK;
+  for (uint32_t b = 0; b < n; b++)
+    if (dom->pre[b] != UINT32_MAX)
+      by_pre[dom->pre[b]] = b;
+  STACK(Undo) log = {0};
+  STACK(Open) open = {0};
+  for (uint32_t i = 0; i < 2 * n; i++) {
+    uint32_t b = by_pre[i];
+    if (b == IR_NO_BLOCK)
+      continue;
+    while (open.len && !ir_dominates(dom, stack_top(&open)->blk, b)) {
+      Open o = stack_pop(&open);
+      while (log.len > o.mark) {
+        Undo u = stack_pop(&log);
+        val[u.slot] = u.old;
+      }
+    }
+    stack_push(&open, ((Open){b, log.len}));
+
+    IrBlock *blk = ir_block(fn, b);
+    for (size_t k = 0; k < blk->insts.len; k++) {
+      IrRef ref = blk->insts.items[k];
+      IrInst *in = ir_inst(fn, ref);
+      uint32_t s = in->op == IR_PHI ? p->slot_of[ref]
+                 : in->op == IR_LOAD || in->op == IR_STORE ? (uint32_t)in->imm
+                 : 0;
+      if (!s)
+        continue;
+      if (in->op == IR_LOAD) {
+        p->repl[ref] = val[s];
+        kill(fn, ref);
+        continue;
+      }
+      if (p->slot_type[s]) {
+        stack_push(&log, ((Undo){s, val[s]}));
+        val[s] = in->op == IR_PHI ? ref : in->a;
+      }
+      if (in->op == IR_STORE)
+        kill(fn, ref);
+    }
+    for (int k = 0; k < 2; k++) {
+      uint32_t t = blk->succ[k];
+      if (t == IR_NO_BLOCK)
+        continue;
+      const IrBlock *tb = ir_block(fn, t);
+      uint32_t j = pred_index[b][k] - 1;
+      for (size_t m = 0; m < tb->insts.len; m++) {
+        IrRef ref = tb->insts.items[m];
+        const IrInst *in = ir_inst(fn, ref);
+        if (in->op != IR_PHI)
+          break;
+        if (p->slot_of[ref])
+          fn->args.items[in->imm + j] = val[p->slot_of[ref]];
+      }
+    }
+  }
+  stack_free(&log);
+  stack_free(&open);
+  free(by_pre);
+  free(pred_index);
+  free(val);
+}
+
+// Point every operand and phi argument at what replaced it.
+static void rewrite(IrFn *fn, IrRef *repl) {
+  for (size_t b = 0; b < fn->blocks.len; b++) {
+    const IrBlock *blk = ir_block(fn, (uint32_t)b);
+    for (size_t i = 0; i < blk->insts.len; i++) {
+      IrInst *in = ir_inst(fn, blk->insts.items[i]);
+      if (in->op == IR_NOP)
+        continue;
+      if (in->op == IR_PHI) {
+        for (size_t j = 0; j < blk->preds.len; j++) {
+          IrRef *x = &fn->args.items[in->imm + j];
+          *x = resolve(repl, *x);
+        }
+      }
+      in->a = resolve(repl, in->a);
+      in->b = resolve(repl, in->b);
+    }
+  }
+}
+
+// A phi whose arguments are all one value, or the phi itself, is that
+// value.  Replacing one can make another trivial, so repeat until none is.
+static void drop_trivial_phis(IrFn *fn, IrRef *repl) {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = 0; b < fn->blocks.len; b++) {
+      const IrBlock *blk = ir_block(fn, (uint32_t)b);
+      for (size_t i = 0; i < blk->insts.len; i++) {
+        IrRef ref = blk->insts.items[i];
+        const IrInst *in = ir_inst(fn, ref);
+        if (in->op == IR_NOP)
+          continue;
+        if (in->op != IR_PHI)
+          break;
+        IrRef same = IR_NONE;
+        bool trivial = true;
+        for (size_t j = 0; j < blk->preds.len && trivial; j++) {
+          IrRef x = resolve(repl, fn->args.items[in->imm + j]);
+          if (x == ref || x == same)
+            continue;
+          trivial = !same;
+          same = x;
+        }
+        if (trivial && same) {
+          repl[ref] = same;
+          kill(fn, ref);
+          changed = true;
+        }
+      }
+    }
+  }
+  rewrite(fn, repl);
+}
+
+// --- dead values ------------------------------------------------------------
+
+// Whether an instruction matters only through its value.  Division stays:
+// it can trap.
+static bool is_pure(uint8_t op) {
+  return op != IR_NOP && op != IR_DIV && op != IR_REM && op < IR_STORE;
+}
+
+// Mark what the effects and terminators use, transitively, and drop the
+// rest.  Unlike counting uses, this also drops a loop's dead phi cycles.
+static void drop_dead_values(IrFn *fn) {
+  uint8_t *live = xcalloc(fn->insts.len, 1);
+  Words work = {0};
+  for (size_t b = 0; b < fn->blocks.len; b++) {
+    const IrBlock *blk = ir_block(fn, (uint32_t)b);
+    for (size_t i = 0; i < blk->insts.len; i++) {
+      IrRef ref = blk->insts.items[i];
+      if (!is_pure(ir_inst(fn, ref)->op)) {
+        live[ref] = 1;
+        stack_push(&work, ref);
+      }
+    }
+  }
+  while (work.len) {
+    const IrInst *in = ir_inst(fn, stack_pop(&work));
+    size_t nargs = in->op == IR_PHI ? ir_block(fn, in->block)->preds.len : 0;
+    for (size_t k = 0; k < 2 + nargs; k++) {
+      IrRef x = k == 0 ? in->a : k == 1 ? in->b
+                                        : fn->args.items[in->imm + k - 2];
+      if (x && !live[x]) {
+        live[x] = 1;
+        stack_push(&work, x);
+      }
+    }
+  }
+  for (IrRef r = 1; r < fn->insts.len; r++) {
+    if (!live[r] && ir_inst(fn, r)->block != IR_NO_BLOCK)
+      kill(fn, r);
+  }
+  stack_free(&work);
+  free(live);
+}
+
+// --- loops ------------------------------------------------------------------
+// A loop is the natural loop of its header: the blocks that reach a back
+// edge into it, from a block the header dominates, without passing through
+// the header.  ir_build() enters every loop from one block that ends in a
+// jump to the header, and that block is its preheader.  Headers are taken
+// innermost first, in reverse dominator tree preorder.
+
+typedef STACK(uint64_t) Keys;
+
+static int by_key(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+typedef struct {
+  const IrFn *fn;
+  IrDom dom;
+  uint32_t *by_pre;   // block at each dominator tree number, or IR_NO_BLOCK
+  uint32_t *loop;     // header + 1 of the last loop found to hold the block
+  Words work;
+  Keys body;          // dominator tree number << 32 | block, sorted
+} Loops;
+
+static void loops_init(Loops *lp, const IrFn *fn) {
+  uint32_t n = (uint32_t)fn->blocks.len;
+  *lp = (Loops){.fn = fn};
+  ir_dom_build(&lp->dom, fn);
+  lp->by_pre = xcalloc(2 * n, sizeof(*lp->by_pre));
+  for (uint32_t i = 0; i < 2 * n; i++)
+    lp->by_pre[i] = IR_NO_BLOCK;
+  for (uint32_t b = 0; b < n; b++)
+    if (lp->dom.pre[b] != UINT32_MAX)
+      lp->by_pre[lp->dom.pre[b]] = b;
+  lp->loop = xcalloc(n, sizeof(*lp->loop));
+}
+
+static void loops_free(Loops *lp) {
+  ir_dom_free(&lp->dom);
+  free(lp->by_pre);
+  free(lp->loop);
+  stack_free(&lp->work);
+  stack_free(&lp->body);
+}
+
+// Find the loop headed by `h`: mark its blocks with h + 1 in lp->loop and
+// list them in lp->body in dominator tree order, header first.  Returns
+// its preheader, or IR_NO_BLOCK if `h` heads no loop or has another entry.
+static uint32_t find_loop(Loops *lp, uint32_t h) {
+  const IrFn *fn = lp->fn;
+  const IrBlock *hb = ir_block(fn, h);
+  uint32_t mark = h + 1, pre = IR_NO_BLOCK, entries = 0;
+  lp->loop[h] = mark;
+  lp->work.len = lp->body.len = 0;
+  for (size_t j = 0; j < hb->preds.len; j++) {
+    uint32_t p = hb->preds.items[j];
+    if (ir_dominates(&lp->dom, h, p)) {
+      if (lp->loop[p] != mark) {
+        lp->loop[p] = mark;
+        stack_push(&lp->work, p);
+      }
+    } else {
+      pre = p;
+      entries++;
+    }
+  }
+  if (!lp->work.len || entries != 1 || ir_inst(fn, ir_terminator(fn, pre))->op != IR_JMP)
+    return IR_NO_BLOCK;
+  stack_push(&lp->body, (uint64_t)lp->dom.pre[h] << 32 | h);
+  while (lp->work.len) {
+    uint32_t b = stack_pop(&lp->work);
+    const IrBlock *blk = ir_block(fn, b);
+    stack_push(&lp->body, (uint64_t)lp->dom.pre[b] << 32 | b);
+    for (size_t j = 0; j < blk->preds.len; j++) {
+      uint32_t p = blk->preds.items[j];
+      if (lp->loop[p] != mark) {
+        lp->loop[p] = mark;
+        stack_push(&lp->work, p);
+      }
+    }
+  }
+  qsort(lp->body.items, lp->body.len, sizeof(*lp->body.items), by_key);
+  return pre;
+}
+
+// A loop whose header has two predecessors: its preheader and one latch.
+typedef struct {
+  IrFn *fn;
+  uint32_t head;
+  uint32_t mark;      // Loops.loop of its blocks
+  const uint32_t *loop;
+  size_t entry, latch;  // index of the preheader and the latch among the
+                        // header's predecessors
+} Loop;
+
+static bool outside(const Loop *l, IrRef v) {
+  return l->loop[ir_inst(l->fn, v)->block] != l->mark;
+}
+
+static IrRef phi_arg(const Loop *l, IrRef p, size_t i) {
+  return l->fn->args.items[ir_inst(l->fn, p)->imm + i];
+}
+
+// A test that stays in the loop while `iv` has not reached `bound`,
+// counting up or down by one.
+typedef struct {
+  IrRef iv, bound;
+  uint8_t op;       // the test as `iv op bound`
+  bool up;
+  bool inclusive;   // i <= n or i >= n, rather than i < n, i > n or i != n
+} Counted;
+
+// Whether compare `cmp`, which stays in the loop while true (or while
+// false, for `negate`), is a counted test.
+static bool counted_test(const Loop *l, IrRef cmp, bool negate, Counted *out) {
+  static const uint8_t swapped[] = {
+    [IR_EQ] = IR_EQ, [IR_NE] = IR_NE, [IR_LT] = IR_GT,
+    [IR_LE] = IR_GE, [IR_GT] = IR_LT, [IR_GE] = IR_LE,
+  };
+  static const uint8_t negated[] = {
+    [IR_EQ] = IR_NE, [IR_NE] = IR_EQ, [IR_LT] = IR_GE,
+    [IR_LE] = IR_GT, [IR_GT] = IR_LE, [IR_GE] = IR_LT,
+  };
+  const IrFn *fn = l->fn;
+  const IrInst *in = ir_inst(fn, cmp);
+  uint8_t op = negate ? negated[in->op] : in->op;
+  IrRef iv = in->a, bound = in->b;
+  if (outside(l, iv)) {
+    iv = in->b;
+    bound = in->a;
+    op = swapped[op];
+  }
+  if (ir_inst(fn, iv)->block != l->head || ir_inst(fn, iv)->op != IR_PHI || !outside(l, bound))
+    return false;
+  // The step is the constant 1 or -1.
+  IrRef next = phi_arg(l, iv, l->latch);
+  const IrInst *nx = ir_inst(fn, next);
+  IrRef d = nx->a == iv ? nx->b : nx->a;
+  const IrInst *cd = ir_inst(fn, d);
+  if ((nx->op != IR_ADD && (nx->op != IR_SUB || nx->a != iv)) || cd->op != IR_CONST ||
+      (cd->imm != 1 && cd->imm != -1))
+    return false;
+  out->iv = iv;
+  out->bound = bound;
+  out->op = op;
+  out->up = (cd->imm == 1) == (nx->op == IR_ADD);
+  out->inclusive = op == (out->up ? IR_LE : IR_GE);
+  // i <= n and i >= n never end for the last n; take only other constants.
+  const IrInst *cb = ir_inst(fn, bound);
+  if (out->inclusive)
+    return cb->op == IR_CONST && cb->imm != (out->up ? INT64_MAX : INT64_MIN);
+  return op == IR_NE || op == (out->up ? IR_LT : IR_GT);
+}
+
+// --- loop-invariant code motion --------------------------------------------
+// What leaves an inner loop lands in its preheader, inside the outer loop,
+// and can leave that as well.
+
+// Whether `in` may run where it did not before: it has no effect and
+// cannot trap.  Compares stay by the branch that reads their flags, and
+// concatenation allocates.
+static bool can_hoist(const IrFn *fn, const IrInst *in) {
+  switch (in->op) {
+  case IR_CONST:
+  case IR_STR:
+  case IR_NEG:
+  case IR_NOT:
+  case IR_ADD:
+  case IR_SUB:
+  case IR_MUL:
+    return true;
+  case IR_DIV:
+  case IR_REM: {
+    const IrInst *d = ir_inst(fn, in->b);
+    return d->op == IR_CONST && d->imm != 0 && d->imm != -1;
+  }
+  default:
+    return false;
+  }
+}
+
+void ir_hoist(IrFn *fn) {
+  uint32_t n = (uint32_t)fn->blocks.len;
+  Loops lp;
+  loops_init(&lp, fn);
+  IrRefs hoisted = {0};
+  for (uint32_t i = 2 * n; i-- > 0;) {
+    uint32_t h = lp.by_pre[i];
+    if (h == IR_NO_BLOCK)
+      continue;
+    uint32_t pre = find_loop(&lp, h), mark = h + 1;
+    if (pre == IR_NO_BLOCK)
+      continue;
+
+    // In dominator tree order, each value's operands are placed before it
+    // is looked at.  A value whose operands are all outside the loop moves
+    // to the preheader, and then counts as outside itself.
+    hoisted.len = 0;
+    for (size_t k = 0; k < lp.body.len; k++) {
+      uint32_t b = (uint32_t)lp.body.items[k];
+      const IrBlock *blk = ir_block(fn, b);
+      for (size_t j = 0; j < blk->insts.len; j++) {
+        IrRef ref = blk->insts.items[j];
+        IrInst *in = ir_inst(fn, ref);
+        if (!can_hoist(fn, in) || (in->a && lp.loop[ir_inst(fn, in->a)->block] == mark) ||
+            (in->b && lp.loop[ir_inst(fn, in->b)->block] == mark))
+          continue;
+        in->block = pre;
+        stack_push(&hoisted, ref);
+      }
+    }
+    if (!hoisted.len)
+      continue;
+    for (size_t k = 0; k < lp.body.len; k++) {
+      uint32_t b = (uint32_t)lp.body.items[k];
+      IrBlock *blk = ir_block(fn, b);
+      size_t keep = 0;
+      for (size_t j = 0; j < blk->insts.len; j++) {
+        IrRef ref = blk->insts.items[j];
+        if (ir_inst(fn, ref)->block == b)
+          blk->insts.items[keep++] = ref;
+      }
+      blk->insts.len = keep;
+    }
+    IrBlock *pb = ir_block(fn, pre);
+    IrRef term = stack_pop(&pb->insts);
+    for (size_t k = 0; k < hoisted.len; k++)
+      stack_push(&pb->insts, hoisted.items[k]);
+    stack_push(&pb->insts, term);
+  }
+  stack_free(&hoisted);
+  loops_free(&lp);
+}
+
+// --- closed forms -----------------------------------------------------------
+// A loop whose body is one block without effects does nothing but advance
+// the header's phis, and each phi p must come back as p plus an increment.
+// Where the increment is invariant, p is an induction variable and its
+// value on iteration k is affine in k: base + step * k.  Otherwise the
+// increment must be affine in the induction variables, and p adds up
+// base + step * k over the iterations.  The loop test compares an
+// induction variable with step 1 or -1 against an invariant bound, which
+// gives the trip count t.  The body is replaced by the phis' values after
+// t iterations; its jump back to the header then finds the test false.
+// Runs after ir_hoist(), so invariant values are already outside the loop.
+
+enum {
+  CLOSE_OTHER,
+  CLOSE_AFFINE,       // base + step * k
+  CLOSE_SUM,          // phi `who` + base + step * k
+};
+
+typedef struct {
+  IrFn *fn;
+  Loop l;             // the body is its latch
+  uint32_t body;
+  bool emit;          // build base and step, or only classify
+  uint8_t *kind;      // CLOSE_* of each value in the loop
+  IrRef *who;
+  IrRef *base, *step; // IR_NONE is zero
+  uint8_t *iv;        // phis that are induction variables
+  IrRef *iv_step;
+  IrRefs old;         // the body's instructions before it is replaced
+} Close;
+
+static IrRef constant(Close *c, int64_t v) {
+  return ir_append(c->fn, c->body, (IrInst){.op = IR_CONST, .type = IRT_INT, .imm = v});
+}
+
+static bool is_const(const Close *c, IrRef x, int64_t v) {
+  const IrInst *in = ir_inst(c->fn, x);
+  return x && in->op == IR_CONST && in->imm == v;
+}
+
+// Integer `x op y` appended to the body, or folded when both are
+// constants.  IR_NONE stands for zero in and out.  Only builds anything
+// while c->emit is set.
+static IrRef arith(Close *c, uint8_t op, IrRef x, IrRef y) {
+  IrFn *fn = c->fn;
+  if (!c->emit)
+    return IR_NONE;
+  if (is_const(c, x, 0))
+    x = IR_NONE;
+  if (is_const(c, y, 0))
+    y = IR_NONE;
+  switch (op) {
+  case IR_ADD:
+    if (!x || !y)
+      return x ? x : y;
+    break;
+  case IR_SUB:
+    if (!y)
+      return x;
+    if (!x)
+      return arith(c, IR_NEG, y, IR_NONE);
+    break;
+  case IR_MUL:
+    if (!x || !y)
+      return IR_NONE;
+    if (is_const(c, x, 1) || is_const(c, y, 1))
+      return is_const(c, x, 1) ? y : x;
+    break;
+  default:
+    if (!x)
+      return IR_NONE;
+    break;
+  }
+  const IrInst *cx = ir_inst(fn, x), *cy = ir_inst(fn, y);
+  if (cx->op == IR_CONST && (!y || cy->op == IR_CONST)) {
+    uint64_t u = (uint64_t)cx->imm, v = y ? (uint64_t)cy->imm : 0;
+    int64_t r = 0;
+    switch (op) {
+    case IR_ADD: r = (int64_t)(u + v); break;
+    case IR_SUB: r = (int64_t)(u - v); break;
+    case IR_MUL: r = (int64_t)(u * v); break;
+    case IR_NEG: r = (int64_t)(0 - u); break;
+    case IR_DIV:
+    case IR_REM:
+      if (v == 0 || (cx->imm == INT64_MIN && cy->imm == -1))
+        goto emit;
+      r = op == IR_DIV ? cx->imm / cy->imm : cx->imm % cy->imm;
+      break;
+    }
+    return r ? constant(c, r) : IR_NONE;
+  }
+emit:
+  return ir_append(fn, c->body, (IrInst){.op = op, .type = IRT_INT, .a = x, .b = y});
+}
+
+// Operand `x` of a body value as a kind, phi, base and step.
+static uint8_t operand_form(Close *c, IrRef x, IrRef *who, IrRef *base, IrRef *step) {
+  const IrInst *in = ir_inst(c->fn, x);
+  *who = *base = *step = IR_NONE;
+  if (outside(&c->l, x)) {
+    *base = x;
+    return CLOSE_AFFINE;
+  }
+  if (in->block == c->body) {
+    *who = c->who[x];
+    *base = c->base[x];
+    *step = c->step[x];
+    return c->kind[x];
+  }
+  if (in->op != IR_PHI)
+    return CLOSE_OTHER;
+  if (!c->iv[x]) {
+    *who = x;
+    return CLOSE_SUM;
+  }
+  *base = c->emit ? phi_arg(&c->l, x, c->l.entry) : IR_NONE;
+  *step = c->iv_step[x];
+  return CLOSE_AFFINE;
+}
+
+// Classify the body's values in order, building their base and step when
+// c->emit is set.
+static void walk_body(Close *c) {
+  for (size_t j = 0; j < c->old.len; j++) {
+    IrRef v = c->old.items[j];
+    const IrInst *in = ir_inst(c->fn, v);
+    uint8_t op = in->op, kind = CLOSE_OTHER;
+    IrRef wa = IR_NONE, ba, sa, wb = IR_NONE, bb, sb, a = in->a, b = in->b;
+    uint8_t ka = a ? operand_form(c, a, &wa, &ba, &sa) : CLOSE_OTHER;
+    uint8_t kb = b ? operand_form(c, b, &wb, &bb, &sb) : CLOSE_OTHER;
+    switch (op) {
+    case IR_ADD:
+      if (ka == CLOSE_AFFINE || kb == CLOSE_AFFINE)
+        kind = ka == CLOSE_AFFINE ? kb : ka;
+      break;
+    case IR_SUB:
+      if (kb == CLOSE_AFFINE)
+        kind = ka;
+      break;
+    case IR_NEG:
+      if (ka == CLOSE_AFFINE)
+        kind = ka;
+      break;
+    case IR_MUL:
+      if (ka == CLOSE_AFFINE && kb == CLOSE_AFFINE && (outside(&c->l, a) || outside(&c->l, b)))
+        kind = CLOSE_AFFINE;
+      break;
+    }
+    c->kind[v] = kind;
+    c->who[v] = wa ? wa : wb;
+    if (kind == CLOSE_OTHER || !c->emit)
+      continue;
+    if (op == IR_MUL) {
+      IrRef w = outside(&c->l, a) ? a : b;
+      c->base[v] = arith(c, IR_MUL, w == a ? bb : ba, w);
+      c->step[v] = arith(c, IR_MUL, w == a ? sb : sa, w);
+    } else {
+      c->base[v] = arith(c, op, ba, op == IR_NEG ? IR_NONE : bb);
+      c->step[v] = arith(c, op, sa, op == IR_NEG ? IR_NONE : sb);
+    }
+  }
+}
+
+// Find the induction variables, whose increment the first walk finds
+// invariant, then check that every other phi is a sum.  When building,
+// iv_step holds each one's increment.
+static bool find_sums(Close *c) {
+  const IrBlock *hb = ir_block(c->fn, c->l.head);
+  for (size_t j = 0; j < hb->insts.len; j++)
+    c->iv[hb->insts.items[j]] = 0;
+  walk_body(c);
+  for (size_t j = 0; j < hb->insts.len; j++) {
+    IrRef p = hb->insts.items[j], next;
+    if (ir_inst(c->fn, p)->op != IR_PHI)
+      continue;
+    next = phi_arg(&c->l, p, c->l.latch);
+    if (ir_inst(c->fn, next)->block == c->body && c->kind[next] == CLOSE_SUM &&
+        c->who[next] == p) {
+      c->iv[p] = 1;
+      c->iv_step[p] = c->base[next];
+    }
+  }
+  walk_body(c);
+  for (size_t j = 0; j < hb->insts.len; j++) {
+    IrRef p = hb->insts.items[j], next;
+    if (ir_inst(c->fn, p)->op != IR_PHI || c->iv[p])
+      continue;
+    next = phi_arg(&c->l, p, c->l.latch);
+    if (ir_inst(c->fn, next)->block != c->body || c->kind[next] != CLOSE_SUM ||
+        c->who[next] != p)
+      return false;
+  }
+  return true;
+}
+
+// Whether the body only computes values: anything else could trap or be
+// seen.
+static bool body_is_pure(const Close *c, const IrBlock *blk) {
+  for (size_t j = 0; j + 1 < blk->insts.len; j++) {
+    const IrInst *in = ir_inst(c->fn, blk->insts.items[j]);
+    if (!can_hoist(c->fn, in) && !(in->op >= IR_EQ && in->op <= IR_GE))
+      return false;
+  }
+  return ir_inst(c->fn, ir_terminator(c->fn, c->body))->op == IR_JMP;
+}
+
+static bool close_loop(Close *c) {
+  IrFn *fn = c->fn;
+  const IrBlock *hb = ir_block(fn, c->l.head), *bb = ir_block(fn, c->body);
+  const IrInst *br = ir_inst(fn, ir_terminator(fn, c->l.head));
+  if (hb->preds.len != 2 || br->op != IR_BR || !body_is_pure(c, bb))
+    return false;
+  IrRef cmp = br->a;
+  const IrInst *ci = ir_inst(fn, cmp);
+  if (ci->block != c->l.head || ci->op < IR_EQ || ci->op > IR_GE)
+    return false;
+  for (size_t j = 0; j + 2 < hb->insts.len; j++) {
+    const IrInst *in = ir_inst(fn, hb->insts.items[j]);
+    if (in->op != IR_PHI || in->type != IRT_INT)
+      return false;
+  }
+  c->l.latch = hb->preds.items[0] == c->body ? 0 : 1;
+  c->l.entry = 1 - c->l.latch;
+  c->old.len = 0;
+  for (size_t j = 0; j + 1 < bb->insts.len; j++)
+    stack_push(&c->old, bb->insts.items[j]);
+  Counted test;
+  c->emit = false;
+  if (!find_sums(c) || !counted_test(&c->l, cmp, hb->succ[0] != c->body, &test))
+    return false;
+
+  // Rebuild the body: the increments and affine values, the trip count,
+  // and the value of each phi after the last iteration.
+  IrRef term = ir_terminator(fn, c->body);
+  ir_block(fn, c->body)->insts.len = 0;
+  c->emit = true;
+  find_sums(c);
+  IrRef start = phi_arg(&c->l, test.iv, c->l.entry);
+  IrRef t = test.up ? arith(c, IR_SUB, test.bound, start) : arith(c, IR_SUB, start, test.bound);
+  if (test.inclusive)
+    t = arith(c, IR_ADD, t, constant(c, 1));
+
+  // A sum adds base * t + step * t(t - 1)/2, the last computed as
+  // t/2 * (t - 1) + t%2 * ((t - 1)/2) so that nothing is lost to wrap.
+  IrRef pairs = IR_NONE;
+  hb = ir_block(fn, c->l.head);
+  for (size_t j = 0; j + 2 < hb->insts.len; j++) {
+    IrRef p = hb->insts.items[j];
+    IrRef next = phi_arg(&c->l, p, c->l.latch), last;
+    if (c->iv[p]) {
+      last = arith(c, IR_ADD, phi_arg(&c->l, p, c->l.entry), arith(c, IR_MUL, c->iv_step[p], t));
+    } else {
+      IrRef sum = arith(c, IR_MUL, c->base[next], t);
+      if (c->step[next]) {
+        if (!pairs) {
+          IrRef two = constant(c, 2), t1 = arith(c, IR_SUB, t, constant(c, 1));
+          pairs = arith(c, IR_ADD, arith(c, IR_MUL, arith(c, IR_DIV, t, two), t1),
+                        arith(c, IR_MUL, arith(c, IR_REM, t, two), arith(c, IR_DIV, t1, two)));
+        }
+        sum = arith(c, IR_ADD, sum, arith(c, IR_MUL, c->step[next], pairs));
+      }
+      last = arith(c, IR_ADD, phi_arg(&c->l, p, c->l.entry), sum);
+    }
+    fn->args.items[ir_inst(fn, p)->imm + c->l.latch] = last ? last : constant(c, 0);
+  }
+  for (size_t j = 0; j < c->old.len; j++)
+    kill(fn, c->old.items[j]);
+  stack_push(&ir_block(fn, c->body)->insts, term);
+  return true;
+}
+
+void ir_close_loops(IrFn *fn) {
+  uint32_t n = (uint32_t)fn->blocks.len;
+  size_t ninsts = fn->insts.len;
+  Loops lp;
+  loops_init(&lp, fn);
+  Close c = {.fn = fn, .l = {.fn = fn, .loop = lp.loop}};
+  c.kind = xcalloc(ninsts, 1);
+  c.who = xcalloc(ninsts, sizeof(IrRef));
+  c.base = xcalloc(ninsts, sizeof(IrRef));
+  c.step = xcalloc(ninsts, sizeof(IrRef));
+  c.iv = xcalloc(ninsts, 1);
+  c.iv_step = xcalloc(ninsts, sizeof(IrRef));
+  bool changed = false;
+  for (uint32_t i = 2 * n; i-- > 0;) {
+    uint32_t h = lp.by_pre[i];
+    if (h == IR_NO_BLOCK || find_loop(&lp, h) == IR_NO_BLOCK || lp.body.len != 2)
+      continue;
+    c.l.head = h;
+    c.l.mark = h + 1;
+    c.body = (uint32_t)lp.body.items[1];
+    changed |= close_loop(&c);
+  }
+  if (changed) {
+    drop_dead_values(fn);
+    ir_compact(fn);
+  }
+  stack_free(&c.old);
+  free(c.kind);
+  free(c.who);
+  free(c.base);
+  free(c.step);
+  free(c.iv);
+  free(c.iv_step);
+  loops_free(&lp);
+}
+
+// --- unrolling --------------------------------------------------------------
+// An innermost loop with a counted test gets `factor` copies of its body,
+// chained one into the next, and a block that picks them while at least
+// `factor` iterations are left:
+//
+//   head:  i < n ? pick : exit
+//   pick:  n - i >= factor ? copies : body
+//
+// The copies jump back to the header, and the loop's own body runs the
+// iterations left over.  Once the header's test holds, n - i is exact or
+// wraps negative, so the copies never run past the bound.  A loop known to
+// run at most `factor` times becomes its copies alone.
+
+// Copies hold at most UNROLL_SIZE instructions in all, and there are at
+// most UNROLL_MAX of them, unless hsc --unroll=N asks for N.
+#define UNROLL_SIZE 64
+#define UNROLL_MAX 8
+
+// A loop to unroll, found before any is changed.
+typedef struct {
+  uint32_t head, pre;
+  size_t first, count;  // its other blocks in Unroll.blocks, in dominator
+                        // tree order
+  Counted test;
+  unsigned factor;
+  bool full;            // no loop is left
+} Unrollable;
+
+typedef struct {
+  IrFn *fn;
+  Words blocks;
+  uint32_t head;
+  uint32_t *rank;       // layout position of each block among its loop's
+                        // others, UINT32_MAX outside them
+  IrRef *map;           // each loop value in the copy being built
+  IrRefs phis, next;    // header phis and their values for the next copy
+  uint32_t *place_lo, *place_hi;  // new blocks laid out before a block
+  uint8_t *drop;        // blocks of loops unrolled in full
+} Unroll;
+
+static int by_block(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static bool compare_consts(uint8_t op, int64_t x, int64_t y) {
+  switch (op) {
+  case IR_EQ: return x == y;
+  case IR_NE: return x != y;
+  case IR_LT: return x < y;
+  case IR_LE: return x <= y;
+  case IR_GT: return x > y;
+  default: return x >= y;
+  }
+}
+
+// Whether the loop headed by `h`, which find_loop() just found, can be
+// unrolled; fills in `out` if so.
+static bool unrollable(Unroll *u, Loops *lp, uint32_t h, uint32_t pre, unsigned factor,
+                       Unrollable *out) {
+  IrFn *fn = u->fn;
+  const IrBlock *hb = ir_block(fn, h);
+  Loop l = {.fn = fn, .head = h, .mark = h + 1, .loop = lp->loop};
+  if (hb->preds.len != 2 || lp->body.len < 2)
+    return false;
+  l.entry = hb->preds.items[0] == pre ? 0 : 1;
+  l.latch = 1 - l.entry;
+  const IrInst *br = ir_inst(fn, ir_terminator(fn, h));
+  IrRef cmp = br->a;
+  uint32_t first = (uint32_t)lp->body.items[1];
+  if (br->op != IR_BR || hb->insts.items[hb->insts.len - 2] != cmp ||
+      ir_inst(fn, cmp)->op < IR_EQ || ir_inst(fn, cmp)->op > IR_GE ||
+      ir_inst(fn, ir_terminator(fn, hb->preds.items[l.latch]))->op != IR_JMP)
+    return false;
+  for (size_t j = 0; j + 2 < hb->insts.len; j++) {
+    IrRef p = hb->insts.items[j];
+    if (ir_inst(fn, p)->op != IR_PHI || phi_arg(&l, p, l.latch) == cmp)
+      return false;
+  }
+  // The body is entered only from the header, holds no loop, leaves only
+  // through the header and does not read the test.
+  if ((hb->succ[0] == first) == (hb->succ[1] == first) || ir_block(fn, first)->preds.len != 1)
+    return false;
+  size_t size = 0;
+  for (size_t k = 1; k < lp->body.len; k++) {
+    uint32_t b = (uint32_t)lp->body.items[k];
+    const IrBlock *blk = ir_block(fn, b);
+    for (size_t j = 0; j < blk->preds.len; j++) {
+      if (ir_dominates(&lp->dom, b, blk->preds.items[j]))
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+      if (blk->succ[i] != IR_NO_BLOCK && lp->loop[blk->succ[i]] != l.mark)
+        return false;
+    }
+    for (size_t j = 0; j < blk->insts.len; j++) {
+      const IrInst *in = ir_inst(fn, blk->insts.items[j]);
+      size_t nargs = in->op == IR_PHI ? blk->preds.len : 0;
+      for (size_t q = 0; q < nargs; q++) {
+        if (fn->args.items[in->imm + q] == cmp)
+          return false;
+      }
+      if (in->a == cmp || in->b == cmp)
+        return false;
+    }
+    size += blk->insts.len;
+  }
+  if (!counted_test(&l, cmp, hb->succ[0] != first, &out->test))
+    return false;
+  if (!factor)
+    factor = (unsigned)(size * UNROLL_MAX > UNROLL_SIZE ? UNROLL_SIZE / size : UNROLL_MAX);
+  if (factor < 2)
+    return false;
+
+  // With a constant start and bound, the trip count is known.
+  const IrInst *start = ir_inst(fn, phi_arg(&l, out->test.iv, l.entry));
+  const IrInst *bound = ir_inst(fn, out->test.bound);
+  out->full = false;
+  if (start->op == IR_CONST && bound->op == IR_CONST) {
+    if (!compare_consts(out->test.op, start->imm, bound->imm))
+      return false;
+    uint64_t t = out->test.up ? (uint64_t)bound->imm - (uint64_t)start->imm
+                              : (uint64_t)start->imm - (uint64_t)bound->imm;
+    t += out->test.inclusive;
+    if (t <= factor) {
+      factor = (unsigned)t;
+      out->full = true;
+    }
+  }
+  out->head = h;
+  out->pre = pre;
+  out->first = u->blocks.len;
+  out->count = lp->body.len - 1;
+  out->factor = factor;
+  for (size_t k = 1; k < lp->body.len; k++)
+    stack_push(&u->blocks, (uint32_t)lp->body.items[k]);
+  return true;
+}
+
+// The value of `x` in the copy being built.
+static IrRef lookup(const Unroll *u, IrRef x) {
+  uint32_t b = ir_inst(u->fn, x)->block;
+  return b == u->head || u->rank[b] != UINT32_MAX ? u->map[x] : x;
+}
+
+// Fold copy `ref` if its operands have become constants, as they do in a
+// loop with a constant start unrolled in full.
+static void fold(IrFn *fn, IrRef ref) {
+  IrInst *in = ir_inst(fn, ref);
+  if (in->op < IR_NEG || in->op > IR_GE || in->op == IR_NOT || in->op == IR_DIV ||
+      in->op == IR_REM)
+    return;
+  const IrInst *x = ir_inst(fn, in->a), *y = ir_inst(fn, in->b);
+  if (x->op != IR_CONST || x->type != IRT_INT ||
+      (in->op != IR_NEG && (y->op != IR_CONST || y->type != IRT_INT)))
+    return;
+  uint64_t a = (uint64_t)x->imm, b = (uint64_t)y->imm;
+  switch (in->op) {
+  case IR_NEG: in->imm = (int64_t)(0 - a); break;
+  case IR_ADD: in->imm = (int64_t)(a + b); break;
+  case IR_SUB: in->imm = (int64_t)(a - b); break;
+  case IR_MUL: in->imm = (int64_t)(a * b); break;
+  default: in->imm = compare_consts(in->op, x->imm, y->imm); break;
+  }
+  in->op = IR_CONST;
+  in->a = in->b = IR_NONE;
+}
+
+static void unroll_loop(Unroll *u, const Unrollable *c) {
+  IrFn *fn = u->fn;
+  uint32_t head = c->head, n = c->factor, ns = (uint32_t)c->count;
+  const uint32_t *body = &u->blocks.items[c->first];
+  IrBlock *hb = ir_block(fn, head);
+  size_t entry = hb->preds.items[0] == c->pre ? 0 : 1;
+  uint32_t latch = hb->preds.items[1 - entry], first = body[0];
+  uint32_t exit = hb->succ[0] == first ? hb->succ[1] : hb->succ[0];
+  Loop l = {.fn = fn, .head = head, .entry = entry, .latch = 1 - entry};
+
+  // Blocks of a copy are laid out as the body's are.
+  Words sorted = {0};
+  for (uint32_t i = 0; i < ns; i++)
+    stack_push(&sorted, body[i]);
+  qsort(sorted.items, ns, sizeof(*sorted.items), by_block);
+  uint32_t low = sorted.items[0];
+  for (uint32_t i = 0; i < ns; i++)
+    u->rank[sorted.items[i]] = i;
+  stack_free(&sorted);
+  u->head = head;
+  u->phis.len = 0;
+  for (size_t j = 0; j + 2 < hb->insts.len; j++)
+    stack_push(&u->phis, hb->insts.items[j]);
+
+  uint32_t pick = c->full ? IR_NO_BLOCK : ir_new_block(fn);
+  uint32_t base = (uint32_t)fn->blocks.len;
+  for (uint32_t k = 0; k < n * ns; k++)
+    ir_new_block(fn);
+#define COPY(k, b) (base + (k) * ns + u->rank[b])
+
+  for (uint32_t k = 0; k < n; k++) {
+    // The header phis start each copy with what the one before left.
+    u->next.len = 0;
+    for (size_t j = 0; j < u->phis.len; j++) {
+      IrRef p = u->phis.items[j];
+      stack_push(&u->next, k ? lookup(u, phi_arg(&l, p, l.latch))
+                             : c->full ? phi_arg(&l, p, l.entry) : p);
+    }
+    for (size_t j = 0; j < u->phis.len; j++)
+      u->map[u->phis.items[j]] = u->next.items[j];
+
+    for (uint32_t i = 0; i < ns; i++) {
+      uint32_t b = body[i], to = COPY(k, b);
+      const IrBlock *blk = ir_block(fn, b);
+      for (size_t j = 0; j < blk->insts.len; j++) {
+        IrRef ref = blk->insts.items[j];
+        u->map[ref] = ir_append(fn, to, *ir_inst(fn, ref));
+      }
+      IrBlock *nb = ir_block(fn, to);
+      for (size_t j = 0; j < blk->preds.len; j++) {
+        uint32_t p = blk->preds.items[j];
+        if (p != head)
+          p = COPY(k, p);
+        else if (k)
+          p = COPY(k - 1, latch);
+        else
+          p = c->full ? c->pre : pick;
+        stack_push(&nb->preds, p);
+      }
+      for (int s = 0; s < 2; s++) {
+        uint32_t t = blk->succ[s];
+        if (t == head)
+          t = k + 1 < n ? COPY(k + 1, first) : head;
+        else if (t != IR_NO_BLOCK)
+          t = COPY(k, t);
+        nb->succ[s] = t;
+      }
+    }
+    // Operands are renamed in dominator tree order, so that what they fold
+    // to is known.
+    for (uint32_t i = 0; i < ns; i++) {
+      uint32_t to = COPY(k, body[i]);
+      size_t npreds = ir_block(fn, to)->preds.len;
+      for (size_t j = 0; j < ir_block(fn, to)->insts.len; j++) {
+        IrRef ref = ir_block(fn, to)->insts.items[j];
+        IrInst *in = ir_inst(fn, ref);
+        if (in->a)
+          in->a = lookup(u, in->a);
+        if (in->b)
+          in->b = lookup(u, in->b);
+        if (in->op == IR_PHI) {
+          size_t old = (size_t)in->imm;
+          in->imm = (int64_t)fn->args.len;
+          for (size_t q = 0; q < npreds; q++)
+            stack_push(&fn->args, lookup(u, fn->args.items[old + q]));
+        }
+        fold(fn, ref);
+      }
+    }
+  }
+
+  // The header takes the last copy's values, from the preheader's place in
+  // a loop unrolled in full and as a new predecessor otherwise.
+  u->next.len = 0;
+  for (size_t j = 0; j < u->phis.len; j++)
+    stack_push(&u->next, lookup(u, phi_arg(&l, u->phis.items[j], l.latch)));
+  hb = ir_block(fn, head);
+  uint32_t last = COPY(n - 1, latch), into = COPY(0, first);
+#undef COPY
+  for (size_t j = 0; j < u->phis.len; j++) {
+    IrInst *p = ir_inst(fn, u->phis.items[j]);
+    int64_t old = p->imm;
+    p->imm = (int64_t)fn->args.len;
+    if (!c->full) {
+      stack_push(&fn->args, fn->args.items[old]);
+      stack_push(&fn->args, fn->args.items[old + 1]);
+    }
+    stack_push(&fn->args, u->next.items[j]);
+  }
+  if (c->full) {
+    hb->preds.len = 0;
+    stack_push(&hb->preds, last);
+    IrInst *br = ir_inst(fn, ir_terminator(fn, head));
+    br->op = IR_JMP;
+    br->a = IR_NONE;
+    hb->succ[0] = exit;
+    hb->succ[1] = IR_NO_BLOCK;
+    ir_block(fn, c->pre)->succ[0] = into;
+    for (uint32_t i = 0; i < ns; i++)
+      u->drop[body[i]] = 1;
+  } else {
+    stack_push(&hb->preds, last);
+    hb->succ[hb->succ[0] == first ? 0 : 1] = pick;
+    ir_block(fn, first)->preds.items[0] = pick;
+    stack_push(&ir_block(fn, pick)->preds, head);
+
+    // pick: n - i >= factor, or n - i >= factor - 1 for i <= n.
+    IrBlock *pb = ir_block(fn, c->pre);
+    IrRef want = ir_insert(fn, c->pre, pb->insts.len - 1,
+                           (IrInst){.op = IR_CONST, .type = IRT_INT,
+                                    .imm = (int64_t)n - c->test.inclusive});
+    IrRef iv = c->test.iv, bound = c->test.bound;
+    IrRef left = ir_append(fn, pick, (IrInst){.op = IR_SUB, .type = IRT_INT,
+                                              .a = c->test.up ? bound : iv,
+                                              .b = c->test.up ? iv : bound});
+    IrRef enough = ir_append(fn, pick, (IrInst){.op = IR_GE, .type = IRT_BOOL,
+                                                .a = left, .b = want});
+    ir_append(fn, pick, (IrInst){.op = IR_BR, .a = enough});
+    ir_block(fn, pick)->succ[0] = into;
+    ir_block(fn, pick)->succ[1] = first;
+  }
+  u->place_lo[low] = c->full ? base : pick;
+  u->place_hi[low] = base + n * ns;
+  for (uint32_t i = 0; i < ns; i++)
+    u->rank[body[i]] = UINT32_MAX;
+}
+
+void ir_unroll(IrFn *fn, unsigned factor) {
+  if (factor == 1)
+    return;
+  uint32_t n = (uint32_t)fn->blocks.len;
+  Loops lp;
+  loops_init(&lp, fn);
+  Unroll u = {.fn = fn};
+  STACK(Unrollable) todo = {0};
+  for (uint32_t i = 2 * n; i-- > 0;) {
+    uint32_t h = lp.by_pre[i], pre;
+    Unrollable c;
+    if (h != IR_NO_BLOCK && (pre = find_loop(&lp, h)) != IR_NO_BLOCK &&
+        unrollable(&u, &lp, h, pre, factor, &c))
+      stack_push(&todo, c);
+  }
+  loops_free(&lp);
+  if (todo.len) {
+    u.rank = xcalloc(n, sizeof(*u.rank));
+    for (uint32_t b = 0; b < n; b++)
+      u.rank[b] = UINT32_MAX;
+    u.map = xcalloc(fn->insts.len, sizeof(*u.map));
+    u.place_lo = xcalloc(n, sizeof(*u.place_lo));
+    u.place_hi = xcalloc(n, sizeof(*u.place_hi));
+    u.drop = xcalloc(n, 1);
+    for (size_t k = 0; k < todo.len; k++)
+      unroll_loop(&u, &todo.items[k]);
+
+    Words order = {0};
+    for (uint32_t b = 0; b < n; b++) {
+      for (uint32_t x = u.place_lo[b]; x < u.place_hi[b]; x++)
+        stack_push(&order, x);
+      if (!u.drop[b])
+        stack_push(&order, b);
+    }
+    ir_reorder(fn, order.items, order.len);
+    drop_dead_values(fn);
+    ir_compact(fn);
+    stack_free(&order);
+    free(u.rank);
+    free(u.map);
+    free(u.place_lo);
+    free(u.place_hi);
+    free(u.drop);
+  }
+  stack_free(&todo);
+  stack_free(&u.blocks);
+  stack_free(&u.phis);
+  stack_free(&u.next);
+}
+
+void ir_promote(IrFn *fn) {
+  Promote p = {.fn = fn, .nslots = fn->nslots};
+  p.slot_type = xcalloc(p.nslots + 1, 1);
+  IrDom dom;
+  ir_dom_build(&dom, fn);
+  place_phis(&p, &dom);
+  rename_slots(&p, &dom);
+  ir_dom_free(&dom);
+  rewrite(fn, p.repl);
+  drop_trivial_phis(fn, p.repl);
+  drop_dead_values(fn);
+  ir_compact(fn);
+  fn->nslots = 0;
+  free(p.slot_type);
+  free(p.slot_of);
+  free(p.repl);
+}
@@ -1,74 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-
-typedef enum {
-  BEGINNING,
-
-  INT,
-  STRING,
-  BOOL,
-  IDENTIFIER,
-
-  OPEN_BRACKET,
-  CLOSE_BRACKET,
-  OPEN_CURLY,
-  CLOSE_CURLY,
-  OPEN_PAREN,
-  CLOSE_PAREN,
-
-  ASSIGNMENT,
-  EQUALS,
-  NOT_EQUALS,
-  NOT,
-
-  LESS,
-  LESS_EQUALS,
-  GREATER,
-  GREATER_EQUALS,
-
-  OR,
-  AND,
-  
-  SEMICOLON,
-  COMMA,
-
-  PLUS_PLUS,
-  MINUS_MINUS,
-  PLUS_EQUALS,
-  MINUS_EQUALS,
-  
-  PLUS,
-  DASH,
-  SLASH,
-  STAR,
-  PERCENT,
-
-  //Reserved Keywords
-  LET,
-  FN,
-  IF,
-  ELSE_IF,
-  ELSE,
-  FOR,
-  WHILE,
-  WRITE,
-  EXIT,
-
-  //End of Pointer Type
-  END_OF_TOKENS,
-} TokenType;
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-typedef struct {
-  TokenType type;
-  char *value;
-  size_t line_num;
-} Token;
-
-size_t line_number = 0;
+#include "lexer.h"
 
-void print_token(Token token){
+void print_token(const Source *src, Token token){
   //printf("TOKEN VALUE: ");
   //printf("'");
   //for(int i = 0; token.value[i] != '\0'; i++){
@@ -82,16 +23,16 @@ void print_token(Token token){
       printf("BEGINNING\n");
       break;   
     case INT:
-      printf(" TOKEN TYPE: INT (%s)\n", token.value);
+      printf(" TOKEN TYPE: INT (%.*s)\n", (int)token.len, token_text(src, &token));
       break;
     case STRING:
-      printf(" TOKEN TYPE: STRING (%s)\n", token.value);
+      printf(" TOKEN TYPE: STRING (%.*s)\n", (int)token.len, token_text(src, &token));
       break;
     case BOOL:
-      printf(" TOKEN TYPE: BOOL (%s)\n", token.value);
+      printf(" TOKEN TYPE: BOOL (%.*s)\n", (int)token.len, token_text(src, &token));
       break;
     case IDENTIFIER:
-      printf(" TOKEN TYPE: IDENTIFIER (%s)\n", token.value);
+      printf(" TOKEN TYPE: IDENTIFIER (%.*s)\n", (int)token.len, token_text(src, &token));
       break;
     case OPEN_BRACKET:
       printf(" TOKEN TYPE: OPEN_BRACKET\n");
@@ -207,334 +148,1007 @@ void print_token(Token token){
   }
 }
 
-Token *generate_number(char *current, int *current_index){
-  Token *token = malloc(sizeof(Token));
-  token->line_num = line_number;
-  token->type = INT;
-  char *value = malloc(sizeof(char) * 8);
-  int value_index = 0;
-  while(isdigit(current[*current_index]) && current[*current_index] != '\0'){
-    if(!isdigit(current[*current_index])){
+// --- source loading --------------------------------------------------------
+// Regular files are mapped read-only so tokens can refer straight into the
+// page cache.  Anything else (pipes, "-" for stdin, empty files, or a failed
+// mmap) is read through a window that holds SOURCE_CHUNK-sized reads and is
+// compacted as the token stream retires text it no longer needs.
+
+static int source_open_chunked(Source *src, int fd) {
+  src->fd = fd;
+  src->cap = SOURCE_CHUNK;
+  src->data = malloc(src->cap);
+  if (!src->data)
+    return -1;
+  return source_refill(src, 0);
+}
+
+int source_open(Source *src, const char *path) {
+  src->data = NULL;
+  src->base = 0;
+  src->len = 0;
+  src->released = 0;
+  src->cap = 0;
+  src->fd = -1;
+  src->mapped = false;
+  src->eof = false;
+
+  if (strcmp(path, "-") == 0)
+    return source_open_chunked(src, STDIN_FILENO);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+      src->data = map;
+      src->len = (size_t)st.st_size;
+      src->mapped = true;
+      src->eof = true;
+      close(fd);
+      return 0;
+    }
+  }
+
+  if (source_open_chunked(src, fd) != 0) {
+    close(fd);
+    src->fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+int source_refill(Source *src, size_t keep_from) {
+  if (src->eof)
+    return 0;
+
+  // Drop everything before keep_from, then make room for one more chunk.
+  char *buf = (char *)src->data;
+  size_t drop = keep_from - src->base;
+  memmove(buf, buf + drop, src->len - drop);
+  src->base += drop;
+  src->len -= drop;
+  if (src->cap - src->len < SOURCE_CHUNK) {
+    size_t cap = src->cap * 2;
+    while (cap - src->len < SOURCE_CHUNK)
+      cap *= 2;
+    buf = realloc(buf, cap);
+    if (!buf)
+      return -1;
+    src->data = buf;
+    src->cap = cap;
+  }
+
+  ssize_t n = read(src->fd, buf + src->len, SOURCE_CHUNK);
+  if (n < 0)
+    return -1;
+  if (n == 0)
+    src->eof = true;
+  src->len += (size_t)n;
+  return 0;
+}
+
+void source_release(Source *src, size_t upto) {
+  // Chunked windows are compacted by the next refill instead.
+  if (!src->mapped || upto - src->released < SOURCE_CHUNK)
+    return;
+  long page = sysconf(_SC_PAGESIZE);
+  size_t from = src->released & ~((size_t)page - 1);
+  size_t to = upto & ~((size_t)page - 1);
+  if (to > from)
+    madvise((char *)src->data + from, to - from, MADV_DONTNEED);
+  src->released = upto;
+}
+
+void source_close(Source *src) {
+  if (src->mapped)
+    munmap((void *)src->data, src->len);
+  else
+    free((void *)src->data);
+  if (src->fd > STDIN_FILENO)
+    close(src->fd);
+  src->data = NULL;
+  src->len = 0;
+  src->fd = -1;
+  src->mapped = false;
+}
+
+// --- lexeme access ---------------------------------------------------------
+const char *token_text(const Source *src, const Token *tok) {
+  return src->data + (tok->start - src->base);
+}
+
+
+// --- dispatch tables -------------------------------------------------------
+// Every input byte is classified with a single table load; punctuation is
+// then resolved through the operator tables below instead of a chain of
+// comparisons.
+
+enum {
+  CC_OTHER = 0,  // ignored byte
+  CC_SPACE,
+  CC_NEWLINE,
+  CC_ALPHA,
+  CC_DIGIT,
+  CC_QUOTE,
+  CC_PUNCT,      // may start an operator or separator
+};
+
+static const uint8_t char_class[256] = {
+  [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\r'] = CC_SPACE,
+  ['\v'] = CC_SPACE, ['\f'] = CC_SPACE,
+  ['\n'] = CC_NEWLINE,
+  ['a' ... 'z'] = CC_ALPHA, ['A' ... 'Z'] = CC_ALPHA,
+  ['0' ... '9'] = CC_DIGIT,
+  ['"'] = CC_QUOTE,
+  [';'] = CC_PUNCT, [','] = CC_PUNCT, ['('] = CC_PUNCT, [')'] = CC_PUNCT,
+  ['{'] = CC_PUNCT, ['}'] = CC_PUNCT, ['['] = CC_PUNCT, [']'] = CC_PUNCT,
+  ['='] = CC_PUNCT, ['!'] = CC_PUNCT, ['<'] = CC_PUNCT, ['>'] = CC_PUNCT,
+  ['+'] = CC_PUNCT, ['-'] = CC_PUNCT, ['*'] = CC_PUNCT, ['/'] = CC_PUNCT,
+  ['%'] = CC_PUNCT, ['&'] = CC_PUNCT, ['|'] = CC_PUNCT,
+};
+
+// Single-character tokens.  BEGINNING (0) means the byte is not a token on
+// its own ('&' and '|' only appear doubled).
+static const uint8_t single_char_token[128] = {
+  [';'] = SEMICOLON, [','] = COMMA,
+  ['('] = OPEN_PAREN, [')'] = CLOSE_PAREN,
+  ['{'] = OPEN_CURLY, ['}'] = CLOSE_CURLY,
+  ['['] = OPEN_BRACKET, [']'] = CLOSE_BRACKET,
+  ['='] = ASSIGNMENT, ['!'] = NOT, ['<'] = LESS, ['>'] = GREATER,
+  ['+'] = PLUS, ['-'] = DASH, ['*'] = STAR, ['/'] = SLASH, ['%'] = PERCENT,
+};
+
+// Two-character operators, indexed by the first byte and the column of the
+// second byte in second_char_column.
+enum { PAIR_NONE = 0, PAIR_EQ, PAIR_AMP, PAIR_BAR, PAIR_PLUS, PAIR_DASH, PAIR_COLUMNS };
+
+static const uint8_t second_char_column[256] = {
+  ['='] = PAIR_EQ, ['&'] = PAIR_AMP, ['|'] = PAIR_BAR,
+  ['+'] = PAIR_PLUS, ['-'] = PAIR_DASH,
+};
+
+static const uint8_t two_char_token[128][PAIR_COLUMNS] = {
+  ['='] = { [PAIR_EQ] = EQUALS },
+  ['!'] = { [PAIR_EQ] = NOT_EQUALS },
+  ['<'] = { [PAIR_EQ] = LESS_EQUALS },
+  ['>'] = { [PAIR_EQ] = GREATER_EQUALS },
+  ['&'] = { [PAIR_AMP] = AND },
+  ['|'] = { [PAIR_BAR] = OR },
+  ['+'] = { [PAIR_PLUS] = PLUS_PLUS, [PAIR_EQ] = PLUS_EQUALS },
+  ['-'] = { [PAIR_DASH] = MINUS_MINUS, [PAIR_EQ] = MINUS_EQUALS },
+};
+
+// Keywords are recognized with a perfect hash over (first byte, second byte,
+// last byte, length).  The multiplier was found offline by searching for a
+// value that maps every keyword below to a distinct slot; adding a keyword
+// means re-running that search and updating KEYWORD_HASH_MUL.
+#define KEYWORD_HASH_MUL 0x6ec9d287u
+#define KEYWORD_HASH_BITS 5
+#define KEYWORD_MIN_LEN 2
+#define KEYWORD_MAX_LEN 5
+
+typedef struct {
+  char word[KEYWORD_MAX_LEN + 1];
+  uint8_t len;
+  uint8_t type;
+} Keyword;
+
+static inline uint32_t keyword_hash(const char *text, size_t len) {
+  uint32_t key = (uint32_t)(unsigned char)text[0] |
+                 (uint32_t)(unsigned char)text[1] << 8 |
+                 (uint32_t)(unsigned char)text[len - 1] << 16 |
+                 (uint32_t)len << 24;
+  return (key * KEYWORD_HASH_MUL) >> (32 - KEYWORD_HASH_BITS);
+}
+
+static const Keyword keyword_table[1 << KEYWORD_HASH_BITS] = {
+  [0]  = { "else",  4, ELSE },
+  [1]  = { "less",  4, LESS },
+  [2]  = { "write", 5, WRITE },
+  [5]  = { "while", 5, WHILE },
+  [7]  = { "true",  4, BOOL },
+  [9]  = { "false", 5, BOOL },
+  [10] = { "let",   3, LET },
+  [12] = { "fn",    2, FN },
+  [16] = { "and",   3, AND },
+  [22] = { "or",    2, OR },
+  [23] = { "neq",   3, NOT_EQUALS },
+  [24] = { "eq",    2, EQUALS },
+  [25] = { "if",    2, IF },
+  [26] = { "exit",  4, EXIT },
+  [27] = { "elif",  4, ELSE_IF },
+  [31] = { "for",   3, FOR },
+};
+
+static TokenType keyword_lookup(const char *text, size_t len) {
+  if (len < KEYWORD_MIN_LEN || len > KEYWORD_MAX_LEN)
+    return IDENTIFIER;
+  const Keyword *kw = &keyword_table[keyword_hash(text, len)];
+  if (kw->len == len && memcmp(kw->word, text, len) == 0)
+    return (TokenType)kw->type;
+  return IDENTIFIER;
+}
+
+// --- scanning kernels ------------------------------------------------------
+// Runs of whitespace, letters and digits and the body of a string literal
+// are skipped in bulk.  On x86-64 the SSE2 or AVX2 variant is picked at
+// first use (HSC_SCAN=scalar|sse2|avx2 overrides the choice); each kernel
+// finishes the last partial block with the scalar loop so it never reads
+// past the end of the mapping.  Newlines crossed are counted from the
+// comparison masks with popcount.
+
+typedef struct {
+  const char *name;
+  size_t (*skip_space)(const char *p, size_t i, size_t end, size_t *newlines);
+  size_t (*skip_alpha)(const char *p, size_t i, size_t end);
+  size_t (*skip_digit)(const char *p, size_t i, size_t end);
+  size_t (*find_quote)(const char *p, size_t i, size_t end, size_t *newlines);
+} ScanKernels;
+
+static size_t skip_space_scalar(const char *p, size_t i, size_t end, size_t *newlines) {
+  for (; i < end; i++) {
+    uint8_t cc = char_class[(unsigned char)p[i]];
+    if (cc == CC_NEWLINE)
+      *newlines += 1;
+    else if (cc != CC_SPACE)
       break;
+  }
+  return i;
+}
+
+static size_t skip_alpha_scalar(const char *p, size_t i, size_t end) {
+  while (i < end && char_class[(unsigned char)p[i]] == CC_ALPHA)
+    i++;
+  return i;
+}
+
+static size_t skip_digit_scalar(const char *p, size_t i, size_t end) {
+  while (i < end && char_class[(unsigned char)p[i]] == CC_DIGIT)
+    i++;
+  return i;
+}
+
+static size_t find_quote_scalar(const char *p, size_t i, size_t end, size_t *newlines) {
+  for (; i < end && p[i] != '"'; i++) {
+    if (p[i] == '\n')
+      *newlines += 1;
+  }
+  return i;
+}
+
+static const ScanKernels scan_scalar = {
+  "scalar", skip_space_scalar, skip_alpha_scalar, skip_digit_scalar, find_quote_scalar,
+};
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// Bytes of `v` that are <= `hi` when viewed as unsigned.
+#define SSE2_ULE(v, hi) _mm_cmpeq_epi8(_mm_min_epu8((v), (hi)), (v))
+#define AVX2_ULE(v, hi) _mm256_cmpeq_epi8(_mm256_min_epu8((v), (hi)), (v))
+
+static size_t skip_space_sse2(const char *p, size_t i, size_t end, size_t *newlines) {
+  // Most runs are a single separating space; don't pay for a vector load.
+  if (i + 1 < end && char_class[(unsigned char)p[i + 1]] > CC_NEWLINE)
+    return skip_space_scalar(p, i, i + 1, newlines);
+  const __m128i nl = _mm_set1_epi8('\n'), sp = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t'), ctl_hi = _mm_set1_epi8('\r' - '\t');
+  for (; i + 16 <= end; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i ctl = _mm_sub_epi8(v, tab);
+    __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, sp), SSE2_ULE(ctl, ctl_hi));
+    unsigned lines = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    unsigned stop = ~(unsigned)_mm_movemask_epi8(ws) & 0xFFFFu;
+    if (stop) {
+      unsigned k = (unsigned)__builtin_ctz(stop);
+      *newlines += (size_t)__builtin_popcount(lines & ((1u << k) - 1));
+      return i + k;
     }
-    value[value_index] = current[*current_index];
-    value_index++;
-    *current_index += 1;
-  }
-  value[value_index] = '\0';
-  token->value = value;
-  return token;
-}
-
-Token *generate_keyword_or_identifier(char *current, int *current_index){
-  Token *token = malloc(sizeof(Token));
-  token->line_num = line_number;
-  char *keyword = malloc(sizeof(char) * 64);
-  int keyword_index = 0;
-  while(isalpha(current[*current_index]) && current[*current_index] != '\0'){
-    if(keyword_index < 63){
-      keyword[keyword_index] = current[*current_index];
-      keyword_index++;
+    *newlines += (size_t)__builtin_popcount(lines);
+  }
+  return skip_space_scalar(p, i, end, newlines);
+}
+
+static size_t skip_alpha_sse2(const char *p, size_t i, size_t end) {
+  const __m128i lower = _mm_set1_epi8(0x20), a = _mm_set1_epi8('a');
+  const __m128i span = _mm_set1_epi8('z' - 'a');
+  for (; i + 16 <= end; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i off = _mm_sub_epi8(_mm_or_si128(v, lower), a);
+    unsigned stop = ~(unsigned)_mm_movemask_epi8(SSE2_ULE(off, span)) & 0xFFFFu;
+    if (stop)
+      return i + (unsigned)__builtin_ctz(stop);
+  }
+  return skip_alpha_scalar(p, i, end);
+}
+
+static size_t skip_digit_sse2(const char *p, size_t i, size_t end) {
+  const __m128i zero = _mm_set1_epi8('0'), span = _mm_set1_epi8(9);
+  for (; i + 16 <= end; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i off = _mm_sub_epi8(v, zero);
+    unsigned stop = ~(unsigned)_mm_movemask_epi8(SSE2_ULE(off, span)) & 0xFFFFu;
+    if (stop)
+      return i + (unsigned)__builtin_ctz(stop);
+  }
+  return skip_digit_scalar(p, i, end);
+}
+
+static size_t find_quote_sse2(const char *p, size_t i, size_t end, size_t *newlines) {
+  const __m128i nl = _mm_set1_epi8('\n'), quote = _mm_set1_epi8('"');
+  for (; i + 16 <= end; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    unsigned lines = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    unsigned stop = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote));
+    if (stop) {
+      unsigned k = (unsigned)__builtin_ctz(stop);
+      *newlines += (size_t)__builtin_popcount(lines & ((1u << k) - 1));
+      return i + k;
     }
-    *current_index += 1;
-  }
-  keyword[keyword_index] = '\0';
-  if(strcmp(keyword, "exit") == 0){
-    token->type = EXIT;
-    token->value = "EXIT";
-  } else if(strcmp(keyword, "let") == 0){
-    token->type = LET;
-    token->value = "let";
-  } else if(strcmp(keyword, "if") == 0){
-    token->type = IF;
-    token->value = "if";
-  } else if(strcmp(keyword, "while") == 0){
-    token->type = WHILE;
-    token->value = "while";
-  } else if(strcmp(keyword, "write") == 0){
-    token->type = WRITE;
-    token->value = "write";
-  } else if(strcmp(keyword, "eq") == 0){
-    token->type = EQUALS;
-    token->value = "eq";
-  } else if(strcmp(keyword, "neq") == 0){
-    token->type = NOT_EQUALS;
-    token->value = "neq";
-  } else if(strcmp(keyword, "less") == 0){
-    token->type = LESS;
-    token->value = "less";
-  } else if(strcmp(keyword, "elif") == 0){
-    token->type = ELSE_IF;
-    token->value = "elif";
-  } else if(strcmp(keyword, "for") == 0){
-    token->type = FOR;
-    token->value = "for";
-  } else if(strcmp(keyword, "fn") == 0){
-    token->type = FN;
-    token->value = "fn";
-  } else if(strcmp(keyword, "else") == 0){ 
-    token->type = ELSE;
-    token->value = "else";
-  } else if(strcmp(keyword, "or") == 0){
-    token->type = OR;
-    token->value = "or";
-  } else if(strcmp(keyword, "and") == 0){
-    token->type = AND;
-    token->value = "and";
-  } else if(strcmp(keyword, "true") == 0 || strcmp(keyword, "false") == 0){
-    token->type = BOOL;
-    token->value = keyword;
-  } else {
-    token->type = IDENTIFIER;
-    token->value = keyword;
-  }
-  return token;
-}
-
-Token *generate_string_token(char *current, int *current_index){
-  Token *token = malloc(sizeof(Token));
-  token->line_num = line_number;
-  char *value = malloc(sizeof(char) * 64);
-  int value_index = 0;
-  *current_index += 1;
-  while(current[*current_index] != '"'){
-    value[value_index] = current[*current_index];
-    value_index++;
-    *current_index += 1;
-  }
-  value[value_index] = '\0';
-  token->type = STRING;
-  token->value = value;
-  return token;
-}
-
-Token *generate_separator_or_operator(char *current, int *current_index, TokenType type){
-  Token *token = malloc(sizeof(Token));
-  token->value = malloc(sizeof(char) * 2);
-  token->value[0] = current[*current_index];
-  token->value[1] = '\0';
-  token->line_num = line_number;
-  token->type = type;
-  return token;
-}
-
-Token *generate_two_char_operator(char *current, int *current_index, TokenType type) {
-    Token *token = malloc(sizeof(Token));
-    token->value = malloc(sizeof(char) * 3);
-    token->value[0] = current[*current_index];
-    token->value[1] = current[*current_index + 1];
-    token->value[2] = '\0';
-    *current_index += 2;
-    token->line_num = line_number;
-    token->type = type;
-    return token;
-}
-
-size_t tokens_index;
-
-Token *lexer(FILE *file) {
-  int length;
-  char *current = 0;
-
-  fseek(file, 0, SEEK_END);
-  length = ftell(file);
-  fseek(file, 0, SEEK_SET);
-
-  current = malloc(sizeof(char) * (length + 1));
-  fread(current, 1, length, file);
-
-  fclose(file);
-
-  current[length] = '\0';
-  int current_index = 0;
-
-  int number_of_tokens = 12;
-  int tokens_size = 0;
-  Token *tokens = malloc(sizeof(Token) * number_of_tokens);
-  tokens_index = 0;
-
-  while(current[current_index] != '\0') {
-    Token *token;
-    
-    tokens_size++;
-    if(tokens_size > number_of_tokens) {
-      number_of_tokens *= 1.5;
-      tokens = realloc(tokens, sizeof(Token) * number_of_tokens);
+    *newlines += (size_t)__builtin_popcount(lines);
+  }
+  return find_quote_scalar(p, i, end, newlines);
+}
+
+static const ScanKernels scan_sse2 = {
+  "sse2", skip_space_sse2, skip_alpha_sse2, skip_digit_sse2, find_quote_sse2,
+};
+
+__attribute__((target("avx2,popcnt,bmi")))
+static size_t skip_space_avx2(const char *p, size_t i, size_t end, size_t *newlines) {
+  // Most runs are a single separating space; don't pay for a vector load.
+  if (i + 1 < end && char_class[(unsigned char)p[i + 1]] > CC_NEWLINE)
+    return skip_space_scalar(p, i, i + 1, newlines);
+  const __m256i nl = _mm256_set1_epi8('\n'), sp = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t'), ctl_hi = _mm256_set1_epi8('\r' - '\t');
+  for (; i + 32 <= end; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i ctl = _mm256_sub_epi8(v, tab);
+    __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), AVX2_ULE(ctl, ctl_hi));
+    uint32_t lines = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(ws);
+    if (stop) {
+      unsigned k = (unsigned)__builtin_ctz(stop);
+      *newlines += (size_t)__builtin_popcount(lines & ((1u << k) - 1));
+      return i + k;
     }
+    *newlines += (size_t)__builtin_popcount(lines);
+  }
+  return skip_space_sse2(p, i, end, newlines);
+}
+
+__attribute__((target("avx2,bmi")))
+static size_t skip_alpha_avx2(const char *p, size_t i, size_t end) {
+  const __m256i lower = _mm256_set1_epi8(0x20), a = _mm256_set1_epi8('a');
+  const __m256i span = _mm256_set1_epi8('z' - 'a');
+  for (; i + 32 <= end; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i off = _mm256_sub_epi8(_mm256_or_si256(v, lower), a);
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(AVX2_ULE(off, span));
+    if (stop)
+      return i + (unsigned)__builtin_ctz(stop);
+  }
+  return skip_alpha_sse2(p, i, end);
+}
 
-    if (current[current_index] == '=' && current[current_index + 1] == '=') {
-      token = generate_two_char_operator(current, &current_index, EQUALS);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (current[current_index] == '!' && current[current_index + 1] == '=') {
-      token = generate_two_char_operator(current, &current_index, NOT_EQUALS);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (current[current_index] == '<' && current[current_index + 1] == '=') {
-      token = generate_two_char_operator(current, &current_index, LESS_EQUALS);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (current[current_index] == '>' && current[current_index + 1] == '=') {
-      token = generate_two_char_operator(current, &current_index, GREATER_EQUALS);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (current[current_index] == '&' && current[current_index + 1] == '&') {
-      token = generate_two_char_operator(current, &current_index, AND);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (current[current_index] == '|' && current[current_index + 1] == '|') {
-      token = generate_two_char_operator(current, &current_index, OR);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (current[current_index] == '+' && current[current_index + 1] == '+') {
-      token = generate_two_char_operator(current, &current_index, PLUS_PLUS);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (current[current_index] == '-' && current[current_index + 1] == '-') {
-      token = generate_two_char_operator(current, &current_index, MINUS_MINUS);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (current[current_index] == '+' && current[current_index + 1] == '=') {
-      token = generate_two_char_operator(current, &current_index, PLUS_EQUALS);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (current[current_index] == '-' && current[current_index + 1] == '=') {
-      token = generate_two_char_operator(current, &current_index, MINUS_EQUALS);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
+__attribute__((target("avx2,bmi")))
+static size_t skip_digit_avx2(const char *p, size_t i, size_t end) {
+  const __m256i zero = _mm256_set1_epi8('0'), span = _mm256_set1_epi8(9);
+  for (; i + 32 <= end; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i off = _mm256_sub_epi8(v, zero);
+    uint32_t stop = ~(uint32_t)_mm256_movemask_epi8(AVX2_ULE(off, span));
+    if (stop)
+      return i + (unsigned)__builtin_ctz(stop);
+  }
+  return skip_digit_sse2(p, i, end);
+}
+
+__attribute__((target("avx2,popcnt,bmi")))
+static size_t find_quote_avx2(const char *p, size_t i, size_t end, size_t *newlines) {
+  const __m256i nl = _mm256_set1_epi8('\n'), quote = _mm256_set1_epi8('"');
+  for (; i + 32 <= end; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    uint32_t lines = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    uint32_t stop = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote));
+    if (stop) {
+      unsigned k = (unsigned)__builtin_ctz(stop);
+      *newlines += (size_t)__builtin_popcount(lines & ((1u << k) - 1));
+      return i + k;
     }
-    else if (current[current_index] == ';') {
-      token = generate_separator_or_operator(current, &current_index, SEMICOLON);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == ',') {
-      token = generate_separator_or_operator(current, &current_index, COMMA);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '(') {
-      token = generate_separator_or_operator(current, &current_index, OPEN_PAREN);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == ')') {
-      token = generate_separator_or_operator(current, &current_index, CLOSE_PAREN);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '{') {
-      token = generate_separator_or_operator(current, &current_index, OPEN_CURLY);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '}') {
-      token = generate_separator_or_operator(current, &current_index, CLOSE_CURLY);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '=') {
-      token = generate_separator_or_operator(current, &current_index, ASSIGNMENT);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '+') {
-      token = generate_separator_or_operator(current, &current_index, PLUS);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '-') {
-      token = generate_separator_or_operator(current, &current_index, DASH);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '*') {
-      token = generate_separator_or_operator(current, &current_index, STAR);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '/') {
-      token = generate_separator_or_operator(current, &current_index, SLASH);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '%') {
-      token = generate_separator_or_operator(current, &current_index, PERCENT);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '>') {
-      token = generate_separator_or_operator(current, &current_index, GREATER);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '<') {
-      token = generate_separator_or_operator(current, &current_index, LESS);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '[') {
-      token = generate_separator_or_operator(current, &current_index, OPEN_BRACKET);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == ']') {
-      token = generate_separator_or_operator(current, &current_index, CLOSE_BRACKET);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (current[current_index] == '!') {
-      token = generate_separator_or_operator(current, &current_index, NOT);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
+    *newlines += (size_t)__builtin_popcount(lines);
+  }
+  return find_quote_sse2(p, i, end, newlines);
+}
+
+static const ScanKernels scan_avx2 = {
+  "avx2", skip_space_avx2, skip_alpha_avx2, skip_digit_avx2, find_quote_avx2,
+};
+#endif
+
+static const ScanKernels *scan;
+
+static const ScanKernels *select_scan_kernels(void) {
+  const char *force = getenv("HSC_SCAN");
+  if (force && strcmp(force, "scalar") == 0)
+    return &scan_scalar;
+#if defined(__x86_64__)
+  if (force && strcmp(force, "sse2") == 0)
+    return &scan_sse2;
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") &&
+      __builtin_cpu_supports("bmi"))
+    return &scan_avx2;
+  return &scan_sse2;
+#else
+  return &scan_scalar;
+#endif
+}
+
+static inline const ScanKernels *scan_kernels(void) {
+  if (!scan)
+    scan = select_scan_kernels();
+  return scan;
+}
+
+const char *lexer_scan_kernel(void) {
+  return scan_kernels()->name;
+}
+
+// --- packed token storage --------------------------------------------------
+
+void tokbuf_init(TokenBuf *buf) {
+  memset(buf, 0, sizeof(*buf));
+}
+
+void tokbuf_free(TokenBuf *buf) {
+  free(buf->kind);
+  free(buf->off);
+  free(buf->lines);
+  tokbuf_init(buf);
+}
+
+static void tokbuf_reserve(TokenBuf *buf, size_t n) {
+  if (buf->cap - buf->len >= n)
+    return;
+  size_t cap = buf->cap ? buf->cap : TS_BATCH;
+  while (cap - buf->len < n)
+    cap *= 2;
+  buf->kind = realloc(buf->kind, cap * sizeof(*buf->kind));
+  buf->off = realloc(buf->off, cap * sizeof(*buf->off));
+  if (!buf->kind || !buf->off) {
+    perror("tokbuf_reserve");
+    exit(1);
+  }
+  buf->cap = cap;
+}
+
+// Start a line run at token `first`.
+static void tokbuf_push_line(TokenBuf *buf, size_t first, size_t line) {
+  if (buf->nlines == buf->lines_cap) {
+    buf->lines_cap = buf->lines_cap ? buf->lines_cap * 2 : 64;
+    buf->lines = realloc(buf->lines, buf->lines_cap * sizeof(*buf->lines));
+    if (!buf->lines) {
+      perror("tokbuf_push_line");
+      exit(1);
     }
-    else if (current[current_index] == '"') {
-      token = generate_string_token(current, &current_index);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-    } else if (isdigit(current[current_index])) {
-      token = generate_number(current, &current_index);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (isalpha(current[current_index])) {
-      token = generate_keyword_or_identifier(current, &current_index);
-      tokens[tokens_index] = *token;
-      free(token);
-      tokens_index++;
-      current_index--;
-    } else if (current[current_index] == '\n') {
-      line_number += 1;
+  }
+  buf->lines[buf->nlines].first = (uint32_t)first;
+  buf->lines[buf->nlines].line = (uint32_t)(line - buf->line_base);
+  buf->nlines++;
+}
+
+// Append a token starting at absolute offset `start`.  Capacity must have
+// been reserved.
+static inline void tokbuf_push(TokenBuf *buf, TokenType type, size_t start, size_t line) {
+  if (buf->len == 0 && buf->nlines == 0) {
+    buf->base = start;
+    buf->line_base = line;
+  }
+  size_t rel = start - buf->base;
+  if (rel > UINT32_MAX || line - buf->line_base > UINT32_MAX) {
+    fprintf(stderr, "ERROR: more than 4 GB of source between two top-level statements\n");
+    exit(1);
+  }
+  if (buf->nlines == 0 ||
+      buf->lines[buf->nlines - 1].line != (uint32_t)(line - buf->line_base))
+    tokbuf_push_line(buf, buf->len, line);
+  buf->kind[buf->len] = (uint8_t)type;
+  buf->off[buf->len] = (uint32_t)rel;
+  buf->len++;
+}
+
+size_t tokbuf_line(const TokenBuf *buf, size_t i) {
+  // Last run starting at or before token i.
+  size_t lo = 0, hi = buf->nlines;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (buf->lines[mid].first <= i)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return buf->line_base + (buf->nlines ? buf->lines[lo].line : 0);
+}
+
+// Drop the first n tokens and rebase the remaining offsets and lines.
+static void tokbuf_drop(TokenBuf *buf, size_t n) {
+  if (n == 0)
+    return;
+  size_t live = buf->len - n;
+  size_t run = 0;
+  while (run + 1 < buf->nlines && buf->lines[run + 1].first <= n)
+    run++;
+  if (live == 0) {
+    buf->len = 0;
+    buf->nlines = 0;
+    return;
+  }
+  uint32_t off_delta = buf->off[n];
+  uint32_t line_delta = buf->lines[run].line;
+  memmove(buf->kind, buf->kind + n, live * sizeof(*buf->kind));
+  for (size_t i = 0; i < live; i++)
+    buf->off[i] = buf->off[i + n] - off_delta;
+  buf->nlines -= run;
+  for (size_t r = 0; r < buf->nlines; r++) {
+    LineRun lr = buf->lines[r + run];
+    lr.first = r == 0 ? 0 : lr.first - (uint32_t)n;
+    lr.line -= line_delta;
+    buf->lines[r] = lr;
+  }
+  buf->len = live;
+  buf->base += off_delta;
+  buf->line_base += line_delta;
+}
+
+Token tokbuf_get(const TokenBuf *buf, const Source *src, size_t i) {
+  Token t;
+  t.type = (TokenType)buf->kind[i];
+  t.start = tokbuf_start(buf, i);
+  t.len = (uint32_t)token_length(src, t.type, t.start);
+  t.line_num = tokbuf_line(buf, i);
+  return t;
+}
+
+// Lengths are not stored; they are recovered by rescanning the lexeme,
+// which only happens when a lexeme is materialized.
+size_t token_length(const Source *src, TokenType type, size_t start) {
+  const ScanKernels *k = scan_kernels();
+  size_t i = start - src->base;
+  if (type == END_OF_TOKENS)
+    return 0;
+  if (type == STRING) {
+    size_t lines = 0;
+    return k->find_quote(src->data, i, src->len, &lines) - i;
+  }
+  switch (char_class[(unsigned char)src->data[i]]) {
+  case CC_ALPHA:
+    return k->skip_alpha(src->data, i, src->len) - i;
+  case CC_DIGIT:
+    return k->skip_digit(src->data, i, src->len) - i;
+  default:
+    switch (type) {
+    case EQUALS: case NOT_EQUALS: case LESS_EQUALS: case GREATER_EQUALS:
+    case AND: case OR: case PLUS_PLUS: case MINUS_MINUS:
+    case PLUS_EQUALS: case MINUS_EQUALS:
+      return 2;
+    default:
+      return 1;
+    }
+  }
+}
+
+// --- batch lexing ----------------------------------------------------------
+// The lex_* helpers start at src->data[*i], advance *i past one lexeme and
+// return its type.  They take the kernel set explicitly so lex_batch() can
+// inline them once per instruction set.
+
+#define LEX_INLINE static inline __attribute__((always_inline))
+
+LEX_INLINE TokenType lex_word(const ScanKernels *k, const Source *src, size_t *i) {
+  size_t start = *i;
+  *i = k->skip_alpha(src->data, *i, src->len);
+  return keyword_lookup(src->data + start, *i - start);
+}
+
+// The token starts after the opening quote.  An unterminated string runs to
+// the end of the source.  Newlines inside the literal count towards the line
+// number.
+LEX_INLINE size_t lex_string(const ScanKernels *k, const Source *src, size_t *i, size_t *line) {
+  size_t start = *i + 1;
+  *i = k->find_quote(src->data, start, src->len, line);
+  if (*i < src->len)
+    *i += 1;
+  return start;
+}
+
+void lexer_init(Lexer *lx, const Source *src) {
+  lx->src = src;
+  lx->pos = src->base;
+  lx->line = 0;
+}
+
+// The main loop, written once and instantiated per kernel set below.  Lexes
+// from lx->pos until `max` tokens are produced or the source window ends.
+// Unless the window reaches end of input, a token touching the end of the
+// window may continue in the next chunk, so it is left for the next call.
+LEX_INLINE size_t lex_batch(Lexer *lx, TokenBuf *buf, size_t max, const ScanKernels *kernels) {
+  const Source *src = lx->src;
+  const char *current = src->data;
+  size_t length = src->len;
+  size_t base = src->base;
+  bool eof = src->eof;
+  size_t current_index = lx->pos - base;
+  size_t line = lx->line;
+  size_t count = 0;
+
+  tokbuf_reserve(buf, max + 1);
+  while(count < max && current_index < length) {
+    unsigned char c = (unsigned char)current[current_index];
+    size_t token_index = current_index;
+    size_t token_start = current_index;
+    size_t token_line = line;
+    TokenType type;
+    switch (char_class[c]) {
+    case CC_SPACE:
+    case CC_NEWLINE:
+      current_index = kernels->skip_space(current, current_index, length, &line);
+      continue;
+    case CC_ALPHA:
+      type = lex_word(kernels, src, &current_index);
+      break;
+    case CC_DIGIT:
+      type = INT;
+      current_index = kernels->skip_digit(current, current_index, length);
+      break;
+    case CC_QUOTE:
+      type = STRING;
+      token_start = lex_string(kernels, src, &current_index, &line);
+      break;
+    case CC_PUNCT: {
+      // The second byte of a two-character operator may be in the next chunk.
+      if (!eof && current_index + 1 == length)
+        goto partial;
+      unsigned char n = current_index + 1 < length ? (unsigned char)current[current_index + 1] : 0;
+      type = (TokenType)two_char_token[c][second_char_column[n]];
+      if (type != BEGINNING) {
+        current_index += 2;
+      } else if ((type = (TokenType)single_char_token[c]) != BEGINNING) {
+        current_index += 1;
+      } else {
+        current_index++;
+        continue;
+      }
+      break;
+    }
+    default:
+      current_index++;
+      continue;
+    }
+    if (!eof && current_index == length)
+      goto partial;
+    tokbuf_push(buf, type, base + token_start, token_line);
+    count++;
+    continue;
+  partial:
+    current_index = token_index;
+    line = token_line;
+    break;
+  }
+
+  if (eof && current_index == length && count < max) {
+    tokbuf_push(buf, END_OF_TOKENS, base + length, line);
+    count++;
+  }
+  lx->pos = base + current_index;
+  lx->line = line;
+  return count;
+}
+
+static size_t lex_batch_scalar(Lexer *lx, TokenBuf *buf, size_t max) {
+  return lex_batch(lx, buf, max, &scan_scalar);
+}
+
+#if defined(__x86_64__)
+static size_t lex_batch_sse2(Lexer *lx, TokenBuf *buf, size_t max) {
+  return lex_batch(lx, buf, max, &scan_sse2);
+}
+
+__attribute__((target("avx2,popcnt,bmi")))
+static size_t lex_batch_avx2(Lexer *lx, TokenBuf *buf, size_t max) {
+  return lex_batch(lx, buf, max, &scan_avx2);
+}
+#endif
+
+size_t lexer_next(Lexer *lx, TokenBuf *buf, size_t max) {
+  const ScanKernels *kernels = scan_kernels();
+#if defined(__x86_64__)
+  if (kernels == &scan_avx2)
+    return lex_batch_avx2(lx, buf, max);
+  if (kernels == &scan_sse2)
+    return lex_batch_sse2(lx, buf, max);
+#endif
+  return lex_batch_scalar(lx, buf, max);
+}
+
+// --- parallel lexing -------------------------------------------------------
+// lexer() splits a complete source into chunks that start right after a
+// newline outside any string literal.  No token spans such a newline, so
+// each chunk lexes independently from line 0 and the per-chunk buffers are
+// stitched together by shifting their offsets and lines.  Strings have no
+// escapes, so whether a position is inside one is the parity of the quotes
+// before it; a parallel pre-scan counts quotes per region to find that.
+
+static size_t lex_threads = 0;
+
+size_t lexer_threads(void) {
+  if (!lex_threads) {
+    const char *force = getenv("HSC_LEX_THREADS");
+    long n = force ? atol(force) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+      n = 1;
+    if (n > LEX_MAX_THREADS)
+      n = LEX_MAX_THREADS;
+    lex_threads = (size_t)n;
+  }
+  return lex_threads;
+}
+
+typedef struct {
+  const Source *src;
+  size_t begin;      // window-relative
+  size_t end;
+  size_t quotes;     // pre-scan result
+  Source sub;        // the chunk as a complete source of its own
+  TokenBuf buf;
+  size_t lines;      // newlines in the chunk
+  // Where the chunk lands in the stitched buffer.
+  TokenBuf *dst;
+  size_t lines_before;
+  size_t ntoks;
+  size_t tok_at;
+  size_t nruns;
+  size_t run_at;
+} LexChunk;
+
+static void *count_quotes(void *arg) {
+  LexChunk *c = arg;
+  const char *p = c->src->data + c->begin;
+  const char *end = c->src->data + c->end;
+  size_t n = 0;
+  while ((p = memchr(p, '"', (size_t)(end - p))) != NULL) {
+    n++;
+    p++;
+  }
+  c->quotes = n;
+  return NULL;
+}
+
+// Lex one chunk to its end.  The sub-source is complete, so lexer_next()
+// never asks for a refill.
+static void *lex_chunk(void *arg) {
+  LexChunk *c = arg;
+  Lexer lx;
+  lexer_init(&lx, &c->sub);
+  tokbuf_init(&c->buf);
+  do
+    lexer_next(&lx, &c->buf, TS_BATCH);
+  while (c->buf.kind[c->buf.len - 1] != END_OF_TOKENS);
+  c->lines = lx.line;
+  return NULL;
+}
+
+static void run_chunks(LexChunk *chunks, size_t n, void *(*fn)(void *)) {
+  pthread_t tid[LEX_MAX_THREADS];
+  for (size_t i = 1; i < n; i++)
+    if (pthread_create(&tid[i], NULL, fn, &chunks[i]) != 0) {
+      fprintf(stderr, "ERROR: could not start lexer thread\n");
+      exit(1);
     }
-    current_index++;
+  fn(&chunks[0]);
+  for (size_t i = 1; i < n; i++)
+    pthread_join(tid[i], NULL);
+}
+
+// Split [0, src->len) into at most n chunks at safe boundaries.  Returns
+// the number of chunks.
+static size_t split_chunks(const Source *src, LexChunk *chunks, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    chunks[i].src = src;
+    chunks[i].begin = src->len * i / n;
+    chunks[i].end = src->len * (i + 1) / n;
   }
-  tokens[tokens_index].value = NULL;
-  tokens[tokens_index].type = END_OF_TOKENS;
+  run_chunks(chunks, n, count_quotes);
 
-  free(current);
+  size_t count = 0;
+  size_t quotes = 0;
+  size_t begin = 0;
+  for (size_t i = 1; i < n; i++) {
+    quotes += chunks[i - 1].quotes;
+    bool in_string = quotes & 1;
+    size_t j = chunks[i].begin;
+    if (j < begin)
+      continue;
+    for (; j < src->len; j++) {
+      if (src->data[j] == '"')
+        in_string = !in_string;
+      else if (src->data[j] == '\n' && !in_string)
+        break;
+    }
+    if (j >= src->len)
+      break;
+    chunks[count].begin = begin;
+    chunks[count].end = j + 1;
+    count++;
+    begin = j + 1;
+  }
+  chunks[count].begin = begin;
+  chunks[count].end = src->len;
+  return count + 1;
+}
+
+// Copy a chunk's tokens into its slice of the stitched buffer.  Chunks end
+// right after a newline, so no line run continues across chunks.
+static void *stitch_chunk(void *arg) {
+  LexChunk *c = arg;
+  TokenBuf *dst = c->dst;
+  uint32_t shift = (uint32_t)(c->buf.base - dst->base);
+  size_t line_shift = c->lines_before + c->buf.line_base - dst->line_base;
+  memcpy(dst->kind + c->tok_at, c->buf.kind, c->ntoks * sizeof(*dst->kind));
+  for (size_t i = 0; i < c->ntoks; i++)
+    dst->off[c->tok_at + i] = c->buf.off[i] + shift;
+  for (size_t r = 0; r < c->nruns; r++) {
+    dst->lines[c->run_at + r].first = (uint32_t)(c->tok_at + c->buf.lines[r].first);
+    dst->lines[c->run_at + r].line = (uint32_t)(c->buf.lines[r].line + line_shift);
+  }
+  tokbuf_free(&c->buf);
+  return NULL;
+}
+
+void lexer(Source *src, TokenBuf *buf) {
+  // Every token stays alive, so read the whole input into the window.
+  while (!src->eof)
+    if (source_refill(src, src->base) != 0) {
+      fprintf(stderr, "ERROR: could not read source\n");
+      exit(1);
+    }
+  // Pick the kernels before any thread can race to do it.
+  scan_kernels();
+  tokbuf_init(buf);
+
+  size_t n = lexer_threads();
+  if (n > src->len / LEX_MIN_CHUNK)
+    n = src->len / LEX_MIN_CHUNK;
+  if (n <= 1) {
+    Lexer lx;
+    lexer_init(&lx, src);
+    do
+      lexer_next(&lx, buf, TS_BATCH);
+    while (buf->kind[buf->len - 1] != END_OF_TOKENS);
+    return;
+  }
+
+  LexChunk chunks[LEX_MAX_THREADS];
+  n = split_chunks(src, chunks, n);
+  for (size_t i = 0; i < n; i++) {
+    chunks[i].sub = *src;
+    chunks[i].sub.data = src->data + chunks[i].begin;
+    chunks[i].sub.base = src->base + chunks[i].begin;
+    chunks[i].sub.len = chunks[i].end - chunks[i].begin;
+    chunks[i].sub.eof = true;
+  }
+  run_chunks(chunks, n, lex_chunk);
+
+  // Lay out the chunks, dropping the END_OF_TOKENS of all but the last,
+  // then copy them into place in parallel.
+  size_t lines = 0, ntoks = 0, nruns = 0;
+  for (size_t i = 0; i < n; i++) {
+    LexChunk *c = &chunks[i];
+    c->dst = buf;
+    c->lines_before = lines;
+    c->ntoks = i + 1 == n ? c->buf.len : c->buf.len - 1;
+    c->tok_at = ntoks;
+    c->nruns = c->buf.nlines;
+    while (c->nruns > 0 && c->buf.lines[c->nruns - 1].first >= c->ntoks)
+      c->nruns--;
+    c->run_at = nruns;
+    if (ntoks == 0 && c->ntoks > 0) {
+      buf->base = c->buf.base;
+      buf->line_base = lines + c->buf.line_base;
+    }
+    lines += c->lines;
+    ntoks += c->ntoks;
+    nruns += c->nruns;
+  }
+  const LexChunk *last = &chunks[n - 1];
+  if (last->buf.base - buf->base + last->buf.off[last->buf.len - 1] > UINT32_MAX ||
+      lines - buf->line_base > UINT32_MAX) {
+    fprintf(stderr, "ERROR: source too large to lex as one buffer\n");
+    exit(1);
+  }
+  tokbuf_reserve(buf, ntoks);
+  buf->lines = malloc(nruns * sizeof(*buf->lines));
+  if (!buf->lines) {
+    perror("lexer");
+    exit(1);
+  }
+  buf->lines_cap = buf->nlines = nruns;
+  buf->len = ntoks;
+  run_chunks(chunks, n, stitch_chunk);
+}
+
+// --- token stream ----------------------------------------------------------
+
+void ts_init(TokenStream *ts, Source *src) {
+  ts->src = src;
+  lexer_init(&ts->lx, src);
+  tokbuf_init(&ts->buf);
+  ts->pos = 0;
+  ts->ahead = false;
+}
+
+void ts_lex_ahead(TokenStream *ts) {
+  Source *src = ts->src;
+  if (!src->mapped || src->len < 2 * (size_t)LEX_MIN_CHUNK ||
+      src->len > UINT32_MAX || lexer_threads() < 2)
+    return;
+  lexer(src, &ts->buf);
+  ts->ahead = true;
+  // Leave the on-demand lexer at the end, where it only yields
+  // END_OF_TOKENS.
+  ts->lx.pos = src->base + src->len;
+  ts->lx.line = tokbuf_line(&ts->buf, ts->buf.len - 1);
+}
+
+void ts_free(TokenStream *ts) {
+  tokbuf_free(&ts->buf);
+  ts->pos = 0;
+}
+
+void ts_fill(TokenStream *ts) {
+  while (ts->pos >= ts->buf.len) {
+    if (lexer_next(&ts->lx, &ts->buf, TS_BATCH) > 0)
+      continue;
+    // The window ended inside a token: keep the text of live tokens and
+    // read the next chunk.
+    size_t keep = ts->buf.len > 0 ? tokbuf_start(&ts->buf, 0) : ts->lx.pos;
+    if (source_refill(ts->src, keep) != 0) {
+      fprintf(stderr, "ERROR: could not read source\n");
+      exit(1);
+    }
+  }
+}
+
+void ts_retire(TokenStream *ts) {
+  if (ts->ahead) {
+    // Dropping would shift the rest of the file's tokens every statement.
+    source_release(ts->src, ts->pos < ts->buf.len ? tokbuf_start(&ts->buf, ts->pos) : ts->lx.pos);
+    return;
+  }
+  tokbuf_drop(&ts->buf, ts->pos);
+  ts->pos = 0;
+  source_release(ts->src, ts->buf.len > 0 ? tokbuf_start(&ts->buf, 0) : ts->lx.pos);
+}
+
+size_t ts_line(const TokenStream *ts, size_t i) {
+  return tokbuf_line(&ts->buf, i);
+}
+
+char *ts_strdup(const TokenStream *ts, size_t i, Arena *arena) {
+  TokenType type = (TokenType)ts->buf.kind[i];
+  size_t start = tokbuf_start(&ts->buf, i);
+  return arena_strndup(arena, ts->src->data + (start - ts->src->base),
+                       token_length(ts->src, type, start));
+}
 
-  return tokens;
+Atom ts_atom(const TokenStream *ts, size_t i) {
+  TokenType type = (TokenType)ts->buf.kind[i];
+  size_t start = tokbuf_start(&ts->buf, i);
+  return intern(ts->src->data + (start - ts->src->base),
+                token_length(ts->src, type, start));
 }
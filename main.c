@@ -6,10 +6,14 @@
 #include <stddef.h>
 
 #include "lexer.h"
+#include "token_helpers.h"
 #include "parser.h"
 #include "tools.h"
 #include "codegen.h"
 #include "sem.h"
+#include "opt.h"
+#include "peephole.h"
+#include "watch.h"
 
 extern unsigned char rt_o_start[];
 extern unsigned char rt_o_end[];
@@ -26,26 +30,88 @@ static int dump_runtime(const char *path) {
   return 0;
 }
 
-void print_tokens(Token *t) {
-  size_t i = 0;
-  while(t[i].value != NULL){
-    print_token(t[i]);
-    i++;
+// Assemble `asm_path` and link it with the embedded runtime.
+static int build_binary(const char *asm_path, const char *bin_path) {
+  if (dump_runtime("build/rt_tmp.o") != 0) {
+    fprintf(stderr, "ERROR: failed to write runtime object\n");
+    return 1;
+  }
+  char cmd[512];
+  snprintf(cmd, sizeof(cmd), "gcc -Wa,--noexecstack -c %s -o build/out.o", asm_path);
+  if (system(cmd) != 0) {
+    fprintf(stderr, "ERROR: failed to assemble output\n");
+    return 1;
+  }
+  snprintf(cmd, sizeof(cmd), "gcc build/out.o build/rt_tmp.o -o %s", bin_path);
+  if (system(cmd) != 0) {
+    fprintf(stderr, "ERROR: failed to link binary\n");
+    return 1;
+  }
+  return 0;
+}
+
+// Set by --skip-teardown: leave the AST pool and atom table to the OS at
+// exit instead of freeing them.
+static int skip_teardown = 0;
+
+static void teardown(Ast *ast) {
+  if (skip_teardown)
+    return;
+  ast_free(ast);
+  intern_free();
+}
+
+void print_tokens(TokenStream *ts) {
+  while (peek(ts) != END_OF_TOKENS) {
+    print_token(ts->src, tokbuf_get(&ts->buf, ts->src, next(ts)));
+    ts_retire(ts);
   }
 }
 
 int main(int argc, char *argv[]) {
   int ast_only = 0;
+  int ir_only = 0;
   const char *emit_path = NULL;
   int compile_bin = 0;
   const char *bin_path = NULL;
   int run_bin = 0;
+  int watch = 0;
+  unsigned peephole = PEEP_ALL;
+  int peephole_stats = 0;
+  unsigned unroll = 0;
   int argi = 1;
 
   while (argc > argi) {
     if (strcmp(argv[argi], "--ast-only") == 0) {
       ast_only = 1;
       argi++;
+    } else if (strcmp(argv[argi], "--emit-ir") == 0) {
+      ir_only = 1;
+      argi++;
+    } else if (strcmp(argv[argi], "--skip-teardown") == 0) {
+      skip_teardown = 1;
+      argi++;
+    } else if (strncmp(argv[argi], "--peephole=", 11) == 0) {
+      if (!peephole_parse(argv[argi] + 11, &peephole)) {
+        fprintf(stderr, "--peephole takes a comma-separated list of moves, stack, jumps, flags, all or none\n");
+        return 1;
+      }
+      argi++;
+    } else if (strncmp(argv[argi], "--unroll=", 9) == 0) {
+      char *end;
+      unsigned long n = strtoul(argv[argi] + 9, &end, 10);
+      if (end == argv[argi] + 9 || *end || n < 1 || n > 64) {
+        fprintf(stderr, "--unroll takes a factor from 1 to 64\n");
+        return 1;
+      }
+      unroll = (unsigned)n;
+      argi++;
+    } else if (strcmp(argv[argi], "--peephole-stats") == 0) {
+      peephole_stats = 1;
+      argi++;
+    } else if (strcmp(argv[argi], "--watch") == 0) {
+      watch = 1;
+      argi++;
     } else if (strcmp(argv[argi], "--emit-asm") == 0) {
       emit_path = "build/out.s";
       if (argc > argi + 2 && argv[argi + 1][0] != '-') {
@@ -79,30 +145,68 @@ int main(int argc, char *argv[]) {
   }
 
   if (argc <= argi) {
-    fprintf(stderr, "Usage: %s [--ast-only] [--emit-asm [path]] [--compile [output]] <file>\n", argv[0]);
+    fprintf(stderr, "Usage: %s [--ast-only] [--emit-ir] [--skip-teardown] [--peephole=LIST] [--peephole-stats] [--unroll=N] [--watch] [--emit-asm [path]] [--compile [output]] <file>\n", argv[0]);
+    fprintf(stderr, "  --emit-ir prints main's IR after optimization, as codegen sees it\n");
     return 1;
   }
 
-  FILE *file = fopen(argv[argi], "r");
+  if (watch) {
+    if (strcmp(argv[argi], "-") == 0) {
+      fprintf(stderr, "--watch needs a file, not standard input\n");
+      return 1;
+    }
+    if (system("mkdir -p build") != 0) {
+      fprintf(stderr, "ERROR: could not create build directory\n");
+      return 1;
+    }
+    return watch_file(argv[argi], emit_path ? emit_path : "build/out.s",
+                      bin_path ? bin_path : "a.out", build_binary);
+  }
 
-  if(!file){
+  Source src;
+  if (source_open(&src, argv[argi]) != 0) {
     printf("ERROR: File not found\n");
     exit(1);
   }
 
-  Token *tokens = lexer(file);
+  TokenStream ts;
+  ts_init(&ts, &src);
+  ts_lex_ahead(&ts);
+  Ast ast;
+  ast_init(&ast);
 
   if (ast_only) {
-    Node *root = parser(tokens);
+    NodeId root = parser(&ts, &ast);
+    ts_free(&ts);
+    source_close(&src);
     printf("Printing AST (Abstract Syntax Tree):\n");
-    print_tree(root, 0);
+    print_tree(&ast, root, 0);
     fflush(stdout);
-    free_tree(root);
+    teardown(&ast);
     return 0;
   }
 
-  Node *root = parser(tokens);
-  sem_program(root);
+  NodeId root = parser(&ts, &ast);
+  ts_free(&ts);
+  source_close(&src);
+  sem_program(&ast, root);
+  opt_program(&ast, root);
+
+  if (ir_only) {
+    NodeId main_fn = codegen_find_main(&ast, root);
+    if (!main_fn) {
+      fprintf(stderr, "codegen: no main\n");
+      teardown(&ast);
+      return 1;
+    }
+    IrFn fn;
+    codegen_ir(&fn, &ast, main_fn, unroll);
+    bool ok = ir_verify(&fn);
+    ir_dump(&fn, stdout);
+    ir_free(&fn);
+    teardown(&ast);
+    return ok ? 0 : 1;
+  }
 
   if (!compile_bin && emit_path == NULL) {
     emit_path = "build/out.s";
@@ -120,40 +224,32 @@ int main(int argc, char *argv[]) {
 
   if (system("mkdir -p build") != 0) {
     fprintf(stderr, "ERROR: could not create build directory\n");
-    free_tree(root);
+    teardown(&ast);
     return 1;
   }
 
   FILE *outf = fopen(emit_path, "w");
   if (!outf) {
     fprintf(stderr, "ERROR: Could not open %s for writing\n", emit_path);
-    free_tree(root);
+    teardown(&ast);
     return 1;
   }
 
   Codegen *cg = codegen_create(outf);
-  codegen_program(cg, root);
+  codegen_set_peephole(cg, peephole, peephole_stats);
+  codegen_set_unroll(cg, unroll);
+  codegen_program(cg, &ast, root);
   codegen_free(cg);
   fclose(outf);
-  if (dump_runtime("build/rt_tmp.o") != 0) {
-    fprintf(stderr, "ERROR: failed to write runtime object\n");
-    free_tree(root);
-    return 1;
-  }
   if (compile_bin) {
-    char cmd[512];
-    snprintf(cmd, sizeof(cmd), "gcc -Wa,--noexecstack -c %s -o build/out.o", emit_path);
-    if (system(cmd) != 0) {
-      fprintf(stderr, "ERROR: failed to assemble output\n");
-      free_tree(root);
-      return 1;
-    }
-    snprintf(cmd, sizeof(cmd), "gcc build/out.o build/rt_tmp.o -o %s", bin_path);
-    if (system(cmd) != 0) {
-      fprintf(stderr, "ERROR: failed to link binary\n");
-      free_tree(root);
+    if (build_binary(emit_path, bin_path) != 0) {
+      teardown(&ast);
       return 1;
     }
+  } else if (dump_runtime("build/rt_tmp.o") != 0) {
+    fprintf(stderr, "ERROR: failed to write runtime object\n");
+    teardown(&ast);
+    return 1;
   }
 
   if (run_bin) {
@@ -167,10 +263,10 @@ int main(int argc, char *argv[]) {
     if (rc != -1) {
       rc = WEXITSTATUS(rc);
     }
-    free_tree(root);
+    teardown(&ast);
     return rc;
   }
 
-  free_tree(root);
+  teardown(&ast);
   return 0;
 }
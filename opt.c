@@ -0,0 +1,887 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "codegen.h"
+#include "opt.h"
+#include "stack.h"
+
+// Folding runs on one function at a time.  Analysis numbered the function's
+// variables with frame slots, so what is known about a variable is kept in
+// tables indexed by slot.  Nested functions have slots of their own and are
+// queued instead of entered.
+
+typedef struct {
+  NodeId id;
+  bool operands_done;
+} ExprFrame;
+
+typedef struct {
+  NodeId id;
+  bool children_done;
+} StmtFrame;
+
+typedef enum { LF_BLOCK, LF_IF, LF_LOOP } LiveKind;
+
+// A block, if or loop the dead-store walk is inside; see live_block.
+typedef struct {
+  NodeId id;
+  uint8_t kind;      // LiveKind
+  bool apply;        // rewrite dead stores
+  bool final;        // LF_LOOP: the pass in progress is the rewriting one
+  uint32_t left;     // LF_BLOCK: statements not walked; LF_IF: arms
+  NodeId arm;        // LF_IF: arm whose then block was walked last
+  uint64_t *live;    // the set the frame updates
+  uint64_t *out;     // LF_IF: live after the if; LF_LOOP: live at the head
+  uint64_t *tmp;     // LF_IF: one arm's set; LF_LOOP: one iteration's
+} LiveFrame;
+
+typedef struct {
+  Ast *ast;
+  uint32_t nslots;        // highest slot in the function + 1
+  uint8_t *written;       // slot is assigned somewhere besides its `let`
+  NodeId *value;          // literal a never-written slot holds, or NODE_NONE
+  uint32_t bool_lit[2];   // lexemes "false" and "true", once added
+  size_t words;           // size of a live set, in 64-bit words
+  STACK(ExprFrame) work;
+  STACK(NodeId) stmts;
+  STACK(NodeId) nodes;    // every node of the function, see collect_nodes
+  STACK(StmtFrame) frames;
+  STACK(NodeId) fns;      // functions still to fold
+  STACK(LiveFrame) live_frames;
+  STACK(NodeId) arms;     // elif arms the dead-store walk has yet to visit
+} Opt;
+
+// --- literals ---------------------------------------------------------------
+
+// The value of an integer or boolean literal.  Integer lexemes that do not
+// fit in an int64_t are left unfolded; lowering wraps those up to 2^64 - 1
+// and reports the rest (see int_literal in ir.c).
+static bool const_value(const Ast *ast, const Node *node, int64_t *v) {
+  if (node->kind == NK_Bool) {
+    *v = strcmp(ast_lit(ast, node), "true") == 0;
+    return true;
+  }
+  if (node->kind != NK_Int)
+    return false;
+  char *end;
+  errno = 0;
+  long long x = strtoll(ast_lit(ast, node), &end, 10);
+  if (errno || *end)
+    return false;
+  *v = x;
+  return true;
+}
+
+// Turn `node` into a literal in place; its id and type stay the same.
+static void set_literal(Node *node, NodeKind kind, uint32_t lit) {
+  node->kind = (uint8_t)kind;
+  node->op = 0;
+  node->flags = 0;
+  node->lit = lit;
+  node->right = NODE_NONE;
+  node->name = ATOM_NONE;
+}
+
+static void set_int(Opt *o, Node *node, int64_t v) {
+  char buf[24];
+  int len = snprintf(buf, sizeof(buf), "%lld", (long long)v);
+  set_literal(node, NK_Int, ast_add_lit(o->ast, buf, (size_t)len));
+}
+
+static void set_bool(Opt *o, Node *node, bool v) {
+  if (!o->bool_lit[v])
+    o->bool_lit[v] = v ? ast_add_lit(o->ast, "true", 4)
+                       : ast_add_lit(o->ast, "false", 5);
+  set_literal(node, NK_Bool, o->bool_lit[v]);
+}
+
+static void set_concat(Opt *o, Node *node, const Node *l, const Node *r) {
+  const char *a = ast_lit(o->ast, l), *b = ast_lit(o->ast, r);
+  size_t alen = strlen(a), blen = strlen(b);
+  char *buf = malloc(alen + blen + 1);
+  if (!buf) {
+    perror("opt");
+    exit(1);
+  }
+  memcpy(buf, a, alen);
+  memcpy(buf + alen, b, blen);
+  set_literal(node, NK_String, ast_add_lit(o->ast, buf, alen + blen));
+  free(buf);
+}
+
+// --- expressions ------------------------------------------------------------
+
+static void fold_unary(Opt *o, Node *node) {
+  const Node *operand = ast_node(o->ast, node->left);
+  int64_t v;
+  if (!node->left || !const_value(o->ast, operand, &v))
+    return;
+  switch (node->op) {
+  case NOT:
+    if (operand->kind == NK_Bool)
+      set_bool(o, node, !v);
+    break;
+  case DASH:
+    if (operand->kind == NK_Int)
+      set_int(o, node, (int64_t)(0 - (uint64_t)v));
+    break;
+  case PLUS:
+    if (operand->kind == NK_Int)
+      set_literal(node, NK_Int, operand->lit);
+    break;
+  default:
+    break;
+  }
+}
+
+// `&&` and `||` with a constant operand.  The right operand runs only when
+// the left one does not decide the result, so a deciding left constant
+// drops it; a right constant can only drop itself.
+static void fold_logical(Opt *o, Node *node, const Node *l, const Node *r) {
+  bool is_and = node->op == AND;
+  int64_t v;
+  if (l->kind == NK_Bool && const_value(o->ast, l, &v)) {
+    if ((v != 0) != is_and)
+      set_bool(o, node, v != 0);
+    else
+      *node = *r;
+  } else if (r->kind == NK_Bool && const_value(o->ast, r, &v)) {
+    if ((v != 0) == is_and)
+      *node = *l;
+  }
+}
+
+static void fold_binary(Opt *o, Node *node) {
+  if (!node->left || !node->right)
+    return;
+  const Node *l = ast_node(o->ast, node->left);
+  const Node *r = ast_node(o->ast, node->right);
+  if (node->op == AND || node->op == OR) {
+    fold_logical(o, node, l, r);
+    return;
+  }
+  // Strings compare by address, so only concatenation is folded.
+  if (l->kind == NK_String && r->kind == NK_String) {
+    if (node->op == PLUS)
+      set_concat(o, node, l, r);
+    return;
+  }
+  int64_t a, b;
+  if (l->kind != r->kind || !const_value(o->ast, l, &a) ||
+      !const_value(o->ast, r, &b))
+    return;
+  // Arithmetic wraps like the emitted instructions.
+  uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+  switch (node->op) {
+  case PLUS:
+    set_int(o, node, (int64_t)(ua + ub));
+    break;
+  case DASH:
+    set_int(o, node, (int64_t)(ua - ub));
+    break;
+  case STAR:
+    set_int(o, node, (int64_t)(ua * ub));
+    break;
+  case SLASH:
+  case PERCENT:
+    // Left in place so the program still traps at run time.
+    if (b == 0 || (a == INT64_MIN && b == -1))
+      break;
+    set_int(o, node, node->op == SLASH ? a / b : a % b);
+    break;
+  case EQUALS:
+    set_bool(o, node, a == b);
+    break;
+  case NOT_EQUALS:
+    set_bool(o, node, a != b);
+    break;
+  case LESS:
+    set_bool(o, node, a < b);
+    break;
+  case LESS_EQUALS:
+    set_bool(o, node, a <= b);
+    break;
+  case GREATER:
+    set_bool(o, node, a > b);
+    break;
+  case GREATER_EQUALS:
+    set_bool(o, node, a >= b);
+    break;
+  default:
+    break;
+  }
+}
+
+// A use of a variable whose `let` is its only store reads the initializer.
+static void fold_identifier(Opt *o, Node *node) {
+  if (node->slot >= o->nslots || !o->value[node->slot])
+    return;
+  const Node *lit = ast_node(o->ast, o->value[node->slot]);
+  set_literal(node, (NodeKind)lit->kind, lit->lit);
+}
+
+// Post-order walk on an explicit stack, as in sem_expr: a node is folded
+// once its operands are, so constants bubble up through a whole expression.
+static void fold_expr(Opt *o, NodeId root) {
+  if (!root)
+    return;
+  size_t base = o->work.len;
+  stack_push(&o->work, ((ExprFrame){root, false}));
+  while (o->work.len > base) {
+    ExprFrame *f = stack_top(&o->work);
+    Node *node = ast_node(o->ast, f->id);
+    bool operands = node->kind == NK_Unary || node->kind == NK_Binary ||
+                    node->kind == NK_Assign;
+    if (!operands || f->operands_done) {
+      o->work.len--;
+      if (node->kind == NK_Unary)
+        fold_unary(o, node);
+      else if (node->kind == NK_Binary)
+        fold_binary(o, node);
+      else if (node->kind == NK_Identifier)
+        fold_identifier(o, node);
+      continue;
+    }
+    f->operands_done = true;
+    // Assignment and ++/-- targets are written, so they are never replaced.
+    NodeId left = node->left, right = node->right;
+    if (node->kind != NK_Unary && right)
+      stack_push(&o->work, ((ExprFrame){right, false}));
+    if (left && node->kind != NK_Assign)
+      stack_push(&o->work, ((ExprFrame){left, false}));
+  }
+}
+
+// --- propagation ------------------------------------------------------------
+
+// The slot of the variable an assignment or ++/-- writes, or 0.
+static uint32_t target_slot(const Ast *ast, const Node *node) {
+  const Node *target = node->left ? ast_node(ast, node->left) : NULL;
+  return target && target->kind == NK_Identifier ? target->slot : 0;
+}
+
+// Every node of the function with body `body` into o->nodes, leaving out
+// nested functions.
+static void collect_nodes(Opt *o, NodeId body) {
+  o->nodes.len = 0;
+  o->stmts.len = 0;
+  stack_push(&o->stmts, body);
+  while (o->stmts.len) {
+    NodeId id = stack_pop(&o->stmts);
+    if (!id)
+      continue;
+    const Node *node = ast_node(o->ast, id);
+    if (node->kind == NK_FnDecl)
+      continue;
+    stack_push(&o->nodes, id);
+    if (node_is_list(node->kind)) {
+      for (size_t i = 0; i < node->count; i++)
+        stack_push(&o->stmts, ast_child(o->ast, node, i));
+      continue;
+    }
+    if (node_has_left(node->kind))
+      stack_push(&o->stmts, node->left);
+    if (node_has_right(node->kind))
+      stack_push(&o->stmts, node->right);
+  }
+}
+
+// Size the slot tables for `body` and mark every slot that is written
+// after its `let`.
+static void scan_writes(Opt *o, NodeId body) {
+  collect_nodes(o, body);
+  uint32_t top = 0;
+  for (size_t i = 0; i < o->nodes.len; i++) {
+    const Node *node = ast_node(o->ast, o->nodes.items[i]);
+    if (node->kind == NK_LetStmt && node->slot > top)
+      top = node->slot;
+  }
+  o->nslots = top + 1;
+  o->written = calloc(o->nslots, sizeof(*o->written));
+  o->value = calloc(o->nslots, sizeof(*o->value));
+  if (!o->written || !o->value) {
+    perror("opt");
+    exit(1);
+  }
+  for (size_t i = 0; i < o->nodes.len; i++) {
+    const Node *node = ast_node(o->ast, o->nodes.items[i]);
+    if (node->kind == NK_AssignStmt || node->kind == NK_Assign ||
+        (node->kind == NK_Unary &&
+         (node->op == PLUS_PLUS || node->op == MINUS_MINUS))) {
+      uint32_t slot = target_slot(o->ast, node);
+      if (slot < o->nslots)
+        o->written[slot] = 1;
+    }
+  }
+}
+
+// Fold every expression of `body` in source order, so a `let` is seen
+// before any use of its variable.
+static void fold_body(Opt *o, NodeId body) {
+  o->stmts.len = 0;
+  stack_push(&o->stmts, body);
+  while (o->stmts.len) {
+    NodeId id = stack_pop(&o->stmts);
+    if (!id)
+      continue;
+    Node *node = ast_node(o->ast, id);
+    switch (node->kind) {
+    case NK_FnDecl:
+      stack_push(&o->fns, id);
+      break;
+    case NK_Program: case NK_Block:
+    case NK_IfStmt: case NK_WhileStmt: case NK_ForStmt:
+      for (size_t i = node->count; i-- > 0;)
+        stack_push(&o->stmts, ast_child(o->ast, node, i));
+      break;
+    case NK_LetStmt:
+      fold_expr(o, node->right);
+      // Statements after an `exit` are never analysed and have no slot.
+      if (node->right && node->slot && !o->written[node->slot] &&
+          node_is_literal(ast_node(o->ast, node->right)->kind))
+        o->value[node->slot] = node->right;
+      break;
+    case NK_AssignStmt:
+      fold_expr(o, node->right);
+      break;
+    case NK_ExprStmt: case NK_WriteStmt: case NK_ExitStmt:
+      fold_expr(o, node->left);
+      break;
+    default:
+      fold_expr(o, id);
+      break;
+    }
+  }
+}
+
+// --- dead code --------------------------------------------------------------
+
+// True if evaluating `root` has no effect besides its value.  Division may
+// trap, so it counts as an effect.
+static bool is_pure(Opt *o, NodeId root) {
+  o->stmts.len = 0;
+  stack_push(&o->stmts, root);
+  while (o->stmts.len) {
+    NodeId id = stack_pop(&o->stmts);
+    if (!id)
+      continue;
+    const Node *node = ast_node(o->ast, id);
+    if (node->kind == NK_Assign ||
+        (node->kind == NK_Unary &&
+         (node->op == PLUS_PLUS || node->op == MINUS_MINUS)) ||
+        (node->kind == NK_Binary &&
+         (node->op == SLASH || node->op == PERCENT)))
+      return false;
+    if (node->kind == NK_Unary || node->kind == NK_Binary) {
+      stack_push(&o->stmts, node->left);
+      if (node->kind == NK_Binary)
+        stack_push(&o->stmts, node->right);
+    }
+  }
+  return true;
+}
+
+static void set_empty(Node *node) {
+  node->kind = NK_Block;
+  node->op = 0;
+  node->flags = 0;
+  node->first = 0;
+  node->count = 0;
+}
+
+static bool is_empty(const Node *node) {
+  return node->kind == NK_Block && node->count == 0;
+}
+
+// Replace a branch or loop whose condition folded to a constant by the code
+// that actually runs.  A whole elif chain collapses arm by arm in place; a
+// `true` loop condition is dropped, so the loop is emitted without a test.
+static void resolve_branch(Opt *o, Node *node) {
+  while (node->kind == NK_IfStmt || node->kind == NK_WhileStmt ||
+         node->kind == NK_ForStmt) {
+    size_t at = node->kind == NK_ForStmt ? 1 : 0;
+    NodeId cond_id = ast_child(o->ast, node, at);
+    const Node *cond = cond_id ? ast_node(o->ast, cond_id) : NULL;
+    int64_t v;
+    if (!cond || cond->kind != NK_Bool || !const_value(o->ast, cond, &v))
+      return;
+    switch (node->kind) {
+    case NK_IfStmt: {
+      NodeId taken = ast_child(o->ast, node, v ? 1 : 2);
+      if (!taken) {
+        set_empty(node);
+        return;
+      }
+      *node = *ast_node(o->ast, taken);  // the then block, else, or next arm
+      if (node->kind != NK_IfStmt)
+        return;
+      break;
+    }
+    case NK_WhileStmt:
+      if (v)
+        o->ast->kids[node->first] = NODE_NONE;
+      else
+        set_empty(node);
+      return;
+    case NK_ForStmt: {
+      if (v) {
+        o->ast->kids[node->first + 1] = NODE_NONE;
+        return;
+      }
+      // Only the initializer runs.
+      NodeId init = ast_child(o->ast, node, 0);
+      uint8_t kind = init ? ast_node(o->ast, init)->kind : NK_Block;
+      if (!init)
+        set_empty(node);
+      else if (kind == NK_LetStmt || kind == NK_AssignStmt)
+        *node = *ast_node(o->ast, init);
+      else
+        o->ast->kids[node->first + 2] = o->ast->kids[node->first + 3] = NODE_NONE;
+      return;
+    }
+    default:
+      return;
+    }
+  }
+}
+
+// Drop empty blocks, expression statements without effects and everything
+// after a statement that never completes.
+static void prune_block(Opt *o, Node *block) {
+  NodeId *kids = o->ast->kids + block->first;
+  uint32_t n = 0;
+  block->flags &= (uint8_t)~NF_EXITS;
+  for (uint32_t i = 0; i < block->count; i++) {
+    const Node *stmt = kids[i] ? ast_node(o->ast, kids[i]) : NULL;
+    if (!stmt || is_empty(stmt) ||
+        (stmt->kind == NK_ExprStmt && is_pure(o, stmt->left)))
+      continue;
+    kids[n++] = kids[i];
+    if (stmt->flags & NF_EXITS) {
+      block->flags |= NF_EXITS;
+      break;
+    }
+  }
+  block->count = n;
+}
+
+static void prune_if(Opt *o, Node *node) {
+  NodeId else_id = ast_child(o->ast, node, 2);
+  if (else_id && is_empty(ast_node(o->ast, else_id)))
+    node->count = 2, else_id = NODE_NONE;
+  NodeId then_id = ast_child(o->ast, node, 1);
+  const Node *then_block = then_id ? ast_node(o->ast, then_id) : NULL;
+  if (!else_id && (!then_block || is_empty(then_block)) &&
+      is_pure(o, ast_child(o->ast, node, 0))) {
+    set_empty(node);
+    return;
+  }
+  // No loop can be left early, so an if exits only if every arm does.
+  if (else_id && then_block && (then_block->flags & NF_EXITS) &&
+      (ast_node(o->ast, else_id)->flags & NF_EXITS))
+    node->flags |= NF_EXITS;
+}
+
+// Post-order over the statements of `body`: branches with constant
+// conditions are resolved on the way down, and each block is pruned once
+// its statements have been, so it can see which of them never complete.
+// A loop without a condition never completes, as the language has no
+// `break`.
+static void prune_body(Opt *o, NodeId body) {
+  o->frames.len = 0;
+  stack_push(&o->frames, ((StmtFrame){body, false}));
+  while (o->frames.len) {
+    StmtFrame *f = stack_top(&o->frames);
+    Node *node = ast_node(o->ast, f->id);
+    if (f->children_done) {
+      o->frames.len--;
+      if (node->kind == NK_Block)
+        prune_block(o, node);
+      else if (node->kind == NK_IfStmt)
+        prune_if(o, node);
+      continue;
+    }
+    f->children_done = true;
+    resolve_branch(o, node);
+    NodeId kids[3];
+    size_t nkids = 0;
+    switch (node->kind) {
+    case NK_Block:
+      for (size_t i = node->count; i-- > 0;) {
+        NodeId kid = ast_child(o->ast, node, i);
+        if (kid)
+          stack_push(&o->frames, ((StmtFrame){kid, false}));
+      }
+      break;
+    case NK_IfStmt:
+      kids[nkids++] = ast_child(o->ast, node, 2);
+      kids[nkids++] = ast_child(o->ast, node, 1);
+      break;
+    case NK_WhileStmt:
+      kids[nkids++] = ast_child(o->ast, node, 1);
+      if (!ast_child(o->ast, node, 0))
+        node->flags |= NF_EXITS;
+      break;
+    case NK_ForStmt:
+      kids[nkids++] = ast_child(o->ast, node, 3);
+      if (!ast_child(o->ast, node, 1))
+        node->flags |= NF_EXITS;
+      break;
+    case NK_ExitStmt:
+      node->flags |= NF_EXITS;
+      break;
+    default:
+      break;
+    }
+    for (size_t i = 0; i < nkids; i++) {
+      if (kids[i])
+        stack_push(&o->frames, ((StmtFrame){kids[i], false}));
+    }
+  }
+}
+
+// --- dead stores ------------------------------------------------------------
+
+// Backward liveness over the structured tree.  A live set has one bit per
+// slot: the variable's current value may still be read.  A store to a slot
+// that is not live afterwards is dead; the store goes, and what computes
+// the value stays as an expression statement if it has effects.  Loops
+// iterate to a fixed point without rewriting anything, then rewrite their
+// body once with the final sets.
+
+static uint64_t *live_new(Opt *o) {
+  uint64_t *set = calloc(o->words, sizeof(*set));
+  if (!set) {
+    perror("opt");
+    exit(1);
+  }
+  return set;
+}
+
+static bool live_has(const uint64_t *set, uint32_t slot) {
+  return set[slot / 64] >> (slot % 64) & 1;
+}
+
+static void live_add(uint64_t *set, uint32_t slot) {
+  set[slot / 64] |= (uint64_t)1 << (slot % 64);
+}
+
+static void live_del(uint64_t *set, uint32_t slot) {
+  set[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+}
+
+// dst |= src; returns whether dst grew.
+static bool live_union(Opt *o, uint64_t *dst, const uint64_t *src) {
+  bool grew = false;
+  for (size_t i = 0; i < o->words; i++) {
+    grew |= (src[i] & ~dst[i]) != 0;
+    dst[i] |= src[i];
+  }
+  return grew;
+}
+
+// Every variable `expr` mentions is read.  That over-approximates for
+// assignment targets inside expressions, which only keeps more stores.
+static void live_uses(Opt *o, NodeId expr, uint64_t *live) {
+  o->stmts.len = 0;
+  stack_push(&o->stmts, expr);
+  while (o->stmts.len) {
+    NodeId id = stack_pop(&o->stmts);
+    if (!id)
+      continue;
+    const Node *node = ast_node(o->ast, id);
+    if (node->kind == NK_Identifier && node->slot && node->slot < o->nslots)
+      live_add(live, node->slot);
+    else if (node->kind == NK_Unary || node->kind == NK_Binary ||
+             node->kind == NK_Assign) {
+      stack_push(&o->stmts, node->left);
+      if (node->kind != NK_Unary)
+        stack_push(&o->stmts, node->right);
+    }
+  }
+}
+
+// A `let` or plain assignment of `value` to `slot`.  A dead one becomes an
+// expression statement that keeps the value only if it has effects, so a
+// pure value reads nothing.
+static void live_store(Opt *o, Node *stmt, uint32_t slot, uint64_t *live,
+                       bool apply) {
+  NodeId value = stmt->right;
+  if (slot && slot < o->nslots && !live_has(live, slot)) {
+    if (is_pure(o, value))
+      value = NODE_NONE;
+    if (apply) {
+      stmt->kind = NK_ExprStmt;
+      stmt->op = 0;
+      stmt->left = value;
+      stmt->right = NODE_NONE;
+      stmt->name = ATOM_NONE;
+    }
+  } else if (slot < o->nslots) {
+    live_del(live, slot);
+  }
+  live_uses(o, value, live);
+}
+
+// An expression evaluated for its effects.  `x++` of a dead `x` is
+// dropped by clearing *expr.
+static void live_effect(Opt *o, NodeId *expr, uint64_t *live, bool apply) {
+  const Node *node = *expr ? ast_node(o->ast, *expr) : NULL;
+  if (node && node->kind == NK_Unary &&
+      (node->op == PLUS_PLUS || node->op == MINUS_MINUS)) {
+    uint32_t slot = target_slot(o->ast, node);
+    if (slot && slot < o->nslots && !live_has(live, slot)) {
+      if (apply)
+        *expr = NODE_NONE;
+      return;
+    }
+  }
+  live_uses(o, *expr, live);
+}
+
+static void live_stmt(Opt *o, NodeId id, uint64_t *live, bool apply);
+
+// The statement walk keeps the blocks, ifs and loops it is inside on
+// o->live_frames rather than on the C stack.  Each frame updates `live`, a
+// set owned by the frame below it or by the caller.
+static void live_push(Opt *o, uint8_t kind, NodeId id, uint64_t *live,
+                      bool apply) {
+  LiveFrame f = {.id = id, .kind = kind, .apply = apply, .live = live};
+  if (kind == LF_BLOCK)
+    f.left = ast_node(o->ast, id)->count;
+  stack_push(&o->live_frames, f);
+}
+
+// Start one pass over what an iteration of the loop on top reads: the
+// body, then a `for` step.  The pass starts from the loop's head set.
+static void live_loop_pass(Opt *o, bool final) {
+  LiveFrame *f = stack_top(&o->live_frames);
+  Node *loop = ast_node(o->ast, f->id);
+  NodeId *kids = o->ast->kids + loop->first;
+  uint64_t *iter = f->tmp;
+  bool apply = f->apply && final;
+  f->final = final;
+  memcpy(iter, f->out, o->words * sizeof(*iter));
+  if (loop->kind == NK_ForStmt) {
+    if (kids[2] && ast_node(o->ast, kids[2])->kind == NK_AssignStmt) {
+      live_stmt(o, kids[2], iter, apply);
+      if (ast_node(o->ast, kids[2])->kind == NK_ExprStmt)
+        kids[2] = ast_node(o->ast, kids[2])->left;  // a dead step store
+    } else {
+      live_effect(o, &kids[2], iter, apply);
+    }
+  }
+  NodeId body = kids[loop->kind == NK_ForStmt ? 3 : 1];
+  if (body)
+    live_push(o, LF_BLOCK, body, iter, apply);
+}
+
+// Walk one statement backwards from `live`.  Blocks, ifs and loops push a
+// frame for live_block to finish.
+static void live_stmt(Opt *o, NodeId id, uint64_t *live, bool apply) {
+  Node *node = ast_node(o->ast, id);
+  switch (node->kind) {
+  case NK_Block:
+    live_push(o, LF_BLOCK, id, live, apply);
+    break;
+  case NK_LetStmt:
+    live_store(o, node, node->slot, live, apply);
+    break;
+  case NK_AssignStmt: {
+    uint32_t slot = target_slot(o->ast, node);
+    if (node->op == ASSIGNMENT) {
+      live_store(o, node, slot, live, apply);
+    } else {
+      // `+=` and `-=` read their target.
+      if (slot < o->nslots)
+        live_add(live, slot);
+      live_uses(o, node->right, live);
+    }
+    break;
+  }
+  case NK_ExprStmt:
+    live_effect(o, &node->left, live, apply);
+    break;
+  case NK_WriteStmt:
+    live_uses(o, node->left, live);
+    break;
+  case NK_ExitStmt:
+    memset(live, 0, o->words * sizeof(*live));
+    live_uses(o, node->left, live);
+    break;
+  case NK_IfStmt: {
+    // The arms of an elif chain go on o->arms and are walked last arm
+    // first, after the final else.
+    uint32_t narms = 0;
+    NodeId tail = id;
+    while (tail && ast_node(o->ast, tail)->kind == NK_IfStmt) {
+      stack_push(&o->arms, tail);
+      narms++;
+      tail = ast_child(o->ast, ast_node(o->ast, tail), 2);
+    }
+    live_push(o, LF_IF, id, live, apply);
+    LiveFrame *f = stack_top(&o->live_frames);
+    f->left = narms;
+    f->out = live_new(o);
+    f->tmp = live_new(o);
+    memcpy(f->out, live, o->words * sizeof(*live));
+    if (tail)
+      live_push(o, LF_BLOCK, tail, live, apply);
+    break;
+  }
+  case NK_WhileStmt:
+  case NK_ForStmt: {
+    // out is live where the condition is tested.  Without a condition the
+    // loop never exits, so nothing after it is read.
+    NodeId cond = ast_child(o->ast, node, node->kind == NK_ForStmt ? 1 : 0);
+    live_push(o, LF_LOOP, id, live, apply);
+    LiveFrame *f = stack_top(&o->live_frames);
+    f->out = live_new(o);
+    f->tmp = live_new(o);
+    if (cond) {
+      memcpy(f->out, live, o->words * sizeof(*live));
+      live_uses(o, cond, f->out);
+    }
+    live_loop_pass(o, false);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Walk `block` backwards from `live`, leaving in it what is live on entry.
+// A loop's body is walked without rewriting until the loop's head set stops
+// growing, then once more with the final set if `apply` is set.
+static void live_block(Opt *o, NodeId block, uint64_t *live, bool apply) {
+  size_t base = o->live_frames.len;
+  live_push(o, LF_BLOCK, block, live, apply);
+  while (o->live_frames.len > base) {
+    LiveFrame *f = stack_top(&o->live_frames);
+    switch (f->kind) {
+    case LF_BLOCK: {
+      if (!f->left) {
+        o->live_frames.len--;
+        break;
+      }
+      NodeId stmt = ast_child(o->ast, ast_node(o->ast, f->id), --f->left);
+      if (stmt)
+        live_stmt(o, stmt, f->live, f->apply);
+      break;
+    }
+    case LF_IF: {
+      if (f->arm) {
+        live_union(o, f->live, f->tmp);
+        live_uses(o, ast_child(o->ast, ast_node(o->ast, f->arm), 0), f->live);
+      }
+      if (!f->left) {
+        free(f->out);
+        free(f->tmp);
+        o->live_frames.len--;
+        break;
+      }
+      f->left--;
+      f->arm = stack_pop(&o->arms);
+      memcpy(f->tmp, f->out, o->words * sizeof(*f->tmp));
+      NodeId then_block = ast_child(o->ast, ast_node(o->ast, f->arm), 1);
+      if (then_block)
+        live_push(o, LF_BLOCK, then_block, f->tmp, f->apply);
+      break;
+    }
+    case LF_LOOP: {
+      if (!f->final && live_union(o, f->out, f->tmp)) {
+        live_loop_pass(o, false);
+        break;
+      }
+      if (!f->final && f->apply) {
+        live_loop_pass(o, true);
+        break;
+      }
+      LiveFrame done = stack_pop(&o->live_frames);
+      const Node *loop = ast_node(o->ast, done.id);
+      memcpy(done.live, done.out, o->words * sizeof(*done.live));
+      free(done.out);
+      free(done.tmp);
+      // A `for` initializer is a plain statement and pushes nothing.
+      NodeId init = loop->kind == NK_ForStmt ? ast_child(o->ast, loop, 0)
+                                             : NODE_NONE;
+      if (init)
+        live_stmt(o, init, done.live, done.apply);
+      break;
+    }
+    }
+  }
+}
+
+// Number the slots still in use from 1 again, so the frame only has room
+// for the variables that are left.
+static void renumber_slots(Opt *o, NodeId body) {
+  collect_nodes(o, body);
+  uint32_t *map = calloc(o->nslots, sizeof(*map));
+  if (!map) {
+    perror("opt");
+    exit(1);
+  }
+  for (size_t i = 0; i < o->nodes.len; i++) {
+    const Node *node = ast_node(o->ast, o->nodes.items[i]);
+    if ((node->kind == NK_LetStmt || node->kind == NK_Identifier) &&
+        node->slot < o->nslots)
+      map[node->slot] = 1;
+  }
+  uint32_t next = 0;
+  for (uint32_t slot = 1; slot < o->nslots; slot++) {
+    if (map[slot])
+      map[slot] = ++next;
+  }
+  for (size_t i = 0; i < o->nodes.len; i++) {
+    Node *node = ast_node(o->ast, o->nodes.items[i]);
+    if ((node->kind == NK_LetStmt || node->kind == NK_Identifier) &&
+        node->slot < o->nslots)
+      node->slot = map[node->slot];
+  }
+  free(map);
+}
+
+// --- functions --------------------------------------------------------------
+
+static void opt_fn(Opt *o, NodeId fn) {
+  NodeId body = ast_child(o->ast, ast_node(o->ast, fn), 0);
+  if (!body)
+    return;
+  scan_writes(o, body);
+  fold_body(o, body);
+  prune_body(o, body);
+  o->words = o->nslots / 64 + 1;
+  uint64_t *live = live_new(o);
+  live_block(o, body, live, true);
+  free(live);
+  prune_body(o, body);
+  renumber_slots(o, body);
+  free(o->written);
+  free(o->value);
+  o->written = NULL;
+  o->value = NULL;
+}
+
+void opt_program(Ast *ast, NodeId root) {
+  // Only main is emitted (see codegen_program), so only main and the
+  // functions declared in it are worth folding.
+  NodeId main_fn = codegen_find_main(ast, root);
+  if (!main_fn)
+    return;
+  Opt o = {.ast = ast};
+  stack_push(&o.fns, main_fn);
+  while (o.fns.len)
+    opt_fn(&o, stack_pop(&o.fns));
+  stack_free(&o.work);
+  stack_free(&o.stmts);
+  stack_free(&o.nodes);
+  stack_free(&o.frames);
+  stack_free(&o.fns);
+  stack_free(&o.live_frames);
+  stack_free(&o.arms);
+}
@@ -5,6 +5,7 @@
 #include <stdbool.h>
 
 #include "parser.h"
+#include "stack.h"
 #include "tools.h"
 #include "token_helpers.h"
 
@@ -98,64 +99,176 @@ static const char *op_name(TokenType type) {
   }
 }
 
-// --- helper constructors ---------------------------------------------------
-// Allocate and initialize a node. `node` is ignored and kept only for
-// compatibility with existing call sites.
-Node *init_node(Node *node, const char *value, TokenType type) {
-  (void)node;
-  node = malloc(sizeof(Node));
-  if (!node)
-    return NULL;
-  node->kind = 0;
-  node->type = type;
-  node->op = 0;
-  node->value = value ? strdup(value) : NULL;
-  node->left = NULL;
-  node->right = NULL;
-  node->children.items = NULL;
-  node->children.len = 0;
-  node->children.cap = 0;
-  node->postfix = false;
-  node->ty = NULL;
-  return node;
+// --- node pool -------------------------------------------------------------
+
+void ast_init(Ast *ast) {
+  memset(ast, 0, sizeof(*ast));
+  arena_init(&ast->strings);
+  // Slot 0 is NODE_NONE; literal 0 is unused for the same reason.
+  ast->cap = 1024;
+  ast->nodes = calloc(ast->cap, sizeof(Node));
+  ast->len = 1;
+  ast->lits_cap = 64;
+  ast->lits = malloc(ast->lits_cap * sizeof(*ast->lits));
+  ast->lits[0] = NULL;
+  ast->nlits = 1;
+  if (!ast->nodes || !ast->lits) {
+    perror("ast_init");
+    exit(1);
+  }
 }
 
-// Return the node's identifier name or "<null>" if none.
-const char *node_name(const Node *node) {
-  return (node && node->value) ? node->value : "<null>";
+void ast_free(Ast *ast) {
+  free(ast->nodes);
+  free(ast->kids);
+  free(ast->lits);
+  arena_free(&ast->strings);
+  memset(ast, 0, sizeof(*ast));
 }
 
-// --- tree printer ----------------------------------------------------------
-void print_tree(Node *node, int indent) {
+static void *grow(void *items, size_t *cap, size_t need, size_t size) {
+  if (need <= *cap)
+    return items;
+  size_t n = *cap ? *cap : 64;
+  while (n < need)
+    n *= 2;
+  items = realloc(items, n * size);
+  if (!items) {
+    perror("parser");
+    exit(1);
+  }
+  *cap = n;
+  return items;
+}
+
+// Pool of the tree being parsed.  Node pointers are only valid until the
+// next node is created, so the parser works with ids and builds each node
+// after its operands.
+static Ast *ast;
+
+// Child ids of lists still being parsed; each list copies its range into
+// ast->kids once complete, so every list ends up contiguous.
+static NodeId *scratch;
+static size_t scratch_len;
+static size_t scratch_cap;
+
+static NodeId new_node(NodeKind kind, TokenType op, NodeId left, NodeId right) {
+  ast->nodes = grow(ast->nodes, &ast->cap, ast->len + 1, sizeof(Node));
+  NodeId id = (NodeId)ast->len++;
+  Node *node = &ast->nodes[id];
+  node->kind = (uint8_t)kind;
+  node->op = (uint8_t)op;
+  node->flags = 0;
+  node->ty = 0;
+  node->left = left;
+  node->right = right;
+  node->name = ATOM_NONE;
+  return id;
+}
+
+static void scratch_push(NodeId id) {
+  scratch = grow(scratch, &scratch_cap, scratch_len + 1, sizeof(NodeId));
+  scratch[scratch_len++] = id;
+}
+
+NodeId ast_list(Ast *pool, NodeKind kind, const NodeId *kids, size_t count) {
+  ast = pool;
+  ast->kids = grow(ast->kids, &ast->kids_cap, ast->nkids + count, sizeof(NodeId));
+  memcpy(ast->kids + ast->nkids, kids, count * sizeof(NodeId));
+  NodeId id = new_node(kind, 0, NODE_NONE, NODE_NONE);
+  ast->nodes[id].first = (uint32_t)ast->nkids;
+  ast->nodes[id].count = (uint32_t)count;
+  ast->nkids += count;
+  return id;
+}
+
+// Make a list node from the children pushed since scratch_len was `base`.
+static NodeId new_list(NodeKind kind, size_t base) {
+  NodeId id = ast_list(ast, kind, scratch + base, scratch_len - base);
+  scratch_len = base;
+  return id;
+}
+
+static uint32_t push_lit(Ast *pool, const char *text) {
+  pool->lits = grow(pool->lits, &pool->lits_cap, pool->nlits + 1, sizeof(*pool->lits));
+  pool->lits[pool->nlits] = text;
+  return (uint32_t)pool->nlits++;
+}
+
+uint32_t ast_add_lit(Ast *pool, const char *text, size_t len) {
+  return push_lit(pool, arena_strndup(&pool->strings, text, len));
+}
+
+// A literal node whose value is the lexeme of token `tok`.
+static NodeId new_lexeme_node(TokenStream *ts, size_t tok, NodeKind kind) {
+  uint32_t lit = push_lit(ast, ts_strdup(ts, tok, &ast->strings));
+  NodeId id = new_node(kind, 0, NODE_NONE, NODE_NONE);
+  ast->nodes[id].lit = lit;
+  return id;
+}
+
+static NodeId new_name_node(TokenStream *ts, size_t tok, NodeKind kind) {
+  NodeId id = new_node(kind, 0, NODE_NONE, NODE_NONE);
+  ast->nodes[id].name = ts_atom(ts, tok);
+  return id;
+}
+
+const char *node_name(const Ast *ast, const Node *node) {
   if (!node)
-    return;
+    return "<null>";
+  if (node->name)
+    return atom_name(node->name);
+  if (node_is_literal(node->kind))
+    return ast_lit(ast, node);
+  return "<null>";
+}
 
-  for (int i = 0; i < indent; i++)
-    printf(" ");
+// --- tree printer ----------------------------------------------------------
 
-  printf("%s", kind_name(node->kind));
+typedef struct {
+  NodeId id;
+  int indent;
+} PrintFrame;
+
+// Pre-order walk on an explicit stack; children are pushed last-first so
+// they pop in source order.
+void print_tree(const Ast *ast, NodeId root, int indent) {
+  STACK(PrintFrame) stack = {0};
+  stack_push(&stack, ((PrintFrame){root, indent}));
+
+  while (stack.len) {
+    PrintFrame f = stack_pop(&stack);
+    if (!f.id)
+      continue;
+    const Node *node = ast_node(ast, f.id);
 
-  if (node->op || node->kind == NK_Assign || node->kind == NK_AssignStmt)
-    printf(" op: %s", op_name(node->op));
+    printf("%*s%s", f.indent, "", kind_name(node->kind));
 
-  if (node->value)
-    printf(" value: %s", node_name(node));
+    if (node->op || node->kind == NK_Assign || node->kind == NK_AssignStmt)
+      printf(" op: %s", op_name(node->op));
 
-  printf("\n");
+    if (node->name || node_is_literal(node->kind))
+      printf(" value: %s", node_name(ast, node));
 
-  indent += 4;
+    printf("\n");
 
-  if (node->left)
-    print_tree(node->left, indent);
-  if (node->right)
-    print_tree(node->right, indent);
-  for (size_t i = 0; i < node->children.len; i++)
-    print_tree(node->children.items[i], indent);
+    int child = f.indent + 4;
+    if (node_is_list(node->kind)) {
+      for (size_t i = node->count; i-- > 0;)
+        stack_push(&stack, ((PrintFrame){ast_child(ast, node, i), child}));
+      continue;
+    }
+    if (node_has_right(node->kind))
+      stack_push(&stack, ((PrintFrame){node->right, child}));
+    if (node_has_left(node->kind))
+      stack_push(&stack, ((PrintFrame){node->left, child}));
+  }
+  stack_free(&stack);
 }
 
 void print_error(char *error_type, size_t line_number){
   printf("ERROR: %s on line number: %zu\n", error_type, line_number);
-  exit(1);
+  error_exit();
 }
 
 // --- expression parsing (Pratt parser) ------------------------------------
@@ -189,327 +302,374 @@ static int lbp(TokenType type) {
   return lbp_table[type];
 }
 
-static Node *parse_expr(Token **pp, int minbp); // forward declaration
+// Operators whose operand is still being parsed.  parse_expr keeps them on
+// an explicit stack instead of recursing, so `((((x))))`, `- - - x` and long
+// assignment chains nest as deep as the heap allows.
+typedef enum { PF_PREFIX, PF_PAREN, PF_BINARY } PendingKind;
 
-static Node *nud(Token **pp) {
-  Token *tok = peek(pp);
-  switch (tok->type) {
-  case INT: {
-    next(pp);
-    Node *node = init_node(NULL, tok->value, tok->type);
-    node->kind = NK_Int;
-    return node;
-  }
-  case STRING: {
-    next(pp);
-    Node *node = init_node(NULL, tok->value, tok->type);
-    node->kind = NK_String;
-    return node;
-  }
-  case BOOL: {
-    next(pp);
-    Node *node = init_node(NULL, tok->value, tok->type);
-    node->kind = NK_Bool;
-    return node;
-  }
-  case IDENTIFIER: {
-    next(pp);
-    Node *node = init_node(NULL, tok->value, tok->type);
-    node->kind = NK_Identifier;
-    return node;
-  }
-  case OPEN_PAREN: {
-    next(pp);
-    Node *expr = parse_expr(pp, 0);
-    expect(pp, CLOSE_PAREN, "Invalid Syntax on CLOSE");
-    return expr;
-  }
-  case NOT:
-  case DASH:
-  case PLUS:
-  case PLUS_PLUS:
-  case MINUS_MINUS: {
-    TokenType op = tok->type;
-    next(pp);
-    Node *right = parse_expr(pp, PREC_PREFIX);
-    Node *node = init_node(NULL, NULL, 0);
-    node->kind = NK_Unary;
-    node->op = op;
-    node->left = right;
-    node->postfix = false;
-    return node;
-  }
-  default:
-    print_error("Unexpected token", tok->line_num);
-    return NULL;
-  }
+typedef struct {
+  uint8_t kind; // PendingKind
+  uint8_t op;
+  int minbp;    // binding power of the operand being parsed
+  NodeId left;  // left operand of a PF_BINARY
+} Pending;
+
+static STACK(Pending) pending;
+
+static bool is_postfix_end(TokenType type) {
+  return type == SEMICOLON || type == CLOSE_PAREN || type == CLOSE_CURLY ||
+         type == CLOSE_BRACKET || type == COMMA || type == END_OF_TOKENS;
 }
 
-static Node *parse_expr(Token **pp, int minbp) {
-  Node *left = nud(pp);
+static NodeId parse_expr(TokenStream *ts, int minbp) {
+  size_t base = pending.len;
+  NodeId left;
+
+operand:
+  // nud: prefix operators and parens open a pending operand; atoms fall
+  // through to the operator loop.
   for (;;) {
-    Token *tok = peek(pp);
-    int lb = lbp(tok->type);
-    if (lb <= minbp)
+    TokenType type = peek(ts);
+    size_t tok = ts->pos;
+    switch (type) {
+    case INT:
+      next(ts);
+      left = new_lexeme_node(ts, tok, NK_Int);
+      break;
+    case STRING:
+      next(ts);
+      left = new_lexeme_node(ts, tok, NK_String);
+      break;
+    case BOOL:
+      next(ts);
+      left = new_lexeme_node(ts, tok, NK_Bool);
+      break;
+    case IDENTIFIER:
+      next(ts);
+      left = new_name_node(ts, tok, NK_Identifier);
       break;
-    TokenType op = tok->type;
-    next(pp);
-    // Handle post-increment/decrement used without a right operand.
-    TokenType next_type = peek(pp)->type;
-    if ((op == PLUS_PLUS || op == MINUS_MINUS) &&
-        (next_type == SEMICOLON || next_type == CLOSE_PAREN ||
-         next_type == CLOSE_CURLY || next_type == CLOSE_BRACKET ||
-         next_type == COMMA || next_type == END_OF_TOKENS)) {
-      Node *node = init_node(NULL, NULL, 0);
-      node->kind = NK_Unary;
-      node->op = op;
-      node->left = left;
-      node->postfix = true;
-      left = node;
+    case OPEN_PAREN:
+      next(ts);
+      stack_push(&pending, ((Pending){PF_PAREN, 0, 0, NODE_NONE}));
       continue;
+    case NOT:
+    case DASH:
+    case PLUS:
+    case PLUS_PLUS:
+    case MINUS_MINUS:
+      next(ts);
+      stack_push(&pending, ((Pending){PF_PREFIX, (uint8_t)type, PREC_PREFIX, NODE_NONE}));
+      continue;
+    default:
+      print_error("Unexpected token", ts_line(ts, tok));
+      return NODE_NONE;
     }
-
-    int rb = lb - (op == ASSIGNMENT || op == PLUS_EQUALS || op == MINUS_EQUALS);
-    Node *right = parse_expr(pp, rb);
-    Node *node = init_node(NULL, NULL, 0);
-    if (op == ASSIGNMENT || op == PLUS_EQUALS || op == MINUS_EQUALS)
-      node->kind = NK_Assign;
-    else
-      node->kind = NK_Binary;
-    node->op = op;
-    node->left = left;
-    node->right = right;
-    left = node;
+    break;
   }
-  return left;
-}
 
-// --- small vector helper ---------------------------------------------------
-static void vec_push(Vec *v, Node *n) {
-  if (v->len + 1 > v->cap) {
-    v->cap = v->cap ? v->cap * 2 : 4;
-    v->items = realloc(v->items, v->cap * sizeof(Node *));
+  // led: extend `left` while the next operator binds tighter than the
+  // innermost pending operand, otherwise close that operand.
+  for (;;) {
+    int bp = pending.len > base ? stack_top(&pending)->minbp : minbp;
+    TokenType op = peek(ts);
+    int lb = lbp(op);
+    if (lb > bp) {
+      next(ts);
+      // Handle post-increment/decrement used without a right operand.
+      if ((op == PLUS_PLUS || op == MINUS_MINUS) && is_postfix_end(peek(ts))) {
+        left = new_node(NK_Unary, op, left, NODE_NONE);
+        ast->nodes[left].flags |= NF_POSTFIX;
+        continue;
+      }
+      int rb = lb - (op == ASSIGNMENT || op == PLUS_EQUALS || op == MINUS_EQUALS);
+      stack_push(&pending, ((Pending){PF_BINARY, (uint8_t)op, rb, left}));
+      goto operand;
+    }
+    if (pending.len == base)
+      return left;
+
+    Pending p = stack_pop(&pending);
+    switch (p.kind) {
+    case PF_PAREN:
+      expect(ts, CLOSE_PAREN, "Invalid Syntax on CLOSE");
+      break;
+    case PF_PREFIX:
+      left = new_node(NK_Unary, p.op, left, NODE_NONE);
+      break;
+    default: {
+      NodeKind kind = NK_Binary;
+      if (p.op == ASSIGNMENT || p.op == PLUS_EQUALS || p.op == MINUS_EQUALS)
+        kind = NK_Assign;
+      left = new_node(kind, p.op, p.left, left);
+      break;
+    }
+    }
   }
-  v->items[v->len++] = n;
 }
 
 // --- parsing helpers -------------------------------------------------------
 
-static Node *parse_block(Token **pp);
-static Node *parse_stmt(Token **pp);
-
-static Node *parse_write(Token **pp) {
-  expect(pp, WRITE, "expected write");
-  Node *node = init_node(NULL, NULL, 0);
-  node->kind = NK_WriteStmt;
-  expect(pp, OPEN_PAREN, "expected (");
-  Node *expr = parse_expr(pp, 0);
-  node->left = expr;
-  expect(pp, CLOSE_PAREN, "expected )");
-  expect(pp, SEMICOLON, "expected semicolon");
-  return node;
+static NodeId parse_write(TokenStream *ts) {
+  expect(ts, WRITE, "expected write");
+  expect(ts, OPEN_PAREN, "expected (");
+  NodeId expr = parse_expr(ts, 0);
+  expect(ts, CLOSE_PAREN, "expected )");
+  expect(ts, SEMICOLON, "expected semicolon");
+  return new_node(NK_WriteStmt, 0, expr, NODE_NONE);
 }
 
-static Node *parse_exit(Token **pp) {
-  expect(pp, EXIT, "expected exit");
-  Node *node = init_node(NULL, NULL, 0);
-  node->kind = NK_ExitStmt;
-  expect(pp, OPEN_PAREN, "expected (");
-  Node *expr = parse_expr(pp, 0);
-  node->left = expr;
-  expect(pp, CLOSE_PAREN, "expected )");
-  expect(pp, SEMICOLON, "expected semicolon");
-  return node;
+static NodeId parse_exit(TokenStream *ts) {
+  expect(ts, EXIT, "expected exit");
+  expect(ts, OPEN_PAREN, "expected (");
+  NodeId expr = parse_expr(ts, 0);
+  expect(ts, CLOSE_PAREN, "expected )");
+  expect(ts, SEMICOLON, "expected semicolon");
+  return new_node(NK_ExitStmt, 0, expr, NODE_NONE);
 }
 
-static Node *parse_let(Token **pp, bool expect_semi) {
-  expect(pp, LET, "expected let");
-  Token *id = expect(pp, IDENTIFIER, "expected identifier");
-  Node *node = init_node(NULL, id->value, 0);
-  node->kind = NK_LetStmt;
-  if (match(pp, ASSIGNMENT)) {
-    Node *expr = parse_expr(pp, 0);
-    node->right = expr;
-  }
+static NodeId parse_let(TokenStream *ts, bool expect_semi) {
+  expect(ts, LET, "expected let");
+  size_t id = expect(ts, IDENTIFIER, "expected identifier");
+  Atom name = ts_atom(ts, id);
+  NodeId init = NODE_NONE;
+  if (match(ts, ASSIGNMENT))
+    init = parse_expr(ts, 0);
   if (expect_semi)
-    expect(pp, SEMICOLON, "expected semicolon");
+    expect(ts, SEMICOLON, "expected semicolon");
+  NodeId node = new_node(NK_LetStmt, 0, NODE_NONE, init);
+  ast->nodes[node].name = name;
   return node;
 }
 
-static Node *parse_expr_or_assign_nosemi(Token **pp) {
-  Node *expr = parse_expr(pp, 0);
-  if (expr && expr->kind == NK_Assign && expr->left &&
-      expr->left->kind == NK_Identifier) {
-    Node *node = init_node(NULL, NULL, 0);
+static NodeId parse_expr_or_assign_nosemi(TokenStream *ts) {
+  NodeId expr = parse_expr(ts, 0);
+  Node *node = ast_node(ast, expr);
+  if (node->kind == NK_Assign && node->left &&
+      ast_node(ast, node->left)->kind == NK_Identifier)
     node->kind = NK_AssignStmt;
-    node->op = expr->op;
-    node->left = expr->left;
-    node->right = expr->right;
-    free(expr);
-    return node;
-  }
   return expr;
 }
 
-static Node *parse_assign_or_expr(Token **pp) {
-  Node *expr = parse_expr_or_assign_nosemi(pp);
-  if (expr && expr->kind == NK_AssignStmt)
+static NodeId parse_assign_or_expr(TokenStream *ts) {
+  NodeId expr = parse_expr_or_assign_nosemi(ts);
+  if (ast_node(ast, expr)->kind == NK_AssignStmt)
     return expr;
-  Node *node = init_node(NULL, NULL, 0);
-  node->kind = NK_ExprStmt;
-  node->left = expr;
-  return node;
+  return new_node(NK_ExprStmt, 0, expr, NODE_NONE);
 }
 
-static Node *parse_if_internal(Token **pp, bool consumed_kw) {
-  if (!consumed_kw)
-    expect(pp, IF, "expected if");
-  Node *node = init_node(NULL, NULL, 0);
-  node->kind = NK_IfStmt;
-  expect(pp, OPEN_PAREN, "expected (");
-  Node *cond = parse_expr(pp, 0);
-  expect(pp, CLOSE_PAREN, "expected )");
-  Node *then_block = parse_block(pp);
-  vec_push(&node->children, cond);
-  vec_push(&node->children, then_block);
-  if (match(pp, ELSE_IF)) {
-    Node *elif = parse_if_internal(pp, true);
-    vec_push(&node->children, elif);
-  } else if (match(pp, ELSE)) {
-    Node *else_block = parse_block(pp);
-    vec_push(&node->children, else_block);
+static NodeId parse_simple(TokenStream *ts) {
+  switch (peek(ts)) {
+  case WRITE:
+    return parse_write(ts);
+  case EXIT:
+    return parse_exit(ts);
+  case LET:
+    return parse_let(ts, true);
+  default: {
+    NodeId stmt = parse_assign_or_expr(ts);
+    expect(ts, SEMICOLON, "expected semicolon");
+    return stmt;
+  }
   }
-  return node;
 }
 
-static Node *parse_if(Token **pp) { return parse_if_internal(pp, false); }
+// --- statements --------------------------------------------------------------
 
-static Node *parse_while(Token **pp) {
-  expect(pp, WHILE, "expected while");
-  Node *node = init_node(NULL, NULL, 0);
-  node->kind = NK_WhileStmt;
-  expect(pp, OPEN_PAREN, "expected (");
-  Node *cond = parse_expr(pp, 0);
-  expect(pp, CLOSE_PAREN, "expected )");
-  Node *body = parse_block(pp);
-  vec_push(&node->children, cond);
-  vec_push(&node->children, body);
-  return node;
-}
+// Blocks still open.  parse_stmt keeps them on an explicit stack instead of
+// recursing, like parse_expr does for operands, so `if`s, loops and bare
+// blocks nest as deep as the heap allows.  The header of the statement that
+// owns a block (an `if` condition, a `for` clause) sits on the scratch stack
+// from `base`; the block's own statements follow from `block_base`.
+typedef enum { OB_BLOCK, OB_IF, OB_ELSE, OB_WHILE, OB_FOR, OB_FN } OpenKind;
 
-static Node *parse_for(Token **pp) {
-  expect(pp, FOR, "expected for");
-  Node *node = init_node(NULL, NULL, 0);
-  node->kind = NK_ForStmt;
-  expect(pp, OPEN_PAREN, "expected (");
+typedef struct {
+  uint8_t kind;      // OpenKind
+  uint32_t arms;     // of an OB_IF or OB_ELSE, counting this one
+  Atom name;         // of an OB_FN
+  size_t base;
+  size_t block_base;
+} OpenBlock;
 
-  Node *init = NULL;
-  if (peek(pp)->type != SEMICOLON) {
-    if (peek(pp)->type == LET)
-      init = parse_let(pp, false);
-    else {
-      init = parse_assign_or_expr(pp);
-    }
-  }
-  expect(pp, SEMICOLON, "expected semicolon");
-  vec_push(&node->children, init);
-
-  Node *cond = NULL;
-  if (peek(pp)->type != SEMICOLON)
-    cond = parse_expr(pp, 0);
-  expect(pp, SEMICOLON, "expected semicolon");
-  vec_push(&node->children, cond);
-
-  Node *step = NULL;
-  if (peek(pp)->type != CLOSE_PAREN) {
-    step = parse_expr_or_assign_nosemi(pp);
-  }
-  expect(pp, CLOSE_PAREN, "expected )");
-  vec_push(&node->children, step);
+static STACK(OpenBlock) open_blocks;
 
-  Node *body = parse_block(pp);
-  vec_push(&node->children, body);
-  return node;
+static void open_block(TokenStream *ts, OpenKind kind, size_t base) {
+  expect(ts, OPEN_CURLY, "expected {");
+  stack_push(&open_blocks, ((OpenBlock){(uint8_t)kind, 1, ATOM_NONE, base, scratch_len}));
 }
 
-static Node *parse_fn(Token **pp) {
-  expect(pp, FN, "expected fn");
-  Token *id = expect(pp, IDENTIFIER, "expected identifier");
-  Node *node = init_node(NULL, id->value, FN);
-  node->kind = NK_FnDecl;
-  expect(pp, OPEN_PAREN, "expected (");
-  while (peek(pp)->type != CLOSE_PAREN && peek(pp)->type != END_OF_TOKENS)
-    next(pp);
-  expect(pp, CLOSE_PAREN, "expected )");
-  Node *body = parse_block(pp);
-  vec_push(&node->children, body);
-  return node;
+// Parse `(cond)` onto the scratch stack.
+static void parse_cond(TokenStream *ts) {
+  expect(ts, OPEN_PAREN, "expected (");
+  scratch_push(parse_expr(ts, 0));
+  expect(ts, CLOSE_PAREN, "expected )");
 }
 
-static Node *parse_block(Token **pp) {
-  expect(pp, OPEN_CURLY, "expected {");
-  Node *block = init_node(NULL, NULL, 0);
-  block->kind = NK_Block;
-  while (peek(pp)->type != CLOSE_CURLY && peek(pp)->type != END_OF_TOKENS) {
-    Node *stmt = parse_stmt(pp);
-    if (stmt)
-      vec_push(&block->children, stmt);
+static void begin_for(TokenStream *ts) {
+  expect(ts, FOR, "expected for");
+  size_t base = scratch_len;
+  expect(ts, OPEN_PAREN, "expected (");
+
+  NodeId init = NODE_NONE;
+  if (peek(ts) != SEMICOLON) {
+    if (peek(ts) == LET)
+      init = parse_let(ts, false);
+    else
+      init = parse_assign_or_expr(ts);
   }
-  expect(pp, CLOSE_CURLY, "expected }");
-  return block;
+  expect(ts, SEMICOLON, "expected semicolon");
+  scratch_push(init);
+
+  NodeId cond = NODE_NONE;
+  if (peek(ts) != SEMICOLON)
+    cond = parse_expr(ts, 0);
+  expect(ts, SEMICOLON, "expected semicolon");
+  scratch_push(cond);
+
+  NodeId step = NODE_NONE;
+  if (peek(ts) != CLOSE_PAREN)
+    step = parse_expr_or_assign_nosemi(ts);
+  expect(ts, CLOSE_PAREN, "expected )");
+  scratch_push(step);
+
+  open_block(ts, OB_FOR, base);
 }
 
-static Node *parse_stmt(Token **pp) {
-  switch (peek(pp)->type) {
-  case WRITE:
-    return parse_write(pp);
-  case EXIT:
-    return parse_exit(pp);
-  case LET:
-    return parse_let(pp, true);
-  case IF:
-    return parse_if(pp);
-  case WHILE:
-    return parse_while(pp);
-  case FOR:
-    return parse_for(pp);
-  case FN:
-    return parse_fn(pp);
-  case OPEN_CURLY:
-    return parse_block(pp);
+static void begin_fn(TokenStream *ts) {
+  expect(ts, FN, "expected fn");
+  size_t id = expect(ts, IDENTIFIER, "expected identifier");
+  Atom name = ts_atom(ts, id);
+  expect(ts, OPEN_PAREN, "expected (");
+  while (peek(ts) != CLOSE_PAREN && peek(ts) != END_OF_TOKENS)
+    next(ts);
+  expect(ts, CLOSE_PAREN, "expected )");
+  open_block(ts, OB_FN, scratch_len);
+  stack_top(&open_blocks)->name = name;
+}
+
+// The innermost block has been closed into `block`.  Returns the statement
+// it completes, or NODE_NONE if an `elif` or `else` opened the next block of
+// the same `if`.
+//
+// An elif chain leaves each arm's condition and block on the scratch stack;
+// the nested IfStmt nodes are built from the last arm outwards, each taking
+// the one after it as its else branch.
+static NodeId close_block(TokenStream *ts, NodeId block) {
+  OpenBlock ob = stack_pop(&open_blocks);
+  if (ob.kind == OB_BLOCK)
+    return block;
+  scratch_push(block);
+  switch (ob.kind) {
+  case OB_IF:
+    if (match(ts, ELSE_IF)) {
+      parse_cond(ts);
+      open_block(ts, OB_IF, ob.base);
+      stack_top(&open_blocks)->arms = ob.arms + 1;
+      return NODE_NONE;
+    }
+    if (match(ts, ELSE)) {
+      open_block(ts, OB_ELSE, ob.base);
+      stack_top(&open_blocks)->arms = ob.arms;
+      return NODE_NONE;
+    }
+    // fall through
+  case OB_ELSE: {
+    uint32_t arms = ob.arms;
+    NodeId node = new_list(NK_IfStmt, ob.base + 2 * --arms);
+    while (arms--) {
+      scratch_push(node);
+      node = new_list(NK_IfStmt, ob.base + 2 * arms);
+    }
+    return node;
+  }
+  case OB_WHILE:
+    return new_list(NK_WhileStmt, ob.base);
+  case OB_FOR:
+    return new_list(NK_ForStmt, ob.base);
   default: {
-    Node *stmt = parse_assign_or_expr(pp);
-    expect(pp, SEMICOLON, "expected semicolon");
-    return stmt;
+    NodeId node = new_list(NK_FnDecl, ob.base);
+    ast->nodes[node].name = ob.name;
+    return node;
   }
   }
 }
 
-Node *parser(Token *tokens) {
-  Token *t = tokens;
-  Token **pp = &t;
-  Node *program = init_node(NULL, NULL, 0);
-  program->kind = NK_Program;
-  Node *block = init_node(NULL, NULL, 0);
-  block->kind = NK_Block;
-  while (peek(pp)->type != END_OF_TOKENS) {
-    Node *stmt = parse_stmt(pp);
-    if (stmt)
-      vec_push(&block->children, stmt);
+// Parse one statement.  A statement that owns a block opens it and goes on
+// with the block's statements; each statement completed inside an open
+// block is pushed onto the scratch stack until its `}` closes the block.
+static NodeId parse_stmt(TokenStream *ts) {
+  size_t depth = open_blocks.len;
+  for (;;) {
+    NodeId stmt = NODE_NONE;
+    TokenType type = peek(ts);
+    if (open_blocks.len > depth && (type == CLOSE_CURLY || type == END_OF_TOKENS)) {
+      expect(ts, CLOSE_CURLY, "expected }");
+      stmt = close_block(ts, new_list(NK_Block, stack_top(&open_blocks)->block_base));
+      if (!stmt)
+        continue;
+    } else {
+      switch (type) {
+      case IF:
+        next(ts);
+        parse_cond(ts);
+        open_block(ts, OB_IF, scratch_len - 1);
+        continue;
+      case WHILE:
+        next(ts);
+        parse_cond(ts);
+        open_block(ts, OB_WHILE, scratch_len - 1);
+        continue;
+      case FOR:
+        begin_for(ts);
+        continue;
+      case FN:
+        begin_fn(ts);
+        continue;
+      case OPEN_CURLY:
+        open_block(ts, OB_BLOCK, scratch_len);
+        continue;
+      default:
+        stmt = parse_simple(ts);
+        break;
+      }
+    }
+    if (open_blocks.len == depth)
+      return stmt;
+    scratch_push(stmt);
   }
-  vec_push(&program->children, block);
-  return program;
 }
 
-void free_tree(Node *node) {
-  if (!node)
-    return;
-  free_tree(node->left);
-  free_tree(node->right);
-  for (size_t i = 0; i < node->children.len; i++) {
-    free_tree(node->children.items[i]);
+// Start a parse into `pool`, dropping anything a parse abandoned by
+// error_exit() left on the work stacks.
+static void parse_begin(Ast *pool) {
+  ast = pool;
+  scratch_len = 0;
+  pending.len = 0;
+  open_blocks.len = 0;
+}
+
+// Tokens are pulled from `ts` on demand; after each top-level statement
+// (normally an `fn`) the consumed tokens are retired.
+NodeId parser(TokenStream *ts, Ast *pool) {
+  parse_begin(pool);
+  size_t base = scratch_len;
+  while (peek(ts) != END_OF_TOKENS) {
+    scratch_push(parse_stmt(ts));
+    ts_retire(ts);
   }
-  free(node->children.items);
-  free(node->value);
-  free(node);
+  NodeId block = new_list(NK_Block, base);
+  scratch_push(block);
+  NodeId program = new_list(NK_Program, base);
+  stack_free(&pending);
+  stack_free(&open_blocks);
+  free(scratch);
+  scratch = NULL;
+  scratch_cap = 0;
+  return program;
+}
+
+NodeId parse_span(TokenStream *ts, size_t end, Ast *pool) {
+  parse_begin(pool);
+  while (ts->pos < end && peek(ts) != END_OF_TOKENS)
+    scratch_push(parse_stmt(ts));
+  return new_list(NK_Block, 0);
 }
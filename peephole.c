@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peephole.h"
+#include "regalloc.h"
+
+static void *xcalloc(size_t n, size_t size) {
+  void *p = calloc(n ? n : 1, size);
+  if (!p) {
+    perror("peephole");
+    exit(1);
+  }
+  return p;
+}
+
+static bool is_reg(uint8_t kind) {
+  return kind == AO_REG || kind == AO_REG32 || kind == AO_REG8;
+}
+
+static bool is_jump(const AsmInst *in) {
+  return (in->op == A_JMP || in->op == A_JCC) && in->kind[0] == AO_LABEL;
+}
+
+// Whether operand a of `in` is written but not read.
+static bool writes_only_a(const AsmInst *in) {
+  switch (in->op) {
+  case A_MOV:
+  case A_MOVZX:
+  case A_LEA:
+  case A_SETCC:
+  case A_POP:
+    return true;
+  case A_IMUL:
+    return in->kind[2] != AO_NONE;
+  default:
+    return false;
+  }
+}
+
+// Registers `in` writes, as a mask of 1 << Reg.
+static uint16_t writes(const AsmInst *in) {
+  uint16_t m = 0;
+  switch (in->op) {
+  case A_CMP:
+  case A_TEST:
+  case A_PUSH:
+  case A_IMUL1:
+  case A_IDIV:
+  case A_CALL:
+  case A_JCC:
+  case A_JMP:
+  case A_RET:
+    break;
+  default:
+    if (is_reg(in->kind[0]))
+      m |= 1u << in->reg[0];
+    break;
+  }
+  switch (in->op) {
+  case A_CQO:
+    m |= 1u << REG_RDX;
+    break;
+  case A_IMUL1:
+  case A_IDIV:
+    m |= 1u << REG_RAX | 1u << REG_RDX;
+    break;
+  case A_CALL:
+    m |= REG_CALLER_SAVED;
+    break;
+  case A_PUSH:
+  case A_POP:
+    m |= 1u << REG_RSP;
+    break;
+  default:
+    break;
+  }
+  return m;
+}
+
+// Registers `in` reads, including rbp for a memory operand.
+static uint16_t reads(const AsmInst *in) {
+  uint16_t m = 0;
+  for (int i = writes_only_a(in); i < 3; i++) {
+    if (is_reg(in->kind[i]) || in->kind[i] == AO_INDEX)
+      m |= 1u << in->reg[i];
+  }
+  for (int i = 0; i < 3; i++) {
+    if (in->kind[i] == AO_MEM)
+      m |= 1u << REG_RBP;
+  }
+  switch (in->op) {
+  case A_CQO:
+  case A_IMUL1:
+    m |= 1u << REG_RAX;
+    break;
+  case A_IDIV:
+    m |= 1u << REG_RAX | 1u << REG_RDX;
+    break;
+  case A_CALL:
+    m |= 1u << REG_RDI | 1u << REG_RSI | 1u << REG_RSP;
+    break;
+  case A_PUSH:
+  case A_POP:
+  case A_RET:
+    m |= 1u << REG_RSP;
+    break;
+  default:
+    break;
+  }
+  return m;
+}
+
+// Whether `in` writes its memory operand a.
+static bool writes_mem(const AsmInst *in) {
+  if (in->kind[0] != AO_MEM)
+    return false;
+  return in->op != A_CMP && in->op != A_TEST && in->op != A_PUSH &&
+         in->op != A_IMUL1 && in->op != A_IDIV;
+}
+
+// --- moves -----------------------------------------------------------------
+// A forward walk that knows which registers hold the same value as which
+// stack slot, from a load of the slot or a store to it.  A load of a slot
+// into a register that already holds it goes, as does a store of such a
+// register back to the slot; a load of a slot another register holds
+// becomes a register move.  What is known is forgotten at labels, where
+// other paths join, and when either side is written.
+
+static bool peep_moves(AsmFn *fn) {
+  bool changed = false;
+  int32_t holds[REG_COUNT] = {0};  // slot offset, or 0
+  for (size_t i = 0; i < fn->insts.len; i++) {
+    AsmInst *in = &fn->insts.items[i];
+    uint8_t a = in->kind[0], b = in->kind[1];
+    if (in->op == A_LABEL || in->op == A_JMP || in->op == A_RET) {
+      memset(holds, 0, sizeof(holds));
+      continue;
+    }
+    if (in->op == A_MOV && a == AO_REG && b == AO_REG) {
+      uint8_t d = in->reg[0], s = in->reg[1];
+      if (d == s) {
+        in->op = A_NOP;
+        changed = true;
+      } else if (d == REG_RSP || d == REG_RBP) {
+        memset(holds, 0, sizeof(holds));
+      } else {
+        holds[d] = holds[s];
+      }
+      continue;
+    }
+    if (in->op == A_MOV && a == AO_REG && b == AO_MEM && in->reg[0] != REG_RSP &&
+        in->reg[0] != REG_RBP) {
+      uint8_t d = in->reg[0];
+      if (holds[d] == in->disp) {
+        in->op = A_NOP;
+        changed = true;
+        continue;
+      }
+      for (uint8_t r = 0; r < REG_COUNT; r++) {
+        if (holds[r] == in->disp) {
+          in->kind[1] = AO_REG;
+          in->reg[1] = r;
+          changed = true;
+          break;
+        }
+      }
+      holds[d] = in->disp;
+      continue;
+    }
+    if (in->op == A_MOV && a == AO_MEM && b == AO_REG && holds[in->reg[1]] == in->disp) {
+      in->op = A_NOP;
+      changed = true;
+      continue;
+    }
+    uint16_t w = writes(in);
+    if (w & (1u << REG_RSP | 1u << REG_RBP)) {
+      memset(holds, 0, sizeof(holds));
+      continue;
+    }
+    for (uint8_t r = 0; r < REG_COUNT; r++) {
+      if (w >> r & 1)
+        holds[r] = 0;
+    }
+    if (writes_mem(in)) {
+      for (uint8_t r = 0; r < REG_COUNT; r++) {
+        if (holds[r] == in->disp)
+          holds[r] = 0;
+      }
+      if (in->op == A_MOV && b == AO_REG)
+        holds[in->reg[1]] = in->disp;
+    }
+  }
+  return changed;
+}
+
+// --- stack -----------------------------------------------------------------
+// `push x` and `pop y` with nothing between become `mov y, x`, or nothing
+// when x is y.  A push and pop of the same register around instructions
+// that touch neither it nor the stack go too.
+
+#define STACK_WINDOW 8
+
+static bool peep_stack(AsmFn *fn) {
+  bool changed = false;
+  AsmInst *x = fn->insts.items;
+  size_t n = fn->insts.len;
+  for (size_t i = 0; i < n; i++) {
+    if (x[i].op != A_PUSH)
+      continue;
+    uint16_t held = 1u << REG_RSP;
+    if (x[i].kind[0] == AO_REG)
+      held |= 1u << x[i].reg[0];
+    for (size_t j = i + 1; j < n && j <= i + STACK_WINDOW; j++) {
+      AsmInst *y = &x[j];
+      if (y->op == A_POP) {
+        bool same = x[i].kind[0] == AO_REG && y->kind[0] == AO_REG && x[i].reg[0] == y->reg[0];
+        if (same) {
+          x[i].op = y->op = A_NOP;
+          changed = true;
+        } else if (j == i + 1 && (x[i].kind[0] != AO_MEM || y->kind[0] != AO_MEM)) {
+          AsmInst mov = x[i];
+          mov.op = A_MOV;
+          mov.kind[1] = mov.kind[0];
+          mov.reg[1] = mov.reg[0];
+          mov.kind[0] = y->kind[0];
+          mov.reg[0] = y->reg[0];
+          if (y->kind[0] == AO_MEM)
+            mov.disp = y->disp;
+          x[i] = mov;
+          y->op = A_NOP;
+          changed = true;
+        }
+        break;
+      }
+      if (y->op == A_LABEL || y->op == A_PUSH || y->op == A_CALL || y->op == A_RET ||
+          y->op == A_JMP || y->op == A_JCC || ((reads(y) | writes(y)) & held))
+        break;
+    }
+  }
+  return changed;
+}
+
+// --- jumps -----------------------------------------------------------------
+// A jump to a label whose code starts with a jump goes straight to that
+// jump's target.  Then a jump to the label right after it goes, and
+// `jcc a; jmp b; a:` becomes `j!cc b; a:`.  Labels no jump names go, and
+// so does the code after a jmp or ret up to the next label that stays.
+
+// Whether the code after instruction i, past labels only, is at label `to`.
+static bool falls_to(const AsmInst *x, size_t n, size_t i, int32_t to) {
+  for (size_t j = i + 1; j < n && (x[j].op == A_LABEL || x[j].op == A_NOP); j++) {
+    if (x[j].op == A_LABEL && x[j].kind[0] == AO_LABEL && x[j].disp == to)
+      return true;
+  }
+  return false;
+}
+
+// The first instruction at or after i that is not a label.
+static size_t skip_labels(const AsmInst *x, size_t n, size_t i) {
+  while (i < n && (x[i].op == A_LABEL || x[i].op == A_NOP))
+    i++;
+  return i;
+}
+
+#define JUMP_HOPS 8
+
+static bool peep_jumps(AsmFn *fn) {
+  bool changed = false;
+  AsmInst *x = fn->insts.items;
+  size_t n = fn->insts.len;
+  int32_t nlabels = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (x[i].op == A_LABEL && x[i].kind[0] == AO_LABEL && x[i].disp >= nlabels)
+      nlabels = x[i].disp + 1;
+  }
+  size_t *at = xcalloc((size_t)nlabels, sizeof(*at));
+  uint32_t *refs = xcalloc((size_t)nlabels, sizeof(*refs));
+  for (size_t i = 0; i < n; i++) {
+    if (x[i].op == A_LABEL && x[i].kind[0] == AO_LABEL)
+      at[x[i].disp] = i;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    if (!is_jump(&x[i]))
+      continue;
+    int32_t to = x[i].disp;
+    for (int hops = 0; hops < JUMP_HOPS; hops++) {
+      size_t j = skip_labels(x, n, at[to]);
+      if (j == n || x[j].op != A_JMP || x[j].kind[0] != AO_LABEL || x[j].disp == to)
+        break;
+      to = x[j].disp;
+    }
+    if (to != x[i].disp) {
+      x[i].disp = to;
+      changed = true;
+    }
+    refs[to]++;
+  }
+
+  bool dead = false;
+  for (size_t i = 0; i < n; i++) {
+    AsmInst *in = &x[i];
+    if (in->op == A_NOP)
+      continue;
+    if (in->op == A_LABEL) {
+      if (in->kind[0] == AO_LABEL && !refs[in->disp]) {
+        in->op = A_NOP;
+        changed = true;
+      } else {
+        dead = false;
+      }
+      continue;
+    }
+    if (dead || (is_jump(in) && falls_to(x, n, i, in->disp))) {
+      if (is_jump(in))
+        refs[in->disp]--;
+      in->op = A_NOP;
+      changed = true;
+      continue;
+    }
+    if (in->op == A_JCC && is_jump(in)) {
+      size_t k = i + 1;
+      while (k < n && x[k].op == A_NOP)
+        k++;
+      if (k < n && x[k].op == A_JMP && is_jump(&x[k]) && falls_to(x, n, k, in->disp)) {
+        refs[in->disp]--;
+        in->cc ^= 1;
+        in->disp = x[k].disp;
+        x[k].op = A_NOP;
+        changed = true;
+        continue;
+      }
+    }
+    dead = in->op == A_JMP || in->op == A_RET;
+  }
+  free(at);
+  free(refs);
+  return changed;
+}
+
+// --- flags -----------------------------------------------------------------
+// `setcc al; movzx r, al; test r, r; je/jne` tests what the flags of the
+// setcc already say, so the test goes and the jump takes the setcc's
+// condition, or its negation for je.  The setcc and movzx stay: r may be
+// read elsewhere.
+
+static bool peep_flags(AsmFn *fn) {
+  bool changed = false;
+  AsmInst *x = fn->insts.items;
+  for (size_t i = 2; i + 1 < fn->insts.len; i++) {
+    const AsmInst *set = &x[i - 2], *ext = &x[i - 1], *test = &x[i];
+    AsmInst *jcc = &x[i + 1];
+    if (test->op != A_TEST || test->kind[0] != AO_REG || test->kind[1] != AO_REG ||
+        test->reg[0] != test->reg[1])
+      continue;
+    if (set->op != A_SETCC || set->kind[0] != AO_REG8 || ext->op != A_MOVZX ||
+        ext->kind[0] != AO_REG32 || ext->reg[0] != test->reg[0] ||
+        ext->kind[1] != AO_REG8 || ext->reg[1] != set->reg[0])
+      continue;
+    if (jcc->op != A_JCC || (jcc->cc != CC_E && jcc->cc != CC_NE))
+      continue;
+    jcc->cc = jcc->cc == CC_NE ? set->cc : set->cc ^ 1;
+    x[i].op = A_NOP;
+    changed = true;
+  }
+  return changed;
+}
+
+// --- driver ------------------------------------------------------------------
+
+// Rounds of all the rules.  Each round only removes instructions or
+// retargets jumps, but a cycle of jumps could be retargeted forever.
+#define MAX_ROUNDS 4
+
+void peephole_run(AsmFn *fn, unsigned rules) {
+  static bool (*const pass[])(AsmFn *) = {peep_moves, peep_stack, peep_jumps, peep_flags};
+  bool changed = true;
+  for (int round = 0; round < MAX_ROUNDS && changed; round++) {
+    changed = false;
+    for (unsigned r = 0; r < sizeof(pass) / sizeof(pass[0]); r++) {
+      if (rules >> r & 1 && pass[r](fn)) {
+        asm_compact(fn);
+        changed = true;
+      }
+    }
+  }
+}
+
+static const struct {
+  const char *name;
+  unsigned rules;
+} rule_names[] = {
+  {"moves", PEEP_MOVES}, {"stack", PEEP_STACK}, {"jumps", PEEP_JUMPS},
+  {"flags", PEEP_FLAGS}, {"all", PEEP_ALL},     {"none", 0},
+};
+
+bool peephole_parse(const char *list, unsigned *rules) {
+  unsigned mask = 0;
+  const char *p = list;
+  while (*p) {
+    size_t len = strcspn(p, ",");
+    size_t k = 0, count = sizeof(rule_names) / sizeof(rule_names[0]);
+    while (k < count && (strlen(rule_names[k].name) != len || strncmp(p, rule_names[k].name, len)))
+      k++;
+    if (k == count)
+      return false;
+    mask |= rule_names[k].rules;
+    p += len;
+    if (*p == ',')
+      p++;
+  }
+  *rules = mask;
+  return true;
+}
@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "regalloc.h"
+
+static void *xcalloc(size_t n, size_t size) {
+  void *p = calloc(n ? n : 1, size);
+  if (!p) {
+    perror("regalloc");
+    exit(1);
+  }
+  return p;
+}
+
+static bool is_remat(const IrInst *in) {
+  return in->op == IR_CONST || in->op == IR_STR;
+}
+
+static bool is_call(const IrInst *in) {
+  return in->op == IR_CONCAT || in->op == IR_PRINT;
+}
+
+// --- live ranges ------------------------------------------------------------
+// Instructions are numbered in layout order from 1.  Instruction i reads
+// its operands at position 2i and writes its value at 2i + 1; a phi is
+// written where its block starts, and its arguments are read where each
+// predecessor ends.  A value is live in a list of disjoint position ranges,
+// at most one per block: from its definition or the start of a block it is
+// live into, to its last use there or the end of a block it is live out of.
+// The gaps between them are the holes where its register is free for
+// others, such as the body of a loop whose counter is only read after it.
+
+typedef struct {
+  uint32_t from, to;   // inclusive
+} Range;
+
+typedef struct {
+  uint32_t blk, pos;   // pos is LIVE_OUT for a phi argument
+} Use;
+
+#define LIVE_OUT UINT32_MAX
+
+typedef struct {
+  const IrFn *fn;
+  uint32_t *bstart, *bend;  // per block: first and last position
+  uint8_t *used;            // per value: its readers, counted up to 2
+  STACK(Range) ranges;      // value x's are ranges[first[x]] ..
+  uint32_t *first;          // ranges[first[x + 1]], ascending
+  // Per block, for the value whose ranges are being built: whether it is
+  // live in and out, and its last use.
+  uint32_t *in, *out, *use_at, *use_pos, *touched_at;
+  IrBlockList work, touched;
+} Live;
+
+static void touch(Live *l, IrRef x, uint32_t b) {
+  if (l->touched_at[b] != x) {
+    l->touched_at[b] = x;
+    stack_push(&l->touched, b);
+  }
+}
+
+// Value `x` is live into block `b`: so it is live out of each predecessor,
+// and into each one that does not define it.  The search stops at blocks
+// already marked, so all uses of one value cost at most one visit per
+// block.
+static void live_into(Live *l, IrRef x, uint32_t b) {
+  uint32_t def = ir_inst(l->fn, x)->block;
+  if (b == def || l->in[b] == x)
+    return;
+  l->in[b] = x;
+  stack_push(&l->work, b);
+  while (l->work.len) {
+    const IrBlock *blk = ir_block(l->fn, stack_pop(&l->work));
+    for (size_t i = 0; i < blk->preds.len; i++) {
+      uint32_t p = blk->preds.items[i];
+      l->out[p] = x;
+      touch(l, x, p);
+      if (p != def && l->in[p] != x) {
+        l->in[p] = x;
+        stack_push(&l->work, p);
+      }
+    }
+  }
+}
+
+static int by_block(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// Ranges of value `x`, defined at `def`, from its uses.
+static void build_ranges(Live *l, IrRef x, uint32_t def, const Use *uses,
+                         size_t nuses) {
+  uint32_t d = ir_inst(l->fn, x)->block;
+  l->touched.len = 0;
+  touch(l, x, d);
+  for (size_t k = 0; k < nuses; k++) {
+    uint32_t b = uses[k].blk;
+    touch(l, x, b);
+    if (uses[k].pos == LIVE_OUT) {
+      l->out[b] = x;
+    } else if (l->use_at[b] != x || uses[k].pos > l->use_pos[b]) {
+      l->use_at[b] = x;
+      l->use_pos[b] = uses[k].pos;
+    }
+    live_into(l, x, b);
+  }
+  qsort(l->touched.items, l->touched.len, sizeof(uint32_t), by_block);
+  size_t at = l->ranges.len;
+  for (size_t k = 0; k < l->touched.len; k++) {
+    uint32_t b = l->touched.items[k];
+    Range r = {b == d ? def : l->bstart[b], 0};
+    r.to = l->out[b] == x ? l->bend[b]
+         : l->use_at[b] == x ? l->use_pos[b] : r.from;
+    if (l->ranges.len > at && stack_top(&l->ranges)->to + 1 >= r.from)
+      stack_top(&l->ranges)->to = r.to;
+    else
+      stack_push(&l->ranges, r);
+  }
+}
+
+// Whether `x` is a compare that only the branch right after it reads.
+static bool in_flags(const Live *l, IrRef x) {
+  const IrInst *in = ir_inst(l->fn, x);
+  if (in->op < IR_EQ || in->op > IR_GE || in->block == IR_NO_BLOCK || l->used[x] != 1)
+    return false;
+  const IrBlock *blk = ir_block(l->fn, in->block);
+  size_t n = blk->insts.len;
+  if (n < 2 || blk->insts.items[n - 2] != x)
+    return false;
+  const IrInst *br = ir_inst(l->fn, blk->insts.items[n - 1]);
+  return br->op == IR_BR && br->a == x;
+}
+
+static bool is_allocated(const Live *l, IrRef x) {
+  const IrInst *in = ir_inst(l->fn, x);
+  return in->block != IR_NO_BLOCK && in->type != IRT_VOID && !is_remat(in) &&
+         l->used[x] && !in_flags(l, x);
+}
+
+static void build_live(Live *l, uint32_t *pos) {
+  const IrFn *fn = l->fn;
+  size_t n = fn->insts.len, nblocks = fn->blocks.len;
+  l->bstart = xcalloc(nblocks, sizeof(uint32_t));
+  l->bend = xcalloc(nblocks, sizeof(uint32_t));
+  l->used = xcalloc(n, 1);
+  l->first = xcalloc(n + 1, sizeof(uint32_t));
+  l->in = xcalloc(nblocks, sizeof(uint32_t));
+  l->out = xcalloc(nblocks, sizeof(uint32_t));
+  l->use_at = xcalloc(nblocks, sizeof(uint32_t));
+  l->use_pos = xcalloc(nblocks, sizeof(uint32_t));
+  l->touched_at = xcalloc(nblocks, sizeof(uint32_t));
+
+  uint32_t i = 0;
+  for (uint32_t b = 0; b < nblocks; b++) {
+    const IrBlock *blk = ir_block(fn, b);
+    l->bstart[b] = 2 * (i + 1);
+    for (size_t k = 0; k < blk->insts.len; k++)
+      pos[blk->insts.items[k]] = 2 * ++i;
+    l->bend[b] = 2 * i + 1;
+  }
+
+  // Every use, grouped by the value used.  Pass 0 counts, pass 1 fills.
+  uint32_t *count = xcalloc(n + 1, sizeof(uint32_t));
+  Use *uses = NULL;
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass) {
+      for (size_t x = 1; x <= n; x++)
+        count[x] += count[x - 1];
+      uses = xcalloc(count[n], sizeof(Use));
+    }
+    for (uint32_t b = 0; b < nblocks; b++) {
+      const IrBlock *blk = ir_block(fn, b);
+      for (size_t k = 0; k < blk->insts.len; k++) {
+        IrRef ref = blk->insts.items[k];
+        const IrInst *in = ir_inst(fn, ref);
+        size_t nargs = in->op == IR_PHI ? blk->preds.len : 0;
+        // A compare left in the flags reads its operands at the branch.
+        uint32_t at = pass && in_flags(l, ref) ? pos[ref] + 2 : pos[ref];
+        for (size_t o = 0; o < 2 + nargs; o++) {
+          IrRef x = o == 0 ? in->a : o == 1 ? in->b
+                                            : fn->args.items[in->imm + o - 2];
+          if (!x)
+            continue;
+          Use u = o < 2 ? (Use){b, at} : (Use){blk->preds.items[o - 2], LIVE_OUT};
+          if (pass) {
+            uses[count[x - 1]++] = u;
+          } else {
+            count[x]++;
+            if (l->used[x] < 2)
+              l->used[x]++;
+          }
+        }
+      }
+    }
+  }
+  // count[x - 1] now ends value x's uses, and so count[x - 2] starts them.
+  for (IrRef x = 1; x < n; x++) {
+    l->first[x] = (uint32_t)l->ranges.len;
+    if (!is_allocated(l, x))
+      continue;
+    const IrInst *in = ir_inst(fn, x);
+    uint32_t def = in->op == IR_PHI ? l->bstart[in->block] : pos[x] + 1;
+    uint32_t from = x >= 2 ? count[x - 2] : 0;
+    build_ranges(l, x, def, &uses[from], count[x - 1] - from);
+  }
+  l->first[n] = (uint32_t)l->ranges.len;
+  free(count);
+  free(uses);
+}
+
+static void live_free(Live *l) {
+  free(l->bstart);
+  free(l->bend);
+  free(l->used);
+  stack_free(&l->ranges);
+  free(l->first);
+  free(l->in);
+  free(l->out);
+  free(l->use_at);
+  free(l->use_pos);
+  free(l->touched_at);
+  stack_free(&l->work);
+  stack_free(&l->touched);
+}
+
+// --- linear scan ------------------------------------------------------------
+// In the manner of Wimmer and Mössenböck, without splitting: values in
+// order of their start take a register that no value live at the same
+// time holds.  Values already allocated are active where the scan is, or
+// inactive when it is in one of their holes, and then their register is
+// free for values that fit in the hole.  When no register is free, the
+// value that ends last is spilled for its whole life.
+
+// Handed out in this order; rax, rdx and r11 stay with codegen.
+static const uint8_t callee_regs[] = {REG_RBX, REG_R12, REG_R13, REG_R14,
+                                      REG_R15};
+static const uint8_t caller_regs[] = {REG_RCX, REG_RSI, REG_RDI, REG_R8,
+                                      REG_R9, REG_R10};
+
+typedef struct {
+  Live live;
+  uint32_t *calls;      // positions of the calls, ascending
+  IrRef *call_ref;      // the call at each of those positions
+  size_t ncalls;
+  uint32_t *cursor;     // per value: its first range the scan is not past
+  IrRefs active, inactive;
+  IrRef *phi_of;        // per value: a phi it is an argument of
+} Scan;
+
+static const Range *ranges_of(const Scan *s, IrRef x, const Range **end) {
+  const Live *l = &s->live;
+  *end = l->ranges.items + l->first[x + 1];
+  return l->ranges.items + l->first[x];
+}
+
+static uint32_t start_of(const Scan *s, IrRef x) {
+  return s->live.ranges.items[s->live.first[x]].from;
+}
+
+static uint32_t end_of(const Scan *s, IrRef x) {
+  return s->live.ranges.items[s->live.first[x + 1] - 1].to;
+}
+
+// Whether value `x` is live at position `p`; the scan only moves forward,
+// so x's cursor skips the ranges behind it for good.
+static bool covers(Scan *s, IrRef x, uint32_t p) {
+  const Range *r = s->live.ranges.items;
+  uint32_t last = s->live.first[x + 1];
+  while (s->cursor[x] < last && r[s->cursor[x]].to < p)
+    s->cursor[x]++;
+  return s->cursor[x] < last && r[s->cursor[x]].from <= p;
+}
+
+// Whether allocated value `x` is live anywhere `y` is.
+static bool intersects(const Scan *s, IrRef x, IrRef y) {
+  const Range *r = s->live.ranges.items;
+  uint32_t i = s->cursor[x], iend = s->live.first[x + 1];
+  const Range *rend, *q = ranges_of(s, y, &rend);
+  while (i < iend && q < rend) {
+    if (r[i].to < q->from)
+      i++;
+    else if (q->to < r[i].from)
+      q++;
+    else
+      return true;
+  }
+  return false;
+}
+
+// Index of the first call at or after position `p`.
+static size_t next_call(const Scan *s, uint32_t p) {
+  size_t lo = 0, hi = s->ncalls;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (s->calls[mid] < p)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Calls value `x` is live across: x is live where the call reads its
+// arguments, and read after the call writes its result.  Adds `reg` to each
+// such call's saves, or with REG_NONE just returns whether there is one.
+static bool across_calls(const Scan *s, RegAlloc *ra, IrRef x, uint8_t reg) {
+  const Range *end, *r = ranges_of(s, x, &end);
+  for (; r < end; r++) {
+    for (size_t c = next_call(s, r->from);
+         c < s->ncalls && s->calls[c] + 1 < r->to; c++) {
+      if (reg == REG_NONE)
+        return true;
+      ra->saves[s->call_ref[c]] |= (uint16_t)(1u << reg);
+    }
+  }
+  return false;
+}
+
+static int by_key(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+// The register value `x` would like: the one its phi, its phi's other
+// arguments or its first operand hold, so the copy between them vanishes.
+static uint8_t hint(const Scan *s, const RegAlloc *ra, IrRef x) {
+  const IrFn *fn = s->live.fn;
+  const IrInst *in = ir_inst(fn, x);
+  IrRef phi = s->phi_of[x];
+  if (phi && ra->reg[phi] != REG_NONE)
+    return ra->reg[phi];
+  if (in->op == IR_PHI) {
+    const IrBlock *blk = ir_block(fn, in->block);
+    for (size_t j = 0; j < blk->preds.len; j++) {
+      IrRef a = fn->args.items[in->imm + j];
+      if (ra->reg[a] != REG_NONE)
+        return ra->reg[a];
+    }
+    return REG_NONE;
+  }
+  return in->a ? ra->reg[in->a] : REG_NONE;
+}
+
+static uint8_t free_reg(uint16_t blocked, const uint8_t *regs, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (!(blocked >> regs[i] & 1))
+      return regs[i];
+  }
+  return REG_NONE;
+}
+
+// A register for `x` outside `blocked`.  One that lives across a call goes
+// to a callee-saved register if it can, so it needs no saving around
+// calls; others take a caller-saved one first, which needs no saving in
+// the prologue.
+static uint8_t pick(const Scan *s, RegAlloc *ra, IrRef x, uint16_t blocked) {
+  uint8_t h = hint(s, ra, x);
+  bool h_free = h < REG_COUNT && !(blocked >> h & 1);
+  uint8_t r;
+  if (across_calls(s, ra, x, REG_NONE)) {
+    if (h_free && reg_is_callee_saved(h))
+      return h;
+    r = free_reg(blocked, callee_regs, sizeof(callee_regs));
+    if (r == REG_NONE && h_free)
+      r = h;
+    if (r == REG_NONE)
+      r = free_reg(blocked, caller_regs, sizeof(caller_regs));
+    return r;
+  }
+  if (h_free)
+    return h;
+  r = free_reg(blocked, caller_regs, sizeof(caller_regs));
+  if (r == REG_NONE)
+    r = free_reg(blocked, callee_regs, sizeof(callee_regs));
+  return r;
+}
+
+// Moves the values the scan has passed out of the active and inactive
+// sets, and the others between them, for the scan at position `p`.
+static void advance(Scan *s, uint32_t p) {
+  IrRefs *act = &s->active, *inact = &s->inactive;
+  size_t keep = 0, keep_in = 0, ninact = inact->len;
+  for (size_t k = 0; k < act->len; k++) {
+    IrRef a = act->items[k];
+    if (end_of(s, a) < p)
+      continue;
+    if (covers(s, a, p))
+      act->items[keep++] = a;
+    else
+      stack_push(inact, a);
+  }
+  act->len = keep;
+  for (size_t k = 0; k < inact->len; k++) {
+    IrRef a = inact->items[k];
+    if (end_of(s, a) < p)
+      continue;
+    if (k < ninact && covers(s, a, p))
+      stack_push(act, a);
+    else
+      inact->items[keep_in++] = a;
+  }
+  inact->len = keep_in;
+}
+
+void regalloc_run(RegAlloc *ra, const IrFn *fn) {
+  size_t n = fn->insts.len;
+  *ra = (RegAlloc){0};
+  ra->reg = xcalloc(n, 1);
+  memset(ra->reg, REG_NONE, n ? n : 1);
+  ra->spill = xcalloc(n, sizeof(uint32_t));
+  ra->saves = xcalloc(n, sizeof(uint16_t));
+
+  Scan s = {.live = {.fn = fn}};
+  uint32_t *pos = xcalloc(n, sizeof(uint32_t));
+  build_live(&s.live, pos);
+  s.cursor = xcalloc(n + 1, sizeof(uint32_t));
+  s.phi_of = xcalloc(n, sizeof(IrRef));
+  s.calls = xcalloc(n, sizeof(uint32_t));
+  s.call_ref = xcalloc(n, sizeof(IrRef));
+  STACK(uint64_t) order = {0};   // start << 32 | value
+  for (uint32_t b = 0; b < fn->blocks.len; b++) {
+    const IrBlock *blk = ir_block(fn, b);
+    for (size_t k = 0; k < blk->insts.len; k++) {
+      IrRef ref = blk->insts.items[k];
+      const IrInst *in = ir_inst(fn, ref);
+      if (is_call(in)) {
+        s.calls[s.ncalls] = pos[ref];
+        s.call_ref[s.ncalls++] = ref;
+      }
+      if (in->op == IR_PHI) {
+        for (size_t j = 0; j < blk->preds.len; j++)
+          s.phi_of[fn->args.items[in->imm + j]] = ref;
+      }
+      if (in_flags(&s.live, ref))
+        ra->reg[ref] = REG_FLAGS;
+      if (is_allocated(&s.live, ref)) {
+        s.cursor[ref] = s.live.first[ref];
+        stack_push(&order, (uint64_t)start_of(&s, ref) << 32 | ref);
+      }
+    }
+  }
+  if (order.len)
+    qsort(order.items, order.len, sizeof(*order.items), by_key);
+
+  for (size_t i = 0; i < order.len; i++) {
+    IrRef x = (IrRef)order.items[i];
+    advance(&s, start_of(&s, x));
+    uint16_t busy = 0, held = 0;   // by active values; by inactive ones
+    for (size_t k = 0; k < s.active.len; k++)
+      busy |= (uint16_t)(1u << ra->reg[s.active.items[k]]);
+    for (size_t k = 0; k < s.inactive.len; k++) {
+      IrRef a = s.inactive.items[k];
+      if (intersects(&s, a, x))
+        held |= (uint16_t)(1u << ra->reg[a]);
+    }
+
+    uint8_t r = pick(&s, ra, x, busy | held);
+    if (r == REG_NONE) {
+      // Take the register of the active value that ends last, if that is
+      // after `x` ends and no inactive value needs the register during x.
+      size_t victim = SIZE_MAX;
+      for (size_t k = 0; k < s.active.len; k++) {
+        IrRef a = s.active.items[k];
+        if (!(held >> ra->reg[a] & 1) && end_of(&s, a) > end_of(&s, x) &&
+            (victim == SIZE_MAX ||
+             end_of(&s, a) > end_of(&s, s.active.items[victim])))
+          victim = k;
+      }
+      if (victim == SIZE_MAX) {
+        ra->spill[x] = ++ra->nspills;
+        continue;
+      }
+      IrRef v = s.active.items[victim];
+      r = ra->reg[v];
+      ra->reg[v] = REG_NONE;
+      ra->spill[v] = ++ra->nspills;
+      s.active.items[victim] = stack_pop(&s.active);
+    }
+    ra->reg[x] = r;
+    ra->used |= (uint16_t)(1u << r);
+    stack_push(&s.active, x);
+  }
+
+  for (size_t i = 0; i < order.len; i++) {
+    IrRef x = (IrRef)order.items[i];
+    uint8_t r = ra->reg[x];
+    if (r != REG_NONE && !reg_is_callee_saved(r))
+      across_calls(&s, ra, x, r);
+  }
+
+  stack_free(&order);
+  stack_free(&s.active);
+  stack_free(&s.inactive);
+  free(pos);
+  free(s.cursor);
+  free(s.phi_of);
+  free(s.calls);
+  free(s.call_ref);
+  live_free(&s.live);
+}
+
+void regalloc_free(RegAlloc *ra) {
+  free(ra->reg);
+  free(ra->spill);
+  free(ra->saves);
+  *ra = (RegAlloc){0};
+}
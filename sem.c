@@ -3,6 +3,8 @@
 #include <string.h>
 
 #include "sem.h"
+#include "stack.h"
+#include "tools.h"
 
 // --- primitive type singletons -------------------------------------------
 static Type TY_INT_OBJ    = { TY_INT };
@@ -18,111 +20,144 @@ Type *type_void(void)   { return &TY_VOID_OBJ; }
 Type *type_unknown(void){ return &TY_UNKNOWN_OBJ; }
 
 // --- scope handling -------------------------------------------------------
-Scope *scope_new(Scope *parent) {
-  Scope *s = malloc(sizeof(Scope));
-  if (!s) { perror("scope_new"); exit(1); }
-  s->parent = parent;
-  s->bindings = NULL;
-  return s;
+static Type *type_of(TypeKind kind) {
+  static Type *const by_kind[] = {
+    [TY_INT] = &TY_INT_OBJ, [TY_STRING] = &TY_STRING_OBJ,
+    [TY_BOOL] = &TY_BOOL_OBJ, [TY_VOID] = &TY_VOID_OBJ,
+    [TY_UNKNOWN] = &TY_UNKNOWN_OBJ,
+  };
+  return by_kind[kind];
 }
 
-static Binding *binding_new(const char *name, Type *type) {
-  Binding *b = malloc(sizeof(Binding));
-  if (!b) { perror("binding_new"); exit(1); }
-  b->name = strdup(name);
-  b->type = type;
-  b->next = NULL;
-  return b;
-}
+// --- semantic helpers -----------------------------------------------------
 
-Type *scope_lookup(Scope *scope, const char *name) {
-  for (Scope *s = scope; s; s = s->parent) {
-    for (Binding *b = s->bindings; b; b = b->next) {
-      if (strcmp(b->name, name) == 0)
-        return b->type;
-    }
+// A body checked as a task keeps its diagnostic in fn_errors[task_index]
+// instead of printing it; see sem_program.
+static char **fn_errors;
+static _Thread_local bool in_task;
+static _Thread_local size_t task_index;
+
+static void sem_error(const char *msg, const char *name) {
+  if (!in_task) {
+    if (name)
+      fprintf(stderr, "Semantic error: %s '%s'\n", msg, name);
+    else
+      fprintf(stderr, "Semantic error: %s\n", msg);
+    error_exit();
   }
-  return NULL;
+  size_t len = strlen(msg) + (name ? strlen(name) : 0) + 24;
+  char *text = malloc(len);
+  if (!text) { perror("sem_error"); exit(1); }
+  if (name)
+    snprintf(text, len, "Semantic error: %s '%s'\n", msg, name);
+  else
+    snprintf(text, len, "Semantic error: %s\n", msg);
+  fn_errors[task_index] = text;
+  error_exit();
 }
 
-int scope_insert(Scope *scope, const char *name, Type *type) {
-  for (Binding *b = scope->bindings; b; b = b->next) {
-    if (strcmp(b->name, name) == 0)
-      return 0; // duplicate
-  }
-  Binding *b = binding_new(name, type);
-  b->next = scope->bindings;
-  scope->bindings = b;
+static Type *set_type(Node *node, Type *type) {
+  node->ty = (uint8_t)(type->kind + 1);
+  return type;
+}
+
+Type *node_type(const Node *node) {
+  return node->ty ? type_of((TypeKind)(node->ty - 1)) : NULL;
+}
+
+void node_set_type(Node *node, Type *type) {
+  set_type(node, type);
+}
+
+// Each variable gets a frame slot, numbered from 1 in declaration order
+// within its function; codegen addresses it as [rbp - 8 * slot].  A
+// binding's value is its slot and its flags its TypeKind.
+static _Thread_local uint32_t next_slot;
+
+// Resolve an identifier use to its declaration, recording the slot and
+// type on the node.  Returns NULL if the name is not declared.
+static Type *scope_lookup(SymTab *scope, Node *ident) {
+  Sym *sym = symtab_lookup(scope, ident->name);
+  if (!sym)
+    return NULL;
+  ident->slot = sym->value;
+  return set_type(ident, type_of((TypeKind)sym->flags));
+}
+
+// Declare the variable of a `let` in the innermost scope and give it the
+// next slot.  Returns 0 if the scope already has one of that name.
+static int scope_insert(SymTab *scope, Node *let, Type *type) {
+  Sym *sym = symtab_insert(scope, let->name);
+  if (!sym)
+    return 0; // duplicate
+  sym->value = let->slot = ++next_slot;
+  sym->flags = type->kind;
   return 1;
 }
 
-// --- semantic helpers -----------------------------------------------------
-static void sem_error(const char *msg, const char *name) {
-  if (name)
-    fprintf(stderr, "Semantic error: %s '%s'\n", msg, name);
-  else
-    fprintf(stderr, "Semantic error: %s\n", msg);
-  exit(1);
+static Type *operand_type(Ast *ast, NodeId id) {
+  return id ? node_type(ast_node(ast, id)) : type_void();
 }
 
-Type *sem_expr(Node *node, Scope *scope) {
-  if (!node) return type_void();
+// Type one expression node whose operands have already been typed.
+static Type *sem_expr_node(Ast *ast, Node *node, SymTab *scope) {
   switch (node->kind) {
   case NK_Int:
-    return node->ty = type_int();
+    return set_type(node, type_int());
   case NK_String:
-    return node->ty = type_string();
+    return set_type(node, type_string());
   case NK_Bool:
-    return node->ty = type_bool();
+    return set_type(node, type_bool());
   case NK_Identifier: {
-    Type *t = scope_lookup(scope, node->value);
-    if (!t) sem_error("undeclared identifier", node_name(node));
-    return node->ty = t;
+    Type *t = scope_lookup(scope, node);
+    if (!t) sem_error("undeclared identifier", node_name(ast, node));
+    return t;
   }
   case NK_Unary: {
-    Type *rt = sem_expr(node->left, scope);
+    Type *rt = operand_type(ast, node->left);
     switch (node->op) {
     case NOT:
       if (rt != type_bool()) sem_error("operator requires boolean", NULL);
-      node->ty = type_bool();
-      return node->ty;
+      return set_type(node, type_bool());
     case DASH:
     case PLUS:
     case PLUS_PLUS:
     case MINUS_MINUS:
       if (rt != type_int()) sem_error("operator requires integer", NULL);
-      node->ty = type_int();
-      return node->ty;
+      return set_type(node, type_int());
     default:
-      node->ty = rt;
-      return node->ty;
+      return set_type(node, rt);
     }
   }
   case NK_Assign: {
-    Type *lt = sem_expr(node->left, scope);
-    Type *rt = sem_expr(node->right, scope);
+    Type *lt = operand_type(ast, node->left);
+    Type *rt = operand_type(ast, node->right);
     if (node->op == PLUS_EQUALS || node->op == MINUS_EQUALS) {
       if (lt != type_int() || rt != type_int())
         sem_error("compound assignment on non-integers", NULL);
     }
     if (lt != rt)
       sem_error("assignment of incompatible types", NULL);
-    node->ty = lt;
-    return node->ty;
+    return set_type(node, lt);
   }
   case NK_Binary: {
-    Type *lt = sem_expr(node->left, scope);
-    Type *rt = sem_expr(node->right, scope);
+    Type *lt = operand_type(ast, node->left);
+    Type *rt = operand_type(ast, node->right);
     switch (node->op) {
     case PLUS:
+      // `+` also concatenates two strings.
+      if (lt == type_string() && rt == type_string())
+        return set_type(node, type_string());
+      if (lt != type_int() || rt != type_int())
+        sem_error("arithmetic on non-integers", NULL);
+      return set_type(node, type_int());
     case DASH:
     case STAR:
     case SLASH:
     case PERCENT:
       if (lt != type_int() || rt != type_int())
         sem_error("arithmetic on non-integers", NULL);
-      node->ty = type_int();
-      return node->ty;
+      return set_type(node, type_int());
     case EQUALS:
     case NOT_EQUALS:
     case LESS:
@@ -130,156 +165,413 @@ Type *sem_expr(Node *node, Scope *scope) {
     case GREATER:
     case GREATER_EQUALS:
       if (lt != rt) sem_error("comparison of incompatible types", NULL);
-      node->ty = type_bool();
-      return node->ty;
+      return set_type(node, type_bool());
     case AND:
     case OR:
       if (lt != type_bool() || rt != type_bool())
         sem_error("logical operator on non-bools", NULL);
-      node->ty = type_bool();
-      return node->ty;
+      return set_type(node, type_bool());
     default:
-      node->ty = type_unknown();
-      return node->ty;
+      return set_type(node, type_unknown());
     }
   }
   default:
-    node->ty = type_void();
-    return node->ty;
+    return set_type(node, type_void());
   }
 }
 
-static int sem_if(Node *ifnode, Scope *scope);
-static void sem_for(Node *fornode, Scope *scope);
+typedef struct {
+  NodeId id;
+  bool operands_done;
+} ExprFrame;
 
-static void sem_let(Node *stmt, Scope *scope) {
-  const char *name = stmt->value;
+typedef STACK(ExprFrame) ExprStack;
+
+// Reused across calls so typing a leaf or a short expression never
+// allocates.  Function bodies are analysed on several threads, so each
+// thread points at its own: sem_program's walk of the top level uses
+// top_exprs, and each worker one of fn_exprs (see sem_program).
+static ExprStack top_exprs;
+static _Thread_local ExprStack *expr_stack = &top_exprs;
+
+// Post-order walk on an explicit stack: an operator node is typed once both
+// operands are, left before right, so errors come out in source order.
+Type *sem_expr(Ast *ast, NodeId root, SymTab *scope) {
+  if (!root) return type_void();
+  size_t base = expr_stack->len;
+  stack_push(expr_stack, ((ExprFrame){root, false}));
+  while (expr_stack->len > base) {
+    ExprFrame *f = stack_top(expr_stack);
+    Node *node = ast_node(ast, f->id);
+    bool operands = node->kind == NK_Unary || node->kind == NK_Binary ||
+                    node->kind == NK_Assign;
+    if (!operands || f->operands_done) {
+      expr_stack->len--;
+      sem_expr_node(ast, node, scope);
+      continue;
+    }
+    f->operands_done = true;
+    NodeId left = node->left, right = node->right;
+    if (node->kind != NK_Unary && right)
+      stack_push(expr_stack, ((ExprFrame){right, false}));
+    if (left)
+      stack_push(expr_stack, ((ExprFrame){left, false}));
+  }
+  return node_type(ast_node(ast, root));
+}
+
+static void sem_let(Ast *ast, Node *stmt, SymTab *scope) {
   Type *t = type_unknown();
   if (stmt->right)
-    t = sem_expr(stmt->right, scope);
-  if (!scope_insert(scope, name, t))
-    sem_error("duplicate identifier", node_name(stmt));
-  stmt->ty = type_void();
+    t = sem_expr(ast, stmt->right, scope);
+  if (!scope_insert(scope, stmt, t))
+    sem_error("duplicate identifier", node_name(ast, stmt));
+  set_type(stmt, type_void());
 }
 
-static void sem_assign(Node *stmt, Scope *scope) {
-  const char *name = NULL;
-  if (stmt->left && stmt->left->value)
-    name = stmt->left->value;
-  else
+static void sem_assign(Ast *ast, Node *stmt, SymTab *scope) {
+  Node *lhs_node = stmt->left ? ast_node(ast, stmt->left) : NULL;
+  if (!lhs_node || !lhs_node->name)
     sem_error("assignment missing identifier", NULL);
-  Type *lhs = scope_lookup(scope, name);
-  if (!lhs) sem_error("undeclared identifier", node_name(stmt->left));
-  Type *rhs = sem_expr(stmt->right, scope);
-  if (lhs != rhs) sem_error("assignment of incompatible types", node_name(stmt->left));
-  stmt->ty = lhs;
+  Type *lhs = scope_lookup(scope, lhs_node);
+  if (!lhs) sem_error("undeclared identifier", node_name(ast, lhs_node));
+  Type *rhs = sem_expr(ast, stmt->right, scope);
+  if (lhs != rhs) sem_error("assignment of incompatible types", node_name(ast, lhs_node));
+  set_type(stmt, lhs);
 }
 
-int sem_block(Node *block, Scope *scope) {
-  Scope *inner = scope_new(scope);
-  int must_exit = 0;
-  for (size_t i = 0; i < block->children.len; i++) {
-    if (must_exit)
-      break;
-    Node *stmt = block->children.items[i];
-    switch (stmt->kind) {
-    case NK_LetStmt:
-      sem_let(stmt, inner);
-      break;
-    case NK_AssignStmt:
-      sem_assign(stmt, inner);
-      break;
-    case NK_ExprStmt:
-      sem_expr(stmt->left, inner);
-      stmt->ty = type_void();
-      break;
-    case NK_WriteStmt:
-      sem_expr(stmt->left, inner);
-      stmt->ty = type_void();
-      break;
-    case NK_ExitStmt:
-      if (sem_expr(stmt->left, inner) != type_int())
-        sem_error("exit expects integer status", NULL);
-      stmt->ty = type_void();
-      must_exit = 1;
-      break;
-    case NK_IfStmt:
-      if (sem_if(stmt, inner))
-        must_exit = 1;
-      stmt->ty = type_void();
-      break;
-    case NK_Block:
-      if (sem_block(stmt, inner))
-        must_exit = 1;
-      stmt->ty = type_void();
-      break;
-    case NK_ForStmt:
-      sem_for(stmt, inner);
-      stmt->ty = type_void();
-      break;
-    default:
-      sem_expr(stmt, inner);
-      stmt->ty = type_void();
-      break;
-    }
-  }
-  return must_exit;
+static void sem_for_init(Ast *ast, NodeId init, SymTab *scope) {
+  Node *n = ast_node(ast, init);
+  if (n->kind == NK_LetStmt)
+    sem_let(ast, n, scope);
+  else if (n->kind == NK_AssignStmt)
+    sem_assign(ast, n, scope);
+  else
+    sem_expr(ast, init, scope);
 }
 
-static int sem_if(Node *ifnode, Scope *scope) {
-  Node *cond = ifnode->children.len > 0 ? ifnode->children.items[0] : NULL;
-  Node *then_block = ifnode->children.len > 1 ? ifnode->children.items[1] : NULL;
-  Node *else_node = ifnode->children.len > 2 ? ifnode->children.items[2] : NULL;
-  if (sem_expr(cond, scope) != type_bool())
+static void sem_for_step(Ast *ast, NodeId step, SymTab *scope) {
+  Node *n = ast_node(ast, step);
+  if (n->kind == NK_AssignStmt)
+    sem_assign(ast, n, scope);
+  else
+    sem_expr(ast, step, scope);
+}
+
+// --- blocks -----------------------------------------------------------------
+
+// Functions met while sem_program walks the top level are queued for the
+// workers instead of being checked in place; see below.
+static STACK(NodeId) fn_queue;
+static bool queue_fns; // set while sem_program walks the top level
+
+// Blocks being walked.  sem_block keeps them on an explicit stack instead of
+// recursing, so `if`s, loops and bare blocks nest as deep as the heap
+// allows.  `role` says what the block belongs to, and so what to do once its
+// last statement is checked.
+typedef enum { BR_ROOT, BR_BLOCK, BR_THEN, BR_ELSE, BR_WHILE, BR_FOR, BR_FN } BlockRole;
+
+typedef struct {
+  NodeId block;
+  NodeId stmt;       // statement owning the block, in the enclosing block
+  NodeId arm;        // IfStmt of a BR_THEN block, one arm of stmt's chain
+  uint8_t role;      // BlockRole
+  bool must_exit;    // a statement checked so far always exits
+  bool exits;        // every arm of the chain so far always exits
+  uint32_t next;     // next statement to check
+  size_t mark;       // scope of the block
+  size_t saved;      // BR_FOR: scope of its header; BR_FN: the outer next_slot
+} BlockFrame;
+
+typedef STACK(BlockFrame) BlockStack;
+
+// Per thread, like expr_stack.
+static BlockStack top_blocks;
+static _Thread_local BlockStack *block_stack = &top_blocks;
+
+static void open_block(NodeId block, NodeId stmt, BlockRole role,
+                       SymTab *scope) {
+  stack_push(block_stack, ((BlockFrame){block, stmt, NODE_NONE, (uint8_t)role,
+                                         false, true, 0, symtab_enter(scope), 0}));
+}
+
+// Check `arm`'s condition and open its then-block, carrying whether the
+// arms before it all exit.
+static void open_arm(Ast *ast, NodeId stmt, NodeId arm, bool exits,
+                     SymTab *scope) {
+  Node *ifnode = ast_node(ast, arm);
+  if (sem_expr(ast, ast_child(ast, ifnode, 0), scope) != type_bool())
     sem_error("if condition must be boolean", NULL);
-  int exit_then = sem_block(then_block, scope);
-  if (else_node) {
-    int exit_alt;
-    if (else_node->kind == NK_IfStmt)
-      exit_alt = sem_if(else_node, scope);
+  open_block(ast_child(ast, ifnode, 1), stmt, BR_THEN, scope);
+  BlockFrame *f = stack_top(block_stack);
+  f->arm = arm;
+  f->exits = exits;
+}
+
+// Start checking a statement of the innermost block.  Statements that own
+// a block open it and return; the rest are checked here.
+static void sem_stmt(Ast *ast, NodeId stmt_id, SymTab *scope) {
+  Node *stmt = ast_node(ast, stmt_id);
+  switch (stmt->kind) {
+  case NK_LetStmt:
+    sem_let(ast, stmt, scope);
+    break;
+  case NK_AssignStmt:
+    sem_assign(ast, stmt, scope);
+    break;
+  case NK_ExprStmt:
+  case NK_WriteStmt:
+    sem_expr(ast, stmt->left, scope);
+    set_type(stmt, type_void());
+    break;
+  case NK_ExitStmt:
+    if (sem_expr(ast, stmt->left, scope) != type_int())
+      sem_error("exit expects integer status", NULL);
+    set_type(stmt, type_void());
+    stack_top(block_stack)->must_exit = true;
+    break;
+  case NK_IfStmt:
+    open_arm(ast, stmt_id, stmt_id, true, scope);
+    break;
+  case NK_Block:
+    open_block(stmt_id, stmt_id, BR_BLOCK, scope);
+    break;
+  case NK_WhileStmt: {
+    NodeId cond = ast_child(ast, stmt, 0);
+    NodeId body = ast_child(ast, stmt, 1);
+    if (cond && sem_expr(ast, cond, scope) != type_bool())
+      sem_error("while condition must be boolean", NULL);
+    if (body)
+      open_block(body, stmt_id, BR_WHILE, scope);
     else
-      exit_alt = sem_block(else_node, scope);
-    return exit_then && exit_alt;
+      set_type(stmt, type_void());
+    break;
+  }
+  case NK_ForStmt: {
+    size_t mark = symtab_enter(scope);
+    NodeId init = ast_child(ast, stmt, 0);
+    NodeId cond = ast_child(ast, stmt, 1);
+    NodeId body = ast_child(ast, stmt, 3);
+    if (init)
+      sem_for_init(ast, init, scope);
+    if (cond && sem_expr(ast, cond, scope) != type_bool())
+      sem_error("for condition must be boolean", NULL);
+    if (body) {
+      open_block(body, stmt_id, BR_FOR, scope);
+      stack_top(block_stack)->saved = mark;
+    } else {
+      NodeId step = ast_child(ast, stmt, 2);
+      if (step)
+        sem_for_step(ast, step, scope);
+      symtab_leave(scope, mark);
+      set_type(stmt, type_void());
+    }
+    break;
+  }
+  case NK_FnDecl: {
+    if (queue_fns) {
+      stack_push(&fn_queue, stmt_id);
+      break;
+    }
+    // Every function, nested ones too, is emitted with a frame of its own.
+    uint32_t outer_slots = next_slot;
+    next_slot = 0;
+    NodeId body = ast_child(ast, stmt, 0);
+    if (body) {
+      open_block(body, stmt_id, BR_FN, scope);
+      stack_top(block_stack)->saved = outer_slots;
+    } else {
+      next_slot = outer_slots;
+      set_type(stmt, type_void());
+    }
+    break;
+  }
+  default:
+    sem_expr(ast, stmt_id, scope);
+    set_type(stmt, type_void());
+    break;
   }
-  return 0;
 }
 
-static void sem_for(Node *fornode, Scope *scope) {
-  Scope *loop = scope_new(scope);
-  Node *init = fornode->children.len > 0 ? fornode->children.items[0] : NULL;
-  Node *cond = fornode->children.len > 1 ? fornode->children.items[1] : NULL;
-  Node *step = fornode->children.len > 2 ? fornode->children.items[2] : NULL;
-  Node *body = fornode->children.len > 3 ? fornode->children.items[3] : NULL;
-
-  if (init) {
-    if (init->kind == NK_LetStmt)
-      sem_let(init, loop);
-    else if (init->kind == NK_AssignStmt)
-      sem_assign(init, loop);
-    else
-      sem_expr(init, loop);
+// The innermost block is done: close its scope and finish the statement it
+// belongs to.  An `if` arm may instead open the next block of its chain.
+static void close_block(Ast *ast, SymTab *scope) {
+  BlockFrame f = stack_pop(block_stack);
+  symtab_leave(scope, f.mark);
+  if (f.role == BR_ROOT)
+    return;
+  Node *stmt = ast_node(ast, f.stmt);
+  bool exits = false;
+  switch (f.role) {
+  case BR_THEN: {
+    // The chain exits only if every arm and the final else do.
+    NodeId else_node = ast_child(ast, ast_node(ast, f.arm), 2);
+    if (else_node && ast_node(ast, else_node)->kind == NK_IfStmt) {
+      open_arm(ast, f.stmt, else_node, f.exits && f.must_exit, scope);
+      return;
+    }
+    if (else_node) {
+      open_block(else_node, f.stmt, BR_ELSE, scope);
+      stack_top(block_stack)->exits = f.exits && f.must_exit;
+      return;
+    }
+    break;
+  }
+  case BR_ELSE:
+    exits = f.exits && f.must_exit;
+    break;
+  case BR_BLOCK:
+    exits = f.must_exit;
+    break;
+  case BR_FOR: {
+    NodeId step = ast_child(ast, stmt, 2);
+    if (step)
+      sem_for_step(ast, step, scope);
+    symtab_leave(scope, f.saved);
+    break;
+  }
+  case BR_FN:
+    next_slot = (uint32_t)f.saved;
+    break;
+  default:
+    break;
   }
+  set_type(stmt, type_void());
+  if (exits)
+    stack_top(block_stack)->must_exit = true;
+}
 
-  if (cond) {
-    if (sem_expr(cond, loop) != type_bool())
-      sem_error("for condition must be boolean", NULL);
+int sem_block(Ast *ast, NodeId block_id, SymTab *scope) {
+  size_t base = block_stack->len;
+  open_block(block_id, NODE_NONE, BR_ROOT, scope);
+  int must_exit = 0;
+  while (block_stack->len > base) {
+    BlockFrame *f = stack_top(block_stack);
+    Node *block = ast_node(ast, f->block);
+    // Statements after one that always exits are not checked.
+    if (f->must_exit || f->next == block->count) {
+      if (block_stack->len == base + 1)
+        must_exit = f->must_exit;
+      close_block(ast, scope);
+      continue;
+    }
+    sem_stmt(ast, ast_child(ast, block, f->next++), scope);
   }
+  return must_exit;
+}
+
+// --- functions ------------------------------------------------------------
+// Top-level statements are analysed first, on the calling thread, and the
+// functions they declare are queued.  Once every name is known to be unique
+// the queued bodies are analysed as independent tasks: a body sees only its
+// own scope and writes only its own nodes.  Functions nested in a body are
+// analysed in place, inside the enclosing scope.
+//
+// A function is typed once its body has passed, and a typed top-level
+// function is not analysed again; watch mode relies on this to check only
+// the functions it re-parsed.
+
+static SymTab top_scope;
+static SymTab *fn_scopes; // one per worker, reused from body to body
+// The workers' walk stacks, likewise reused from body to body.  They live
+// here rather than in thread-local storage because the pool's threads exit
+// when run_tasks returns, and nothing would free what those threads held.
+static ExprStack *fn_exprs;
+static BlockStack *fn_blocks;
 
+// Check a queued function's body in `scope`.
+static void sem_fn(Ast *ast, NodeId fn, SymTab *scope) {
+  Node *node = ast_node(ast, fn);
+  NodeId body = ast_child(ast, node, 0);
+  next_slot = 0;
   if (body)
-    sem_block(body, loop);
+    sem_block(ast, body, scope);
+  set_type(node, type_void());
+}
 
-  if (step) {
-    if (step->kind == NK_AssignStmt)
-      sem_assign(step, loop);
-    else
-      sem_expr(step, loop);
-  }
+static void sem_fn_task(void *arg, size_t worker, size_t index) {
+  Ast *ast = arg;
+  NodeId fn = fn_queue.items[index];
+  if (ast_node(ast, fn)->ty)
+    return;
+  // All three are left over if error_exit() abandoned a walk.
+  expr_stack = &fn_exprs[worker];
+  block_stack = &fn_blocks[worker];
+  expr_stack->len = 0;
+  block_stack->len = 0;
+  symtab_reset(&fn_scopes[worker]);
+  in_task = true;
+  task_index = index;
+  sem_fn(ast, fn, &fn_scopes[worker]);
+  in_task = false;
 }
 
-void sem_program(Node *root) {
-  if (!root || root->children.len == 0) return;
-  Scope *global = scope_new(NULL);
-  for (size_t i = 0; i < root->children.len; i++)
-    sem_block(root->children.items[i], global);
+static void sem_signatures(Ast *ast, const NodeId *fns, size_t count) {
+  uint8_t *seen = calloc(atom_count() + 1, 1);
+  if (!seen) { perror("sem_signatures"); exit(1); }
+  for (size_t i = 0; i < count; i++) {
+    Node *fn = ast_node(ast, fns[i]);
+    if (seen[fn->name]) {
+      free(seen);
+      sem_error("duplicate function", node_name(ast, fn));
+    }
+    seen[fn->name] = 1;
+  }
+  free(seen);
 }
 
+void sem_program(Ast *ast, NodeId root) {
+  Node *program = root ? ast_node(ast, root) : NULL;
+  if (!program || program->count == 0) return;
+  // These are left over if error_exit() abandoned an earlier run.
+  expr_stack->len = 0;
+  block_stack->len = 0;
+  fn_queue.len = 0;
+  symtab_reset(&top_scope);
+  next_slot = 0;
+  queue_fns = true;
+  for (size_t i = 0; i < program->count; i++)
+    sem_block(ast, ast_child(ast, program, i), &top_scope);
+  queue_fns = false;
+  sem_signatures(ast, fn_queue.items, fn_queue.len);
+
+  size_t workers = task_threads();
+  fn_scopes = calloc(workers, sizeof(*fn_scopes));
+  fn_exprs = calloc(workers, sizeof(*fn_exprs));
+  fn_blocks = calloc(workers, sizeof(*fn_blocks));
+  fn_errors = calloc(fn_queue.len ? fn_queue.len : 1, sizeof(*fn_errors));
+  if (!fn_scopes || !fn_exprs || !fn_blocks || !fn_errors) {
+    perror("sem_program");
+    exit(1);
+  }
+  bool ok = run_tasks(fn_queue.len, sem_fn_task, ast);
+  // This thread ran tasks as worker 0, and a failed one leaves in_task set.
+  in_task = false;
+  expr_stack = &top_exprs;
+  block_stack = &top_blocks;
+  for (size_t i = 0; i < workers; i++) {
+    symtab_free(&fn_scopes[i]);
+    stack_free(&fn_exprs[i]);
+    stack_free(&fn_blocks[i]);
+  }
+  free(fn_scopes);
+  free(fn_exprs);
+  free(fn_blocks);
+  fn_scopes = NULL;
+  fn_exprs = NULL;
+  fn_blocks = NULL;
+  // Every body queued before a failing one has been checked, so the first
+  // recorded error is the first in source order, whatever the thread count.
+  bool printed = false;
+  for (size_t i = 0; i < fn_queue.len; i++) {
+    if (fn_errors[i] && !printed) {
+      fputs(fn_errors[i], stderr);
+      printed = true;
+    }
+    free(fn_errors[i]);
+  }
+  free(fn_errors);
+  fn_errors = NULL;
+  if (!ok)
+    error_exit();
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "symtab.h"
+
+static void *xrealloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (!p) {
+    perror("symtab");
+    exit(1);
+  }
+  return p;
+}
+
+// Atoms are handed out sequentially, so spread them before masking.
+static size_t slot_of(const SymTab *t, Atom name) {
+  uint32_t h = name * 2654435761u;
+  return (h ^ (h >> 16)) & (t->nslots - 1);
+}
+
+// The slot holding `name`, or the empty slot where it would go.
+static SymSlot *find_slot(SymTab *t, Atom name) {
+  size_t i = slot_of(t, name);
+  while (t->slots[i].name && t->slots[i].name != name)
+    i = (i + 1) & (t->nslots - 1);
+  return &t->slots[i];
+}
+
+// Double the table.  Names with no binding left are dropped on the way.
+static void grow_slots(SymTab *t) {
+  SymSlot *old = t->slots;
+  size_t n = t->nslots;
+  t->nslots = n ? n * 2 : 64;
+  t->slots = calloc(t->nslots, sizeof(*t->slots));
+  if (!t->slots) {
+    perror("symtab");
+    exit(1);
+  }
+  t->used = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (!old[i].top)
+      continue;
+    *find_slot(t, old[i].name) = old[i];
+    t->used++;
+  }
+  free(old);
+}
+
+void symtab_init(SymTab *t) {
+  *t = (SymTab){0};
+}
+
+void symtab_free(SymTab *t) {
+  free(t->syms);
+  free(t->slots);
+  symtab_init(t);
+}
+
+void symtab_reset(SymTab *t) {
+  t->scope = 0;
+  symtab_leave(t, 0);
+}
+
+size_t symtab_enter(SymTab *t) {
+  size_t mark = t->scope;
+  t->scope = t->len;
+  return mark;
+}
+
+void symtab_leave(SymTab *t, size_t mark) {
+  while (t->len > t->scope) {
+    const Sym *s = &t->syms[--t->len];
+    find_slot(t, s->name)->top = s->shadowed;
+  }
+  t->scope = mark;
+}
+
+Sym *symtab_insert(SymTab *t, Atom name) {
+  if (2 * (t->used + 1) > t->nslots)
+    grow_slots(t);
+  SymSlot *slot = find_slot(t, name);
+  if (!slot->name) {
+    slot->name = name;
+    t->used++;
+  } else if (slot->top > t->scope) {
+    return NULL;  // declared in this scope already
+  }
+  if (t->len == t->cap) {
+    t->cap = t->cap ? t->cap * 2 : 64;
+    t->syms = xrealloc(t->syms, t->cap * sizeof(*t->syms));
+  }
+  Sym *s = &t->syms[t->len++];
+  *s = (Sym){.name = name, .shadowed = slot->top};
+  slot->top = (uint32_t)t->len;
+  return s;
+}
+
+Sym *symtab_lookup(SymTab *t, Atom name) {
+  if (!t->nslots)
+    return NULL;
+  SymSlot *slot = find_slot(t, name);
+  return slot->top ? &t->syms[slot->top - 1] : NULL;
+}
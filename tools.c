@@ -1,5 +1,97 @@
 #include "tools.h"
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+_Thread_local jmp_buf *error_trap;
+
+void error_exit(void) {
+    fflush(stdout);
+    if (error_trap)
+        longjmp(*error_trap, 1);
+    exit(1);
+}
+
+static size_t threads = 0;
+
+size_t task_threads(void) {
+    if (!threads) {
+        const char *force = getenv("HSC_THREADS");
+        long n = force ? atol(force) : sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n < 1 ? 1 : (size_t)n;
+    }
+    return threads;
+}
+
+typedef struct {
+    TaskFn task;
+    void *arg;
+    size_t count;
+    atomic_size_t next;
+    atomic_bool failed;
+} TaskPool;
+
+typedef struct {
+    TaskPool *pool;
+    size_t worker;
+} TaskWorker;
+
+static void *task_worker(void *p) {
+    TaskWorker *w = p;
+    TaskPool *pool = w->pool;
+    jmp_buf *saved = error_trap;
+    jmp_buf trap;
+    if (setjmp(trap)) {
+        atomic_store(&pool->failed, true);
+        error_trap = saved;
+        return NULL;
+    }
+    error_trap = &trap;
+    while (!atomic_load(&pool->failed)) {
+        size_t i = atomic_fetch_add(&pool->next, 1);
+        if (i >= pool->count)
+            break;
+        pool->task(pool->arg, w->worker, i);
+    }
+    error_trap = saved;
+    return NULL;
+}
+
+bool run_tasks(size_t count, TaskFn task, void *arg) {
+    TaskPool pool = { .task = task, .arg = arg, .count = count };
+    atomic_init(&pool.next, 0);
+    atomic_init(&pool.failed, false);
+    size_t n = task_threads();
+    if (n > count)
+        n = count;
+    if (n <= 1) {
+        TaskWorker only = { &pool, 0 };
+        task_worker(&only);
+        return !atomic_load(&pool.failed);
+    }
+
+    TaskWorker *workers = malloc(n * sizeof(*workers));
+    pthread_t *tid = malloc(n * sizeof(*tid));
+    if (!workers || !tid) {
+        perror("run_tasks");
+        exit(1);
+    }
+    size_t started = 1;
+    for (size_t i = 0; i < n; i++)
+        workers[i] = (TaskWorker){ &pool, i };
+    // With fewer threads than asked for, the ones running take the rest.
+    while (started < n && pthread_create(&tid[started], NULL, task_worker, &workers[started]) == 0)
+        started++;
+    task_worker(&workers[0]);
+    for (size_t i = 1; i < started; i++)
+        pthread_join(tid[i], NULL);
+    free(tid);
+    free(workers);
+    return !atomic_load(&pool.failed);
+}
 
 bool is_operator(TokenType token) {
     switch (token) {
@@ -0,0 +1,17 @@
+#!/usr/bin/env bash
+# Build and run the nesting-depth benchmark.
+#
+#   ./tools/bench_depth.sh [bench args...]
+#
+# Compares parse, analysis and codegen cost per node on depth-10^6 inputs
+# (see bench/depth_bench.c for the shapes) against a flat program.
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+BUILD_DIR=build
+mkdir -p "$BUILD_DIR"
+CFLAGS=( -Iinclude -O2 -Wall -Wextra -pthread )
+
+gcc "${CFLAGS[@]}" bench/depth_bench.c lexer.c intern.c arena.c parser.c tools.c \
+  symtab.c sem.c ir.c iropt.c regalloc.c asm.c peephole.c codegen.c -o "$BUILD_DIR/depth_bench"
+"$BUILD_DIR/depth_bench" "$@"
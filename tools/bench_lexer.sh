@@ -0,0 +1,36 @@
+#!/usr/bin/env bash
+# Build and run the lexer microbenchmark.
+#
+#   ./tools/bench_lexer.sh [--baseline <git-rev>] [bench args...]
+#
+# With --baseline, the benchmark is also built from the bench, lexer and
+# headers at <rev> so the two throughput figures can be compared on the same
+# input even across lexer API changes.
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+BUILD_DIR=build
+mkdir -p "$BUILD_DIR"
+CFLAGS=( -Iinclude -O2 -Wall -Wextra -pthread )
+
+baseline=""
+if [[ "${1-}" == "--baseline" ]]; then
+  baseline="$2"
+  shift 2
+fi
+
+gcc "${CFLAGS[@]}" bench/lexer_bench.c lexer.c intern.c arena.c -o "$BUILD_DIR/lexer_bench"
+
+if [[ -n "$baseline" ]]; then
+  base_dir="$BUILD_DIR/bench_baseline"
+  rm -rf "$base_dir"
+  mkdir -p "$base_dir"
+  git archive "$baseline" bench include \
+    $(git ls-tree --name-only "$baseline" lexer.c intern.c arena.c) | tar -x -C "$base_dir"
+  gcc -I"$base_dir/include" -O2 -Wall -Wextra -pthread "$base_dir/bench/lexer_bench.c" \
+    "$base_dir"/*.c -o "$BUILD_DIR/lexer_bench_baseline"
+  echo "== baseline ($baseline)"
+  "$BUILD_DIR/lexer_bench_baseline" "$@"
+  echo "== current"
+fi
+"$BUILD_DIR/lexer_bench" "$@"
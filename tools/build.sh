@@ -14,8 +14,8 @@ objcopy --redefine-sym _binary_build_rt_o_start=rt_o_start \
         build/rt_blob.o build/rt_embed.o
 gcc -Iinclude \
   -Wall -Wextra \
-  main.c lexer.c parser.c tools.c sem.c codegen.c build/rt_embed.o \
-  -o build/hsc
+  main.c lexer.c intern.c arena.c parser.c tools.c symtab.c sem.c opt.c ir.c iropt.c regalloc.c asm.c peephole.c codegen.c watch.c build/rt_embed.o \
+  -pthread -o build/hsc
 set +x
 
 echo "Built: $(realpath build/hsc)"
@@ -18,10 +18,11 @@ CFLAGS=(
 )
 LDFLAGS=(
   -fsanitize=address
+  -pthread
 )
 
 # sources → objects
-SRC=( main.c lexer.c parser.c tools.c sem.c codegen.c )
+SRC=( main.c lexer.c intern.c arena.c parser.c tools.c symtab.c sem.c opt.c ir.c iropt.c regalloc.c asm.c peephole.c codegen.c watch.c )
 OBJ=()
 
 # out dir
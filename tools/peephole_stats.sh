@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+# Count instructions before and after the peephole pass on tests/exec.
+#
+#   ./tools/peephole_stats.sh [--peephole=LIST]
+#
+# Prints each program's count with no rules and with the given rules (all
+# of them by default), then the totals.
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+./tools/build.sh > /dev/null 2>&1
+rules="${1:---peephole=all}"
+before=0
+after=0
+mapfile -d '' -t cases < <(find tests/exec -type f -name '*.hsc' -print0 | sort -z)
+printf '%-28s %8s %8s\n' program before after
+for case_path in "${cases[@]}"; do
+  # Programs that fail to compile (the error tests) are skipped.
+  stats="$(./build/hsc "$rules" --peephole-stats --emit-asm build/peephole.s "$case_path" 2>&1 >/dev/null)" || continue
+  read -r _ b _ a _ <<< "$(grep '^peephole:' <<< "$stats")"
+  printf '%-28s %8d %8d\n' "$(basename "$case_path" .hsc)" "$b" "$a"
+  before=$((before + b))
+  after=$((after + a))
+done
+printf '%-28s %8d %8d\n' total "$before" "$after"
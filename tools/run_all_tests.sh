@@ -8,3 +8,6 @@ echo "===== Running language tests ====="
 echo "===== Running execution tests ====="
 ./tools/runexec.sh
 
+
+echo "===== Running watch test ====="
+./tools/runwatch.sh
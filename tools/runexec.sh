@@ -33,7 +33,12 @@ passed=0
 failed=0
 total=0
 
-for case_path in "${cases[@]}"; do
+# Run one case with extra hsc options `flags`.  A case whose source fails to
+# compile is checked by hsc's diagnostics: stderr against NAME.out and the
+# compiler's exit code against NAME.exit.
+run_case() {
+  local case_path="$1" flags="$2"
+  local dir base exp_out exp_exit rel safe name asm obj exe
   dir="$(dirname "$case_path")"
   base="$(basename "$case_path" .hsc)"
   exp_out="$dir/$base.out"
@@ -43,62 +48,86 @@ for case_path in "${cases[@]}"; do
   safe="${rel//\//_}"
   safe="${safe%.hsc}"
   name="$rel"
+  [[ -z "$flags" ]] || name="$rel [$flags]"
 
   asm="$BUILD_DIR/$safe.s"
   obj="$BUILD_DIR/$safe.o"
   exe="$BUILD_DIR/$safe"
 
-  if [[ -f "$exp_out" && -f "$exp_exit" ]]; then
-    # Emit assembly
-    if ! ./build/hsc --emit-asm "$asm" "$case_path" >/dev/null 2>&1; then
-      printf '\e[31m[FAIL]\e[0m %s (emit)\n' "$name"
-      failed=$((failed+1)); total=$((total+1)); continue
+  local out_tmp err_tmp rc expected_rc what=""
+  out_tmp="$(mktemp)"
+  err_tmp="$(mktemp)"
+  expected_rc="$(cat "$exp_exit")"
+  total=$((total+1))
+
+  # Leading NAME=VALUE words of `flags` go to hsc's environment
+  local word vars=() opts=()
+  for word in $flags; do
+    if [[ ${#opts[@]} -eq 0 && "$word" == [A-Z]*=* ]]; then
+      vars+=("$word")
+    else
+      opts+=("$word")
     fi
+  done
 
-    # Assemble (silence executable-stack warnings)
-    # (You should ALSO add `.section .note.GNU-stack,"",@progbits` in emitted .s)
-    if ! gcc -Wa,--noexecstack -c "$asm" -o "$obj"; then
-      printf '\e[31m[FAIL]\e[0m %s (assemble)\n' "$name"
-      failed=$((failed+1)); total=$((total+1)); continue
-    fi
+  # Emit assembly
+  if env "${vars[@]}" ./build/hsc "${opts[@]}" --emit-asm "$asm" "$case_path" >/dev/null 2>"$out_tmp"; then
+    rc=0
+  else
+    rc=$?
+  fi
 
-    # Link
-    if ! gcc "$obj" "$RT_OBJ" -o "$exe"; then
-      printf '\e[31m[FAIL]\e[0m %s (link)\n' "$name"
-      failed=$((failed+1)); total=$((total+1)); continue
-    fi
+  if [[ $rc -ne 0 ]]; then
+    what=" (emit)"
+  # Assemble (silence executable-stack warnings)
+  # (You should ALSO add `.section .note.GNU-stack,"",@progbits` in emitted .s)
+  elif ! gcc -Wa,--noexecstack -c "$asm" -o "$obj"; then
+    printf '\e[31m[FAIL]\e[0m %s (assemble)\n' "$name"
+    failed=$((failed+1)); rm -f "$out_tmp" "$err_tmp"; return
+  # Link
+  elif ! gcc "$obj" "$RT_OBJ" -o "$exe"; then
+    printf '\e[31m[FAIL]\e[0m %s (link)\n' "$name"
+    failed=$((failed+1)); rm -f "$out_tmp" "$err_tmp"; return
+  # Run and capture RAW stdout + stderr (no normalization)
+  elif "$exe" >"$out_tmp" 2>"$err_tmp"; then
+    rc=0
+  else
+    rc=$?
+  fi
 
-    # Run and capture RAW stdout + stderr (no normalization)
-    out_tmp="$(mktemp)"
-    err_tmp="$(mktemp)"
-    if "$exe" >"$out_tmp" 2>"$err_tmp"; then
-      rc=0
-    else
-      rc=$?
+  # Byte-for-byte comparison
+  if cmp -s "$exp_out" "$out_tmp" && [[ "$rc" == "$expected_rc" ]]; then
+    printf '\e[32m[PASS]\e[0m %s\n' "$name"
+    passed=$((passed+1))
+  else
+    printf '\e[31m[FAIL]\e[0m %s%s\n' "$name" "$what"
+    echo "Expected exit: $expected_rc, Got: $rc"
+    echo "---- diff (expected vs actual output; raw) ----"
+    diff -u "$exp_out" "$out_tmp" || true
+    if [[ -s "$err_tmp" ]]; then
+      echo "---------------- stderr ----------------"
+      # Show only first ~200 lines to avoid spam
+      sed -n '1,200p' "$err_tmp"
     fi
+    echo "----------------------------------------"
+    failed=$((failed+1))
+  fi
 
-    expected_rc="$(cat "$exp_exit")"
-
-    # Byte-for-byte comparison
-    if cmp -s "$exp_out" "$out_tmp" && [[ "$rc" == "$expected_rc" ]]; then
-      printf '\e[32m[PASS]\e[0m %s\n' "$name"
-      passed=$((passed+1))
-    else
-      printf '\e[31m[FAIL]\e[0m %s\n' "$name"
-      echo "Expected exit: $expected_rc, Got: $rc"
-      echo "---- diff (expected vs actual stdout; raw) ----"
-      diff -u "$exp_out" "$out_tmp" || true
-      if [[ -s "$err_tmp" ]]; then
-        echo "---------------- stderr ----------------"
-        # Show only first ~200 lines to avoid spam
-        sed -n '1,200p' "$err_tmp"
-      fi
-      echo "----------------------------------------"
-      failed=$((failed+1))
-    fi
+  rm -f "$out_tmp" "$err_tmp"
+}
 
-    rm -f "$out_tmp" "$err_tmp"
-    total=$((total+1))
+# NAME.flags, when present, lists one set of extra hsc options per line,
+# optionally led by environment assignments such as HSC_THREADS=4; the case
+# runs once per line (an empty line means no options) against the same
+# oracle.
+for case_path in "${cases[@]}"; do
+  flags_file="${case_path%.hsc}.flags"
+  if [[ -f "$flags_file" ]]; then
+    while IFS= read -r -u 3 flags || [[ -n "$flags" ]]; do
+      run_case "$case_path" "$flags"
+    done 3< "$flags_file"
+  else
+    run_case "$case_path" ""
   fi
 done
 
@@ -22,6 +22,7 @@ failed=0
 for case_path in "${cases[@]}"; do
   name="$(basename "$case_path" .hsc)"
   exp_ast="tests/cases/$name.ast"
+  exp_ir="tests/cases/$name.ir"
   tmp="$(mktemp)"
   rc=0
 
@@ -42,8 +43,19 @@ for case_path in "${cases[@]}"; do
       # sed -n '1,120p' "$tmp"
     fi
 
+  # An .ir oracle is the --emit-ir dump; exit 0 means the IR verifier passed
+  elif [[ -f "$exp_ir" ]]; then
+    if ./build/hsc --emit-ir "$case_path" >"$tmp" 2>&1; then rc=0; else rc=$?; fi
+
+    if diff -q <(strip_trailing "$exp_ir") <(strip_trailing "$tmp") >/dev/null && [[ $rc -eq 0 ]]; then
+      printf '\e[32m[PASS]\e[0m %s\n' "$name"; ((passed++))
+    else
+      printf '\e[31m[FAIL]\e[0m %s\n' "$name"; ((failed++))
+      diff -u "$exp_ir" "$tmp" || true
+    fi
+
   else
-    printf '\e[31m[FAIL]\e[0m %s (missing .ast oracle)\n' "$name"; ((failed++))
+    printf '\e[31m[FAIL]\e[0m %s (missing .ast or .ir oracle)\n' "$name"; ((failed++))
   fi
 
   ((total++))
@@ -0,0 +1,112 @@
+#!/usr/bin/env bash
+# Drive --watch through a scripted edit session: build, edit a helper,
+# edit main, break the file, then fix it, checking the watcher's report
+# and the binary after each save.
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+echo "Building..."
+if ! ./tools/build.sh > /dev/null 2>&1; then
+  echo "Build failed" >&2
+  exit 1
+fi
+
+work="$(mktemp -d)"
+src="$work/app.hsc"
+log="$work/watch.log"
+watcher=""
+cleanup() {
+  [[ -z "$watcher" ]] || kill "$watcher" 2>/dev/null || true
+  wait 2>/dev/null || true
+  rm -rf "$work"
+}
+trap cleanup EXIT
+
+passed=0
+failed=0
+
+# Save the file in one write, as an editor would.
+save() {
+  printf '%s\n' "$1" > "$work/app.tmp"
+  mv "$work/app.tmp" "$src"
+}
+
+# Wait until the log holds `count` lines matching `pattern`.
+wait_for() {
+  local pattern="$1" count="$2"
+  for _ in $(seq 200); do
+    if (( $(grep -c -- "$pattern" "$log" || true) >= count )); then
+      return 0
+    fi
+    sleep 0.05
+  done
+  return 1
+}
+
+# Check that step `name` logged its `count`th `pattern` and that the binary
+# now prints `expected`.
+check() {
+  local name="$1" pattern="$2" count="$3" expected="$4" got=""
+  if wait_for "$pattern" "$count"; then
+    got="$("$work/app" 2>&1 || true)"
+  fi
+  if [[ "$got" == "$expected" ]]; then
+    printf '\e[32m[PASS]\e[0m %s\n' "$name"
+    passed=$((passed+1))
+  else
+    printf '\e[31m[FAIL]\e[0m %s\n' "$name"
+    echo "Expected output: $expected, Got: $got"
+    echo "---------------- watch log ----------------"
+    cat "$log"
+    echo "-------------------------------------------"
+    failed=$((failed+1))
+  fi
+}
+
+helper='fn helper() {
+  let unused = 1;
+}'
+
+save "$helper
+fn main() {
+  write(1);
+}"
+./build/hsc --watch --emit-asm "$work/app.s" --compile "$work/app" "$src" >"$log" 2>&1 &
+watcher=$!
+check "first build" "watch: rebuilt" 1 1
+
+save "fn helper() {
+  let unused = 2;
+}
+fn main() {
+  write(1);
+}"
+check "helper edit keeps main" "watch: kept" 1 1
+
+save "$helper
+fn main() {
+  write(2);
+}"
+check "main edit relinks" "watch: rebuilt" 2 2
+
+save "$helper
+fn main() {
+  write(3;
+}"
+check "syntax error keeps the last binary" "watch: build failed" 1 2
+
+save "$helper
+fn main() {
+  write(missing);
+}"
+check "semantic error keeps the last binary" "watch: build failed" 2 2
+
+save "$helper
+fn main() {
+  write(4);
+}"
+check "fixed file rebuilds" "watch: rebuilt" 3 4
+
+echo "----------------------------------------------------------------------"
+echo "Total: $((passed + failed))   Passed: $passed   Failed: $failed"
+[[ $failed -eq 0 ]] || exit 1
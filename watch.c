@@ -0,0 +1,514 @@
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "opt.h"
+#include "sem.h"
+#include "stack.h"
+#include "tools.h"
+#include "watch.h"
+
+// The pool is rebuilt from scratch once nodes of replaced functions outweigh
+// the live ones by this much.
+#define POOL_SLACK (1u << 16)
+
+// Quiet period that ends a burst of writes from the editor.
+#define SETTLE_MS 20
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+
+// --- layout ----------------------------------------------------------------
+
+// The text is cut before every `fn` at brace depth 0.  A piece is one such
+// function plus any top-level statements up to the next one; pieces tile the
+// text, each running to the start of the next.
+typedef struct {
+  size_t start;      // byte offset in the text
+  size_t line;       // line number at `start`
+  uint64_t hash;     // of the piece's token kinds and lexemes
+  NodeId block;      // NK_Block of its statements, parsed by parse_span
+  size_t size;       // pool nodes and child slots the block owns
+  size_t tok;        // first token, while the piece is being re-parsed
+} Piece;
+
+typedef struct {
+  const char *path;
+  const char *asm_path;
+  const char *bin_path;
+  LinkFn link;
+
+  Ast ast;
+  char *text;          // text the layout describes
+  size_t len;
+  size_t text_cap;
+  STACK(Piece) pieces;
+  size_t live;         // sum of pieces[].size
+  NodeId main_fn;      // main of the binary on disk, NODE_NONE if stale
+
+  // Per-rebuild state, kept here so error_exit() can unwind to the trap.
+  char *next;          // text just read; swapped with `text` once parsed
+  size_t next_len;
+  size_t next_cap;
+  Source sub;          // the region being re-lexed
+  TokenStream ts;
+  STACK(Piece) fresh;  // pieces of that region
+  STACK(Piece) layout; // the new layout being assembled
+  STACK(NodeId) stmts;
+  uint32_t *slots;     // replaced pieces by hash: index + 1, 0 = empty
+  size_t nslots;
+  FILE *out;
+  Codegen *cg;
+} Watch;
+
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t len) {
+  const unsigned char *p = data;
+  for (size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Read all of `path` into *data, reusing its allocation of *cap bytes.
+static int read_file(const char *path, char **data, size_t *cap, size_t *len) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  size_t want = fstat(fd, &st) == 0 && st.st_size > 0 ? (size_t)st.st_size + 1 : 4096;
+  size_t n = 0;
+  for (;;) {
+    if (*cap < want) {
+      char *grown = realloc(*data, want);
+      if (!grown) {
+        close(fd);
+        return -1;
+      }
+      *data = grown;
+      *cap = want;
+    }
+    ssize_t got = read(fd, *data + n, *cap - n);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got < 0) {
+      close(fd);
+      return -1;
+    }
+    if (got == 0)
+      break;
+    n += (size_t)got;
+    if (n == *cap)
+      want = *cap * 2;
+  }
+  close(fd);
+  *len = n;
+  return 0;
+}
+
+// Index of the piece holding byte `pos`.
+static size_t piece_at(const Watch *w, size_t pos) {
+  size_t lo = 0, hi = w->pieces.len;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (w->pieces.items[mid].start <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Length of the common prefix of a and b, comparing a block at a time.
+static size_t common_prefix(const char *a, const char *b, size_t n) {
+  size_t i = 0;
+  while (i + 4096 <= n && memcmp(a + i, b + i, 4096) == 0)
+    i += 4096;
+  while (i < n && a[i] == b[i])
+    i++;
+  return i;
+}
+
+// Length of the common suffix of the n bytes ending at a_end and b_end.
+static size_t common_suffix(const char *a_end, const char *b_end, size_t n) {
+  size_t i = 0;
+  while (i + 4096 <= n && memcmp(a_end - i - 4096, b_end - i - 4096, 4096) == 0)
+    i += 4096;
+  while (i < n && a_end[-1 - (long)i] == b_end[-1 - (long)i])
+    i++;
+  return i;
+}
+
+static size_t count_lines(const char *p, size_t len) {
+  size_t n = 0;
+  for (const char *end = p + len; (p = memchr(p, '\n', (size_t)(end - p))); p++)
+    n++;
+  return n;
+}
+
+// --- region ----------------------------------------------------------------
+
+// Lex bytes [start, end) of the new text, numbering lines from `line`.
+static void lex_region(Watch *w, size_t start, size_t end, size_t line) {
+  w->sub = (Source){0};
+  w->sub.data = w->next + start;
+  w->sub.base = start;
+  w->sub.len = end - start;
+  w->sub.fd = -1;
+  w->sub.mapped = true;
+  w->sub.eof = true;
+  ts_init(&w->ts, &w->sub);
+  w->ts.lx.line = line;
+  do {
+    w->ts.pos = w->ts.buf.len;
+    ts_fill(&w->ts);
+  } while (w->ts.buf.kind[w->ts.buf.len - 1] != END_OF_TOKENS);
+  w->ts.pos = 0;
+}
+
+// Cut the region's tokens into fresh pieces and hash them.  Hashing tokens
+// rather than bytes keeps whitespace-only edits from invalidating a piece.
+// Returns the brace depth at the end of the region.
+static long split_region(Watch *w, size_t start, size_t line) {
+  const TokenBuf *buf = &w->ts.buf;
+  const Source *src = &w->sub;
+  size_t last = buf->len - 1; // END_OF_TOKENS
+  long depth = 0;
+  w->fresh.len = 0;
+  for (size_t i = 0; i < last; i++) {
+    TokenType type = (TokenType)buf->kind[i];
+    if (i == 0 || (type == FN && depth == 0)) {
+      Piece piece = {start, line, FNV_OFFSET, NODE_NONE, 0, i};
+      if (i > 0) {
+        piece.start = tokbuf_start(buf, i);
+        piece.line = tokbuf_line(buf, i);
+      }
+      stack_push(&w->fresh, piece);
+    }
+    if (type == OPEN_CURLY)
+      depth++;
+    else if (type == CLOSE_CURLY)
+      depth--;
+    size_t tok = tokbuf_start(buf, i);
+    uint32_t len = (uint32_t)token_length(src, type, tok);
+    uint8_t kind = buf->kind[i];
+    Piece *piece = stack_top(&w->fresh);
+    piece->hash = hash_bytes(piece->hash, &kind, 1);
+    piece->hash = hash_bytes(piece->hash, &len, sizeof(len));
+    piece->hash = hash_bytes(piece->hash, src->data + (tok - src->base), len);
+  }
+  return depth;
+}
+
+// Whether lexing from `end` on, as the old layout did, still holds: the
+// region closes all its braces and strings and does not run into the `fn`
+// of the next piece.
+static bool region_closed(Watch *w, size_t end, long depth) {
+  if (end == w->next_len)
+    return true;
+  if (depth != 0 || isalpha((unsigned char)w->next[end - 1]))
+    return false;
+  const TokenBuf *buf = &w->ts.buf;
+  if (buf->len < 2)
+    return true;
+  size_t i = buf->len - 2;
+  size_t start = tokbuf_start(buf, i);
+  return buf->kind[i] != STRING ||
+         start + token_length(&w->sub, STRING, start) < end;
+}
+
+// Hash index over the replaced pieces [first, last) so unchanged text that
+// falls inside the region keeps its tree.
+static void index_replaced(Watch *w, size_t first, size_t last) {
+  size_t want = 16;
+  while (want < (last - first) * 2)
+    want *= 2;
+  if (want > w->nslots) {
+    free(w->slots);
+    w->slots = malloc(want * sizeof(*w->slots));
+    if (!w->slots) {
+      perror("watch");
+      exit(1);
+    }
+    w->nslots = want;
+  }
+  memset(w->slots, 0, w->nslots * sizeof(*w->slots));
+  for (size_t k = first; k < last; k++) {
+    size_t i = w->pieces.items[k].hash & (w->nslots - 1);
+    while (w->slots[i])
+      i = (i + 1) & (w->nslots - 1);
+    w->slots[i] = (uint32_t)k + 1;
+  }
+}
+
+static const Piece *find_replaced(const Watch *w, uint64_t hash) {
+  for (size_t i = hash & (w->nslots - 1);; i = (i + 1) & (w->nslots - 1)) {
+    uint32_t slot = w->slots[i];
+    if (!slot)
+      return NULL;
+    if (w->pieces.items[slot - 1].hash == hash)
+      return &w->pieces.items[slot - 1];
+  }
+}
+
+// --- rebuild ---------------------------------------------------------------
+
+static void layout_reset(Watch *w) {
+  ast_free(&w->ast);
+  ast_init(&w->ast);
+  w->pieces.len = 0;
+  w->live = 0;
+  w->main_fn = NODE_NONE;
+}
+
+static void rebuild_cleanup(Watch *w) {
+  if (w->cg) {
+    codegen_free(w->cg);
+    w->cg = NULL;
+  }
+  if (w->out) {
+    fclose(w->out);
+    w->out = NULL;
+  }
+  ts_free(&w->ts);
+}
+
+// The part of the new text to re-lex: bytes [start, end) starting on line
+// `line`, standing in for pieces [first, last) of the old layout.
+typedef struct {
+  size_t first, last;
+  size_t start, end, line;
+} Region;
+
+// Lex and parse `r`, splice it into the layout, then check and emit the
+// program.  Runs under the error trap set by rebuild_trapped, and is kept
+// out of line so none of its locals share a frame with the setjmp.
+static __attribute__((noinline)) void rebuild_region(Watch *w, Region r,
+                                                     double t0) {
+  lex_region(w, r.start, r.end, r.line);
+  long depth = split_region(w, r.start, r.line);
+  if (!region_closed(w, r.end, depth)) {
+    // The edit changes how the rest of the file lexes; redo all of it.
+    ts_free(&w->ts);
+    r = (Region){0, w->pieces.len, 0, w->next_len, 0};
+    lex_region(w, r.start, r.end, r.line);
+    split_region(w, r.start, r.line);
+  }
+
+  index_replaced(w, r.first, r.last);
+  size_t parsed = 0;
+  for (size_t i = 0; i < w->fresh.len; i++) {
+    Piece *piece = &w->fresh.items[i];
+    size_t tok_end = i + 1 < w->fresh.len ? w->fresh.items[i + 1].tok
+                                          : w->ts.buf.len - 1;
+    const Piece *old = find_replaced(w, piece->hash);
+    if (old) {
+      piece->block = old->block;
+      piece->size = old->size;
+      continue;
+    }
+    size_t before = w->ast.len + w->ast.nkids;
+    w->ts.pos = piece->tok;
+    piece->block = parse_span(&w->ts, tok_end, &w->ast);
+    piece->size = w->ast.len + w->ast.nkids - before;
+    parsed++;
+  }
+
+  // Splice the fresh pieces into the layout; pieces after the region move
+  // by the change in length and line count.
+  size_t shift = w->next_len - w->len;
+  size_t old_lines = r.last < w->pieces.len ? w->pieces.items[r.last].line : 0;
+  size_t new_lines = r.line + count_lines(w->next + r.start, r.end - r.start);
+  w->layout.len = 0;
+  w->live = 0;
+  for (size_t k = 0; k < w->pieces.len + w->fresh.len - (r.last - r.first); k++) {
+    Piece piece;
+    if (k < r.first) {
+      piece = w->pieces.items[k];
+    } else if (k < r.first + w->fresh.len) {
+      piece = w->fresh.items[k - r.first];
+    } else {
+      piece = w->pieces.items[k - r.first - w->fresh.len + r.last];
+      piece.start += shift;
+      piece.line += new_lines - old_lines;
+    }
+    stack_push(&w->layout, piece);
+    w->live += piece.size;
+  }
+  STACK(Piece) swap = {w->pieces.items, w->pieces.len, w->pieces.cap};
+  w->pieces.items = w->layout.items, w->pieces.len = w->layout.len, w->pieces.cap = w->layout.cap;
+  w->layout.items = swap.items, w->layout.len = swap.len, w->layout.cap = swap.cap;
+  char *text = w->text;
+  size_t cap = w->text_cap;
+  w->text = w->next, w->text_cap = w->next_cap, w->len = w->next_len;
+  w->next = text, w->next_cap = cap;
+
+  w->stmts.len = 0;
+  for (size_t k = 0; k < w->pieces.len; k++) {
+    const Node *block = ast_node(&w->ast, w->pieces.items[k].block);
+    for (size_t i = 0; i < block->count; i++)
+      stack_push(&w->stmts, ast_child(&w->ast, block, i));
+  }
+  NodeId block = ast_list(&w->ast, NK_Block, w->stmts.items, w->stmts.len);
+  NodeId root = ast_list(&w->ast, NK_Program, &block, 1);
+  NodeId main_fn = codegen_find_main(&w->ast, root);
+  NodeId linked = w->main_fn;
+  w->main_fn = NODE_NONE;
+  sem_program(&w->ast, root);
+
+  // Only main is emitted, so the assembly and binary on disk stay valid
+  // while main's subtree is reused.
+  if (!main_fn || main_fn != linked) {
+    w->out = fopen(w->asm_path, "w");
+    if (!w->out) {
+      fprintf(stderr, "watch: could not open %s for writing\n", w->asm_path);
+      error_exit();
+    }
+    opt_program(&w->ast, root);
+    w->cg = codegen_create(w->out);
+    codegen_program(w->cg, &w->ast, root);
+    codegen_free(w->cg);
+    w->cg = NULL;
+    fclose(w->out);
+    w->out = NULL;
+    if (w->link(w->asm_path, w->bin_path) != 0)
+      error_exit();
+  }
+  w->main_fn = main_fn;
+
+  fprintf(stderr, "watch: %s %s in %.1f ms (%zu of %zu functions parsed)\n",
+          main_fn != linked ? "rebuilt" : "kept", w->bin_path, now_ms() - t0,
+          parsed, w->pieces.len);
+}
+
+// Run rebuild_region with error_exit() unwinding to here.  Nothing but the
+// arguments lives across the setjmp, so no local can be clobbered.
+static void rebuild_trapped(Watch *w, Region r, double t0) {
+  jmp_buf trap;
+  if (setjmp(trap)) {
+    error_trap = NULL;
+    rebuild_cleanup(w);
+    fprintf(stderr, "watch: build failed, waiting for changes\n");
+    return;
+  }
+  error_trap = &trap;
+  rebuild_region(w, r, t0);
+  error_trap = NULL;
+  rebuild_cleanup(w);
+}
+
+// Re-lex and re-parse only the pieces that overlap the bytes changed since
+// the last successful parse, found by trimming the common prefix and suffix
+// of the old and new text.
+static void rebuild(Watch *w) {
+  double t0 = now_ms();
+  if (w->ast.len + w->ast.nkids > 2 * w->live + POOL_SLACK)
+    layout_reset(w);
+
+  if (read_file(w->path, &w->next, &w->next_cap, &w->next_len) != 0) {
+    fprintf(stderr, "watch: could not read %s\n", w->path);
+    return;
+  }
+  Region r = {0, w->pieces.len, 0, w->next_len, 0};
+  if (w->pieces.len) {
+    size_t old_len = w->len, n = old_len < r.end ? old_len : r.end;
+    size_t p = common_prefix(w->text, w->next, n);
+    if (p == old_len && old_len == r.end) {
+      fprintf(stderr, "watch: %s unchanged\n", w->path);
+      return;
+    }
+    size_t s = common_suffix(w->text + old_len, w->next + r.end, n - p);
+    r.first = piece_at(w, p < old_len ? p : old_len - 1);
+    r.last = 1 + (old_len - s > p ? piece_at(w, old_len - s - 1) : r.first);
+    r.start = r.first ? w->pieces.items[r.first].start : 0;
+    r.line = r.first ? w->pieces.items[r.first].line : 0;
+    size_t old_end = r.last < w->pieces.len ? w->pieces.items[r.last].start : old_len;
+    r.end = old_end + w->next_len - old_len;
+  }
+  rebuild_trapped(w, r, t0);
+}
+
+
+// --- event loop ------------------------------------------------------------
+
+// Wait for the next write to the watched file, then for the editor to go
+// quiet.  Returns false if the watch descriptor failed.
+static bool wait_for_change(int fd, const char *name) {
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+  int timeout = -1;
+  for (;;) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout);
+    if (ready < 0 && errno == EINTR)
+      continue;
+    if (ready < 0)
+      return false;
+    if (ready == 0)
+      return true;
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    for (char *p = buf; p < buf + n;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      if (ev->len && strcmp(ev->name, name) == 0)
+        changed = true;
+      p += sizeof(*ev) + ev->len;
+    }
+    if (changed)
+      timeout = SETTLE_MS;
+  }
+}
+
+int watch_file(const char *path, const char *asm_path, const char *bin_path,
+               LinkFn link) {
+  // Editors often save by writing a new file and renaming it over the old
+  // one, so watch the directory and filter on the name.
+  char *dir = strdup(path);
+  char *slash = strrchr(dir, '/');
+  const char *name = slash ? slash + 1 : path;
+  if (slash)
+    *slash = '\0';
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, slash ? (*dir ? dir : "/") : ".",
+                                  IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    perror("watch");
+    free(dir);
+    return 1;
+  }
+
+  Watch w = {0};
+  w.path = path;
+  w.asm_path = asm_path;
+  w.bin_path = bin_path;
+  w.link = link;
+  ast_init(&w.ast);
+
+  fprintf(stderr, "watch: watching %s\n", path);
+  do
+    rebuild(&w);
+  while (wait_for_change(fd, name));
+
+  perror("watch");
+  close(fd);
+  free(dir);
+  return 1;
+}